@@ -122,6 +122,89 @@ int LIBTIMETAG_DLL correlate_unit_bins(const int64_t *bin_edges,
                         int64_t *histogram_ret,
                         uint64_t histogram_ret_len);
 
+/**
+ * \brief   Correlates two arrays with each other, on multiple threads
+ *
+ * Identical to correlate_many_per_bin(), but splits \p left_list into one chunk per thread. Every chunk starts its
+ * search from its own first photon, and is correlated into a histogram of its own; these are summed at the end.
+ *
+ * \param   n_threads   The number of threads to use. Zero: use all hardware threads.
+ * \returns See correlate_many_per_bin()
+*/
+int LIBTIMETAG_DLL correlate_many_per_bin_parallel(const int64_t *bin_edges,
+                                                   uint64_t n_bin_edges,
+                                                   const int64_t *left_list,
+                                                   uint64_t left_list_len,
+                                                   const int64_t *right_list,
+                                                   uint64_t right_list_len,
+                                                   int64_t *histogram_ret,
+                                                   uint64_t histogram_ret_len,
+                                                   unsigned int n_threads);
+
+/**
+ * \brief   Correlates two arrays with each other, on multiple threads
+ *
+ * Identical to correlate_unit_bins(), but splits \p left_list into one chunk per thread, like
+ * correlate_many_per_bin_parallel().
+ *
+ * \param   n_threads   The number of threads to use. Zero: use all hardware threads.
+ * \returns See correlate_unit_bins()
+*/
+int LIBTIMETAG_DLL correlate_unit_bins_parallel(const int64_t *bin_edges,
+                                                uint64_t n_bin_edges,
+                                                const int64_t *left_list,
+                                                uint64_t left_list_len,
+                                                const int64_t *right_list,
+                                                uint64_t right_list_len,
+                                                int64_t *histogram_ret,
+                                                uint64_t histogram_ret_len,
+                                                unsigned int n_threads);
+
+/**
+ * \brief   Correlates two arrays with each other, for equally spaced bins of any width
+ *
+ * Gives the same histogram as correlate_unit_bins() followed by rebin(), without the unit-bin histogram: the time
+ * difference of a photon pair is mapped to its bin by a multiplication with the reciprocal of the bin width, and
+ * counted straight into the histogram. Memory use, and cache footprint, are smaller by the bin width.
+ *
+ * \param   bin_edges       An array containing the edges of the bins; all bins must have the same width
+ * \param   n_bin_edges     The number of bin edges
+ * \param   left_list       An array containing the first data set, sorted
+ * \param   left_list_len   The number of data points in the first data set
+ * \param   right_list      An array containing the second data set, sorted
+ * \param   right_list_len  The number of data points in the second data set
+ * \param   histogram_ret   The array to store the correlation data in. Each new value will be added to the corresponding existing element.
+ * \param   histogram_ret_len   The number of histogram bins, should be one smaller than \p n_bin_edges
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input; 2: \p n_bin_edges <= 1; 3: \p histogram_ret_len != \p n_bin_edges - 1; 4: bins are not equally spaced.
+*/
+int LIBTIMETAG_DLL correlate_uniform_bins(const int64_t *bin_edges,
+                                          uint64_t n_bin_edges,
+                                          const int64_t *left_list,
+                                          uint64_t left_list_len,
+                                          const int64_t *right_list,
+                                          uint64_t right_list_len,
+                                          int64_t *histogram_ret,
+                                          uint64_t histogram_ret_len);
+
+/**
+ * \brief   Correlates two arrays with each other, for equally spaced bins of any width, on multiple threads
+ *
+ * Identical to correlate_uniform_bins(), but splits \p left_list into one chunk per thread, like
+ * correlate_many_per_bin_parallel().
+ *
+ * \param   n_threads   The number of threads to use. Zero: use all hardware threads.
+ * \returns See correlate_uniform_bins()
+*/
+int LIBTIMETAG_DLL correlate_uniform_bins_parallel(const int64_t *bin_edges,
+                                                   uint64_t n_bin_edges,
+                                                   const int64_t *left_list,
+                                                   uint64_t left_list_len,
+                                                   const int64_t *right_list,
+                                                   uint64_t right_list_len,
+                                                   int64_t *histogram_ret,
+                                                   uint64_t histogram_ret_len,
+                                                   unsigned int n_threads);
+
 /**
  * \brief   Finds the index of the bins corresponding to the supplied data values
  *
@@ -232,8 +315,162 @@ int LIBTIMETAG_DLL gen_microtimes(const int64_t* pulses_macrotimes,
                                   uint64_t data_macrotimes_len,
                                   int64_t* results_buffer,
                                   uint64_t results_buffer_len, uint64_t total_sync_divider);
+
+/*
+	Multi-tau correlation of time-tags (Wahl et al., Schaetzel)
+
+	Instead of searching every bin edge for every photon, the photon
+	streams are coarsened step by step: at cascade level l, time-tags are
+	counted in time slots of 2^l time units, and photons in the same slot
+	are merged into one event with a weight. Every level correlates its
+	events at n_channels lags of its own slot size, using only the last
+	n_channels events of the left stream, so that the cost is
+	O(N * n_levels) for N photons.
+
+	Level 0 holds the lags 0 .. n_channels - 1. Every next level holds the
+	lags n_channels / 2 .. n_channels - 1, in slots of 2^l, so the bin
+	edges are contiguous: 0, 1, .., n_channels, n_channels + 2, ..,
+	2 * n_channels, 2 * n_channels + 4, .. The right stream is delayed by
+	half a slot before coarsening, which centers every bin on the lags it
+	counts. The histogram holds pair counts, like correlate_many_per_bin(),
+	and is normalized with normalize_correlation() and the bin edges from
+	multi_tau_bin_edges().
+*/
+
+#define MULTI_TAU_MAX_CHANNELS      256
+#define MULTI_TAU_MAX_LEVELS        40
+
+/**
+ * \brief   Returns the number of histogram bins of a multi-tau correlation; zero if the parameters are invalid
+ *
+ * \param   n_channels  The number of lags per cascade level; even, and at most MULTI_TAU_MAX_CHANNELS. Typically 8 or 16.
+ * \param   n_levels    The number of cascade levels; at least 1, and at most MULTI_TAU_MAX_LEVELS
+*/
+uint64_t LIBTIMETAG_DLL multi_tau_n_bins(uint32_t n_channels, uint32_t n_levels);
+
+/**
+ * \brief   Computes the bin edges of a multi-tau correlation
+ *
+ * \param   bin_edges       The array to store the bin edges in
+ * \param   n_bin_edges     The number of elements in \p bin_edges; must be multi_tau_n_bins() + 1
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input; 2: invalid \p n_channels or \p n_levels; 3: \p n_bin_edges is not correct.
+*/
+int LIBTIMETAG_DLL multi_tau_bin_edges(uint32_t n_channels, uint32_t n_levels, int64_t* bin_edges, uint64_t n_bin_edges);
+
+/**
+ * \brief   Correlates two arrays with each other, using a multi-tau correlator
+ *
+ * \param   n_channels      The number of lags per cascade level, see multi_tau_n_bins()
+ * \param   n_levels        The number of cascade levels, see multi_tau_n_bins()
+ * \param   left_list       An array containing the first data set, sorted
+ * \param   left_list_len   The number of data points in the first data set
+ * \param   right_list      An array containing the second data set, sorted
+ * \param   right_list_len  The number of data points in the second data set
+ * \param   histogram_ret   The array to store the correlation data in. Each new value will be added to the corresponding existing element.
+ * \param   histogram_ret_len   The number of histogram bins; must be multi_tau_n_bins()
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input; 2: invalid \p n_channels or \p n_levels; 3: \p histogram_ret_len is not correct.
+*/
+int LIBTIMETAG_DLL correlate_multi_tau(uint32_t n_channels,
+                                       uint32_t n_levels,
+                                       const int64_t* left_list,
+                                       uint64_t left_list_len,
+                                       const int64_t* right_list,
+                                       uint64_t right_list_len,
+                                       int64_t* histogram_ret,
+                                       uint64_t histogram_ret_len);
+
+typedef struct multi_tau_correlator multi_tau_correlator;
+
+/**
+ * \brief   Creates an incremental multi-tau correlator. Returns NULL if the parameters are invalid, see multi_tau_n_bins().
+ *
+ * Photons are added in chunks, as they are read (e.g. from a file that is still being written). A photon is
+ * correlated as soon as both streams have reached its macrotime, so the histogram can be displayed while the
+ * measurement runs.
+*/
+multi_tau_correlator* LIBTIMETAG_DLL multi_tau_create(uint32_t n_channels, uint32_t n_levels);
+
+/**
+ * \brief   Adds the next chunks of the left and right photon streams. Either chunk may be empty.
+ *
+ * Every stream must be sorted, also across chunks. Photons are buffered until the other stream has caught up.
+ *
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input.
+*/
+int LIBTIMETAG_DLL multi_tau_add(multi_tau_correlator* correlator,
+                                 const int64_t* left_list,
+                                 uint64_t left_list_len,
+                                 const int64_t* right_list,
+                                 uint64_t right_list_len);
+
+/**
+ * \brief   Correlates all photons still buffered. Call when both streams have ended.
+ *
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input.
+*/
+int LIBTIMETAG_DLL multi_tau_flush(multi_tau_correlator* correlator);
+
+/**
+ * \brief   Gets the histogram of the photons correlated so far
+ *
+ * \param   histogram_ret       Is set to the histogram
+ * \param   histogram_ret_len   The number of histogram bins; must be multi_tau_n_bins()
+ * \param   n_left              Is set to the number of left photons correlated so far. May be NULL.
+ * \param   n_right             Is set to the number of right photons correlated so far. May be NULL.
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input; 3: \p histogram_ret_len is not correct.
+*/
+int LIBTIMETAG_DLL multi_tau_get(const multi_tau_correlator* correlator,
+                                 int64_t* histogram_ret,
+                                 uint64_t histogram_ret_len,
+                                 uint64_t* n_left,
+                                 uint64_t* n_right);
+
+/**
+ * \brief   Releases the correlator. Accepts NULL.
+*/
+void LIBTIMETAG_DLL multi_tau_destroy(multi_tau_correlator* correlator);
+
 #ifdef __cplusplus
 }
+
+/**
+ * \brief   Owns a multi_tau_correlator; destroys it when going out of scope
+*/
+class multi_tau_stream_correlator
+{
+public:
+    multi_tau_stream_correlator(uint32_t n_channels, uint32_t n_levels) :
+        m_correlator(multi_tau_create(n_channels, n_levels)),
+        m_n_channels(n_channels),
+        m_n_levels(n_levels),
+        m_n_bins(multi_tau_n_bins(n_channels, n_levels))
+    {
+    }
+
+    ~multi_tau_stream_correlator()
+    {
+        multi_tau_destroy(m_correlator);
+    }
+
+    multi_tau_stream_correlator(const multi_tau_stream_correlator&) = delete;
+    multi_tau_stream_correlator& operator=(const multi_tau_stream_correlator&) = delete;
+
+    bool is_valid() const { return m_correlator != nullptr; }
+
+    uint32_t n_channels() const { return m_n_channels; }
+
+    uint32_t n_levels() const { return m_n_levels; }
+
+    uint64_t n_bins() const { return m_n_bins; }
+
+    multi_tau_correlator* handle() { return m_correlator; }
+
+private:
+    multi_tau_correlator* m_correlator;
+    uint32_t m_n_channels;
+    uint32_t m_n_levels;
+    uint64_t m_n_bins;
+};
 #endif
 
 #endif // ALGOS_H
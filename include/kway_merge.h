@@ -0,0 +1,149 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    kway_merge.h
+ * \brief   Merges sorted macrotime arrays of several channels into a single, time-sorted stream of (macrotime, channel) pairs
+ * \author  Stijn Hinterding
+*/
+
+/*
+	The merge uses a loser tree, so it costs log2(k) comparisons per
+	photon for k channels, and is stable: photons with equal macrotimes
+	are ordered by channel index. Instead of a channel ID, every output
+	photon carries the index of its input array (uint8), so at most
+	KWAY_MERGE_MAX_STREAMS arrays can be merged.
+
+	merge_sorted_arrays() merges arrays that are completely in memory.
+	The kway_merger functions merge streams that arrive in chunks (e.g.
+	from SSTTReader): chunks are pushed per stream, and merged output is
+	produced as far as it is final.
+*/
+
+#ifndef KWAY_MERGE_H
+#define KWAY_MERGE_H
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#ifdef BUILDING_LIBTIMETAG
+#define LIBTIMETAG_DLL __declspec(dllexport)
+#else
+#define LIBTIMETAG_DLL __declspec(dllimport)
+#endif
+#else
+#define LIBTIMETAG_DLL
+#endif
+
+#define KWAY_MERGE_MAX_STREAMS  256
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief   Merges sorted arrays into one sorted array
+ *
+ * \param   arrays          The sorted arrays to merge
+ * \param   lens            The number of elements in every array
+ * \param   n_arrays        The number of arrays; at most KWAY_MERGE_MAX_STREAMS
+ * \param   macrotimes_ret  The array to store the merged macrotimes in
+ * \param   streams_ret     The array to store the index of the source array of every macrotime in. May be NULL.
+ * \param   ret_len         The number of elements in (capacity of) \p macrotimes_ret and \p streams_ret; at least the sum of \p lens
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input; 2: too many arrays; 3: \p ret_len too small.
+*/
+int LIBTIMETAG_DLL merge_sorted_arrays(const int64_t* const* arrays,
+                                       const uint64_t* lens,
+                                       uint32_t n_arrays,
+                                       int64_t* macrotimes_ret,
+                                       uint8_t* streams_ret,
+                                       uint64_t ret_len);
+
+typedef struct kway_merger kway_merger;
+
+/**
+ * \brief   Creates a merger for \p n_streams streams. Returns NULL if \p n_streams is zero or exceeds KWAY_MERGE_MAX_STREAMS.
+*/
+kway_merger* LIBTIMETAG_DLL kway_merger_create(uint32_t n_streams);
+
+/**
+ * \brief   Appends a chunk of sorted macrotimes to a stream. The chunk is copied.
+ *
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input; 2: invalid stream index, or the stream has ended.
+*/
+int LIBTIMETAG_DLL kway_merger_push(kway_merger* merger, uint32_t stream, const int64_t* macrotimes, uint64_t len);
+
+/**
+ * \brief   Marks the end of a stream
+ *
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input; 2: invalid stream index.
+*/
+int LIBTIMETAG_DLL kway_merger_end(kway_merger* merger, uint32_t stream);
+
+/**
+ * \brief   Takes merged output
+ *
+ * Output stops when it is full, or when a stream that has not ended runs out of data: a later chunk of that
+ * stream could still contain smaller macrotimes. Push more data to that stream (or end it) and call again.
+ *
+ * \param   merger          The merger
+ * \param   macrotimes_ret  The array to store the merged macrotimes in
+ * \param   streams_ret     The array to store the stream index of every macrotime in. May be NULL.
+ * \param   ret_len         The number of elements in (capacity of) \p macrotimes_ret and \p streams_ret
+ * \param   n_ret           Is set to the number of macrotimes stored
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input.
+*/
+int LIBTIMETAG_DLL kway_merger_pop(kway_merger* merger,
+                                   int64_t* macrotimes_ret,
+                                   uint8_t* streams_ret,
+                                   uint64_t ret_len,
+                                   uint64_t* n_ret);
+
+/**
+ * \brief   Returns the stream that must receive data (or be ended) before kway_merger_pop() can continue; -1 if none
+*/
+int64_t LIBTIMETAG_DLL kway_merger_waiting_for(const kway_merger* merger);
+
+/**
+ * \brief   Returns 1 if all streams have ended and all output has been taken, else 0
+*/
+int LIBTIMETAG_DLL kway_merger_done(const kway_merger* merger);
+
+/**
+ * \brief   Releases the merger. Accepts NULL.
+*/
+void LIBTIMETAG_DLL kway_merger_destroy(kway_merger* merger);
+
+#ifdef __cplusplus
+}
+
+/**
+ * \brief   Owns a kway_merger; destroys it when going out of scope
+*/
+class kway_stream_merger
+{
+public:
+    kway_stream_merger(uint32_t n_streams) :
+        m_merger(kway_merger_create(n_streams))
+    {
+    }
+
+    ~kway_stream_merger()
+    {
+        kway_merger_destroy(m_merger);
+    }
+
+    kway_stream_merger(const kway_stream_merger&) = delete;
+    kway_stream_merger& operator=(const kway_stream_merger&) = delete;
+
+    bool is_valid() const { return m_merger != nullptr; }
+
+    kway_merger* handle() { return m_merger; }
+
+private:
+    kway_merger* m_merger;
+};
+#endif
+
+#endif // KWAY_MERGE_H
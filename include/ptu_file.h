@@ -0,0 +1,149 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    ptu_file.h
+ * \brief   Reads PicoQuant unified TTTR (PTU) files, in T2 and T3 mode, read-only
+ * \author  Stijn Hinterding
+*/
+
+/*
+	A PTU file starts with the magic "PQTTTR\0\0" and an 8 byte version,
+	followed by a list of tags (name, index, type, value), terminated by
+	the tag "Header_End". Strings and arrays store their length in the
+	value, and their contents directly after the tag. The records follow
+	the header, as 32-bit little-endian words; their layout depends on
+	the record type (tag "TTResultFormat_TTTRRecType"):
+
+		PicoHarp T2:	channel (4 bits), time tag (28 bits)
+		PicoHarp T3:	channel (4 bits), dtime (12 bits), nsync (16 bits)
+		HydraHarp, TimeHarp 260, MultiHarp T2:
+						special (1 bit), channel (6 bits), time tag (25 bits)
+		HydraHarp, TimeHarp 260, MultiHarp T3:
+						special (1 bit), channel (6 bits), dtime (15 bits), nsync (10 bits)
+
+	Special records are overflows (wrap-arounds of the time tag or
+	nsync counter) and markers. Overflows are accumulated into the
+	macrotimes; HydraHarp v1 records always count one overflow, the
+	later formats may store the number of overflows in the record.
+
+	Macrotimes are returned per channel, like read_data_file_sstt2()
+	does for SSTT2 files. In T2 mode they are in units of the global
+	resolution. In T3 mode the macrotime is the sync count (in units of
+	the sync period), and the microtime is dtime (in units of the
+	resolution). Channel IDs follow the PicoQuant demo code: for the
+	PicoHarp the channel field as is; for the other devices the channel
+	field + 1, with the sync channel of T2 mode as channel 0.
+*/
+
+#ifndef PTU_FILE_H
+#define PTU_FILE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifdef BUILDING_LIBTIMETAG
+#define LIBTIMETAG_DLL __declspec(dllexport)
+#else
+#define LIBTIMETAG_DLL __declspec(dllimport)
+#endif
+#else
+#define LIBTIMETAG_DLL
+#endif
+
+#define PTU_MAGIC                   "PQTTTR\0\0"
+#define PTU_N_BYTES_MAGIC           8
+#define PTU_N_BYTES_VERSION         8
+#define PTU_N_BYTES_TAG_IDENT       32
+#define PTU_N_BYTES_TAG             48
+#define PTU_N_BYTES_RECORD          4
+#define PTU_MAX_CHANNELS            65
+
+// Record types (tag TTResultFormat_TTTRRecType)
+#define PTU_REC_PICOHARP_T2         0x00010203
+#define PTU_REC_PICOHARP_T3         0x00010303
+#define PTU_REC_HYDRAHARP_T2        0x00010204
+#define PTU_REC_HYDRAHARP_T3        0x00010304
+#define PTU_REC_HYDRAHARP2_T2       0x01010204
+#define PTU_REC_HYDRAHARP2_T3       0x01010304
+#define PTU_REC_TIMEHARP260N_T2     0x00010205
+#define PTU_REC_TIMEHARP260N_T3     0x00010305
+#define PTU_REC_TIMEHARP260P_T2     0x00010206
+#define PTU_REC_TIMEHARP260P_T3     0x00010306
+#define PTU_REC_MULTIHARP_T2        0x00010207
+#define PTU_REC_MULTIHARP_T3        0x00010307
+
+struct ptu_info
+{
+public:
+    uint32_t record_type;
+    bool is_t3;
+    double global_resolution;   // Seconds per macrotime unit: the time tag resolution (T2) or the sync period (T3)
+    double resolution;          // Seconds per microtime unit (T3)
+    uint64_t n_records;
+    uint64_t data_offset;       // File offset of the first record
+    std::string device_type;    // Tag HW_Type, e.g. "HydraHarp"
+
+    ptu_info() :
+        record_type(0),
+        is_t3(false),
+        global_resolution(0.0),
+        resolution(0.0),
+        n_records(0),
+        data_offset(0),
+        device_type()
+    {
+    }
+};
+
+struct ptu_channel_data
+{
+public:
+    uint64_t ID;
+    std::vector<int64_t> macrotimes;
+    std::vector<int64_t> microtimes;    // T3 only
+
+    ptu_channel_data() :
+        ID(0),
+        macrotimes(),
+        microtimes()
+    {
+    }
+};
+
+/**
+ * \brief   Returns 1 if the file starts with the PTU magic, else 0
+*/
+int LIBTIMETAG_DLL test_is_ptu_file(const std::string& filepath);
+
+/**
+ * \brief   Reads the header of a PTU file
+ *
+ * \returns On success: 0. Else: 1: could not open the file; 2: NULL pointer supplied as input; 3: not a (valid) PTU file.
+*/
+int LIBTIMETAG_DLL read_ptu_header(const std::string& filepath, ptu_info* info);
+
+/**
+ * \brief   Reads the records of a PTU file, per channel
+ *
+ * The file is memory-mapped. A first pass counts the photons per channel, so that every output vector is
+ * allocated only once; the second pass decodes the records.
+ *
+ * \param   filepath        Path to the PTU file
+ * \param   info            Is set to the header information. May be NULL.
+ * \param   channels        Is set to the data of every channel with photons, in order of channel ID
+ * \param   marker_times    The macrotimes of the marker records are appended to this vector. May be NULL.
+ * \param   marker_bits     The marker bits of the marker records are appended to this vector. May be NULL.
+ * \returns On success: 0. Else: 1: could not open the file; 2: NULL pointer supplied as input; 3: not a (valid) PTU file;
+ *          4: unsupported record type.
+*/
+int LIBTIMETAG_DLL read_ptu_file(const std::string& filepath,
+                                 ptu_info* info,
+                                 std::vector<ptu_channel_data>* channels,
+                                 std::vector<int64_t>* marker_times,
+                                 std::vector<uint8_t>* marker_bits);
+
+#endif // PTU_FILE_H
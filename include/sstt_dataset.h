@@ -0,0 +1,68 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    sstt_dataset.h
+ * \brief   Loads all channels of an SSTT dataset concurrently, including the microtimes of pulse-linked channels
+ * \author  Stijn Hinterding
+*/
+
+/*
+	The data files of a dataset are independent, so they are decoded in
+	parallel on a pool of threads. For a channel that has a pulses
+	channel (e.g. a detector next to the laser sync), the microtimes are
+	generated with gen_microtimes() as soon as both channels have been
+	decoded, while the remaining files are still being read.
+
+	Both SSTT2 and version 1 data files are supported. The microtimes
+	stored in a version 1 file, or in a side stream written by
+	convert_sstt1_dataset(), are returned as they are, unless the info
+	file states that they must be generated from a pulses channel.
+*/
+
+#ifndef SSTT_DATASET_H
+#define SSTT_DATASET_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "sstt_file2.h"
+
+struct sstt_channel_data
+{
+public:
+    uint64_t ID;
+    std::vector<int64_t> macrotimes;
+    std::vector<int64_t> microtimes;    // Empty if the channel has no (generated) microtimes
+    int64_t pulse_period;               // Pulses channels only: the average pulse period, divided by the total sync divider. Else 0.
+
+    sstt_channel_data() :
+        ID(0),
+        macrotimes(),
+        microtimes(),
+        pulse_period(0)
+    {
+    }
+};
+
+/**
+ * \brief   Reads all channels of a dataset, in parallel
+ *
+ * \param   info_filepath   Path to the info file; the data files are "<info_filepath>.c<ID>"
+ * \param   exp_info        Is set to the experiment information. May be NULL.
+ * \param   channels        Is set to the channel information. The photon count of a channel is set to the number of
+ *                          photons read if the info file does not state it. May be NULL.
+ * \param   data            Is set to the data of every channel, in the order of the info file
+ * \param   n_threads       The number of threads to use. Zero: use all hardware threads.
+ * \returns On success: 0. Else: 1: could not read the info file; 2: NULL pointer supplied as input; 3: could not open
+ *          a data file, or a microtime side stream does not hold one value per photon; 4: could not generate the microtimes of a channel (e.g. its pulses channel is missing or empty).
+*/
+int LIBTIMETAG_DLL load_sstt_dataset(const std::string& info_filepath,
+                                     exp_info_sstt2* exp_info,
+                                     std::vector<channel_info_sstt2>* channels,
+                                     std::vector<sstt_channel_data>* data,
+                                     unsigned int n_threads);
+
+#endif // SSTT_DATASET_H
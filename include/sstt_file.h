@@ -11,6 +11,12 @@
 /*
 	This is the legacy SSTT file format (version 1), and is not 
 	supported any more. 
+
+	Existing datasets can be read, and converted to SSTT2 using
+	convert_sstt1_dataset(). SSTT2 stores no microtimes; the converter
+	can store the hardware microtimes of every channel in a side stream:
+	a packed file (see sstt_packed.h) named "<SSTT2 data file>.micro"
+	(SSTT1_MICRO_EXTENSION), which holds one microtime per photon.
 */
 
 #ifndef SSTT_FILE_H
@@ -43,6 +49,14 @@
 
 #define SSTT_OVERFLOW_VAL       ((uint64_t)1 << SSTT_N_BITS_MACRO)
 
+#define SSTT_N_BYTES_EVENT      8
+
+#define SSTT1_MICRO_EXTENSION           ".micro"
+
+// Used when the header of a version 1 dataset does not state the time unit or device type
+#define SSTT1_DEFAULT_TIME_UNIT         81e-12
+#define SSTT1_DEFAULT_DEVICE_TYPE       "qutau"
+
 struct channel_info
 {
 public:
@@ -58,14 +72,50 @@ public:
     }
 };
 
+/**
+ * \brief   Reads a version 1 data file
+ *
+ * The file is memory-mapped and walked twice: the photons are counted first, so that the output vectors are grown
+ * only once, and are then decoded. Either output may be NULL, in which case those values are not decoded.
+ *
+ * \param   filepath        Path to the data file
+ * \param   macrotimes      The macrotimes are appended to this vector. May be NULL.
+ * \param   microtimes      The microtimes are appended to this vector. May be NULL.
+ * \returns On success: 0. Else: 1: could not open the file.
+*/
 int LIBTIMETAG_DLL read_data_file(const std::string &filepath,
                    std::vector<int64_t> *macrotimes,
                    std::vector<int64_t> *microtimes);
 
+/**
+ * \brief   Counts the photons in a version 1 data file, and adds them to \p ret
+ *
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input; 2: could not open the file.
+*/
 int LIBTIMETAG_DLL n_photons_in_datafile(const char* directory,
                           const char* filename,
                           uint64_t* ret);
 
 std::vector<channel_info> LIBTIMETAG_DLL get_sstt_info(const char* filename, int *error_code);
 
+/**
+ * \brief   Converts a version 1 dataset to an SSTT2 dataset
+ *
+ * The channels are converted in parallel; every data file is decoded in chunks, so memory use does not depend on
+ * the size of the files. The channel settings are taken over from the version 1 header.
+ *
+ * \param   v1_info_filepath    Path to the header file of the version 1 dataset; the data files are "<v1_info_filepath>.c<ID>"
+ * \param   v2_info_filepath    Path to the info file of the SSTT2 dataset to create
+ * \param   keep_microtimes     Non-zero: store the microtimes of every channel in a side stream, and mark the channels as
+ *                              having microtimes in the info file
+ * \param   n_threads           The number of threads to use. Zero: use all hardware threads.
+ * \returns On success: 0. Else: 1: could not read the header file; 2: could not create the SSTT2 dataset;
+ *          3: could not open a data file; 4: write error; 5: a data file holds macrotimes that decrease by more than
+ *          SSTT2 can store.
+*/
+int LIBTIMETAG_DLL convert_sstt1_dataset(const std::string& v1_info_filepath,
+                                         const std::string& v2_info_filepath,
+                                         int keep_microtimes,
+                                         unsigned int n_threads);
+
 #endif // SSTT_FILE_H
@@ -101,6 +101,74 @@ int LIBTIMETAG_DLL read_data_file_sstt2(const std::string &filepath,
                    std::vector<int64_t> *macrotimes, uint64_t n_events_to_skip,
                                         uint64_t n_overflows_had, uint64_t *n_overflows_in_file);
 
+/**
+ * \brief   Reads an SSTT2 data file, decoding it on multiple threads
+ *
+ * Identical to read_data_file_sstt2(), but splits the file into segments. The photons and overflows in each
+ * segment are counted in parallel, after which every segment is decoded in parallel into its own part of \p macrotimes.
+ *
+ * \param   n_threads   The number of threads to use. Zero: use all hardware threads.
+ * \returns On success: 0. Else: 1: could not open the file; 2: NULL pointer supplied as input; 3: not an SSTT2 data file.
+*/
+int LIBTIMETAG_DLL read_data_file_sstt2_parallel(const std::string &filepath,
+                                                 std::vector<int64_t> *macrotimes,
+                                                 uint64_t n_events_to_skip,
+                                                 uint64_t n_overflows_had,
+                                                 uint64_t *n_overflows_in_file,
+                                                 unsigned int n_threads);
+
+/**
+ * \brief   Reads the photons with a macrotime in [\p t_start, \p t_stop) from an SSTT2 data file
+ *
+ * Blocks of events before \p t_start are skipped using only the overflow records, and decoding stops at the
+ * first photon at or beyond \p t_stop. If the file has a checkpoint index (see sstt_index2.h), reading starts at the
+ * checkpoint closest to \p t_start. Macrotimes are assumed to be sorted, as they are in any SSTT2 data file.
+ *
+ * \param   filepath    Path to the *.sstt.c* data file
+ * \param   macrotimes  The photon macrotimes are appended to this vector
+ * \param   t_start     Start of the time window (inclusive)
+ * \param   t_stop      End of the time window (exclusive)
+ * \returns On success: 0. Else: 1: could not open the file; 2: NULL pointer supplied as input; 3: not an SSTT2 data file.
+*/
+int LIBTIMETAG_DLL read_data_file_sstt2_range(const std::string &filepath,
+                                              std::vector<int64_t> *macrotimes,
+                                              int64_t t_start,
+                                              int64_t t_stop);
+
+/**
+ * \brief   Reads a decimated preview of an SSTT2 data file: every n-th photon, or one photon per time quantum
+ *
+ * Blocks of events without a photon to take are skipped using only their photon count and overflow records. If the
+ * file has a checkpoint index (see sstt_index2.h), whole intervals between checkpoints are skipped without reading
+ * them, so that the time taken depends on the number of photons returned rather than on the size of the file.
+ *
+ * Per time quantum, the first photon is taken. With an index, the first photon after a checkpoint is taken instead if
+ * it lies in the quantum, as it is stored in the index.
+ *
+ * \param   filepath        Path to the *.sstt.c* data file
+ * \param   macrotimes      The selected macrotimes are appended to this vector
+ * \param   photon_step     Non-zero: take photons 0, n, 2n, ...
+ * \param   time_quantum    Positive: take one photon from every interval [m * quantum, (m + 1) * quantum) that holds any.
+ *                          Exactly one of \p photon_step and \p time_quantum must be set.
+ * \returns On success: 0. Else: 1: could not open the file; 2: NULL pointer supplied as input; 3: not an SSTT2 data file;
+ *          4: invalid \p photon_step or \p time_quantum.
+*/
+int LIBTIMETAG_DLL read_data_file_sstt2_decimated(const std::string& filepath,
+                                                  std::vector<int64_t>* macrotimes,
+                                                  uint64_t photon_step,
+                                                  int64_t time_quantum);
+
+/**
+ * \brief   Returns the number of photons in an SSTT2 data file, without decoding it
+ *
+ * The count is taken from the checkpoint index of the file (see sstt_index2.h) if it covers the whole file. Otherwise
+ * only the signal bits of the events are scanned.
+ *
+ * \param   directory   Directory of the data file. May be empty or NULL.
+ * \param   filename    Name of the *.sstt.c* data file
+ * \param   ret         Is set to the number of photons
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input; 2: could not open the file.
+*/
 int LIBTIMETAG_DLL n_photons_in_datafile_sstt2(const char* directory,
                           const char* filename,
                           uint64_t* ret);
@@ -0,0 +1,162 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    sstt_index2.h
+ * \brief   Checkpoint index for "small simple time-tagged" (SSTT) data files, version 2.
+ * \author  Stijn Hinterding
+*/
+
+/*
+	Decoding an SSTT2 data file from an arbitrary position requires the
+	number of overflows that occurred before that position. The index
+	stores this state at regular intervals (every n events), together
+	with the number of photons before that position and the macrotime
+	of the first photon after it. With a binary search over these
+	checkpoints, a reader can jump to any photon index or time, and
+	only needs to decode at most one interval to get there.
+
+	The index is not limited to SSTT2: any event stream of the time-tag
+	reader registry (see timetag_reader.h) can be indexed, e.g. merged
+	and PTU files. The file is scanned with the block functions of its
+	reader; the overflow counts are in the unit of that reader.
+
+	The index is stored next to the data file, with the extension
+	".idx" appended (e.g., "data.sstt.c1.idx"). Because data files
+	are only ever appended to, an index remains valid for the part of
+	the file it covers, and is simply extended when the file has grown.
+	A data file that was replaced (e.g. by a new measurement with the
+	same name) is recognized by the last event the index covers, and
+	the first photons at the first and last checkpoints: these are
+	checked against the data file before the index is used, and the
+	index is rebuilt if they differ.
+
+	Index file layout (all values unsigned 64-bit little endian, except
+	where noted):
+		magic "SSTT2IDX" (8 bytes)
+		version
+		interval (number of events between checkpoints)
+		indexed_size (data file size, in bytes, covered by the index)
+		n_photons, n_overflows (totals within indexed_size)
+		last_event (the raw bytes, at most eight, of the last event within indexed_size)
+		n_checkpoints
+		n_checkpoints times: byte_offset, photon_index, n_overflows, macrotime (signed)
+*/
+
+#ifndef SSTT_INDEX2_H
+#define SSTT_INDEX2_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifdef BUILDING_LIBTIMETAG
+#define LIBTIMETAG_DLL __declspec(dllexport)
+#else
+#define LIBTIMETAG_DLL __declspec(dllimport)
+#endif
+#else
+#define LIBTIMETAG_DLL
+#endif
+
+#define SSTT2_INDEX_MAGIC               "SSTT2IDX"
+#define SSTT2_INDEX_VERSION             2
+#define SSTT2_INDEX_EXTENSION           ".idx"
+#define SSTT2_INDEX_DEFAULT_INTERVAL    65536
+
+struct sstt2_checkpoint
+{
+public:
+    uint64_t byte_offset;   // File offset of the event at this checkpoint
+    uint64_t photon_index;  // Number of photons before byte_offset
+    uint64_t n_overflows;   // Number of overflows before byte_offset
+    int64_t macrotime;      // Macrotime of the first photon at or after byte_offset; INT64_MAX if there is none
+};
+
+struct sstt2_index
+{
+public:
+    uint64_t interval;
+    uint64_t indexed_size;
+    uint64_t n_photons;
+    uint64_t n_overflows;
+    uint64_t last_event;    // The raw bytes (at most eight) of the last event within indexed_size; identifies the data file
+    std::vector<sstt2_checkpoint> checkpoints;
+
+    sstt2_index() :
+        interval(SSTT2_INDEX_DEFAULT_INTERVAL),
+        indexed_size(0),
+        n_photons(0),
+        n_overflows(0),
+        last_event(0),
+        checkpoints()
+    {
+    }
+};
+
+/**
+ * \brief   Returns the path of the index file belonging to a data file
+*/
+std::string LIBTIMETAG_DLL sstt2_index_filepath(const std::string& filepath);
+
+/**
+ * \brief   Builds (or extends) the index of a data file
+ *
+ * If \p index already covers part of the file, only the remainder of the file is scanned. An index that does not
+ * belong to the file (see sstt2_index_matches()) is built anew.
+ *
+ * \param   filepath    Path to the data file: a *.sstt.c* file, or an event stream of another registered format
+ * \param   index       The index to build or extend. Its interval is used for new indices.
+ * \returns On success: 0. Else: 1: could not open the file; 2: NULL pointer supplied as input; 3: not an event stream of
+ *          a registered format.
+*/
+int LIBTIMETAG_DLL build_sstt2_index(const std::string& filepath, sstt2_index* index);
+
+/**
+ * \brief   Tests whether an index belongs to the data file in \p data, i.e. the file was not replaced since
+ *
+ * Checks that the file is at least \p indexed_size long, and that its last indexed event, and the first photons at
+ * the first and last checkpoints, are those in the index. Only an index that passes may be used for the file.
+ *
+ * \param   data    The mapping of the whole data file
+ * \returns 1 if the index belongs to the file, else 0
+*/
+int LIBTIMETAG_DLL sstt2_index_matches(const sstt2_index& index, const unsigned char* data, uint64_t size);
+
+/**
+ * \brief   Reads an index file. Use sstt2_index_matches() before using it for a data file.
+ *
+ * \returns On success: 0. Else: 1: could not open the file; 2: NULL pointer supplied as input; 3: not an index file
+ *          (or one of an older version), or a truncated or corrupt one.
+*/
+int LIBTIMETAG_DLL read_sstt2_index(const std::string& index_filepath, sstt2_index* index);
+
+/**
+ * \returns On success: 0. Else: 1: could not open the file for writing; 2: write error.
+*/
+int LIBTIMETAG_DLL write_sstt2_index(const std::string& index_filepath, const sstt2_index& index);
+
+/**
+ * \brief   Returns an up-to-date index for a data file
+ *
+ * Loads the index file next to \p filepath, if there is one. The index is (re)built if there is none, if it is
+ * invalid, or if the data file has grown since it was written. An updated index is written back if \p save is
+ * non-zero; failing to do so (e.g. in a read-only directory) is not an error.
+ *
+ * \returns On success: 0. Else: see build_sstt2_index().
+*/
+int LIBTIMETAG_DLL get_sstt2_index(const std::string& filepath, sstt2_index* index, int save);
+
+/**
+ * \brief   Returns the index of the last checkpoint at or before the given photon. Zero if there are no checkpoints.
+*/
+uint64_t LIBTIMETAG_DLL sstt2_index_find_photon(const sstt2_index& index, uint64_t photon_index);
+
+/**
+ * \brief   Returns the index of the last checkpoint from which all photons with a macrotime >= \p macrotime can be found
+*/
+uint64_t LIBTIMETAG_DLL sstt2_index_find_time(const sstt2_index& index, int64_t macrotime);
+
+#endif // SSTT_INDEX2_H
@@ -0,0 +1,136 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    sstt_merged.h
+ * \brief   Single-file container holding all channels of a dataset as one time-ordered stream ("SSTT merged").
+ * \author  Stijn Hinterding
+*/
+
+/*
+	An SSTT2 dataset stores every channel in its own data file. A merged
+	file stores the photons of all channels in a single, time-ordered
+	stream, in which every event carries a channel tag. Photons with equal
+	macrotimes are ordered by channel tag.
+
+	Events are 8 bytes (little endian):
+		bits 0-1:	signal; 0: photon, 1: overflow, other: reserved
+		bits 2-9:	channel tag, i.e. index into the channel table
+		bits 10-63:	photon: macrotime (modulo 2^54)
+					overflow: number of overflows of 2^54
+
+	File layout:
+		magic "SSTTMRG\0" (8 bytes)
+		uint32 version, uint32 n_channels
+		n_channels times: uint64 channel ID
+		events
+*/
+
+#ifndef SSTT_MERGED_H
+#define SSTT_MERGED_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifdef BUILDING_LIBTIMETAG
+#define LIBTIMETAG_DLL __declspec(dllexport)
+#else
+#define LIBTIMETAG_DLL __declspec(dllimport)
+#endif
+#else
+#define LIBTIMETAG_DLL
+#endif
+
+#define SSTTM_MAGIC             "SSTTMRG\0"
+#define SSTTM_VERSION           1
+#define SSTTM_N_BYTES_EVENT     8
+#define SSTTM_N_BITS_SIGNAL     2
+#define SSTTM_N_BITS_TAG        8
+#define SSTTM_N_BITS_MACRO      (64 - SSTTM_N_BITS_SIGNAL - SSTTM_N_BITS_TAG)
+#define SSTTM_MAX_CHANNELS      (1 << SSTTM_N_BITS_TAG)
+#define SSTTM_MASK_SIGNAL       (((uint64_t)1 << SSTTM_N_BITS_SIGNAL) - 1)
+#define SSTTM_MASK_TAG          (((uint64_t)1 << SSTTM_N_BITS_TAG) - 1)
+#define SSTTM_MASK_MACRO        (((uint64_t)1 << SSTTM_N_BITS_MACRO) - 1)
+
+/**
+ * \brief   Merges SSTT2 data files into a single merged file
+ *
+ * The data files are decoded in chunks, so memory use does not depend on the size of the files.
+ * The macrotimes in every data file must be sorted.
+ *
+ * \param   filepaths       Paths to the *.sstt.c* data files
+ * \param   channel_ids     The channel ID of each data file
+ * \param   merged_filepath Path to the merged file to create
+ * \returns On success: 0. Else: 1: could not open a file; 2: invalid input (sizes differ, no or too many channels,
+ *          negative or unsorted macrotimes); 3: not an SSTT2 data file; 4: write error.
+*/
+int LIBTIMETAG_DLL merge_sstt2_files(const std::vector<std::string>& filepaths,
+                                     const std::vector<uint64_t>& channel_ids,
+                                     const std::string& merged_filepath);
+
+/**
+ * \brief   Merges all channels of an SSTT2 dataset into a single merged file
+ *
+ * \param   info_filepath   Path to the info (header) file of the dataset; the data files are "<info_filepath>.c<ID>"
+ * \returns On success: 0. Else: 5: could not read the info file; see merge_sstt2_files() for the other errors.
+*/
+int LIBTIMETAG_DLL merge_sstt2_dataset(const std::string& info_filepath, const std::string& merged_filepath);
+
+typedef struct ssttm_reader ssttm_reader;
+
+/**
+ * \param   error_code      Is set to 0 on success. Else: 1: NULL pointer supplied as input; 2: could not open the file; 3: not a merged file.
+ * \returns A reader handle, which must be released using ssttm_reader_close(). NULL on failure.
+*/
+ssttm_reader* LIBTIMETAG_DLL ssttm_reader_open(const std::string& filepath, int* error_code);
+
+/**
+ * \brief   Returns the channel table: the channel ID belonging to every channel tag
+*/
+std::vector<uint64_t> LIBTIMETAG_DLL ssttm_reader_channels(const ssttm_reader* reader);
+
+/**
+ * \brief   Decodes the next chunk of the merged stream
+ *
+ * \param   reader          The reader handle
+ * \param   macrotimes      The array to store the macrotimes in
+ * \param   tags            The array to store the channel tags in
+ * \param   len             The number of elements in (capacity of) \p macrotimes and \p tags
+ * \param   n_photons       Is set to the number of photons stored. Zero signals the end of the file.
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input.
+*/
+int LIBTIMETAG_DLL ssttm_reader_next_chunk(ssttm_reader* reader,
+                                           int64_t* macrotimes,
+                                           uint8_t* tags,
+                                           uint64_t len,
+                                           uint64_t* n_photons);
+
+/**
+ * \brief   Decodes the selected channels from the rest of the file
+ *
+ * Makes two passes over the events: the photons of every tag are counted first, so that every output grows only
+ * once, and are then decoded.
+ *
+ * \param   reader          The reader handle
+ * \param   channel_ids     The channels to extract; channels that are not in the file yield no photons
+ * \param   macrotimes      Is resized to the number of channels; the photons of channel_ids[i] are appended to macrotimes[i]
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input.
+*/
+int LIBTIMETAG_DLL ssttm_reader_demux(ssttm_reader* reader,
+                                      const std::vector<uint64_t>& channel_ids,
+                                      std::vector<std::vector<int64_t> >* macrotimes);
+
+/**
+ * \brief   Closes the file and releases the reader. Accepts NULL.
+*/
+void LIBTIMETAG_DLL ssttm_reader_close(ssttm_reader* reader);
+
+/**
+ * \brief   Returns 1 if the file starts with the magic of a merged file, else 0
+*/
+int LIBTIMETAG_DLL test_is_merged_file(const std::string& filepath);
+
+#endif // SSTT_MERGED_H
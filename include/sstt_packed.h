@@ -0,0 +1,182 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    sstt_packed.h
+ * \brief   Compressed, block-based container for photon macrotimes ("SSTT packed").
+ * \author  Stijn Hinterding
+*/
+
+/*
+	SSTT2 spends 6 bytes on every photon. The differences between
+	consecutive macrotimes usually need far fewer bits, so the packed
+	format stores them delta-encoded and bit-packed, in blocks of at most
+	SSTT_PACKED_BLOCK_PHOTONS photons.
+
+	Within a block, the deltas are stored relative to the smallest delta
+	in that block (frame of reference), using the smallest bit width
+	that fits all of them. Regular signals, such as a laser sync
+	channel, therefore compress to a few bits per photon. Any sequence of
+	macrotimes (also unsorted ones) is stored losslessly.
+
+	File layout (all values little endian):
+		file header:
+			magic "SSTTPCK\0" (8 bytes)
+			uint32 version, uint32 block size (maximum photons per block)
+		n_blocks times, a block:
+			int64 first_macrotime
+			int64 min_delta
+			uint32 n_photons
+			uint32 bit_width
+			uint64 n_bytes (number of bytes of packed data that follow)
+			packed data: (n_photons - 1) values of bit_width bits, in
+			    64-bit words, followed by one zero padding word
+		block table, n_blocks times:
+			uint64 byte_offset, uint64 first_photon, int64 first_macrotime
+		trailer:
+			uint64 n_blocks, uint64 n_photons, uint64 table_offset
+			magic "SSTTPEND" (8 bytes)
+
+	Every block can be decoded on its own; the block table at the end of
+	the file gives random access by photon index or by time.
+*/
+
+#ifndef SSTT_PACKED_H
+#define SSTT_PACKED_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifdef BUILDING_LIBTIMETAG
+#define LIBTIMETAG_DLL __declspec(dllexport)
+#else
+#define LIBTIMETAG_DLL __declspec(dllimport)
+#endif
+#else
+#define LIBTIMETAG_DLL
+#endif
+
+#define SSTT_PACKED_MAGIC           "SSTTPCK\0"
+#define SSTT_PACKED_END_MAGIC       "SSTTPEND"
+#define SSTT_PACKED_VERSION         1
+#define SSTT_PACKED_BLOCK_PHOTONS   4096
+#define SSTT_PACKED_N_BYTES_HEADER  16
+#define SSTT_PACKED_N_BYTES_BLOCK_HEADER    32
+#define SSTT_PACKED_N_BYTES_TRAILER 32
+
+struct sstt_packed_block_info
+{
+public:
+    uint64_t byte_offset;       // File offset of the block header
+    uint64_t first_photon;      // Index of the first photon in the block
+    int64_t first_macrotime;    // Macrotime of the first photon in the block
+};
+
+/**
+ * \brief   Writes macrotimes to a packed file
+ *
+ * \returns On success: 0. Else: 1: could not create the file; 2: NULL pointer supplied as input; 4: write error.
+*/
+int LIBTIMETAG_DLL write_packed_file(const std::string& filepath, const int64_t* macrotimes, uint64_t n_photons);
+
+/**
+ * \brief   Converts an SSTT2 data file to a packed file, losslessly
+ *
+ * The SSTT2 file is decoded in chunks, so the conversion runs in constant memory.
+ *
+ * \param   sstt2_filepath      Path to the *.sstt.c* data file
+ * \param   packed_filepath     Path to the packed file to create
+ * \returns On success: 0. Else: 1: could not open either file; 3: not an SSTT2 data file; 4: write error.
+*/
+int LIBTIMETAG_DLL convert_sstt2_to_packed(const std::string& sstt2_filepath, const std::string& packed_filepath);
+
+typedef struct sstt_packed_writer sstt_packed_writer;
+
+/**
+ * \brief   Creates a packed file, to which values are appended in batches
+ *
+ * Only complete blocks are kept in memory, so files of any size can be written.
+ *
+ * \param   error_code      Is set to 0 on success. Else: 1: NULL pointer supplied as input; 2: could not create the file.
+ * \returns A writer handle, which must be released using sstt_packed_writer_close(). NULL on failure.
+*/
+sstt_packed_writer* LIBTIMETAG_DLL sstt_packed_writer_open(const std::string& filepath, int* error_code);
+
+/**
+ * \brief   Appends values to a packed file
+ *
+ * \returns On success: 0. Else: 1: could not write to the file; 2: NULL pointer supplied as input.
+*/
+int LIBTIMETAG_DLL sstt_packed_writer_write(sstt_packed_writer* writer, const int64_t* values, uint64_t n);
+
+/**
+ * \brief   Writes the last block, the block table and the trailer, and releases the writer. Accepts NULL.
+ *
+ * \returns On success: 0. Else: 4: write error (at any point since the file was opened); the file is removed.
+*/
+int LIBTIMETAG_DLL sstt_packed_writer_close(sstt_packed_writer* writer);
+
+typedef struct sstt_packed_reader sstt_packed_reader;
+
+/**
+ * \brief   Opens a packed file, and loads its block table
+ *
+ * \param   error_code      Is set to 0 on success. Else: 1: NULL pointer supplied as input; 2: could not open the file; 3: not a (complete) packed file.
+ * \returns A reader handle, which must be released using sstt_packed_close(). NULL on failure.
+*/
+sstt_packed_reader* LIBTIMETAG_DLL sstt_packed_open(const std::string& filepath, int* error_code);
+
+uint64_t LIBTIMETAG_DLL sstt_packed_n_photons(const sstt_packed_reader* reader);
+
+uint64_t LIBTIMETAG_DLL sstt_packed_n_blocks(const sstt_packed_reader* reader);
+
+/**
+ * \brief   Returns the block table entry of a block. Must be called with \p block_index < sstt_packed_n_blocks().
+*/
+sstt_packed_block_info LIBTIMETAG_DLL sstt_packed_block(const sstt_packed_reader* reader, uint64_t block_index);
+
+/**
+ * \brief   Returns the index of the block containing the given photon
+*/
+uint64_t LIBTIMETAG_DLL sstt_packed_find_photon(const sstt_packed_reader* reader, uint64_t photon_index);
+
+/**
+ * \brief   Returns the index of the last block starting before \p macrotime. Assumes sorted macrotimes.
+*/
+uint64_t LIBTIMETAG_DLL sstt_packed_find_time(const sstt_packed_reader* reader, int64_t macrotime);
+
+/**
+ * \brief   Decodes a range of blocks, without decoding the blocks before it
+ *
+ * \param   reader          The reader handle
+ * \param   first_block     Index of the first block to decode
+ * \param   n_blocks        The number of blocks to decode; truncated at the last block
+ * \param   macrotimes      The macrotimes are appended to this vector
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input; 3: corrupt block.
+*/
+int LIBTIMETAG_DLL sstt_packed_read_blocks(const sstt_packed_reader* reader,
+                                           uint64_t first_block,
+                                           uint64_t n_blocks,
+                                           std::vector<int64_t>* macrotimes);
+
+/**
+ * \brief   Closes the file and releases the reader. Accepts NULL.
+*/
+void LIBTIMETAG_DLL sstt_packed_close(sstt_packed_reader* reader);
+
+/**
+ * \brief   Reads all macrotimes from a packed file
+ *
+ * \returns On success: 0. Else: 1: could not open the file; 2: NULL pointer supplied as input; 3: not a (valid) packed file.
+*/
+int LIBTIMETAG_DLL read_packed_file(const std::string& filepath, std::vector<int64_t>* macrotimes);
+
+/**
+ * \brief   Returns 1 if the file starts with the magic of a packed file, else 0
+*/
+int LIBTIMETAG_DLL test_is_packed_file(const std::string& filepath);
+
+#endif // SSTT_PACKED_H
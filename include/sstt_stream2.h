@@ -0,0 +1,388 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    sstt_stream2.h
+ * \brief   Streaming (chunked) reader for "small simple time-tagged" (SSTT) data files, version 2.
+ * \author  Stijn Hinterding
+*/
+
+/*
+	The streaming reader decodes a *.sstt.c* data file in chunks of a
+	fixed number of photons, using a fixed-size read buffer. The overflow
+	state is carried over from chunk to chunk, so that arbitrarily large
+	files can be processed in constant memory.
+
+	Usage (C):
+		int error_code = 0;
+		sstt2_reader* r = sstt2_reader_open("data.sstt.c1", &error_code);
+		uint64_t n = 0;
+
+		while (sstt2_reader_next_chunk(r, buf, buf_len, &n) == 0 && n > 0) {
+			// process buf[0] ... buf[n - 1]
+		}
+
+		sstt2_reader_close(r);
+
+	The reader can also follow a file that is still being written: once
+	the end of the file is reached, a subsequent call to
+	sstt2_reader_next_chunk() returns the photons appended in the
+	meantime. An incomplete trailing event is left in place until the
+	rest of it has been written. A reader can be re-created at a
+	later time at the position of another one, using
+	sstt2_reader_offset(), sstt2_reader_n_overflows() and
+	sstt2_reader_open_at().
+
+	Other event-stream formats of the time-tag reader registry (see
+	timetag_reader.h), such as merged and PTU files, are streamed the
+	same way: the format is detected when the header is read, and the
+	events are decoded with the block functions of its reader. Use
+	sstt2_reader_next_photons() to get their microtimes and channels.
+*/
+
+#ifndef SSTT_STREAM2_H
+#define SSTT_STREAM2_H
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#ifdef BUILDING_LIBTIMETAG
+#define LIBTIMETAG_DLL __declspec(dllexport)
+#else
+#define LIBTIMETAG_DLL __declspec(dllimport)
+#endif
+#else
+#define LIBTIMETAG_DLL
+#endif
+
+#define SSTT2_READER_DEFAULT_BLOCK_EVENTS   65536
+#define SSTT2_READER_PREFETCH_BLOCK_BYTES   (4 << 20)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct sstt2_reader sstt2_reader;
+
+/**
+ * \brief   Opens a data file for streaming
+ *
+ * \param   filepath        Path to the *.sstt.c* data file, or an event stream of another registered format
+ * \param   error_code      Is set to 0 on success. Else: 1: NULL pointer supplied as input; 2: could not open the file; 3: not an event stream of a registered format.
+ * \returns A reader handle, which must be released using sstt2_reader_close(). NULL on failure.
+*/
+sstt2_reader* LIBTIMETAG_DLL sstt2_reader_open(const char* filepath, int* error_code);
+
+/**
+ * \brief   Opens a data file for streaming, starting at a given event
+ *
+ * Use this function to resume reading a file (e.g., a file that is still being written), or to follow a file
+ * of which the header has not been written yet.
+ *
+ * \param   filepath        Path to the *.sstt.c* data file
+ * \param   byte_offset     File offset of the first event to decode, as returned by sstt2_reader_offset(). Zero: the first event in the file.
+ * \param   n_overflows     The number of overflows preceding that event, as returned by sstt2_reader_n_overflows()
+ * \param   error_code      Is set to 0 on success. Else: 1: NULL pointer supplied as input, or \p byte_offset is not at an event boundary; 2: could not open the file; 3: not an event stream of a registered format.
+ * \returns A reader handle, which must be released using sstt2_reader_close(). NULL on failure.
+*/
+sstt2_reader* LIBTIMETAG_DLL sstt2_reader_open_at(const char* filepath,
+                                                  uint64_t byte_offset,
+                                                  uint64_t n_overflows,
+                                                  int* error_code);
+
+/**
+ * \brief   Decodes the next chunk of photons
+ *
+ * Fills \p macrotimes with up to \p macrotimes_len photon macrotimes. Less than \p macrotimes_len photons
+ * are only returned when the end of the file is reached.
+ *
+ * \param   reader          The reader handle
+ * \param   macrotimes      The array to store the macrotimes in
+ * \param   macrotimes_len  The number of elements in (capacity of) the \p macrotimes array
+ * \param   n_photons       Is set to the number of photons stored in \p macrotimes. Zero signals the end of the file (for now).
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input; 2: read error; 3: the header, written after opening, is not a valid header (or \p byte_offset of sstt2_reader_open_at() is not at an event boundary).
+*/
+int LIBTIMETAG_DLL sstt2_reader_next_chunk(sstt2_reader* reader,
+                                           int64_t* macrotimes,
+                                           uint64_t macrotimes_len,
+                                           uint64_t* n_photons);
+
+/**
+ * \brief   Decodes the next chunk of photons, with their microtimes and channels
+ *
+ * Like sstt2_reader_next_chunk(), for formats that store more than the macrotimes (see sstt2_reader_flags()).
+ *
+ * \param   microtimes      The array to store the microtimes in. May be NULL; left untouched if the format has none.
+ * \param   channels        The array to store the channel IDs in. May be NULL; left untouched for single-channel formats.
+ * \param   len             The number of elements in (capacity of) every array
+ * \returns See sstt2_reader_next_chunk()
+*/
+int LIBTIMETAG_DLL sstt2_reader_next_photons(sstt2_reader* reader,
+                                             int64_t* macrotimes,
+                                             int64_t* microtimes,
+                                             uint64_t* channels,
+                                             uint64_t len,
+                                             uint64_t* n_photons);
+
+/**
+ * \brief   Positions the reader at the given photon
+ *
+ * Uses the checkpoint index of the file (see sstt_index2.h) to jump close to the photon, so that at most one
+ * index interval needs to be decoded. The index is built (and stored next to the file) if it does not exist yet.
+ *
+ * \param   reader          The reader handle
+ * \param   photon_index    Index of the photon that the next call to sstt2_reader_next_chunk() should start with
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input; 2: read error; 4: could not index the file.
+*/
+int LIBTIMETAG_DLL sstt2_reader_seek_photon(sstt2_reader* reader, uint64_t photon_index);
+
+/**
+ * \brief   Positions the reader at the first photon with a macrotime of at least \p macrotime
+ *
+ * See sstt2_reader_seek_photon().
+ *
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input; 2: read error; 4: could not index the file.
+*/
+int LIBTIMETAG_DLL sstt2_reader_seek_time(sstt2_reader* reader, int64_t macrotime);
+
+/**
+ * \brief   Enables (or disables) asynchronous read-ahead
+ *
+ * A background thread keeps up to \p n_blocks blocks read ahead of the decoder, so that reading the next blocks
+ * overlaps with decoding (and processing) the current one. Worthwhile on slow or high-latency storage, such as
+ * network file systems. Seeking restarts the read-ahead at the new position. Following a file that is still being
+ * written works as without read-ahead.
+ *
+ * \param   reader          The reader handle
+ * \param   n_blocks        The number of blocks to keep in flight. Zero: read synchronously (the default).
+ * \param   block_bytes     The size of every read. Zero: SSTT2_READER_PREFETCH_BLOCK_BYTES.
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input; 2: could not open the file for reading ahead.
+*/
+int LIBTIMETAG_DLL sstt2_reader_set_prefetch(sstt2_reader* reader, uint32_t n_blocks, uint64_t block_bytes);
+
+/**
+ * \brief   Returns the file offset of the next event to decode
+*/
+uint64_t LIBTIMETAG_DLL sstt2_reader_offset(const sstt2_reader* reader);
+
+/**
+ * \brief   Returns the number of overflows encountered so far (including those passed to sstt2_reader_open_at())
+*/
+uint64_t LIBTIMETAG_DLL sstt2_reader_n_overflows(const sstt2_reader* reader);
+
+/**
+ * \brief   Returns the index of the next photon, i.e. the number of photons before the read position
+ *
+ * When the reader was opened using sstt2_reader_open_at(), photons before \p byte_offset are not included.
+*/
+uint64_t LIBTIMETAG_DLL sstt2_reader_n_photons(const sstt2_reader* reader);
+
+/**
+ * \brief   Returns the name of the format of the file (e.g. TIMETAG_READER_SSTT2), or NULL while its header is pending
+*/
+const char* LIBTIMETAG_DLL sstt2_reader_format(const sstt2_reader* reader);
+
+/**
+ * \brief   Returns what the file holds besides macrotimes: TIMETAG_HAS_MICROTIMES and/or TIMETAG_HAS_CHANNELS
+*/
+int LIBTIMETAG_DLL sstt2_reader_flags(const sstt2_reader* reader);
+
+/**
+ * \brief   Closes the file and releases the reader. Accepts NULL.
+*/
+void LIBTIMETAG_DLL sstt2_reader_close(sstt2_reader* reader);
+
+/*
+	Decoding into a buffer of the caller
+
+	The functions below decode a data file straight into an array that
+	the caller owns (e.g. a preallocated, pinned or reused buffer), so
+	that no intermediate vector is grown and copied. Size the array with
+	sstt2_count_file_photons(), or decode in parts: the position is
+	carried over from call to call.
+
+	Usage (C):
+		sstt2_decode_position pos = { 0, 0, 0 };
+		uint64_t n = 0;
+
+		sstt2_count_file_photons("data.sstt.c1", 0, &n);
+		int64_t* buf = malloc(n * sizeof(int64_t));
+		sstt2_decode_file_into("data.sstt.c1", &pos, buf, n, &n, 0);
+*/
+
+typedef struct sstt2_decode_position
+{
+    uint64_t byte_offset;   // File offset of the next event to decode. Zero: the first event in the file.
+    uint64_t n_overflows;   // The number of overflows preceding that event
+    int at_end;             // Set to non-zero when all (complete) events in the file have been decoded
+} sstt2_decode_position;
+
+/**
+ * \brief   Counts the photons in an SSTT2 data file, from a given event on, without decoding them
+ *
+ * Uses the checkpoint index of the file (see sstt_index2.h) if it covers the whole file and \p byte_offset is zero.
+ * Otherwise only the signal bits of the events are scanned.
+ *
+ * \param   filepath        Path to the *.sstt.c* data file
+ * \param   byte_offset     File offset of the first event to count. Zero: the first event in the file.
+ * \param   n_photons       Is set to the number of photons
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input, or \p byte_offset is not at an event boundary;
+ *          2: could not open the file; 3: not an SSTT2 data file.
+*/
+int LIBTIMETAG_DLL sstt2_count_file_photons(const char* filepath, uint64_t byte_offset, uint64_t* n_photons);
+
+/**
+ * \brief   Decodes an SSTT2 data file into an array of the caller
+ *
+ * Decodes photons from \p position on, until \p macrotimes is full or the end of the file is reached, and advances
+ * \p position past the decoded events. Call again with the same position to resume; a file that is still being
+ * written can be followed this way, too.
+ *
+ * \param   filepath        Path to the *.sstt.c* data file
+ * \param   position        The position to start decoding at; updated
+ * \param   macrotimes      The array to store the macrotimes in
+ * \param   capacity        The number of elements in (capacity of) \p macrotimes
+ * \param   n_written       Is set to the number of photons stored in \p macrotimes
+ * \param   n_threads       The number of threads to use. Zero: use all hardware threads.
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input, or the position is not at an event boundary;
+ *          2: could not open the file; 3: not an SSTT2 data file.
+*/
+int LIBTIMETAG_DLL sstt2_decode_file_into(const char* filepath,
+                                          sstt2_decode_position* position,
+                                          int64_t* macrotimes,
+                                          uint64_t capacity,
+                                          uint64_t* n_written,
+                                          unsigned int n_threads);
+
+#ifdef __cplusplus
+}
+
+#include <string>
+#include <vector>
+
+/**
+ * \brief   RAII wrapper around the sstt2_reader C API
+*/
+class sstt2_stream_reader
+{
+public:
+    explicit sstt2_stream_reader(const std::string& filepath, uint64_t chunk_size = 1 << 20) :
+        m_reader(nullptr),
+        m_error_code(0),
+        m_chunk_size(chunk_size == 0 ? 1 : chunk_size)
+    {
+        m_reader = sstt2_reader_open(filepath.c_str(), &m_error_code);
+    }
+
+    /** Resumes reading at \p byte_offset, see sstt2_reader_open_at() */
+    sstt2_stream_reader(const std::string& filepath, uint64_t chunk_size, uint64_t byte_offset, uint64_t n_overflows) :
+        m_reader(nullptr),
+        m_error_code(0),
+        m_chunk_size(chunk_size == 0 ? 1 : chunk_size)
+    {
+        m_reader = sstt2_reader_open_at(filepath.c_str(), byte_offset, n_overflows, &m_error_code);
+    }
+
+    ~sstt2_stream_reader()
+    {
+        close();
+    }
+
+    sstt2_stream_reader(const sstt2_stream_reader&) = delete;
+    sstt2_stream_reader& operator=(const sstt2_stream_reader&) = delete;
+
+    bool is_open() const { return m_reader != nullptr; }
+
+    /** Error code of the last failed operation, see sstt2_reader_open() and sstt2_reader_next_chunk() */
+    int error_code() const { return m_error_code; }
+
+    uint64_t chunk_size() const { return m_chunk_size; }
+
+    uint64_t n_overflows() const { return sstt2_reader_n_overflows(m_reader); }
+
+    uint64_t n_photons() const { return sstt2_reader_n_photons(m_reader); }
+
+    uint64_t offset() const { return sstt2_reader_offset(m_reader); }
+
+    /** See sstt2_reader_seek_photon(). Returns 0 on success. */
+    int seek_photon(uint64_t photon_index) { return sstt2_reader_seek_photon(m_reader, photon_index); }
+
+    /** See sstt2_reader_seek_time(). Returns 0 on success. */
+    int seek_time(int64_t macrotime) { return sstt2_reader_seek_time(m_reader, macrotime); }
+
+    /** See sstt2_reader_set_prefetch(). Returns 0 on success. */
+    int set_prefetch(uint32_t n_blocks, uint64_t block_bytes = 0) { return sstt2_reader_set_prefetch(m_reader, n_blocks, block_bytes); }
+
+    /**
+     * Replaces the contents of \p macrotimes with the next chunk of at most chunk_size() photons.
+     * Returns false at the end of the file, or on error (see error_code()).
+    */
+    bool next_chunk(std::vector<int64_t>* macrotimes)
+    {
+        if (m_reader == nullptr || macrotimes == nullptr) {
+            return false;
+        }
+
+        macrotimes->resize(m_chunk_size);
+
+        uint64_t n = 0;
+        int success = sstt2_reader_next_chunk(m_reader, macrotimes->data(), m_chunk_size, &n);
+
+        macrotimes->resize(n);
+
+        if (success != 0) {
+            m_error_code = success;
+            return false;
+        }
+
+        return n > 0;
+    }
+
+    /**
+     * Appends all photons written to the file since the previous call to \p macrotimes.
+     * The work done is proportional to the amount of new data.
+     * Returns 0 on success, else an error code (see sstt2_reader_next_chunk()).
+    */
+    int poll(std::vector<int64_t>* macrotimes)
+    {
+        if (m_reader == nullptr || macrotimes == nullptr) {
+            return 1;
+        }
+
+        uint64_t n = m_chunk_size;
+
+        while (n == m_chunk_size) {
+            uint64_t n_had = macrotimes->size();
+            macrotimes->resize(n_had + m_chunk_size);
+
+            int success = sstt2_reader_next_chunk(m_reader, macrotimes->data() + n_had, m_chunk_size, &n);
+
+            macrotimes->resize(n_had + n);
+
+            if (success != 0) {
+                m_error_code = success;
+                return success;
+            }
+        }
+
+        return 0;
+    }
+
+    void close()
+    {
+        sstt2_reader_close(m_reader);
+        m_reader = nullptr;
+    }
+
+    sstt2_reader* handle() { return m_reader; }
+
+private:
+    sstt2_reader* m_reader;
+    int m_error_code;
+    uint64_t m_chunk_size;
+};
+
+#endif // __cplusplus
+
+#endif // SSTT_STREAM2_H
@@ -0,0 +1,151 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    sstt_summary2.h
+ * \brief   Cached per-file summaries of "small simple time-tagged" (SSTT) data files, version 2.
+ * \author  Stijn Hinterding
+*/
+
+/*
+	A summary holds the numbers that are needed to browse a dataset
+	without decoding it: the number of photons and overflows, the first
+	and last macrotime (e.g., T_min and T_max for normalize_correlation),
+	and a coarse count rate profile.
+
+	The summary is stored next to the data file, with the extension
+	".sum" appended (e.g., "data.sstt.c1.sum"). It is valid as long as
+	the size and modification time of the data file are unchanged.
+
+	The count rate profile is a histogram of the photon macrotimes,
+	starting at the first macrotime. The bin width is a power of two;
+	it is doubled (and adjacent bins are merged) whenever the profile
+	would exceed SSTT2_SUMMARY_PROFILE_BINS bins. The profile can
+	therefore be built in a single pass over the photons.
+
+	Summary file layout (all values 64-bit little endian):
+		magic "SSTT2SUM" (8 bytes)
+		version
+		file_size, file_mtime (signed)
+		n_photons, n_overflows
+		t_first, t_last (signed)
+		profile_bin_width
+		n_bins
+		n_bins times: number of photons in the bin
+*/
+
+#ifndef SSTT_SUMMARY2_H
+#define SSTT_SUMMARY2_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifdef BUILDING_LIBTIMETAG
+#define LIBTIMETAG_DLL __declspec(dllexport)
+#else
+#define LIBTIMETAG_DLL __declspec(dllimport)
+#endif
+#else
+#define LIBTIMETAG_DLL
+#endif
+
+#define SSTT2_SUMMARY_MAGIC             "SSTT2SUM"
+#define SSTT2_SUMMARY_VERSION           1
+#define SSTT2_SUMMARY_EXTENSION         ".sum"
+#define SSTT2_SUMMARY_PROFILE_BINS      1024
+
+struct sstt2_summary
+{
+public:
+    // Identify the state of the data file the summary was made of
+    uint64_t file_size;
+    int64_t file_mtime;
+
+    uint64_t n_photons;
+    uint64_t n_overflows;
+    int64_t t_first;        // Zero if there are no photons
+    int64_t t_last;         // Zero if there are no photons
+
+    uint64_t profile_bin_width;
+    std::vector<uint64_t> profile;  // Bin i covers [t_first + i * profile_bin_width, t_first + (i + 1) * profile_bin_width)
+
+    sstt2_summary() :
+        file_size(0),
+        file_mtime(0),
+        n_photons(0),
+        n_overflows(0),
+        t_first(0),
+        t_last(0),
+        profile_bin_width(1),
+        profile()
+    {
+    }
+};
+
+/**
+ * \brief   Returns the path of the summary file belonging to a data file
+*/
+std::string LIBTIMETAG_DLL sstt2_summary_filepath(const std::string& filepath);
+
+/**
+ * \brief   Resets a summary, and marks it with the current size and modification time of the data file
+ *
+ * Use init_sstt2_summary(), sstt2_summary_add() and store_sstt2_summary() to summarize a file while decoding it.
+ *
+ * \returns On success: 0. Else: 1: could not access the file; 2: NULL pointer supplied as input.
+*/
+int LIBTIMETAG_DLL init_sstt2_summary(const std::string& filepath, sstt2_summary* summary);
+
+/**
+ * \brief   Adds photons to a summary. The macrotimes must be sorted, and follow those added before.
+ *
+ * The number of overflows is not updated; set n_overflows once all photons have been added.
+*/
+void LIBTIMETAG_DLL sstt2_summary_add(sstt2_summary* summary, const int64_t* macrotimes, uint64_t n_photons);
+
+/**
+ * \brief   Computes the summary of a data file, by decoding it
+ *
+ * \returns On success: 0. Else: 1: could not open the file; 2: NULL pointer supplied as input; 3: not an SSTT2 data file.
+*/
+int LIBTIMETAG_DLL compute_sstt2_summary(const std::string& filepath, sstt2_summary* summary);
+
+/**
+ * \returns On success: 0. Else: 1: could not open the file; 2: NULL pointer supplied as input; 3: not a summary file.
+*/
+int LIBTIMETAG_DLL read_sstt2_summary(const std::string& summary_filepath, sstt2_summary* summary);
+
+/**
+ * \returns On success: 0. Else: 1: could not open the file for writing; 2: write error.
+*/
+int LIBTIMETAG_DLL write_sstt2_summary(const std::string& summary_filepath, const sstt2_summary& summary);
+
+/**
+ * \brief   Loads the summary file next to \p filepath, if it is up to date
+ *
+ * \returns On success: 0. Else: 1: there is no (valid) summary file; 2: NULL pointer supplied as input; 4: the summary is out of date.
+*/
+int LIBTIMETAG_DLL load_sstt2_summary(const std::string& filepath, sstt2_summary* summary);
+
+/**
+ * \brief   Writes a summary next to its data file, if the data file did not change since init_sstt2_summary()
+ *
+ * \returns On success: 0. Else: 1: could not open the file for writing; 2: write error; 4: the data file has changed.
+*/
+int LIBTIMETAG_DLL store_sstt2_summary(const std::string& filepath, const sstt2_summary& summary);
+
+/**
+ * \brief   Returns an up-to-date summary of a data file
+ *
+ * Loads the summary file next to \p filepath. If there is none, or if it is out of date, the data file is
+ * decoded instead. The new summary is written back if \p save is non-zero; failing to do so (e.g. in a read-only
+ * directory) is not an error.
+ *
+ * \returns On success: 0. Else: see compute_sstt2_summary().
+*/
+int LIBTIMETAG_DLL get_sstt2_summary(const std::string& filepath, sstt2_summary* summary, int save);
+
+#endif // SSTT_SUMMARY2_H
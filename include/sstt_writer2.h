@@ -0,0 +1,173 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    sstt_writer2.h
+ * \brief   Buffered writer for "small simple time-tagged" (SSTT) datasets, version 2.
+ * \author  Stijn Hinterding
+*/
+
+/*
+	The writer creates a complete SSTT2 dataset: the info (header) file
+	and one *.sstt.c* data file per channel. Photons are passed in as
+	batches of macrotimes per channel; overflow events are inserted
+	automatically whenever a macrotime does not fit in 46 bits anymore.
+
+	Encoded events are collected in large, page-aligned blocks. Full
+	blocks are handed to a background thread that writes them to disk,
+	so that the producer (e.g., the acquisition loop) only stalls when
+	the disk cannot keep up with SSTT2_WRITER_MAX_PENDING_BLOCKS blocks.
+	As the 18-byte header is part of the first block, all writes start
+	at multiples of the block size in the data files (until
+	sstt2_writer_flush() is called).
+
+	Different channels may be written from different threads at the
+	same time; a single channel must not.
+
+	The info file is written when the dataset is opened, and updated
+	with the number of photons and overflows of every channel by
+	sstt2_writer_flush() and sstt2_writer_close().
+
+	Usage:
+		int error_code = 0;
+		sstt2_writer* w = sstt2_writer_open("data.sstt", exp_info, channels, &error_code);
+
+		while (acquiring) {
+			sstt2_writer_write(w, channel_id, macrotimes, n);
+		}
+
+		sstt2_writer_close(w);
+*/
+
+#ifndef SSTT_WRITER2_H
+#define SSTT_WRITER2_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "sstt_file2.h"
+
+#define SSTT2_WRITER_BLOCK_BYTES            (SSTT2_N_BYTES_TOT * 262144)
+#define SSTT2_WRITER_BLOCK_ALIGNMENT        4096
+#define SSTT2_WRITER_MAX_PENDING_BLOCKS     32
+
+typedef struct sstt2_writer sstt2_writer;
+
+/**
+ * \brief   Creates an SSTT2 dataset for writing
+ *
+ * Creates the info file at \p filepath, and a data file "<filepath>.c<ID>" for every channel. Existing files are
+ * overwritten.
+ *
+ * \param   filepath        Path to the info file of the dataset (e.g., "data.sstt")
+ * \param   exp_info        The time unit and device type of the experiment
+ * \param   channels        The channels of the dataset. ID, the sync dividers, the pulses channel fields and
+ *                          channel_has_microtime are used; filename and n_photons are filled in by the writer.
+ * \param   error_code      Is set to 0 on success. Else: 1: NULL pointer supplied as input, no channels, or duplicate
+ *                          channel IDs; 2: could not create a file.
+ * \returns A writer handle, which must be released using sstt2_writer_close(). NULL on failure.
+*/
+sstt2_writer* LIBTIMETAG_DLL sstt2_writer_open(const std::string& filepath,
+                                               const exp_info_sstt2& exp_info,
+                                               const std::vector<channel_info_sstt2>& channels,
+                                               int* error_code);
+
+/**
+ * \brief   Appends photons to a channel
+ *
+ * The macrotimes must be non-negative, and must not decrease by more than what fits in the current overflow period
+ * (i.e. they should be sorted). The batch is written up to the first offending macrotime.
+ *
+ * \param   writer          The writer handle
+ * \param   channel_id      ID of the channel
+ * \param   macrotimes      The macrotimes to append
+ * \param   n_photons       The number of elements in \p macrotimes
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input, or unknown channel; 2: write error;
+ *          4: invalid (negative or decreasing) macrotime.
+*/
+int LIBTIMETAG_DLL sstt2_writer_write(sstt2_writer* writer,
+                                      uint64_t channel_id,
+                                      const int64_t* macrotimes,
+                                      uint64_t n_photons);
+
+/**
+ * \brief   Writes all buffered events to disk, and updates the info file
+ *
+ * Blocks until the background thread has written everything.
+ *
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input; 2: write error.
+*/
+int LIBTIMETAG_DLL sstt2_writer_flush(sstt2_writer* writer);
+
+/**
+ * \brief   Returns the number of photons written to a channel so far. Zero for unknown channels.
+*/
+uint64_t LIBTIMETAG_DLL sstt2_writer_n_photons(const sstt2_writer* writer, uint64_t channel_id);
+
+/**
+ * \brief   Flushes and closes all files, and releases the writer. Accepts NULL.
+ *
+ * \returns On success: 0. Else: 2: write error (at any point since the dataset was opened).
+*/
+int LIBTIMETAG_DLL sstt2_writer_close(sstt2_writer* writer);
+
+/**
+ * \brief   RAII wrapper around the sstt2_writer API
+*/
+class sstt2_dataset_writer
+{
+public:
+    sstt2_dataset_writer(const std::string& filepath,
+                         const exp_info_sstt2& exp_info,
+                         const std::vector<channel_info_sstt2>& channels) :
+        m_writer(nullptr),
+        m_error_code(0)
+    {
+        m_writer = sstt2_writer_open(filepath, exp_info, channels, &m_error_code);
+    }
+
+    ~sstt2_dataset_writer()
+    {
+        close();
+    }
+
+    sstt2_dataset_writer(const sstt2_dataset_writer&) = delete;
+    sstt2_dataset_writer& operator=(const sstt2_dataset_writer&) = delete;
+
+    bool is_open() const { return m_writer != nullptr; }
+
+    /** Error code of sstt2_writer_open() */
+    int error_code() const { return m_error_code; }
+
+    /** See sstt2_writer_write(). Returns 0 on success. */
+    int write(uint64_t channel_id, const int64_t* macrotimes, uint64_t n_photons)
+    {
+        return sstt2_writer_write(m_writer, channel_id, macrotimes, n_photons);
+    }
+
+    /** See sstt2_writer_flush(). Returns 0 on success. */
+    int flush() { return sstt2_writer_flush(m_writer); }
+
+    uint64_t n_photons(uint64_t channel_id) const { return sstt2_writer_n_photons(m_writer, channel_id); }
+
+    /** See sstt2_writer_close(). Returns 0 on success. */
+    int close()
+    {
+        if (m_writer == nullptr) {
+            return 0;
+        }
+
+        int success = sstt2_writer_close(m_writer);
+        m_writer = nullptr;
+
+        return success;
+    }
+
+private:
+    sstt2_writer* m_writer;
+    int m_error_code;
+};
+
+#endif // SSTT_WRITER2_H
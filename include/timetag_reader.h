@@ -0,0 +1,280 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    timetag_reader.h
+ * \brief   Registry of time-tag file readers, with detection of the file format
+ * \author  Stijn Hinterding
+*/
+
+/*
+	Every supported file format is described by a timetag_reader: a
+	probe, that recognizes the format from the first bytes of the file,
+	and the functions that decode it. read_timetag_file() maps the file
+	once, asks the registered readers whether they recognize it, and
+	decodes it with the first one that does.
+
+	Most formats are a header followed by a stream of fixed-size events,
+	in which overflow events add to a running overflow count (SSTT v1 and
+	v2, merged files, PicoQuant PTU). Such a format only provides a block
+	decoder, and a block counter. Everything else is done for every
+	format alike: streaming (sstt_stream2.h), the checkpoint index
+	(sstt_index2.h), skipping events, and decoding in parallel. For the
+	latter, the events are split into segments, the photons and
+	overflows of every segment are counted in parallel, and after a
+	prefix sum every segment is decoded into its own slot of the output,
+	again in parallel. Formats with another layout (the packed format)
+	provide read_file instead.
+
+	Skipping photons (timetag_read_options::n_photons_to_skip) jumps
+	straight to the event after them if every event is a photon or a
+	single overflow (TIMETAG_SIMPLE_EVENTS), given the number of overflow
+	events before it. Other formats have events that are neither (PTU
+	markers), or overflow events that count several overflows (merged
+	files), so their events are counted up to the photon instead.
+
+	Built in are, in order of probing: SSTT2, SSTT packed, SSTT merged
+	and PTU. SSTT v1 files have no magic, so they can not be detected:
+	that reader has no probe, and is only used when a caller names it as
+	the fallback for unrecognized files (timetag_read_options::fallback).
+*/
+
+#ifndef TIMETAG_READER_H
+#define TIMETAG_READER_H
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifdef BUILDING_LIBTIMETAG
+#define LIBTIMETAG_DLL __declspec(dllexport)
+#else
+#define LIBTIMETAG_DLL __declspec(dllimport)
+#endif
+#else
+#define LIBTIMETAG_DLL
+#endif
+
+// Names of the built-in readers
+#define TIMETAG_READER_SSTT2        "SSTT2"
+#define TIMETAG_READER_SSTT_PACKED  "SSTT packed"
+#define TIMETAG_READER_SSTT_MERGED  "SSTT merged"
+#define TIMETAG_READER_PTU          "PTU"
+#define TIMETAG_READER_SSTT1        "SSTT v1"
+
+// Probes look at no more than this many bytes; a shorter file may not have its magic yet
+#define TIMETAG_N_BYTES_PROBE       8
+
+// Reader flags
+#define TIMETAG_HAS_MICROTIMES      0x1     // The format stores microtimes
+#define TIMETAG_HAS_CHANNELS        0x2     // The file holds several channels; every photon has a channel ID
+#define TIMETAG_SIMPLE_EVENTS       0x4     // Every event is a photon, or a single overflow (SSTT2)
+
+struct timetag_reader;
+
+/**
+ * \brief   Layout of an event stream, as found by timetag_reader::open
+*/
+struct timetag_layout
+{
+public:
+    uint64_t data_offset;               // File offset of the first event
+    uint64_t n_bytes_event;             // Size of every event
+    int flags;                          // The reader flags, as they apply to this file; open may clear some
+    uint32_t variant;                   // Format specific, e.g. the PTU record type
+    std::vector<uint64_t> channel_ids;  // Format specific, e.g. the channel table of a merged file
+
+    timetag_layout() :
+        data_offset(0),
+        n_bytes_event(0),
+        flags(0),
+        variant(0),
+        channel_ids()
+    {
+    }
+};
+
+struct timetag_read_options
+{
+public:
+    uint64_t n_photons_to_skip;     // Resume reading after this many photons
+    uint64_t n_overflow_events;     // TIMETAG_SIMPLE_EVENTS only: the overflow events before them, see read_data_file_sstt2()
+    unsigned int n_threads;         // Zero: use all hardware threads
+    bool read_microtimes;
+    bool read_channels;
+    const timetag_reader* fallback; // Reads the files that no reader recognizes, e.g. SSTT v1. NULL: such files are an error.
+
+    timetag_read_options() :
+        n_photons_to_skip(0),
+        n_overflow_events(0),
+        n_threads(1),
+        read_microtimes(true),
+        read_channels(true),
+        fallback(nullptr)
+    {
+    }
+};
+
+struct timetag_data
+{
+public:
+    const timetag_reader* reader;       // The reader that decoded the file
+    std::vector<int64_t> macrotimes;
+    std::vector<int64_t> microtimes;    // Empty if the format has no microtimes, or they were not requested
+    std::vector<uint64_t> channels;     // Multi-channel formats: the channel ID of every photon. Else empty.
+    uint64_t n_overflows;               // Event streams: the overflow count at the end of the file, to resume reading with
+
+    timetag_data() :
+        reader(nullptr),
+        macrotimes(),
+        microtimes(),
+        channels(),
+        n_overflows(0)
+    {
+    }
+};
+
+struct timetag_reader
+{
+public:
+    const char* name;
+    int flags;
+
+    /**
+     * \brief   Returns 1 if the file has this format, else 0. Should only look at the magic bytes (at most
+     *          TIMETAG_N_BYTES_PROBE).
+     *          NULL: the format has no magic; the reader is never detected, and only used as a fallback.
+    */
+    int (*probe)(const unsigned char* data, uint64_t size);
+
+    /**
+     * \brief   Event streams: parses the header of the file
+     * \returns On success: 0. Else: the file is not valid.
+    */
+    int (*open)(const unsigned char* data, uint64_t size, timetag_layout* layout);
+
+    /**
+     * \brief   Event streams: adds the number of photons, and the number of overflows, in a block of events
+     *          to \p n_photons and \p n_overflows. The overflow count may be in any unit, but must add up.
+    */
+    void (*count_block)(const timetag_layout* layout,
+                        const unsigned char* data,
+                        uint64_t n_events,
+                        uint64_t* n_photons,
+                        uint64_t* n_overflows);
+
+    /**
+     * \brief   Event streams: decodes a block of events
+     *
+     * \p n_overflows is the running overflow count: used as the starting offset, and updated. Every event holds at
+     * most one photon. The outputs have room for \p n_photons elements: at least the number of photons counted by
+     * count_block, or \p n_events; nothing may be written beyond the photons decoded. \p microtimes and \p channels
+     * may be NULL.
+     * \returns The number of photons decoded
+    */
+    uint64_t (*decode_block)(const timetag_layout* layout,
+                             const unsigned char* data,
+                             uint64_t n_events,
+                             uint64_t n_photons,
+                             uint64_t* n_overflows,
+                             int64_t* macrotimes,
+                             int64_t* microtimes,
+                             uint64_t* channels);
+
+    /**
+     * \brief   Other formats: decodes the whole file. NULL for event streams.
+     * \returns On success: 0. Else: the file is not valid.
+    */
+    int (*read_file)(const unsigned char* data,
+                     uint64_t size,
+                     const timetag_read_options* options,
+                     timetag_data* result);
+};
+
+/**
+ * \brief   Adds a reader to the registry. It is probed after the readers registered before it.
+ *
+ * \param   reader  The reader; must stay valid for the lifetime of the program
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input, or the reader lacks a name or decoder.
+*/
+int LIBTIMETAG_DLL timetag_register_reader(const timetag_reader* reader);
+
+/**
+ * \brief   Finds the reader that recognizes the file in \p data, or NULL
+*/
+const timetag_reader* LIBTIMETAG_DLL timetag_find_reader(const unsigned char* data, uint64_t size);
+
+/**
+ * \brief   Returns the registered reader with the given name (e.g. TIMETAG_READER_SSTT1), or NULL
+*/
+const timetag_reader* LIBTIMETAG_DLL timetag_get_reader(const char* name);
+
+/**
+ * \brief   Detects the format of a file
+ *
+ * \returns The reader that recognizes the file, or NULL if the file could not be opened or is not recognized
+*/
+const timetag_reader* LIBTIMETAG_DLL timetag_detect_format(const std::string& filepath);
+
+/**
+ * \brief   Reads a time-tag file of any registered format
+ *
+ * The file is opened once: the same mapping is used to detect the format and to decode the data.
+ *
+ * \param   filepath    Path to the file
+ * \param   options     Options, see timetag_read_options
+ * \param   result      Is set to the data read, and the reader used
+ * \returns On success: 0. Else: 1: could not open the file; 2: NULL pointer supplied as input; 3: unknown format (and
+ *          no fallback), or invalid file.
+*/
+int LIBTIMETAG_DLL read_timetag_file(const std::string& filepath,
+                                     const timetag_read_options& options,
+                                     timetag_data* result);
+
+/**
+ * \brief   Output arrays of read_timetag_file_into()
+*/
+struct timetag_buffers
+{
+public:
+    int64_t* macrotimes;
+    int64_t* microtimes;    // NULL: do not decode the microtimes
+    uint64_t* channels;     // NULL: do not decode the channels
+
+    timetag_buffers() :
+        macrotimes(nullptr),
+        microtimes(nullptr),
+        channels(nullptr)
+    {
+    }
+};
+
+/**
+ * \brief   Provides the output arrays of read_timetag_file_into(), once the number of photons is known
+ *
+ * \param   n_photons   The number of photons that will be decoded; every array must have room for this many
+ * \param   flags       The outputs that can be decoded: TIMETAG_HAS_MICROTIMES and/or TIMETAG_HAS_CHANNELS, as far
+ *                      as the file has them and \p options asks for them
+ * \param   buffers     Is set to the arrays. \p macrotimes must be set; the others may be left NULL.
+*/
+typedef std::function<void(uint64_t n_photons, int flags, timetag_buffers* buffers)> timetag_allocator;
+
+/**
+ * \brief   Reads a time-tag file of any registered format, decoding into arrays of the caller
+ *
+ * Like read_timetag_file(), but event streams are counted first, after which \p allocate is called once, and
+ * the photons are decoded straight into the arrays it provides: no vector is grown, or copied. Formats that decode
+ * the whole file at once (timetag_reader::read_file) can not do this: they fill the vectors of \p result instead,
+ * and \p allocate is not called.
+ *
+ * \returns See read_timetag_file()
+*/
+int LIBTIMETAG_DLL read_timetag_file_into(const std::string& filepath,
+                                          const timetag_read_options& options,
+                                          const timetag_allocator& allocate,
+                                          timetag_data* result);
+
+#endif // TIMETAG_READER_H
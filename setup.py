@@ -3,14 +3,21 @@ from setuptools import setup, Extension, find_packages
 from sys import platform
 
 extra_compile_args =['-std=c++11']
+extra_link_args = []
 
 if platform == "darwin":
     # Mac OS
     extra_compile_args.append('-stdlib=libc++')
 
+if platform != "win32":
+    # std::thread
+    extra_compile_args.append('-pthread')
+    extra_link_args.append('-pthread')
+
 module1 = Extension('_libtimetag',
-                    sources = ['./src/algos.cpp', './src/getline.cpp', './src/python_bindings.cpp', './src/sstt_file.cpp', './src/sstt_file2.cpp'], 
+                    sources = ['./src/algos.cpp', './src/getline.cpp', './src/python_bindings.cpp', './src/sstt_file.cpp', './src/sstt_file2.cpp', './src/mapped_file.cpp', './src/sstt2_decode.cpp', './src/sstt_stream2.cpp', './src/sstt_index2.cpp', './src/sstt_summary2.cpp', './src/sstt_writer2.cpp', './src/sstt_packed.cpp', './src/sstt_merged.cpp', './src/kway_merge.cpp', './src/file_prefetcher.cpp', './src/sstt_dataset.cpp', './src/ptu_file.cpp', './src/timetag_reader.cpp'], 
                     extra_compile_args=extra_compile_args,
+                    extra_link_args=extra_link_args,
                     include_dirs = ['.','./include'],
 					define_macros=[('LIBTIMETAG_COMPILE_PYTHON', None), ('BUILDING_LIBTIMETAG', None)])
 
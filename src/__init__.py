@@ -168,7 +168,7 @@ def read_sstt_header(filepath):
                 
     return exp_header,chan_headers
             
-def import_data(filepath):
+def import_data(filepath, n_threads=0):
     """Imports the data and header information of a small simple time-tagged (SSTT) dataset
 
     This function imports SSTT datasets and header information. Furthermore,
@@ -183,6 +183,9 @@ def import_data(filepath):
     ----------
     filepath : str
         Filepath to the header file
+    n_threads : int, optional
+        Number of threads used to read the channels. Zero: use all
+        available cores.
 
     Returns
     -------
@@ -194,29 +197,111 @@ def import_data(filepath):
         A list of dictionaries, containing the data per channel
     """
     exp_header,chan_header = read_sstt_header(filepath)
-    
+
+    # Decodes the channels, and generates the microtimes, in parallel
+    loaded = load_sstt_dataset(filepath, n_threads)
+
     data = {}
 
     for chan in chan_header:
-        macro,micro,_ = read_sstt_data(filepath+".c"+str(chan))
+        macro,micro,pulse_period = loaded[chan]
+
         data[chan] = {}
         data[chan]["macro"] = macro
         data[chan]["micro"] = micro
 
-    # Generate microtimes if necessary
-    for chan in chan_header:            
         ch = chan_header[chan]
-        
+
         if ch['NumPhotons'] == 0:
-            ch['NumPhotons'] = len(data[chan]["macro"])
-            
-        if ch['HasPulsesChannel'] and not ch['HasMicrotimes'] and ch['NumPhotons'] > 0:
-            # generate microtimes
-            data[chan]['micro'] = gen_micro_times(data[ch["CorrespondingPulsesChannel"]]['macro'],data[chan]['macro'],chan_header[ch["CorrespondingPulsesChannel"]]["TotalSyncDivider"])
-            
-        if ch['IsPulsesChannel']:
-            ch['PulsePeriod'] = _np.int64(round(_np.average(data[chan]['macro'][1:] - data[chan]['macro'][:-1])/ch["TotalSyncDivider"]))
-        else:
-            ch['PulsePeriod'] = 0
-    
-    return exp_header,chan_header,data
\ No newline at end of file
+            ch['NumPhotons'] = len(macro)
+
+        ch['PulsePeriod'] = _np.int64(pulse_period)
+
+    return exp_header,chan_header,data
+
+
+def iter_sstt_data(filepath, chunk_size=1048576, prefetch_blocks=0):
+    """Iterates over the macrotimes of a single *.sstt.c* (SSTT v2) data file, in chunks
+
+    The data file is decoded chunk by chunk, so that files larger than
+    the available memory can be processed in constant memory.
+
+    Parameters
+    ----------
+    filepath : str
+        Path to the *.sstt.c* data file
+    chunk_size : int, optional
+        Maximum number of photons per chunk
+    prefetch_blocks : int, optional
+        Number of blocks to read ahead on a background thread, while the
+        current chunk is processed (see SSTTReader.set_prefetch()).
+        Zero: read synchronously.
+
+    Yields
+    ------
+    macro : array
+        Array containing the next chunk of macro timestamps
+    """
+    reader = SSTTReader(filepath, chunk_size)
+
+    if prefetch_blocks > 0:
+        reader.set_prefetch(prefetch_blocks)
+
+    try:
+        while True:
+            chunk = reader.next_chunk()
+
+            if len(chunk) == 0:
+                break
+
+            yield chunk
+    finally:
+        reader.close()
+
+def iter_merged_sstt_data(filepath, chunk_size=1048576):
+    """Iterates over all channels of an SSTT (v2) dataset as one time-sorted stream, in chunks
+
+    The data files are read chunk by chunk, and merged on the fly, so that
+    datasets larger than the available memory can be processed. Photons
+    with equal macro timestamps are ordered by channel.
+
+    Parameters
+    ----------
+    filepath : str
+        Filepath to the header file
+    chunk_size : int, optional
+        Maximum number of photons per chunk
+
+    Yields
+    ------
+    macro : array
+        Array containing the next chunk of merged macro timestamps
+    channels : array
+        Array containing the channel ID of every macro timestamp
+    """
+    _,chan_header = read_sstt_header(filepath)
+    channel_ids = _np.array(list(chan_header.keys()), dtype=_np.int64)
+    readers = [SSTTReader(filepath+".c"+str(chan), chunk_size) for chan in channel_ids]
+    merger = StreamMerger(len(readers))
+
+    try:
+        while not merger.done:
+            stream = merger.waiting_for
+
+            if stream >= 0:
+                chunk = readers[stream].next_chunk()
+
+                if len(chunk) == 0:
+                    merger.end(stream)
+                else:
+                    merger.push(stream, chunk)
+
+                continue
+
+            macro,streams = merger.pop(chunk_size)
+
+            if len(macro) > 0:
+                yield macro,channel_ids[streams]
+    finally:
+        for reader in readers:
+            reader.close()
@@ -16,8 +16,14 @@
 #include <string.h>
 #include <stdio.h>
 #include <algorithm>
+#include <thread>
 #include <vector>
 
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define ALGOS_X86
+#include <immintrin.h>
+#endif
+
 template <typename T, typename U>
 int _normalize_correlation(const int64_t* corr_hist,
                            uint64_t hist_len,
@@ -200,6 +206,511 @@ int _correlate_many_per_bin(const T* bin_edges,
     return 0;
 }
 
+static int check_unit_bins(const int64_t* bin_edges,
+                           uint64_t n_bin_edges,
+                           const int64_t* left_list,
+                           const int64_t* right_list,
+                           const int64_t* histogram_ret,
+                           uint64_t histogram_ret_len)
+{
+    if (bin_edges == NULL || left_list == NULL || right_list == NULL || histogram_ret == NULL)
+        return 1; // Input is invalid
+
+    if (n_bin_edges <= 1)   // We should have at least one bin
+        return 2;
+
+    if (histogram_ret_len != n_bin_edges - 1)   // The return histogram and the bin edges should match
+        return 3;
+
+    if (bin_edges[1] - bin_edges[0] != 1) {   // Imperfect check to see if the input bins are OK
+        return 4;
+    }
+
+    return 0;
+}
+
+static void _correlate_unit_bins_scalar(int64_t first_bin_edge,
+                                 const int64_t* left_list,
+                                 uint64_t left_list_len,
+                                 const int64_t* right_list,
+                                 uint64_t right_list_len,
+                                 int64_t* histogram_ret,
+                                 uint64_t histogram_ret_len)
+{
+    // We start at the first right photon that can be in the histogram of the first left photon.
+    // All photons before it have a negative index for every left photon.
+    uint64_t next_photon_to_check = _interp_seq_search_left(right_list, left_list[0] + first_bin_edge, right_list_len);
+
+    // We loop through the left photon list.
+    for (uint64_t i = 0; i < left_list_len; i++) {
+
+        // We now take the current photon in the left photon list as
+        // our 'origin', for building up the current correlation histogram.
+        //
+        // We loop through the right photon list. Note that we do not start
+        // at the very first photon: we start at a point we previously
+        // determined.
+        for (uint64_t j = next_photon_to_check; j < right_list_len; j++) {
+
+            // Here we determine the time difference between
+            // the current photon (in the right list) and the reference
+            // photon (in the left list). We use the very first bin edge
+            // here as offset.
+            int64_t index2 = right_list[j] - (left_list[i] + first_bin_edge);
+
+            // Now see what we need to do
+            // if index2 < 0:
+            //      This photon is not in our histogram (because it is too small)
+            //      However, future photon times may be large enough, so we continue
+            // if index2 >= n_bins:
+            //      This photon is not in our histogram (because it is too big)
+            //      Future photons will be too large, so we are completely done
+            //      with the current histogram. We break.
+            // else:
+            //      The photon is within our histogram. We update the histogram.
+            if (index2 < 0) {
+                next_photon_to_check = j;
+                continue;
+            } else if ((uint64_t)index2 >= histogram_ret_len) {
+                break;
+            } else {
+                histogram_ret[index2]++;
+            }
+        }
+    }
+}
+
+#ifdef ALGOS_X86
+
+// The index of the first photon at or after \p value, searching forward from \p j
+__attribute__((target("avx2")))
+static inline uint64_t avx2_skip_below(const int64_t* a, uint64_t j, uint64_t len_a, int64_t value)
+{
+    const __m256i v = _mm256_set1_epi64x(value);
+
+    for (; j + 4 <= len_a; j += 4) {
+        __m256i below = _mm256_cmpgt_epi64(v, _mm256_loadu_si256((const __m256i*)(a + j)));
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(below));
+
+        if (mask != 0xF) {
+            // The list is sorted: the photons below the value are a prefix
+            return j + __builtin_ctz(~mask);
+        }
+    }
+
+    while (j < len_a && a[j] < value) {
+        j++;
+    }
+
+    return j;
+}
+
+/*
+	The same pairs as _correlate_unit_bins_scalar(), without a branch per
+	pair: for every left photon, the right photons in its histogram are
+	the range [start, end), and both ends only move forward. The bin
+	indices of four photons are computed at once; the increments are done
+	one by one, so equal indices (equal right photons) are counted
+	correctly.
+*/
+__attribute__((target("avx2")))
+static void _correlate_unit_bins_avx2(int64_t first_bin_edge,
+                                      const int64_t* left_list,
+                                      uint64_t left_list_len,
+                                      const int64_t* right_list,
+                                      uint64_t right_list_len,
+                                      int64_t* histogram_ret,
+                                      uint64_t histogram_ret_len)
+{
+    uint64_t start = _interp_seq_search_left(right_list, left_list[0] + first_bin_edge, right_list_len);
+    uint64_t end = start;
+
+    for (uint64_t i = 0; i < left_list_len; i++) {
+        int64_t origin = left_list[i] + first_bin_edge;
+
+        start = avx2_skip_below(right_list, start, right_list_len, origin);
+        end = avx2_skip_below(right_list, std::max(start, end), right_list_len, origin + (int64_t)histogram_ret_len);
+
+        const __m256i v_origin = _mm256_set1_epi64x(origin);
+        alignas(32) int64_t index[4];
+        uint64_t j = start;
+
+        for (; j + 4 <= end; j += 4) {
+            __m256i d = _mm256_sub_epi64(_mm256_loadu_si256((const __m256i*)(right_list + j)), v_origin);
+            _mm256_store_si256((__m256i*)index, d);
+
+            histogram_ret[index[0]]++;
+            histogram_ret[index[1]]++;
+            histogram_ret[index[2]]++;
+            histogram_ret[index[3]]++;
+        }
+
+        for (; j < end; j++) {
+            histogram_ret[right_list[j] - origin]++;
+        }
+    }
+}
+
+static bool has_avx2()
+{
+    static const bool avx2 = []() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+    }();
+
+    return avx2;
+}
+
+#endif // ALGOS_X86
+
+static void _correlate_unit_bins(int64_t first_bin_edge,
+                                 const int64_t* left_list,
+                                 uint64_t left_list_len,
+                                 const int64_t* right_list,
+                                 uint64_t right_list_len,
+                                 int64_t* histogram_ret,
+                                 uint64_t histogram_ret_len)
+{
+#ifdef ALGOS_X86
+    if (has_avx2()) {
+        _correlate_unit_bins_avx2(first_bin_edge, left_list, left_list_len, right_list, right_list_len,
+                                  histogram_ret, histogram_ret_len);
+        return;
+    }
+#endif
+
+    _correlate_unit_bins_scalar(first_bin_edge, left_list, left_list_len, right_list, right_list_len,
+                                histogram_ret, histogram_ret_len);
+}
+
+/*
+	Division by the bin width of correlate_uniform_bins(), as a
+	multiplication: with m = ceil(2^64 / w), (d * m) >> 64 equals d / w
+	for all d with d * w < 2^64 (Granlund and Montgomery). Falls back to
+	a division when that does not hold for every difference in the
+	histogram, or there is no 128-bit multiplication.
+*/
+struct uniform_bin_divider
+{
+    uint64_t width;
+    uint64_t multiplier;    // Zero: divide
+};
+
+static uniform_bin_divider make_uniform_bin_divider(uint64_t width, uint64_t span)
+{
+    uniform_bin_divider div;
+    div.width = width;
+    div.multiplier = 0;
+
+#ifdef __SIZEOF_INT128__
+    if (width > 1 && span <= UINT64_MAX / width) {
+        div.multiplier = UINT64_MAX / width + 1;
+    }
+#endif
+
+    return div;
+}
+
+static inline uint64_t uniform_bin_index(const uniform_bin_divider& div, uint64_t d)
+{
+#ifdef __SIZEOF_INT128__
+    if (div.multiplier != 0) {
+        return (uint64_t)(((unsigned __int128)d * div.multiplier) >> 64);
+    }
+#endif
+
+    return d / div.width;
+}
+
+static void _correlate_uniform_bins(int64_t first_bin_edge,
+                                    uint64_t bin_width,
+                                    const int64_t* left_list,
+                                    uint64_t left_list_len,
+                                    const int64_t* right_list,
+                                    uint64_t right_list_len,
+                                    int64_t* histogram_ret,
+                                    uint64_t histogram_ret_len)
+{
+    uint64_t span = bin_width * histogram_ret_len;
+    uniform_bin_divider div = make_uniform_bin_divider(bin_width, span);
+
+    // As _correlate_unit_bins_avx2(): the right photons in the histogram of a left photon are [start, end)
+    uint64_t start = _interp_seq_search_left(right_list, left_list[0] + first_bin_edge, right_list_len);
+    uint64_t end = start;
+
+    for (uint64_t i = 0; i < left_list_len; i++) {
+        int64_t origin = left_list[i] + first_bin_edge;
+
+        while (start < right_list_len && right_list[start] < origin) {
+            start++;
+        }
+
+        end = std::max(start, end);
+
+        while (end < right_list_len && (uint64_t)(right_list[end] - origin) < span) {
+            end++;
+        }
+
+        for (uint64_t j = start; j < end; j++) {
+            histogram_ret[uniform_bin_index(div, (uint64_t)(right_list[j] - origin))]++;
+        }
+    }
+}
+
+// Returns the bin width, or zero if the bins are not equally spaced
+static uint64_t uniform_bin_width(const int64_t* bin_edges, uint64_t n_bin_edges)
+{
+    int64_t width = bin_edges[1] - bin_edges[0];
+
+    if (width <= 0 || (uint64_t)width > UINT64_MAX / (n_bin_edges - 1)) {
+        return 0;
+    }
+
+    for (uint64_t i = 1; i < n_bin_edges; i++) {
+        if (bin_edges[i] - bin_edges[i - 1] != width) {
+            return 0;
+        }
+    }
+
+    return (uint64_t)width;
+}
+
+// Left photons per chunk below which a thread of its own is not worth it
+#define CORRELATE_MIN_CHUNK     (1 << 14)
+
+static unsigned int resolve_n_threads(unsigned int n_threads)
+{
+    if (n_threads == 0) {
+        n_threads = std::thread::hardware_concurrency();
+    }
+
+    return n_threads == 0 ? 1 : n_threads;
+}
+
+/*
+	Splits the left photon list into one chunk per thread. \p func(first,
+	n, histogram) correlates a chunk into its own histogram, which is added
+	to \p histogram_ret when all threads are done. The first chunk is
+	correlated on the calling thread, straight into \p histogram_ret.
+*/
+template <typename F>
+static void correlate_chunks_in_parallel(uint64_t left_list_len,
+                                         int64_t* histogram_ret,
+                                         uint64_t histogram_ret_len,
+                                         unsigned int n_threads,
+                                         F func)
+{
+    uint64_t n_chunks = std::max((uint64_t)1, std::min((uint64_t)resolve_n_threads(n_threads), left_list_len / CORRELATE_MIN_CHUNK));
+    uint64_t chunk_len = left_list_len / n_chunks;
+
+    std::vector<std::vector<int64_t>> histograms(n_chunks - 1, std::vector<int64_t>(histogram_ret_len, 0));
+    std::vector<std::thread> threads;
+
+    for (uint64_t c = 1; c < n_chunks; c++) {
+        uint64_t first = c * chunk_len;
+        uint64_t n = (c == n_chunks - 1) ? left_list_len - first : chunk_len;
+        int64_t* histogram = histograms[c - 1].data();
+
+        threads.push_back(std::thread([=]() {
+            func(first, n, histogram);
+        }));
+    }
+
+    func(0, chunk_len, histogram_ret);
+
+    for (size_t t = 0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+
+    for (uint64_t c = 0; c + 1 < n_chunks; c++) {
+        for (uint64_t i = 0; i < histogram_ret_len; i++) {
+            histogram_ret[i] += histograms[c][i];
+        }
+    }
+}
+
+/*
+	Multi-tau correlation, see algos.h
+
+	Every level keeps the pending (not yet complete) event of both
+	streams, and a ring buffer with the last complete events of the left
+	stream. A pending event is complete once a photon arrives in a later
+	slot. When a right event completes, it is correlated with the left
+	events in the ring buffer; the pending left event is always completed
+	first, so that lag zero is counted. At most one left event later than
+	the right event can be in the ring at that time, hence the one extra
+	slot.
+*/
+struct multi_tau_event
+{
+    int64_t time;       // The slot, in units of 2^level
+    int64_t weight;     // The number of photons in the slot; zero: no event
+};
+
+struct multi_tau_level
+{
+    uint32_t shift;
+    int64_t right_delay;            // Half a slot: centers the bins on the lags they count
+    uint32_t first_lag;
+    uint64_t first_bin;
+    multi_tau_event left;
+    multi_tau_event right;
+    std::vector<multi_tau_event> history;
+    uint64_t history_head;          // Where the next left event goes
+    uint64_t history_len;
+};
+
+struct multi_tau_correlator
+{
+    uint32_t n_channels;
+    std::vector<multi_tau_level> levels;
+    std::vector<int64_t> histogram;
+
+    // Photons that can not be correlated yet, because the other stream has not caught up
+    std::vector<int64_t> left_buffer;
+    std::vector<int64_t> right_buffer;
+    int64_t left_end;
+    int64_t right_end;
+    bool has_left;
+    bool has_right;
+
+    uint64_t n_left;
+    uint64_t n_right;
+};
+
+static int multi_tau_check_params(uint32_t n_channels, uint32_t n_levels)
+{
+    if (n_channels < 2 || n_channels > MULTI_TAU_MAX_CHANNELS || n_channels % 2 != 0) {
+        return 2;
+    }
+
+    if (n_levels < 1 || n_levels > MULTI_TAU_MAX_LEVELS) {
+        return 2;
+    }
+
+    return 0;
+}
+
+static void multi_tau_push_left(multi_tau_level& level)
+{
+    level.history[level.history_head] = level.left;
+    level.history_head = (level.history_head + 1) % level.history.size();
+    level.history_len = std::min(level.history_len + 1, (uint64_t)level.history.size());
+
+    level.left.weight = 0;
+}
+
+static void multi_tau_correlate_right(multi_tau_correlator* c, multi_tau_level& level)
+{
+    const multi_tau_event& r = level.right;
+    uint64_t ring_size = level.history.size();
+    uint64_t index = level.history_head;
+
+    // Newest to oldest: the lag only grows
+    for (uint64_t i = 0; i < level.history_len; i++) {
+        index = (index == 0) ? ring_size - 1 : index - 1;
+
+        const multi_tau_event& l = level.history[index];
+        int64_t lag = r.time - l.time;
+
+        if (lag >= (int64_t)c->n_channels) {
+            break;
+        }
+
+        if (lag >= (int64_t)level.first_lag) {
+            c->histogram[level.first_bin + (uint64_t)(lag - level.first_lag)] += r.weight * l.weight;
+        }
+    }
+
+    level.right.weight = 0;
+}
+
+static void multi_tau_add_photon(multi_tau_correlator* c, int64_t t, bool is_left)
+{
+    for (size_t i = 0; i < c->levels.size(); i++) {
+        multi_tau_level& level = c->levels[i];
+
+        int64_t left_time = t >> level.shift;
+        int64_t right_time = (t - level.right_delay) >> level.shift;
+
+        if (level.left.weight != 0 && level.left.time < left_time) {
+            multi_tau_push_left(level);
+        }
+
+        if (level.right.weight != 0 && level.right.time < right_time) {
+            multi_tau_correlate_right(c, level);
+        }
+
+        multi_tau_event& e = is_left ? level.left : level.right;
+        int64_t time = is_left ? left_time : right_time;
+
+        if (e.weight != 0 && e.time == time) {
+            e.weight++;
+        } else {
+            e.time = time;
+            e.weight = 1;
+        }
+    }
+
+    if (is_left) {
+        c->n_left++;
+    } else {
+        c->n_right++;
+    }
+}
+
+/*
+	Correlates the photons of both lists, in the order of time, that come
+	before \p until; all of them if \p all is set. \p n_left_done and
+	\p n_right_done are set to the number of photons used.
+*/
+static void multi_tau_merge(multi_tau_correlator* c,
+                            const int64_t* left,
+                            uint64_t left_len,
+                            const int64_t* right,
+                            uint64_t right_len,
+                            int64_t until,
+                            bool all,
+                            uint64_t* n_left_done,
+                            uint64_t* n_right_done)
+{
+    uint64_t i = 0;
+    uint64_t j = 0;
+
+    while (i < left_len || j < right_len) {
+        // On equal times, the left photon goes first: lag zero
+        bool is_left = j == right_len || (i < left_len && left[i] <= right[j]);
+        int64_t t = is_left ? left[i] : right[j];
+
+        if (!all && t >= until) {
+            break;
+        }
+
+        multi_tau_add_photon(c, t, is_left);
+
+        if (is_left) {
+            i++;
+        } else {
+            j++;
+        }
+    }
+
+    *n_left_done = i;
+    *n_right_done = j;
+}
+
+static void multi_tau_process(multi_tau_correlator* c, int64_t until, bool all)
+{
+    uint64_t n_left_done = 0;
+    uint64_t n_right_done = 0;
+
+    multi_tau_merge(c, c->left_buffer.data(), c->left_buffer.size(), c->right_buffer.data(), c->right_buffer.size(),
+                    until, all, &n_left_done, &n_right_done);
+
+    c->left_buffer.erase(c->left_buffer.begin(), c->left_buffer.begin() + n_left_done);
+    c->right_buffer.erase(c->right_buffer.begin(), c->right_buffer.begin() + n_right_done);
+}
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -332,6 +843,29 @@ int LIBTIMETAG_DLL correlate_unit_bins(const int64_t* bin_edges,
                         uint64_t right_list_len,
                         int64_t* histogram_ret,
                         uint64_t histogram_ret_len)
+{
+    int success = check_unit_bins(bin_edges, n_bin_edges, left_list, right_list, histogram_ret, histogram_ret_len);
+
+    if (success != 0)
+        return success;
+
+    if (left_list_len == 0 || right_list_len == 0) // We are finished
+        return 0;
+
+    _correlate_unit_bins(bin_edges[0], left_list, left_list_len, right_list, right_list_len, histogram_ret, histogram_ret_len);
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL correlate_many_per_bin_parallel(const int64_t* bin_edges,
+                                                   uint64_t n_bin_edges,
+                                                   const int64_t* left_list,
+                                                   uint64_t left_list_len,
+                                                   const int64_t* right_list,
+                                                   uint64_t right_list_len,
+                                                   int64_t* histogram_ret,
+                                                   uint64_t histogram_ret_len,
+                                                   unsigned int n_threads)
 {
     if (bin_edges == NULL || left_list == NULL || right_list == NULL || histogram_ret == NULL)
         return 1; // Input is invalid
@@ -342,57 +876,98 @@ int LIBTIMETAG_DLL correlate_unit_bins(const int64_t* bin_edges,
     if (histogram_ret_len != n_bin_edges - 1)   // The return histogram and the bin edges should match
         return 3;
 
-    if (bin_edges[1] - bin_edges[0] != 1) {   // Imperfect check to see if the input bins are OK
-        return 4;
-    }
-
     if (left_list_len == 0 || right_list_len == 0) // We are finished
         return 0;
 
-    // Now do the correlation
-    uint64_t next_photon_to_check = 0;
+    correlate_chunks_in_parallel(left_list_len, histogram_ret, histogram_ret_len, n_threads,
+                                 [&](uint64_t first, uint64_t n, int64_t* histogram) {
+        // Seeds its cursors from the first photon of the chunk
+        _correlate_many_per_bin(bin_edges, n_bin_edges, left_list + first, n,
+                                right_list, right_list_len, histogram, histogram_ret_len);
+    });
 
-    // We loop through the left photon list.
-    for (uint64_t i = 0; i < left_list_len; i++) {
+    return 0;
+}
 
-        // We now take the current photon in the left photon list as
-        // our 'origin', for building up the current correlation histogram.
-        //
-        // We loop through the right photon list. Note that we do not start
-        // at the very first photon: we start at a point we previously
-        // determined.
-        for (uint64_t j = next_photon_to_check; j < right_list_len; j++) {
+int LIBTIMETAG_DLL correlate_unit_bins_parallel(const int64_t* bin_edges,
+                                                uint64_t n_bin_edges,
+                                                const int64_t* left_list,
+                                                uint64_t left_list_len,
+                                                const int64_t* right_list,
+                                                uint64_t right_list_len,
+                                                int64_t* histogram_ret,
+                                                uint64_t histogram_ret_len,
+                                                unsigned int n_threads)
+{
+    int success = check_unit_bins(bin_edges, n_bin_edges, left_list, right_list, histogram_ret, histogram_ret_len);
 
-            // Here we determine the time difference between
-            // the current photon (in the right list) and the reference
-            // photon (in the left list). We use the very first bin edge
-            // here as offset.
-            int64_t index2 = right_list[j] - (left_list[i] + bin_edges[0]);
+    if (success != 0)
+        return success;
 
-            // Now see what we need to do
-            // if index2 < 0:
-            //      This photon is not in our histogram (because it is too small)
-            //      However, future photon times may be large enough, so we continue
-            // if index2 >= n_bins:
-            //      This photon is not in our histogram (because it is too big)
-            //      Future photons will be too large, so we are completely done
-            //      with the current histogram. We break.
-            // else:
-            //      The photon is within our histogram. We update the histogram.
-            if (index2 < 0) {
-                next_photon_to_check = j;
-                continue;
-            } else if ((uint64_t)index2 >= n_bin_edges) {
-                break;
-            } else {
-                histogram_ret[index2]++;
-            }
+    if (left_list_len == 0 || right_list_len == 0)
+        return 0;
+
+    correlate_chunks_in_parallel(left_list_len, histogram_ret, histogram_ret_len, n_threads,
+                                 [&](uint64_t first, uint64_t n, int64_t* histogram) {
+        _correlate_unit_bins(bin_edges[0], left_list + first, n, right_list, right_list_len, histogram, histogram_ret_len);
+    });
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL correlate_uniform_bins_parallel(const int64_t* bin_edges,
+                                                   uint64_t n_bin_edges,
+                                                   const int64_t* left_list,
+                                                   uint64_t left_list_len,
+                                                   const int64_t* right_list,
+                                                   uint64_t right_list_len,
+                                                   int64_t* histogram_ret,
+                                                   uint64_t histogram_ret_len,
+                                                   unsigned int n_threads)
+{
+    if (bin_edges == NULL || left_list == NULL || right_list == NULL || histogram_ret == NULL)
+        return 1; // Input is invalid
+
+    if (n_bin_edges <= 1)   // We should have at least one bin
+        return 2;
+
+    if (histogram_ret_len != n_bin_edges - 1)   // The return histogram and the bin edges should match
+        return 3;
+
+    uint64_t bin_width = uniform_bin_width(bin_edges, n_bin_edges);
+
+    if (bin_width == 0)
+        return 4;
+
+    if (left_list_len == 0 || right_list_len == 0) // We are finished
+        return 0;
+
+    correlate_chunks_in_parallel(left_list_len, histogram_ret, histogram_ret_len, n_threads,
+                                 [&](uint64_t first, uint64_t n, int64_t* histogram) {
+        if (bin_width == 1) {
+            _correlate_unit_bins(bin_edges[0], left_list + first, n, right_list, right_list_len, histogram, histogram_ret_len);
+        } else {
+            _correlate_uniform_bins(bin_edges[0], bin_width, left_list + first, n, right_list, right_list_len,
+                                    histogram, histogram_ret_len);
         }
-    }
+    });
 
     return 0;
 }
 
+int LIBTIMETAG_DLL correlate_uniform_bins(const int64_t* bin_edges,
+                                          uint64_t n_bin_edges,
+                                          const int64_t* left_list,
+                                          uint64_t left_list_len,
+                                          const int64_t* right_list,
+                                          uint64_t right_list_len,
+                                          int64_t* histogram_ret,
+                                          uint64_t histogram_ret_len)
+{
+    return correlate_uniform_bins_parallel(bin_edges, n_bin_edges, left_list, left_list_len,
+                                           right_list, right_list_len, histogram_ret, histogram_ret_len, 1);
+}
+
 int LIBTIMETAG_DLL bindata_interp_seq(const int64_t* bin_edges,
                         uint64_t n_bin_edges,
                         const int64_t* data,
@@ -614,6 +1189,207 @@ int LIBTIMETAG_DLL gen_microtimes(const int64_t *pulses_macrotimes,
     return 0;
 }
 
+uint64_t LIBTIMETAG_DLL multi_tau_n_bins(uint32_t n_channels, uint32_t n_levels)
+{
+    if (multi_tau_check_params(n_channels, n_levels) != 0) {
+        return 0;
+    }
+
+    return (uint64_t)n_channels + (uint64_t)(n_levels - 1) * (n_channels / 2);
+}
+
+int LIBTIMETAG_DLL multi_tau_bin_edges(uint32_t n_channels, uint32_t n_levels, int64_t* bin_edges, uint64_t n_bin_edges)
+{
+    if (bin_edges == NULL) {
+        return 1;
+    }
+
+    if (multi_tau_check_params(n_channels, n_levels) != 0) {
+        return 2;
+    }
+
+    if (n_bin_edges != multi_tau_n_bins(n_channels, n_levels) + 1) {
+        return 3;
+    }
+
+    uint64_t n = 0;
+
+    for (uint32_t k = 0; k < n_channels; k++) {
+        bin_edges[n++] = k;
+    }
+
+    for (uint32_t l = 1; l < n_levels; l++) {
+        for (uint32_t k = n_channels / 2; k < n_channels; k++) {
+            bin_edges[n++] = (int64_t)k << l;
+        }
+    }
+
+    bin_edges[n] = (int64_t)n_channels << (n_levels - 1);
+
+    return 0;
+}
+
+multi_tau_correlator* LIBTIMETAG_DLL multi_tau_create(uint32_t n_channels, uint32_t n_levels)
+{
+    if (multi_tau_check_params(n_channels, n_levels) != 0) {
+        return NULL;
+    }
+
+    multi_tau_correlator* c = new multi_tau_correlator();
+
+    c->n_channels = n_channels;
+    c->levels.resize(n_levels);
+    c->histogram.assign(multi_tau_n_bins(n_channels, n_levels), 0);
+    c->left_end = 0;
+    c->right_end = 0;
+    c->has_left = false;
+    c->has_right = false;
+    c->n_left = 0;
+    c->n_right = 0;
+
+    for (uint32_t l = 0; l < n_levels; l++) {
+        multi_tau_level& level = c->levels[l];
+
+        level.shift = l;
+        level.right_delay = (l == 0) ? 0 : (int64_t)1 << (l - 1);
+        level.first_lag = (l == 0) ? 0 : n_channels / 2;
+        level.first_bin = (l == 0) ? 0 : n_channels + (uint64_t)(l - 1) * (n_channels / 2);
+        level.left.time = 0;
+        level.left.weight = 0;
+        level.right.time = 0;
+        level.right.weight = 0;
+        level.history.resize(n_channels + 1);
+        level.history_head = 0;
+        level.history_len = 0;
+    }
+
+    return c;
+}
+
+int LIBTIMETAG_DLL multi_tau_add(multi_tau_correlator* correlator,
+                                 const int64_t* left_list,
+                                 uint64_t left_list_len,
+                                 const int64_t* right_list,
+                                 uint64_t right_list_len)
+{
+    if (correlator == NULL || (left_list == NULL && left_list_len != 0) || (right_list == NULL && right_list_len != 0)) {
+        return 1;
+    }
+
+    if (left_list_len != 0) {
+        correlator->left_buffer.insert(correlator->left_buffer.end(), left_list, left_list + left_list_len);
+        correlator->left_end = left_list[left_list_len - 1];
+        correlator->has_left = true;
+    }
+
+    if (right_list_len != 0) {
+        correlator->right_buffer.insert(correlator->right_buffer.end(), right_list, right_list + right_list_len);
+        correlator->right_end = right_list[right_list_len - 1];
+        correlator->has_right = true;
+    }
+
+    // Photons before the last photon of both streams are final: nothing can be inserted before them anymore
+    if (correlator->has_left && correlator->has_right) {
+        multi_tau_process(correlator, std::min(correlator->left_end, correlator->right_end), false);
+    }
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL multi_tau_flush(multi_tau_correlator* correlator)
+{
+    if (correlator == NULL) {
+        return 1;
+    }
+
+    multi_tau_process(correlator, 0, true);
+
+    for (size_t i = 0; i < correlator->levels.size(); i++) {
+        multi_tau_level& level = correlator->levels[i];
+
+        if (level.left.weight != 0) {
+            multi_tau_push_left(level);
+        }
+
+        if (level.right.weight != 0) {
+            multi_tau_correlate_right(correlator, level);
+        }
+    }
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL multi_tau_get(const multi_tau_correlator* correlator,
+                                 int64_t* histogram_ret,
+                                 uint64_t histogram_ret_len,
+                                 uint64_t* n_left,
+                                 uint64_t* n_right)
+{
+    if (correlator == NULL || histogram_ret == NULL) {
+        return 1;
+    }
+
+    if (histogram_ret_len != correlator->histogram.size()) {
+        return 3;
+    }
+
+    std::copy(correlator->histogram.begin(), correlator->histogram.end(), histogram_ret);
+
+    if (n_left != NULL) {
+        *n_left = correlator->n_left;
+    }
+
+    if (n_right != NULL) {
+        *n_right = correlator->n_right;
+    }
+
+    return 0;
+}
+
+void LIBTIMETAG_DLL multi_tau_destroy(multi_tau_correlator* correlator)
+{
+    delete correlator;
+}
+
+int LIBTIMETAG_DLL correlate_multi_tau(uint32_t n_channels,
+                                       uint32_t n_levels,
+                                       const int64_t* left_list,
+                                       uint64_t left_list_len,
+                                       const int64_t* right_list,
+                                       uint64_t right_list_len,
+                                       int64_t* histogram_ret,
+                                       uint64_t histogram_ret_len)
+{
+    if (left_list == NULL || right_list == NULL || histogram_ret == NULL) {
+        return 1;
+    }
+
+    if (multi_tau_check_params(n_channels, n_levels) != 0) {
+        return 2;
+    }
+
+    if (histogram_ret_len != multi_tau_n_bins(n_channels, n_levels)) {
+        return 3;
+    }
+
+    multi_tau_correlator* c = multi_tau_create(n_channels, n_levels);
+
+    // Both streams are complete: no buffering needed
+    uint64_t n_left_done = 0;
+    uint64_t n_right_done = 0;
+
+    multi_tau_merge(c, left_list, left_list_len, right_list, right_list_len, 0, true, &n_left_done, &n_right_done);
+    multi_tau_flush(c);
+
+    for (uint64_t i = 0; i < histogram_ret_len; i++) {
+        histogram_ret[i] += c->histogram[i];
+    }
+
+    multi_tau_destroy(c);
+
+    return 0;
+}
+
 #ifdef __cplusplus
 }
 #endif
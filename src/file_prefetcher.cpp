@@ -0,0 +1,253 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    file_prefetcher.cpp
+ * \brief   Asynchronous read-ahead of a file, in blocks, on a background thread
+ * \author  Stijn Hinterding
+*/
+
+#include "file_prefetcher.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct prefetch_block
+{
+    size_t slot;
+    int64_t len;        // 0: end of file; -1: read error
+};
+
+struct file_prefetcher
+{
+#ifdef _WIN32
+    HANDLE file;
+#else
+    int fd;
+#endif
+
+    uint64_t block_bytes;
+    std::vector<std::vector<unsigned char> > slots;
+
+    // Block being consumed, and the number of bytes already taken from it
+    bool has_current;
+    prefetch_block current;
+    uint64_t current_pos;
+
+    // Shared with the reading thread
+    std::mutex mutex;
+    std::condition_variable block_ready;
+    std::condition_variable slot_free;
+    std::deque<prefetch_block> ready;
+    std::vector<size_t> free_slots;
+    bool at_end;            // The thread has reported the end of the file, and waits for the next read after it
+    bool stop;
+
+    uint64_t offset;        // Next file offset to read; owned by the thread
+
+    std::thread thread;
+};
+
+// Positioned read; returns the number of bytes read, or -1 on an error
+static int64_t read_at(file_prefetcher* p, unsigned char* buffer, uint64_t len, uint64_t offset)
+{
+#ifdef _WIN32
+    OVERLAPPED ov;
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = (DWORD)(offset & 0xFFFFFFFF);
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+
+    DWORD n_read = 0;
+
+    if (!ReadFile(p->file, buffer, (DWORD)std::min(len, (uint64_t)0x40000000), &n_read, &ov)) {
+        return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+    }
+
+    return (int64_t)n_read;
+#else
+    ssize_t n_read = 0;
+
+    do {
+        n_read = pread(p->fd, buffer, len, (off_t)offset);
+    } while (n_read < 0 && errno == EINTR);
+
+    return (int64_t)n_read;
+#endif
+}
+
+static void file_prefetcher_loop(file_prefetcher* p)
+{
+    std::unique_lock<std::mutex> lock(p->mutex);
+
+    while (true) {
+        p->slot_free.wait(lock, [p] { return p->stop || (!p->free_slots.empty() && !p->at_end); });
+
+        if (p->stop) {
+            break;
+        }
+
+        prefetch_block b;
+        b.slot = p->free_slots.back();
+        p->free_slots.pop_back();
+
+        lock.unlock();
+
+        b.len = read_at(p, p->slots[b.slot].data(), p->block_bytes, p->offset);
+
+        lock.lock();
+
+        if (b.len > 0) {
+            p->offset += b.len;
+        } else {
+            p->at_end = true;
+        }
+
+        p->ready.push_back(b);
+        p->block_ready.notify_one();
+    }
+}
+
+file_prefetcher* file_prefetcher_start(const char* filepath, uint64_t offset, uint32_t n_blocks, uint64_t block_bytes)
+{
+    if (filepath == nullptr || n_blocks == 0 || block_bytes == 0) {
+        return nullptr;
+    }
+
+    file_prefetcher* p = new file_prefetcher();
+
+#ifdef _WIN32
+    p->file = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                          OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if (p->file == INVALID_HANDLE_VALUE) {
+        delete p;
+        return nullptr;
+    }
+#else
+    p->fd = open(filepath, O_RDONLY);
+
+    if (p->fd < 0) {
+        delete p;
+        return nullptr;
+    }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    // Enlarges the kernel's own read-ahead, which matters most on network file systems
+    posix_fadvise(p->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+#endif
+
+    p->block_bytes = block_bytes;
+    p->slots.resize(n_blocks, std::vector<unsigned char>(block_bytes));
+
+    for (size_t i = 0; i < n_blocks; i++) {
+        p->free_slots.push_back(i);
+    }
+
+    p->has_current = false;
+    p->current_pos = 0;
+    p->at_end = false;
+    p->stop = false;
+    p->offset = offset;
+    p->thread = std::thread(file_prefetcher_loop, p);
+
+    return p;
+}
+
+int64_t file_prefetcher_read(file_prefetcher* p, unsigned char* buffer, uint64_t len)
+{
+    uint64_t n = 0;
+
+    while (n < len) {
+        if (!p->has_current) {
+            std::unique_lock<std::mutex> lock(p->mutex);
+
+            // Only wait when nothing has been copied yet
+            if (p->ready.empty() && n > 0) {
+                break;
+            }
+
+            if (p->ready.empty() && p->at_end) {
+                // The end was reported before; try again, for data appended in the meantime
+                p->at_end = false;
+                p->slot_free.notify_one();
+            }
+
+            p->block_ready.wait(lock, [p] { return !p->ready.empty(); });
+
+            prefetch_block b = p->ready.front();
+
+            if (b.len <= 0) {
+                if (n > 0) {
+                    // Report the end (or the error) on the next call
+                    break;
+                }
+
+                // The thread waits until the next call
+                p->ready.pop_front();
+                p->free_slots.push_back(b.slot);
+
+                return b.len;
+            }
+
+            p->ready.pop_front();
+            p->current = b;
+            p->current_pos = 0;
+            p->has_current = true;
+        }
+
+        uint64_t n_copy = std::min(len - n, (uint64_t)p->current.len - p->current_pos);
+
+        memcpy(buffer + n, p->slots[p->current.slot].data() + p->current_pos, n_copy);
+        n += n_copy;
+        p->current_pos += n_copy;
+
+        if (p->current_pos == (uint64_t)p->current.len) {
+            std::lock_guard<std::mutex> lock(p->mutex);
+
+            p->free_slots.push_back(p->current.slot);
+            p->has_current = false;
+            p->slot_free.notify_one();
+        }
+    }
+
+    return (int64_t)n;
+}
+
+void file_prefetcher_stop(file_prefetcher* p)
+{
+    if (p == nullptr) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(p->mutex);
+        p->stop = true;
+        p->slot_free.notify_one();
+    }
+
+    p->thread.join();
+
+#ifdef _WIN32
+    CloseHandle(p->file);
+#else
+    close(p->fd);
+#endif
+
+    delete p;
+}
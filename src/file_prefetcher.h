@@ -0,0 +1,54 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    file_prefetcher.h
+ * \brief   Asynchronous read-ahead of a file, in blocks, on a background thread
+ * \author  Stijn Hinterding
+*/
+
+/*
+	A background thread reads the file sequentially, using positioned
+	reads (pread / ReadFile with an offset) on its own file handle, and
+	keeps up to n_blocks blocks ready. The consumer copies the data out
+	with file_prefetcher_read(), while the thread reads the next blocks:
+	I/O and decoding overlap.
+
+	When the thread reaches the end of the file, it stops until the
+	consumer asks for more data after having seen the end, and then tries
+	again. Data appended to the file in the meantime is therefore picked
+	up, without polling the file continuously.
+*/
+
+#ifndef FILE_PREFETCHER_H
+#define FILE_PREFETCHER_H
+
+#include <stdint.h>
+
+typedef struct file_prefetcher file_prefetcher;
+
+/**
+ * \brief   Starts reading ahead, at \p offset
+ *
+ * \param   filepath        The file to read
+ * \param   offset          File offset to start reading at
+ * \param   n_blocks        The maximum number of blocks read ahead; at least 1
+ * \param   block_bytes     The size of every read
+ * \returns The prefetcher, which must be released using file_prefetcher_stop(). NULL if the file could not be opened.
+*/
+file_prefetcher* file_prefetcher_start(const char* filepath, uint64_t offset, uint32_t n_blocks, uint64_t block_bytes);
+
+/**
+ * \brief   Copies the next bytes of the file into \p buffer, waiting for them if necessary
+ *
+ * \returns The number of bytes copied (at most \p len). Zero: end of the file (for now). -1: read error.
+*/
+int64_t file_prefetcher_read(file_prefetcher* p, unsigned char* buffer, uint64_t len);
+
+/**
+ * \brief   Stops the background thread, and releases the prefetcher. Accepts NULL.
+*/
+void file_prefetcher_stop(file_prefetcher* p);
+
+#endif // FILE_PREFETCHER_H
@@ -0,0 +1,301 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    kway_merge.cpp
+ * \brief   Merges sorted macrotime arrays of several channels into a single, time-sorted stream of (macrotime, channel) pairs
+ * \author  Stijn Hinterding
+*/
+
+#include "kway_merge.h"
+#include "loser_tree.h"
+
+#include <string.h>
+
+#include <vector>
+
+struct kway_stream
+{
+    std::vector<int64_t> buffer;
+    size_t pos;
+    bool ended;
+
+    kway_stream() :
+        pos(0),
+        ended(false)
+    {
+    }
+};
+
+struct kway_merger
+{
+    loser_tree tree;
+    std::vector<kway_stream> streams;
+    bool built;
+    int64_t starved;    // Stream that won, but ran out of data before it ended; -1: none
+
+    kway_merger(uint32_t n_streams) :
+        tree(n_streams),
+        streams(n_streams),
+        built(false),
+        starved(-1)
+    {
+    }
+};
+
+int LIBTIMETAG_DLL merge_sorted_arrays(const int64_t* const* arrays,
+                                       const uint64_t* lens,
+                                       uint32_t n_arrays,
+                                       int64_t* macrotimes_ret,
+                                       uint8_t* streams_ret,
+                                       uint64_t ret_len)
+{
+    if (arrays == nullptr || lens == nullptr || macrotimes_ret == nullptr) {
+        return 1;
+    }
+
+    if (n_arrays > KWAY_MERGE_MAX_STREAMS) {
+        return 2;
+    }
+
+    uint64_t total = 0;
+    uint32_t n_active = 0;
+
+    for (uint32_t i = 0; i < n_arrays; i++) {
+        if (lens[i] > 0 && arrays[i] == nullptr) {
+            return 1;
+        }
+
+        total += lens[i];
+        n_active += lens[i] > 0;
+    }
+
+    if (ret_len < total) {
+        return 3;
+    }
+
+    loser_tree tree(n_arrays);
+    std::vector<uint64_t> pos(n_arrays, 0);
+
+    for (uint32_t i = 0; i < n_arrays; i++) {
+        if (lens[i] > 0) {
+            tree.set(i, arrays[i][0]);
+        }
+    }
+
+    tree.build();
+
+    uint64_t n = 0;
+
+    while (n_active > 1) {
+        uint32_t w = tree.winner();
+
+        macrotimes_ret[n] = tree.winner_head();
+
+        if (streams_ret != nullptr) {
+            streams_ret[n] = (uint8_t)w;
+        }
+
+        n++;
+
+        if (++pos[w] < lens[w]) {
+            tree.replace_winner(arrays[w][pos[w]]);
+        } else {
+            tree.exhaust_winner();
+            n_active--;
+        }
+    }
+
+    // The last stream needs no more comparisons
+    if (n_active == 1) {
+        uint32_t w = tree.winner();
+        uint64_t n_left = lens[w] - pos[w];
+
+        memcpy(macrotimes_ret + n, arrays[w] + pos[w], n_left * sizeof(int64_t));
+
+        if (streams_ret != nullptr) {
+            memset(streams_ret + n, (int)w, n_left);
+        }
+    }
+
+    return 0;
+}
+
+kway_merger* LIBTIMETAG_DLL kway_merger_create(uint32_t n_streams)
+{
+    if (n_streams == 0 || n_streams > KWAY_MERGE_MAX_STREAMS) {
+        return nullptr;
+    }
+
+    return new kway_merger(n_streams);
+}
+
+// Plays the initial tournament, once every stream has data or has ended
+static void try_build(kway_merger* merger)
+{
+    for (size_t i = 0; i < merger->streams.size(); i++) {
+        const kway_stream& s = merger->streams[i];
+
+        if (!s.ended && s.pos == s.buffer.size()) {
+            return;
+        }
+    }
+
+    for (size_t i = 0; i < merger->streams.size(); i++) {
+        const kway_stream& s = merger->streams[i];
+
+        if (s.pos < s.buffer.size()) {
+            merger->tree.set((uint32_t)i, s.buffer[s.pos]);
+        }
+    }
+
+    merger->tree.build();
+    merger->built = true;
+}
+
+int LIBTIMETAG_DLL kway_merger_push(kway_merger* merger, uint32_t stream, const int64_t* macrotimes, uint64_t len)
+{
+    if (merger == nullptr || (macrotimes == nullptr && len > 0)) {
+        return 1;
+    }
+
+    if (stream >= merger->streams.size() || merger->streams[stream].ended) {
+        return 2;
+    }
+
+    if (len == 0) {
+        return 0;
+    }
+
+    kway_stream& s = merger->streams[stream];
+
+    // Drop consumed data, once it makes up at least half of the buffer
+    if (s.pos > 0 && s.pos >= s.buffer.size() / 2) {
+        s.buffer.erase(s.buffer.begin(), s.buffer.begin() + s.pos);
+        s.pos = 0;
+    }
+
+    s.buffer.insert(s.buffer.end(), macrotimes, macrotimes + len);
+
+    if (merger->starved == (int64_t)stream) {
+        // The starved stream is still the winner of the tree
+        merger->tree.replace_winner(s.buffer[s.pos]);
+        merger->starved = -1;
+    }
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL kway_merger_end(kway_merger* merger, uint32_t stream)
+{
+    if (merger == nullptr) {
+        return 1;
+    }
+
+    if (stream >= merger->streams.size()) {
+        return 2;
+    }
+
+    merger->streams[stream].ended = true;
+
+    if (merger->starved == (int64_t)stream) {
+        merger->tree.exhaust_winner();
+        merger->starved = -1;
+    }
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL kway_merger_pop(kway_merger* merger,
+                                   int64_t* macrotimes_ret,
+                                   uint8_t* streams_ret,
+                                   uint64_t ret_len,
+                                   uint64_t* n_ret)
+{
+    if (merger == nullptr || macrotimes_ret == nullptr || n_ret == nullptr) {
+        return 1;
+    }
+
+    *n_ret = 0;
+
+    if (!merger->built) {
+        try_build(merger);
+    }
+
+    if (!merger->built || merger->starved >= 0) {
+        return 0;
+    }
+
+    loser_tree& tree = merger->tree;
+    uint64_t n = 0;
+
+    while (n < ret_len && !tree.empty()) {
+        uint32_t w = tree.winner();
+        kway_stream& s = merger->streams[w];
+
+        macrotimes_ret[n] = s.buffer[s.pos];
+
+        if (streams_ret != nullptr) {
+            streams_ret[n] = (uint8_t)w;
+        }
+
+        n++;
+
+        if (++s.pos < s.buffer.size()) {
+            tree.replace_winner(s.buffer[s.pos]);
+        } else if (s.ended) {
+            tree.exhaust_winner();
+        } else {
+            merger->starved = w;
+            break;
+        }
+    }
+
+    *n_ret = n;
+
+    return 0;
+}
+
+int64_t LIBTIMETAG_DLL kway_merger_waiting_for(const kway_merger* merger)
+{
+    if (merger == nullptr) {
+        return -1;
+    }
+
+    if (merger->built) {
+        return merger->starved;
+    }
+
+    for (size_t i = 0; i < merger->streams.size(); i++) {
+        const kway_stream& s = merger->streams[i];
+
+        if (!s.ended && s.pos == s.buffer.size()) {
+            return (int64_t)i;
+        }
+    }
+
+    return -1;
+}
+
+int LIBTIMETAG_DLL kway_merger_done(const kway_merger* merger)
+{
+    if (merger == nullptr) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < merger->streams.size(); i++) {
+        const kway_stream& s = merger->streams[i];
+
+        if (!s.ended || s.pos < s.buffer.size()) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void LIBTIMETAG_DLL kway_merger_destroy(kway_merger* merger)
+{
+    delete merger;
+}
@@ -0,0 +1,163 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    loser_tree.h
+ * \brief   Tournament (loser) tree selecting the smallest head among k sorted streams
+ * \author  Stijn Hinterding
+*/
+
+/*
+	The tree is stored heap-style: leaf i is node k + i, the internal
+	nodes 1 .. k-1 hold the loser of the match played there, and node 0
+	holds the overall winner. Nodes hold the head of a stream next to
+	its index, so matches need no indirection. After the winner has
+	advanced, a single replay from its leaf to the root (log2(k)
+	comparisons, against the stored losers only) restores the tree. A
+	binary heap needs about twice as many comparisons per element.
+
+	Ties are won by the stream with the lowest index, which makes the
+	merge stable. Exhausted streams lose from every other stream.
+*/
+
+#ifndef LOSER_TREE_H
+#define LOSER_TREE_H
+
+#include <stdint.h>
+
+#include <vector>
+
+class loser_tree
+{
+public:
+    loser_tree(uint32_t n_streams) :
+        k(n_streams),
+        nodes(n_streams > 0 ? n_streams : 1),
+        leaves(n_streams)
+    {
+        for (uint32_t i = 0; i < k; i++) {
+            leaves[i].head = INT64_MAX;
+            leaves[i].rank = k + i;
+        }
+    }
+
+    uint32_t n_streams() const
+    {
+        return k;
+    }
+
+    /**
+     * \brief   Sets the head of a stream, before build()
+    */
+    void set(uint32_t stream, int64_t head)
+    {
+        leaves[stream].head = head;
+        leaves[stream].rank = stream;
+    }
+
+    /**
+     * \brief   Plays the initial tournament. All heads must have been set (or be exhausted).
+    */
+    void build()
+    {
+        if (k == 0) {
+            return;
+        }
+
+        std::vector<entry> winners(2 * k);
+
+        for (uint32_t i = 0; i < k; i++) {
+            winners[k + i] = leaves[i];
+        }
+
+        for (uint32_t n = k - 1; n >= 1; n--) {
+            const entry& a = winners[2 * n];
+            const entry& b = winners[2 * n + 1];
+
+            if (less(a, b)) {
+                winners[n] = a;
+                nodes[n] = b;
+            } else {
+                winners[n] = b;
+                nodes[n] = a;
+            }
+        }
+
+        nodes[0] = winners[1];
+    }
+
+    /**
+     * \brief   Returns the stream holding the smallest head
+    */
+    uint32_t winner() const
+    {
+        return nodes[0].rank < k ? nodes[0].rank : nodes[0].rank - k;
+    }
+
+    /**
+     * \brief   Returns true if all streams are exhausted
+    */
+    bool empty() const
+    {
+        return k == 0 || nodes[0].rank >= k;
+    }
+
+    int64_t winner_head() const
+    {
+        return nodes[0].head;
+    }
+
+    /**
+     * \brief   Replaces the head of the winning stream, and restores the tree
+    */
+    void replace_winner(int64_t head)
+    {
+        nodes[0].head = head;
+        replay();
+    }
+
+    /**
+     * \brief   Marks the winning stream as exhausted, and restores the tree
+    */
+    void exhaust_winner()
+    {
+        nodes[0].head = INT64_MAX;
+        nodes[0].rank = winner() + k;
+        replay();
+    }
+
+private:
+    // Exhausted streams hold the largest possible head, and a rank of k + stream, so that they lose all ties
+    struct entry
+    {
+        int64_t head;
+        uint32_t rank;
+    };
+
+    uint32_t k;
+    std::vector<entry> nodes;
+    std::vector<entry> leaves;  // Initial heads, used by build()
+
+    static inline bool less(const entry& a, const entry& b)
+    {
+        return a.head < b.head || (a.head == b.head && a.rank < b.rank);
+    }
+
+    inline void replay()
+    {
+        entry w = nodes[0];
+
+        for (uint32_t n = (k + winner()) >> 1; n >= 1; n >>= 1) {
+            if (less(nodes[n], w)) {
+                entry tmp = nodes[n];
+                nodes[n] = w;
+                w = tmp;
+            }
+        }
+
+        nodes[0] = w;
+    }
+};
+
+#endif // LOSER_TREE_H
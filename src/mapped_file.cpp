@@ -0,0 +1,151 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    mapped_file.cpp
+ * \brief   Read-only memory mapping of data files (POSIX mmap / Win32 file mappings)
+ * \author  Stijn Hinterding
+*/
+
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+int map_file(const char* filepath, mapped_file* mf)
+{
+    if (filepath == nullptr || mf == nullptr) {
+        return 1;
+    }
+
+    mf->data = nullptr;
+    mf->size = 0;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if (file == INVALID_HANDLE_VALUE) {
+        return 2;
+    }
+
+    LARGE_INTEGER file_size;
+
+    if (!GetFileSizeEx(file, &file_size)) {
+        CloseHandle(file);
+        return 2;
+    }
+
+    mf->file_handle = file;
+
+    if (file_size.QuadPart == 0) {
+        // Windows refuses to map empty files
+        return 0;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+    if (mapping == NULL) {
+        CloseHandle(file);
+        mf->file_handle = nullptr;
+        return 3;
+    }
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+    if (view == NULL) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        mf->file_handle = nullptr;
+        return 3;
+    }
+
+    mf->mapping_handle = mapping;
+    mf->data = (const unsigned char*)view;
+    mf->size = (uint64_t)file_size.QuadPart;
+#else
+    int fd = open(filepath, O_RDONLY);
+
+    if (fd < 0) {
+        return 2;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 2;
+    }
+
+    mf->fd = fd;
+
+    if (st.st_size == 0) {
+        // mmap() refuses zero-length mappings
+        return 0;
+    }
+
+    void* addr = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (addr == MAP_FAILED) {
+        close(fd);
+        mf->fd = -1;
+        return 3;
+    }
+
+    // We (almost) always stream through the data front to back
+    madvise(addr, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    mf->data = (const unsigned char*)addr;
+    mf->size = (uint64_t)st.st_size;
+#endif
+
+    return 0;
+}
+
+void unmap_file(mapped_file* mf)
+{
+    if (mf == nullptr) {
+        return;
+    }
+
+#ifdef _WIN32
+    if (mf->data != nullptr) {
+        UnmapViewOfFile(mf->data);
+    }
+
+    if (mf->mapping_handle != nullptr) {
+        CloseHandle(mf->mapping_handle);
+        mf->mapping_handle = nullptr;
+    }
+
+    if (mf->file_handle != nullptr) {
+        CloseHandle(mf->file_handle);
+        mf->file_handle = nullptr;
+    }
+#else
+    if (mf->data != nullptr) {
+        munmap((void*)mf->data, (size_t)mf->size);
+    }
+
+    if (mf->fd >= 0) {
+        close(mf->fd);
+        mf->fd = -1;
+    }
+#endif
+
+    mf->data = nullptr;
+    mf->size = 0;
+}
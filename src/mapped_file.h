@@ -0,0 +1,57 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    mapped_file.h
+ * \brief   Read-only memory mapping of data files (POSIX mmap / Win32 file mappings)
+ * \author  Stijn Hinterding
+*/
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stdint.h>
+
+struct mapped_file
+{
+public:
+    const unsigned char* data;
+    uint64_t size;
+
+#ifdef _WIN32
+    void* file_handle;
+    void* mapping_handle;
+#else
+    int fd;
+#endif
+
+    mapped_file() :
+        data(nullptr),
+        size(0),
+#ifdef _WIN32
+        file_handle(nullptr),
+        mapping_handle(nullptr)
+#else
+        fd(-1)
+#endif
+    {
+    }
+};
+
+/**
+ * \brief   Maps an entire file into memory, read-only
+ *
+ * \param   filepath    Path to the file to map
+ * \param   mf          Struct to store the mapping in. Release it with unmap_file().
+ * \returns On success: 0. Else: 1: NULL pointer supplied as input; 2: could not open the file; 3: could not map the file.
+ * \note    Mapping an empty file succeeds, \p mf->data is then NULL and \p mf->size is zero.
+*/
+int map_file(const char* filepath, mapped_file* mf);
+
+/**
+ * \brief   Releases a mapping created by map_file(). Safe to call on an unmapped struct.
+*/
+void unmap_file(mapped_file* mf);
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,546 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    ptu_file.cpp
+ * \brief   Reads PicoQuant unified TTTR (PTU) files, in T2 and T3 mode, read-only
+ * \author  Stijn Hinterding
+*/
+
+#include "ptu_file.h"
+#include "mapped_file.h"
+#include "timetag_formats.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define PTU_TAG_TYPE_FLOAT8         0x20000008
+#define PTU_TAG_TYPE_INT8           0x10000008
+#define PTU_TAG_TYPE_ANSI_STRING    0x4001FFFF
+
+// Tags of this type store the length of their contents as value; the contents follow the tag
+#define PTU_TAG_VARIABLE_LENGTH(typ)    (((typ) & 0xFFFF) == 0xFFFF)
+
+#define PTU_PH_T2_WRAPAROUND        210698240
+#define PTU_PH_T3_WRAPAROUND        65536
+#define PTU_HH1_T2_WRAPAROUND       33552000
+#define PTU_HH2_T2_WRAPAROUND       33554432
+#define PTU_HH_T3_WRAPAROUND        1024
+
+enum ptu_format
+{
+    PTU_FORMAT_PH_T2,
+    PTU_FORMAT_PH_T3,
+    PTU_FORMAT_HH1_T2,
+    PTU_FORMAT_HH1_T3,
+    PTU_FORMAT_HH2_T2,
+    PTU_FORMAT_HH2_T3,
+    PTU_FORMAT_UNKNOWN
+};
+
+static ptu_format get_format(uint32_t record_type)
+{
+    switch (record_type) {
+    case PTU_REC_PICOHARP_T2:
+        return PTU_FORMAT_PH_T2;
+    case PTU_REC_PICOHARP_T3:
+        return PTU_FORMAT_PH_T3;
+    case PTU_REC_HYDRAHARP_T2:
+        return PTU_FORMAT_HH1_T2;
+    case PTU_REC_HYDRAHARP_T3:
+        return PTU_FORMAT_HH1_T3;
+    case PTU_REC_HYDRAHARP2_T2:
+    case PTU_REC_TIMEHARP260N_T2:
+    case PTU_REC_TIMEHARP260P_T2:
+    case PTU_REC_MULTIHARP_T2:
+        return PTU_FORMAT_HH2_T2;
+    case PTU_REC_HYDRAHARP2_T3:
+    case PTU_REC_TIMEHARP260N_T3:
+    case PTU_REC_TIMEHARP260P_T3:
+    case PTU_REC_MULTIHARP_T3:
+        return PTU_FORMAT_HH2_T3;
+    default:
+        return PTU_FORMAT_UNKNOWN;
+    }
+}
+
+static inline uint32_t load_record(const unsigned char* p)
+{
+    // Records are stored little-endian
+    uint32_t record = 0;
+    memcpy(&record, p, PTU_N_BYTES_RECORD);
+
+    return record;
+}
+
+/*
+	Record decoders. Every decoder walks the records once, keeping track
+	of the overflows (starting from, and updating, a running overflow
+	time), and hands photons and markers to a sink. For read_ptu_file(),
+	the counting sink sizes the output and the storing sink fills it;
+	the stream sinks serve the time-tag reader registry.
+*/
+
+struct ptu_count_sink
+{
+    uint64_t n_photons[PTU_MAX_CHANNELS];
+    uint64_t n_markers;
+
+    inline void photon(uint32_t channel, int64_t, int64_t) { n_photons[channel]++; }
+    inline void marker(int64_t, uint32_t) { n_markers++; }
+};
+
+struct ptu_store_sink
+{
+    int64_t* macrotimes[PTU_MAX_CHANNELS];
+    int64_t* microtimes[PTU_MAX_CHANNELS];
+    std::vector<int64_t>* marker_times;
+    std::vector<uint8_t>* marker_bits;
+
+    inline void photon(uint32_t channel, int64_t macrotime, int64_t microtime)
+    {
+        *macrotimes[channel]++ = macrotime;
+
+        if (microtimes[channel] != nullptr) {
+            *microtimes[channel]++ = microtime;
+        }
+    }
+
+    inline void marker(int64_t macrotime, uint32_t bits)
+    {
+        if (marker_times != nullptr) {
+            marker_times->push_back(macrotime);
+        }
+
+        if (marker_bits != nullptr) {
+            marker_bits->push_back((uint8_t)bits);
+        }
+    }
+};
+
+// Photons in record order, all channels in one stream
+struct ptu_stream_count_sink
+{
+    uint64_t n_photons;
+
+    inline void photon(uint32_t, int64_t, int64_t) { n_photons++; }
+    inline void marker(int64_t, uint32_t) {}
+};
+
+struct ptu_stream_sink
+{
+    int64_t* macrotimes;
+    int64_t* microtimes;
+    uint64_t* channels;
+    uint64_t n;
+
+    inline void photon(uint32_t channel, int64_t macrotime, int64_t microtime)
+    {
+        macrotimes[n] = macrotime;
+
+        if (microtimes != nullptr) {
+            microtimes[n] = microtime;
+        }
+
+        if (channels != nullptr) {
+            channels[n] = channel;
+        }
+
+        n++;
+    }
+
+    inline void marker(int64_t, uint32_t) {}
+};
+
+template <typename Sink>
+static void decode_picoharp_t2(const unsigned char* data, uint64_t n_records, int64_t* n_overflows, Sink& sink)
+{
+    int64_t overflows = *n_overflows;
+
+    for (uint64_t i = 0; i < n_records; i++) {
+        uint32_t record = load_record(data + i * PTU_N_BYTES_RECORD);
+        uint32_t channel = record >> 28;
+        int64_t time = record & 0x0FFFFFFF;
+
+        if (channel == 0xF) {
+            // The lowest 4 bits of the time tag hold the markers; zero: overflow
+            uint32_t markers = record & 0xF;
+
+            if (markers == 0) {
+                overflows += PTU_PH_T2_WRAPAROUND;
+            } else {
+                sink.marker(overflows + time, markers);
+            }
+        } else {
+            sink.photon(channel, overflows + time, 0);
+        }
+    }
+
+    *n_overflows = overflows;
+}
+
+template <typename Sink>
+static void decode_picoharp_t3(const unsigned char* data, uint64_t n_records, int64_t* n_overflows, Sink& sink)
+{
+    int64_t overflows = *n_overflows;
+
+    for (uint64_t i = 0; i < n_records; i++) {
+        uint32_t record = load_record(data + i * PTU_N_BYTES_RECORD);
+        uint32_t channel = record >> 28;
+        uint32_t dtime = (record >> 16) & 0xFFF;
+        int64_t nsync = record & 0xFFFF;
+
+        if (channel == 0xF) {
+            // dtime holds the markers; zero: overflow
+            if (dtime == 0) {
+                overflows += PTU_PH_T3_WRAPAROUND;
+            } else {
+                sink.marker(overflows + nsync, dtime);
+            }
+        } else {
+            sink.photon(channel, overflows + nsync, dtime);
+        }
+    }
+
+    *n_overflows = overflows;
+}
+
+// HydraHarp (v1 and v2), TimeHarp 260 and MultiHarp
+template <bool T3, bool V2, typename Sink>
+static void decode_hydraharp(const unsigned char* data, uint64_t n_records, int64_t* n_overflows, Sink& sink)
+{
+    const int64_t wraparound = T3 ? PTU_HH_T3_WRAPAROUND : (V2 ? PTU_HH2_T2_WRAPAROUND : PTU_HH1_T2_WRAPAROUND);
+    int64_t overflows = *n_overflows;
+
+    for (uint64_t i = 0; i < n_records; i++) {
+        uint32_t record = load_record(data + i * PTU_N_BYTES_RECORD);
+        uint32_t special = record >> 31;
+        uint32_t channel = (record >> 25) & 0x3F;
+        int64_t time = T3 ? (record & 0x3FF) : (record & 0x1FFFFFF);
+        int64_t dtime = T3 ? ((record >> 10) & 0x7FFF) : 0;
+
+        if (!special) {
+            sink.photon(channel + 1, overflows + time, dtime);
+        } else if (channel == 0x3F) {
+            // Overflow; from v2 on, the time field holds the number of overflows (zero: one, old style)
+            overflows += wraparound * ((V2 && time != 0) ? time : 1);
+        } else if (channel == 0) {
+            // Sync (T2 only)
+            sink.photon(0, overflows + time, 0);
+        } else {
+            sink.marker(overflows + time, channel);
+        }
+    }
+
+    *n_overflows = overflows;
+}
+
+template <typename Sink>
+static void decode_records(ptu_format format, const unsigned char* data, uint64_t n_records, int64_t* n_overflows, Sink& sink)
+{
+    switch (format) {
+    case PTU_FORMAT_PH_T2:
+        decode_picoharp_t2(data, n_records, n_overflows, sink);
+        break;
+    case PTU_FORMAT_PH_T3:
+        decode_picoharp_t3(data, n_records, n_overflows, sink);
+        break;
+    case PTU_FORMAT_HH1_T2:
+        decode_hydraharp<false, false>(data, n_records, n_overflows, sink);
+        break;
+    case PTU_FORMAT_HH1_T3:
+        decode_hydraharp<true, false>(data, n_records, n_overflows, sink);
+        break;
+    case PTU_FORMAT_HH2_T2:
+        decode_hydraharp<false, true>(data, n_records, n_overflows, sink);
+        break;
+    case PTU_FORMAT_HH2_T3:
+        decode_hydraharp<true, true>(data, n_records, n_overflows, sink);
+        break;
+    default:
+        break;
+    }
+}
+
+// Parses the tag list of a mapped PTU file; returns 0 or an error code of read_ptu_header()
+static int parse_header(const unsigned char* data, uint64_t size, ptu_info* info)
+{
+    if (size < PTU_N_BYTES_MAGIC + PTU_N_BYTES_VERSION ||
+            memcmp(data, PTU_MAGIC, PTU_N_BYTES_MAGIC) != 0) {
+        return 3;
+    }
+
+    *info = ptu_info();
+
+    uint64_t offset = PTU_N_BYTES_MAGIC + PTU_N_BYTES_VERSION;
+    bool has_record_type = false;
+
+    while (offset + PTU_N_BYTES_TAG <= size) {
+        char ident[PTU_N_BYTES_TAG_IDENT + 1];
+        uint32_t typ = 0;
+        int64_t value = 0;
+
+        memcpy(ident, data + offset, PTU_N_BYTES_TAG_IDENT);
+        ident[PTU_N_BYTES_TAG_IDENT] = '\0';
+        memcpy(&typ, data + offset + PTU_N_BYTES_TAG_IDENT + 4, 4);
+        memcpy(&value, data + offset + PTU_N_BYTES_TAG_IDENT + 8, 8);
+
+        offset += PTU_N_BYTES_TAG;
+
+        double value_double = 0.0;
+        memcpy(&value_double, &value, sizeof(value_double));
+
+        if (strcmp(ident, "Header_End") == 0) {
+            info->data_offset = offset;
+
+            if (!has_record_type) {
+                return 3;
+            }
+
+            uint64_t n_in_file = (size - offset) / PTU_N_BYTES_RECORD;
+
+            // The record count may be missing, or too large for a file that was cut short
+            if (info->n_records == 0 || info->n_records > n_in_file) {
+                info->n_records = n_in_file;
+            }
+
+            return 0;
+        }
+
+        if (strcmp(ident, "TTResultFormat_TTTRRecType") == 0) {
+            info->record_type = (uint32_t)value;
+            info->is_t3 = (info->record_type & 0xFF00) == 0x0300;
+            has_record_type = true;
+        } else if (strcmp(ident, "TTResult_NumberOfRecords") == 0 && typ == PTU_TAG_TYPE_INT8) {
+            info->n_records = value > 0 ? (uint64_t)value : 0;
+        } else if (strcmp(ident, "MeasDesc_GlobalResolution") == 0 && typ == PTU_TAG_TYPE_FLOAT8) {
+            info->global_resolution = value_double;
+        } else if (strcmp(ident, "MeasDesc_Resolution") == 0 && typ == PTU_TAG_TYPE_FLOAT8) {
+            info->resolution = value_double;
+        }
+
+        if (PTU_TAG_VARIABLE_LENGTH(typ)) {
+            if (value < 0 || (uint64_t)value > size - offset) {
+                return 3;
+            }
+
+            if (strcmp(ident, "HW_Type") == 0 && typ == PTU_TAG_TYPE_ANSI_STRING) {
+                // Zero-terminated, within the given length
+                const char* s = (const char*)(data + offset);
+                info->device_type = std::string(s, strnlen(s, (size_t)value));
+            }
+
+            offset += (uint64_t)value;
+        }
+    }
+
+    // No Header_End
+    return 3;
+}
+
+int LIBTIMETAG_DLL test_is_ptu_file(const std::string& filepath)
+{
+    FILE* f = fopen(filepath.c_str(), "rb");
+
+    if (f == NULL) {
+        return 0;
+    }
+
+    char magic[PTU_N_BYTES_MAGIC];
+    size_t n_read = fread(magic, 1, PTU_N_BYTES_MAGIC, f);
+
+    fclose(f);
+
+    return n_read == PTU_N_BYTES_MAGIC && memcmp(magic, PTU_MAGIC, PTU_N_BYTES_MAGIC) == 0;
+}
+
+int LIBTIMETAG_DLL read_ptu_header(const std::string& filepath, ptu_info* info)
+{
+    if (info == nullptr) {
+        return 2;
+    }
+
+    mapped_file mf;
+
+    if (map_file(filepath.c_str(), &mf) != 0) {
+        return 1;
+    }
+
+    int success = parse_header(mf.data, mf.size, info);
+
+    unmap_file(&mf);
+
+    return success;
+}
+
+int LIBTIMETAG_DLL read_ptu_file(const std::string& filepath,
+                                 ptu_info* info,
+                                 std::vector<ptu_channel_data>* channels,
+                                 std::vector<int64_t>* marker_times,
+                                 std::vector<uint8_t>* marker_bits)
+{
+    if (channels == nullptr) {
+        return 2;
+    }
+
+    mapped_file mf;
+
+    if (map_file(filepath.c_str(), &mf) != 0) {
+        return 1;
+    }
+
+    ptu_info header;
+    int success = parse_header(mf.data, mf.size, &header);
+    ptu_format format = get_format(header.record_type);
+
+    if (success == 0 && format == PTU_FORMAT_UNKNOWN) {
+        success = 4;
+    }
+
+    if (success != 0) {
+        unmap_file(&mf);
+        return success;
+    }
+
+    const unsigned char* records = mf.data + header.data_offset;
+
+    // Count first, so that every channel is allocated once
+    ptu_count_sink counter;
+    memset(&counter, 0, sizeof(counter));
+
+    int64_t n_overflows = 0;
+
+    decode_records(format, records, header.n_records, &n_overflows, counter);
+
+    channels->clear();
+
+    ptu_store_sink store;
+    memset(&store, 0, sizeof(store));
+    store.marker_times = marker_times;
+    store.marker_bits = marker_bits;
+
+    for (uint32_t c = 0; c < PTU_MAX_CHANNELS; c++) {
+        if (counter.n_photons[c] == 0) {
+            continue;
+        }
+
+        channels->push_back(ptu_channel_data());
+
+        ptu_channel_data& d = channels->back();
+        d.ID = c;
+        d.macrotimes.resize(counter.n_photons[c]);
+
+        if (header.is_t3) {
+            d.microtimes.resize(counter.n_photons[c]);
+        }
+    }
+
+    // Pointers are taken once the channel list is complete
+    for (size_t i = 0; i < channels->size(); i++) {
+        ptu_channel_data& d = (*channels)[i];
+
+        store.macrotimes[d.ID] = d.macrotimes.data();
+        store.microtimes[d.ID] = header.is_t3 ? d.microtimes.data() : nullptr;
+    }
+
+    if (marker_times != nullptr) {
+        marker_times->reserve(marker_times->size() + counter.n_markers);
+    }
+
+    if (marker_bits != nullptr) {
+        marker_bits->reserve(marker_bits->size() + counter.n_markers);
+    }
+
+    n_overflows = 0;
+
+    decode_records(format, records, header.n_records, &n_overflows, store);
+
+    unmap_file(&mf);
+
+    if (info != nullptr) {
+        *info = header;
+    }
+
+    return 0;
+}
+
+/*
+	Reader for the time-tag reader registry: the photons of all channels,
+	in record order, with their channel IDs. Markers are left out.
+*/
+
+static int ptu_probe(const unsigned char* data, uint64_t size)
+{
+    return size >= PTU_N_BYTES_MAGIC && memcmp(data, PTU_MAGIC, PTU_N_BYTES_MAGIC) == 0;
+}
+
+static int ptu_open(const unsigned char* data, uint64_t size, timetag_layout* layout)
+{
+    ptu_info header;
+
+    if (parse_header(data, size, &header) != 0 || get_format(header.record_type) == PTU_FORMAT_UNKNOWN) {
+        return 1;
+    }
+
+    layout->data_offset = header.data_offset;
+    layout->n_bytes_event = PTU_N_BYTES_RECORD;
+    layout->variant = header.record_type;
+
+    if (!header.is_t3) {
+        layout->flags &= ~TIMETAG_HAS_MICROTIMES;
+    }
+
+    return 0;
+}
+
+static void ptu_count(const timetag_layout* layout,
+                      const unsigned char* data,
+                      uint64_t n_events,
+                      uint64_t* n_photons,
+                      uint64_t* n_overflows)
+{
+    ptu_stream_count_sink counter;
+    counter.n_photons = 0;
+
+    int64_t overflows = 0;
+
+    decode_records(get_format(layout->variant), data, n_events, &overflows, counter);
+
+    *n_photons += counter.n_photons;
+    *n_overflows += (uint64_t)overflows;
+}
+
+static uint64_t ptu_decode(const timetag_layout* layout,
+                           const unsigned char* data,
+                           uint64_t n_events,
+                           uint64_t,
+                           uint64_t* n_overflows,
+                           int64_t* macrotimes,
+                           int64_t* microtimes,
+                           uint64_t* channels)
+{
+    ptu_stream_sink store;
+    store.macrotimes = macrotimes;
+    store.microtimes = microtimes;
+    store.channels = channels;
+    store.n = 0;
+
+    int64_t overflows = (int64_t)*n_overflows;
+
+    decode_records(get_format(layout->variant), data, n_events, &overflows, store);
+
+    *n_overflows = (uint64_t)overflows;
+
+    return store.n;
+}
+
+const timetag_reader ptu_timetag_reader = {
+    TIMETAG_READER_PTU,
+    TIMETAG_HAS_MICROTIMES | TIMETAG_HAS_CHANNELS,
+    ptu_probe,
+    ptu_open,
+    ptu_count,
+    ptu_decode,
+    nullptr
+};
@@ -11,12 +11,23 @@
 #ifdef LIBTIMETAG_COMPILE_PYTHON
 
 #include <iostream>
+#include <string.h>
 #include "pybind11/pybind11.h"
 #include "pybind11/numpy.h"
 #include "pybind11/stl.h"
 
 #include "sstt_file.h"
 #include "sstt_file2.h"
+#include "sstt_stream2.h"
+#include "sstt_index2.h"
+#include "sstt_summary2.h"
+#include "sstt_writer2.h"
+#include "sstt_packed.h"
+#include "sstt_merged.h"
+#include "kway_merge.h"
+#include "sstt_dataset.h"
+#include "ptu_file.h"
+#include "timetag_reader.h"
 #include "algos.h"
 
 namespace py = pybind11;
@@ -91,25 +102,58 @@ PYBIND11_MODULE(_libtimetag, m) {
       "     and data channel.",
         py::arg("ref_timestamps"), py::arg("data_timestamps"), py::arg("total_sync_divider"));
 
-    m.def("read_sstt_data", [](std::string filepath,uint64_t n_photons_to_skip, uint64_t n_overflow_events) -> py::tuple{
-        std::vector<int64_t>* macrotimes = new std::vector<int64_t>();
-        std::vector<int64_t>* microtimes = new std::vector<int64_t>();
-        uint64_t n_overflows = 0;
+    m.def("read_sstt_data", [](std::string filepath,uint64_t n_photons_to_skip, uint64_t n_overflow_events, unsigned int n_threads, bool read_microtimes) -> py::tuple{
+        timetag_read_options options;
+        options.n_photons_to_skip = n_photons_to_skip;
+        options.n_overflow_events = n_overflow_events;
+        options.n_threads = n_threads;
+        options.read_microtimes = read_microtimes;
+        options.read_channels = false;
+
+        // Version 1 files have no magic: read any file that is not recognized as one
+        options.fallback = timetag_get_reader(TIMETAG_READER_SSTT1);
+
+        timetag_data data;
         int success = 0;
 
-        if (test_is_sstt2_file(filepath)) {
-            // py::print("Reading SSTT V2 file");
+        // Event streams are counted first, and decoded straight into arrays of their final size
+        py::array_t<int64_t> py_macrotimes(0);
+        py::array_t<int64_t> py_microtimes(0);
+        const int64_t* macrotimes_decoded = nullptr;
+        uint64_t n_decoded = 0;
+        bool allocated = false;
 
-            success = read_data_file_sstt2(filepath, macrotimes, n_photons_to_skip, n_overflow_events, &n_overflows);
-        } else {
-            // py::print("Reading SSTT V1 file");
+        {
+            py::gil_scoped_release release;
 
-            success = read_data_file(filepath, macrotimes, microtimes);
-        }
+            // Summarize SSTT2 files while they are read in completely anyway
+            sstt2_summary summary;
+            bool summarize = n_photons_to_skip == 0 &&
+                    load_sstt2_summary(filepath, &summary) != 0 &&
+                    init_sstt2_summary(filepath, &summary) == 0;
 
-        if (success != 0) {
-            delete macrotimes;
-            delete microtimes;
+            // The format is detected while reading, with a single open of the file
+            success = read_timetag_file_into(filepath, options, [&](uint64_t n_photons, int flags, timetag_buffers* buffers) {
+                py::gil_scoped_acquire acquire;
+
+                py_macrotimes = py::array_t<int64_t>((py::ssize_t)n_photons);
+                buffers->macrotimes = py_macrotimes.mutable_data();
+                macrotimes_decoded = buffers->macrotimes;
+                n_decoded = n_photons;
+
+                if (flags & TIMETAG_HAS_MICROTIMES) {
+                    py_microtimes = py::array_t<int64_t>((py::ssize_t)n_photons);
+                    buffers->microtimes = py_microtimes.mutable_data();
+                }
+
+                allocated = true;
+            }, &data);
+
+            if (success == 0 && allocated && summarize && strcmp(data.reader->name, TIMETAG_READER_SSTT2) == 0) {
+                sstt2_summary_add(&summary, macrotimes_decoded, n_decoded);
+                summary.n_overflows = data.n_overflows;
+                store_sstt2_summary(filepath, summary);
+            }
         }
 
         if (success == 1) {
@@ -117,24 +161,41 @@ PYBIND11_MODULE(_libtimetag, m) {
         }
 
         if (success == 3) {
-            throw std::runtime_error("Did not recognize file format as either SSTT v1 or v2!");
+            throw std::runtime_error("Did not recognize the file format, or the file is invalid!");
         }
 
         if (success != 0) {
             throw std::runtime_error("Unknown error");
         }
 
-        auto capsule_macro = py::capsule(macrotimes, [](void *v) { delete reinterpret_cast<std::vector<uint64_t>*>(v); });
-        py::array py_macrotimes(macrotimes->size(), macrotimes->data(), capsule_macro);
+        if (data.reader->flags & TIMETAG_HAS_CHANNELS) {
+            throw std::runtime_error("File '" + filepath + "' holds several channels (" + std::string(data.reader->name) +
+                                     "); use read_timetag_data() instead");
+        }
+
+        if (allocated) {
+            return py::make_tuple(py_macrotimes, py_microtimes, data.n_overflows);
+        }
+
+        // Formats that decode the whole file at once (packed) fill vectors
+        std::vector<int64_t>* macrotimes = new std::vector<int64_t>(std::move(data.macrotimes));
+        std::vector<int64_t>* microtimes = new std::vector<int64_t>(std::move(data.microtimes));
 
-        auto capsule_micro = py::capsule(microtimes, [](void *v) { delete reinterpret_cast<std::vector<uint64_t>*>(v); });
-        py::array py_microtimes(microtimes->size(), microtimes->data(), capsule_micro);
+        auto capsule_macro = py::capsule(macrotimes, [](void *v) { delete reinterpret_cast<std::vector<int64_t>*>(v); });
+        py::array py_vector_macrotimes(macrotimes->size(), macrotimes->data(), capsule_macro);
 
-        return py::make_tuple(py_macrotimes, py_microtimes,n_overflows);
+        auto capsule_micro = py::capsule(microtimes, [](void *v) { delete reinterpret_cast<std::vector<int64_t>*>(v); });
+        py::array py_vector_microtimes(microtimes->size(), microtimes->data(), capsule_micro);
+
+        return py::make_tuple(py_vector_macrotimes, py_vector_microtimes, data.n_overflows);
     },"Reads in data from a single *.sstt.c* data file\n"
     "\n"
 	"Note: the import_data() function is generally more convenient to use.\n"
 	"\n"
+	"The file format (SSTT v2, or packed) is detected from the file itself,\n"
+	"see detect_timetag_format(). Files that are not recognized are read as\n"
+	"legacy SSTT files (v1), which have no magic.\n"
+	"\n"
     "Parameters\n"
     "----------\n"
     "filepath : string\n"
@@ -144,11 +205,21 @@ PYBIND11_MODULE(_libtimetag, m) {
     "     reading this file. Useful when reading in\n"
     "     a file which is still being updated. Be\n"
     "     careful to also specify the correct number\n"
-    "     of overflow events.\n"
+    "     of overflow events. SSTTReader.poll() is\n"
+    "     more convenient for this purpose.\n"
     "n_overflow_events : uint64_t (optional)\n"
     "     The number of overflow events already\n"
     "     encountered in this file. Should be used\n"
-    "     in combination with n_photons_to_skip\n"
+    "     in combination with n_photons_to_skip.\n"
+    "     SSTT v2 files only: the events of other\n"
+    "     formats are counted up to the photon.\n"
+    "n_threads : positive integer (optional)\n"
+    "     Number of threads used to decode the file.\n"
+    "     Zero: use all available cores.\n"
+    "read_microtimes : bool (optional)\n"
+    "     Whether to decode the micro timestamps of legacy\n"
+    "     SSTT files (v1). False: only read the macro\n"
+    "     timestamps, which is faster.\n"
     "\n"
     "Returns\n"
     "-------\n"
@@ -166,11 +237,302 @@ PYBIND11_MODULE(_libtimetag, m) {
 	" 		if desired, in subsequent calls to\n"
 	"		read_sstt_data(), to read in only a portion\n"
 	"		of the data file.",
-    py::arg("filepath"),py::arg("n_photons_to_skip")=0,py::arg("n_overflow_events")=0);
+    py::arg("filepath"),py::arg("n_photons_to_skip")=0,py::arg("n_overflow_events")=0,py::arg("n_threads")=1,py::arg("read_microtimes")=true);
+
+    m.def("detect_timetag_format", [](const std::string& filepath) -> py::object {
+        const timetag_reader* reader = nullptr;
+
+        {
+            py::gil_scoped_release release;
+            reader = timetag_detect_format(filepath);
+        }
+
+        if (reader == nullptr) {
+            return py::none();
+        }
+
+        return py::str(reader->name);
+    }, "Detects the format of a time-tag data file, from its magic bytes\n"
+    "\n"
+    "Parameters\n"
+    "----------\n"
+    "filepath : string\n"
+    "     Path to the data file.\n"
+    "\n"
+    "Returns\n"
+    "-------\n"
+	"format : string\n"
+	"		The name of the format: 'SSTT2', 'SSTT packed', 'SSTT merged' or\n"
+	"		'PTU'. None if the file could not be opened, or its format is not\n"
+	"		recognized. Legacy SSTT files (v1) have no magic, and are not\n"
+	"		recognized; read_sstt_data() reads them.",
+    py::arg("filepath"));
+
+    m.def("read_timetag_data", [](const std::string& filepath, unsigned int n_threads, bool read_microtimes) -> py::tuple {
+        timetag_read_options options;
+        options.n_threads = n_threads;
+        options.read_microtimes = read_microtimes;
+
+        timetag_data data;
+        int success = 0;
+
+        {
+            py::gil_scoped_release release;
+            success = read_timetag_file(filepath, options, &data);
+        }
+
+        if (success == 1) {
+            throw std::runtime_error("Failed to open file '" + filepath + "'");
+        } else if (success == 3) {
+            throw std::runtime_error("Did not recognize the file format, or the file is invalid!");
+        } else if (success != 0) {
+            throw std::runtime_error("Unknown error");
+        }
+
+        std::vector<int64_t>* macrotimes = new std::vector<int64_t>(std::move(data.macrotimes));
+        std::vector<int64_t>* microtimes = new std::vector<int64_t>(std::move(data.microtimes));
+        std::vector<uint64_t>* channels = new std::vector<uint64_t>(std::move(data.channels));
+
+        auto capsule_macro = py::capsule(macrotimes, [](void *v) { delete reinterpret_cast<std::vector<int64_t>*>(v); });
+        auto capsule_micro = py::capsule(microtimes, [](void *v) { delete reinterpret_cast<std::vector<int64_t>*>(v); });
+        auto capsule_channels = py::capsule(channels, [](void *v) { delete reinterpret_cast<std::vector<uint64_t>*>(v); });
+
+        return py::make_tuple(std::string(data.reader->name),
+                              py::array(macrotimes->size(), macrotimes->data(), capsule_macro),
+                              py::array(microtimes->size(), microtimes->data(), capsule_micro),
+                              py::array(channels->size(), channels->data(), capsule_channels));
+    }, "Reads a time-tag data file of any supported format\n"
+    "\n"
+	"The format is detected from the file itself (see detect_timetag_format()),\n"
+	"and the file is opened only once. Files holding several channels (SSTT\n"
+	"merged, PTU) are returned as one stream, in file order, with the channel\n"
+	"ID of every photon. PTU marker records are left out; use read_ptu_data()\n"
+	"for those.\n"
+	"\n"
+    "Parameters\n"
+    "----------\n"
+    "filepath : string\n"
+    "     Path to the data file.\n"
+    "n_threads : positive integer (optional)\n"
+    "     Number of threads used to decode the file.\n"
+    "     Zero: use all available cores.\n"
+    "read_microtimes : bool (optional)\n"
+    "     Whether to decode the micro timestamps, for formats\n"
+    "     that store them.\n"
+    "\n"
+    "Returns\n"
+    "-------\n"
+	"format : string\n"
+	"		The name of the format, see detect_timetag_format().\n"
+	"macro : array\n"
+	"		The macro timestamps.\n"
+	"micro : array\n"
+	"		The micro timestamps; empty if the format has none.\n"
+	"channels : array\n"
+	"		The channel ID of every photon; empty for single-channel formats.",
+    py::arg("filepath"), py::arg("n_threads")=1, py::arg("read_microtimes")=true);
+
+    m.def("read_sstt_data_into", [](const std::string& filepath, py::array_t<int64_t,py::array::c_style> out, uint64_t byte_offset, uint64_t n_overflows, unsigned int n_threads) -> py::tuple {
+        sstt2_decode_position position = { byte_offset, n_overflows, 0 };
+        int64_t* macrotimes = out.mutable_data();
+        uint64_t capacity = (uint64_t)out.size();
+        uint64_t n_written = 0;
+        int success = 0;
+
+        {
+            py::gil_scoped_release release;
+            success = sstt2_decode_file_into(filepath.c_str(), &position, macrotimes, capacity, &n_written, n_threads);
+        }
+
+        if (success == 1) {
+            throw std::runtime_error("byte_offset is not at an event boundary");
+        }
+
+        if (success == 2) {
+            throw std::runtime_error("Failed to open file '" + filepath + "'");
+        }
+
+        if (success == 3) {
+            throw std::runtime_error("Not an SSTT v2 data file!");
+        }
+
+        if (success != 0) {
+            throw std::runtime_error("Unknown error");
+        }
+
+        return py::make_tuple(n_written, position.byte_offset, position.n_overflows, position.at_end != 0);
+    },"Decodes a single *.sstt.c* (SSTT v2) data file into an existing array\n"
+    "\n"
+    "The macro timestamps are written straight into out, without\n"
+    "allocating or copying. Size out using count_sstt_photons(), or\n"
+    "decode the file in parts, passing the returned position to the\n"
+    "next call.\n"
+    "\n"
+    "Parameters\n"
+    "----------\n"
+    "filepath : string\n"
+    "     Path to the *.sstt.c* data file to open.\n"
+    "out : array of int64\n"
+    "     Contiguous array to store the macro timestamps in.\n"
+    "byte_offset : uint64 (optional)\n"
+    "     Position to start decoding at, as returned by a previous call. Zero: the start of the file.\n"
+    "n_overflows : uint64 (optional)\n"
+    "     Number of overflows before byte_offset, as returned by a previous call.\n"
+    "n_threads : positive integer (optional)\n"
+    "     Number of threads to use. Zero: use all available cores.\n"
+    "\n"
+    "Returns\n"
+    "-------\n"
+	"n_written : integer\n"
+	"		The number of macro timestamps stored in out.\n"
+	"byte_offset : integer\n"
+	"		Position to resume decoding at.\n"
+	"n_overflows : integer\n"
+	"		Number of overflows before that position.\n"
+	"at_end : bool\n"
+	"		True if the whole file has been decoded.",
+    py::arg("filepath"),py::arg("out").noconvert(),py::arg("byte_offset")=0,py::arg("n_overflows")=0,py::arg("n_threads")=1);
+
+    m.def("read_sstt_data_range", [](const std::string& filepath, int64_t t_start, int64_t t_stop) -> py::array {
+        std::vector<int64_t>* macrotimes = new std::vector<int64_t>();
+        int success = 0;
+
+        {
+            py::gil_scoped_release release;
+            success = read_data_file_sstt2_range(filepath, macrotimes, t_start, t_stop);
+        }
+
+        if (success != 0) {
+            delete macrotimes;
+        }
+
+        if (success == 1) {
+            throw std::runtime_error("Failed to open file '" + std::string(filepath) + "'");
+        }
+
+        if (success == 3) {
+            throw std::runtime_error("Not an SSTT v2 data file!");
+        }
+
+        if (success != 0) {
+            throw std::runtime_error("Unknown error");
+        }
+
+        auto capsule_macro = py::capsule(macrotimes, [](void *v) { delete reinterpret_cast<std::vector<int64_t>*>(v); });
+        return py::array(macrotimes->size(), macrotimes->data(), capsule_macro);
+    },"Reads in the photons within a time window from a single *.sstt.c* (SSTT v2) data file\n"
+    "\n"
+    "Only the part of the file covering the time window is decoded.\n"
+    "If the file has an index (see build_sstt_index()), it is used\n"
+    "to jump to the start of the window.\n"
+    "\n"
+    "Parameters\n"
+    "----------\n"
+    "filepath : string\n"
+    "     Path to the *.sstt.c* data file to open.\n"
+    "t_start : int64\n"
+    "     Start of the time window (inclusive), in macrotime units.\n"
+    "t_stop : int64\n"
+    "     End of the time window (exclusive), in macrotime units.\n"
+    "\n"
+    "Returns\n"
+    "-------\n"
+	"py_macrotimes : list\n"
+	"		List of macro timestamps t, with t_start <= t < t_stop.",
+    py::arg("filepath"),py::arg("t_start"),py::arg("t_stop"));
+
+    m.def("read_sstt_preview", [](const std::string& filepath, uint64_t photon_step, int64_t time_quantum) -> py::array {
+        std::vector<int64_t>* macrotimes = new std::vector<int64_t>();
+        int success = 0;
+
+        {
+            py::gil_scoped_release release;
+            success = read_data_file_sstt2_decimated(filepath, macrotimes, photon_step, time_quantum);
+        }
+
+        if (success != 0) {
+            delete macrotimes;
+        }
+
+        if (success == 1) {
+            throw std::runtime_error("Failed to open file '" + std::string(filepath) + "'");
+        }
+
+        if (success == 3) {
+            throw std::runtime_error("Not an SSTT v2 data file!");
+        }
+
+        if (success == 4) {
+            throw std::runtime_error("Set either photon_step or time_quantum");
+        }
+
+        if (success != 0) {
+            throw std::runtime_error("Unknown error");
+        }
+
+        auto capsule_macro = py::capsule(macrotimes, [](void *v) { delete reinterpret_cast<std::vector<int64_t>*>(v); });
+        return py::array(macrotimes->size(), macrotimes->data(), capsule_macro);
+    },"Reads a decimated preview of a single *.sstt.c* (SSTT v2) data file\n"
+    "\n"
+    "Returns every photon_step-th photon, or one photon per time quantum,\n"
+    "without decoding the photons in between. If the file has an index\n"
+    "(see build_sstt_index()), the parts of the file between the selected\n"
+    "photons are not read at all, which makes previews of large files fast.\n"
+    "\n"
+    "Parameters\n"
+    "----------\n"
+    "filepath : string\n"
+    "     Path to the *.sstt.c* data file to open.\n"
+    "photon_step : uint64 (optional)\n"
+    "     Take photons 0, photon_step, 2*photon_step, ...\n"
+    "time_quantum : int64 (optional)\n"
+    "     Take one photon from every time quantum, in macrotime units, that holds any.\n"
+    "     Exactly one of photon_step and time_quantum must be set.\n"
+    "\n"
+    "Returns\n"
+    "-------\n"
+	"py_macrotimes : list\n"
+	"		List of the selected macro timestamps.",
+    py::arg("filepath"),py::arg("photon_step")=0,py::arg("time_quantum")=0);
+
+    m.def("count_sstt_photons", [](const std::string& filepath) {
+        uint64_t n_photons = 0;
+        int success = 0;
+
+        {
+            py::gil_scoped_release release;
+            success = n_photons_in_datafile_sstt2("", filepath.c_str(), &n_photons);
+        }
+
+        if (success == 2) {
+            throw std::runtime_error("Failed to open file '" + filepath + "'");
+        }
+
+        if (success != 0) {
+            throw std::runtime_error("Unknown error");
+        }
+
+        return n_photons;
+    },"Returns the number of photons in a single *.sstt.c* (SSTT v2) data file\n"
+    "\n"
+    "The file is not decoded; this is fast enough to browse\n"
+    "through large datasets.\n"
+    "\n"
+    "Parameters\n"
+    "----------\n"
+    "filepath : string\n"
+    "     Path to the *.sstt.c* data file.\n"
+    "\n"
+    "Returns\n"
+    "-------\n"
+	"n_photons : integer\n"
+	"		The number of photon events in the file.",
+    py::arg("filepath"));
 
     m.def("correlate_fcs", [](const py::array_t<int64_t,py::array::c_style|py::array::forcecast>& bin_edges,
                                 const py::array_t<int64_t,py::array::c_style|py::array::forcecast>& left_list,
-                                    const py::array_t<int64_t,py::array::c_style|py::array::forcecast>& right_list) -> py::array {
+                                    const py::array_t<int64_t,py::array::c_style|py::array::forcecast>& right_list,
+                                    unsigned int n_threads) -> py::array {
         if (bin_edges.size() <= 1) {
             throw std::runtime_error("bin_edges should have a minimum length of two");
         }
@@ -183,14 +545,21 @@ PYBIND11_MODULE(_libtimetag, m) {
             return py::array(ret_size, ret, capsule);
         }
 
-        int success = correlate_many_per_bin(bin_edges.data(0),
+        int success = 0;
+
+        {
+            py::gil_scoped_release release;
+
+            success = correlate_many_per_bin_parallel(bin_edges.data(0),
                                         bin_edges.size(),
                                         left_list.data(0),
                                         left_list.size(),
                                         right_list.data(0),
                                         right_list.size(),
                                         ret,
-                                        bin_edges.size() - 1);
+                                        bin_edges.size() - 1,
+                                        n_threads);
+        }
 
         if (success == 1) {
             throw std::runtime_error("Internal error #1");
@@ -221,16 +590,80 @@ PYBIND11_MODULE(_libtimetag, m) {
     "     List containing the timestamps of the 'left' dataset\n"
     "right_array : uint64_t\n"
     "     List containing the timestamps of the 'right' dataset\n"
+    "n_threads : integer (optional)\n"
+    "     The number of threads to use. Zero: use all cores.\n"
+    "\n"
+    "Returns\n"
+    "-------\n"
+    "data : list\n"
+    "     List containing the non-normalized cross-correlation histogram.",
+    py::arg("bin_edges"), py::arg("left_array"), py::arg("right_array"), py::arg("n_threads")=1);
+
+    m.def("correlate_multi_tau", [](const py::array_t<int64_t,py::array::c_style|py::array::forcecast>& left_list,
+                                    const py::array_t<int64_t,py::array::c_style|py::array::forcecast>& right_list,
+                                    uint32_t n_channels,
+                                    uint32_t n_levels) -> py::tuple {
+        uint64_t n_bins = multi_tau_n_bins(n_channels, n_levels);
+
+        if (n_bins == 0) {
+            throw std::runtime_error("n_channels must be even and at most " + std::to_string(MULTI_TAU_MAX_CHANNELS) +
+                                     ", and n_levels between 1 and " + std::to_string(MULTI_TAU_MAX_LEVELS));
+        }
+
+        std::vector<int64_t>* bin_edges = new std::vector<int64_t>(n_bins + 1);
+        std::vector<int64_t>* hist = new std::vector<int64_t>(n_bins, 0);
+        auto capsule_edges = py::capsule(bin_edges, [](void *v) { delete reinterpret_cast<std::vector<int64_t>*>(v); });
+        auto capsule_hist = py::capsule(hist, [](void *v) { delete reinterpret_cast<std::vector<int64_t>*>(v); });
+        int success = 0;
+
+        multi_tau_bin_edges(n_channels, n_levels, bin_edges->data(), bin_edges->size());
+
+        if (left_list.size() != 0 && right_list.size() != 0) {
+            py::gil_scoped_release release;
+            success = correlate_multi_tau(n_channels, n_levels, left_list.data(0), left_list.size(),
+                                          right_list.data(0), right_list.size(), hist->data(), hist->size());
+        }
+
+        if (success != 0) {
+            throw std::runtime_error("Internal error #" + std::to_string(success));
+        }
+
+        return py::make_tuple(py::array(bin_edges->size(), bin_edges->data(), capsule_edges),
+                              py::array(hist->size(), hist->data(), capsule_hist));
+    }, "Cross-correlates two arrays using a multi-tau correlator\n"
+    "\n"
+	"The photon streams are coarsened step by step: every cascade level\n"
+	"correlates n_channels lags, in time slots twice as wide as the level\n"
+	"before it. The cost grows with the number of photons times the number\n"
+	"of levels, instead of with the number of bins, like correlate_fcs().\n"
+	"The bins are quasi-logarithmic: 0, 1, .., n_channels, n_channels + 2,\n"
+	"etc. Normalize the output using norm_corr(), with the bin edges\n"
+	"returned. For live data, see MultiTauCorrelator.\n"
+	"\n"
+    "Parameters\n"
+    "----------\n"
+    "left_array : list\n"
+    "     List containing the timestamps of the 'left' dataset\n"
+    "right_array : list\n"
+    "     List containing the timestamps of the 'right' dataset\n"
+    "n_channels : positive integer (optional)\n"
+    "     Number of lags per cascade level; even. Typically 8 or 16.\n"
+    "n_levels : positive integer (optional)\n"
+    "     Number of cascade levels. The largest lag is\n"
+	"     n_channels * 2**(n_levels - 1).\n"
     "\n"
     "Returns\n"
     "-------\n"
+	"bin_edges : list\n"
+	"		The edges of the correlation histogram.\n"
     "data : list\n"
     "     List containing the non-normalized cross-correlation histogram.",
-    py::arg("bin_edges"), py::arg("left_array"), py::arg("right_array"));
+    py::arg("left_array"), py::arg("right_array"), py::arg("n_channels")=16, py::arg("n_levels")=32);
 
     m.def("correlate_lin", [](const py::array_t<int64_t,py::array::c_style|py::array::forcecast>& bin_edges,
                                     const py::array_t<int64_t,py::array::c_style|py::array::forcecast>& left_list,
-                                    const py::array_t<int64_t,py::array::c_style|py::array::forcecast>& right_list) {
+                                    const py::array_t<int64_t,py::array::c_style|py::array::forcecast>& right_list,
+                                    unsigned int n_threads) {
         if (bin_edges.size() <= 1) {
             throw std::runtime_error("bin_edges should have a minimum length of two");
         }
@@ -242,14 +675,20 @@ PYBIND11_MODULE(_libtimetag, m) {
             return ret;
         }
 
-        int success = correlate_unit_bins(bin_edges.data(0),
+        int success = 0;
+
+        {
+            py::gil_scoped_release release;
+            success = correlate_uniform_bins_parallel(bin_edges.data(0),
                                             bin_edges.size(),
                                             left_list.data(0),
                                             left_list.size(),
                                             right_list.data(0),
                                             right_list.size(),
                                             ret.data(),
-                                            ret_size);
+                                            ret_size,
+                                            n_threads);
+        }
 
         if (success == 1) {
             throw std::runtime_error("Internal error #1");
@@ -258,7 +697,7 @@ PYBIND11_MODULE(_libtimetag, m) {
         } else if (success == 3) {
             throw std::runtime_error("Internal error #3");
         } else if (success == 4) {
-            throw std::runtime_error("Bins should have a size of unity");
+            throw std::runtime_error("Bins should be equally spaced");
         } else if (success != 0) {
             throw std::runtime_error("Unknown error");
         }
@@ -276,17 +715,21 @@ PYBIND11_MODULE(_libtimetag, m) {
     "Parameters\n"
     "----------\n"
     "bin_edges : list\n"
-    "     Edges for the correlation histogram. Bin width must be unity.\n"
+    "     Edges for the correlation histogram. Bins must be equally spaced;\n"
+	"     any width is allowed. Wider bins are counted directly, which is\n"
+	"     faster, and uses less memory, than unit bins followed by rebin().\n"
     "left_array : list\n"
     "     List containing the timestamps of the 'left' dataset\n"
     "right_array : uint64_t\n"
     "     List containing the timestamps of the 'right' dataset\n"
+    "n_threads : integer (optional)\n"
+    "     The number of threads to use. Zero: use all cores.\n"
     "\n"
     "Returns\n"
     "-------\n"
     "data : list\n"
     "     List containing the non-normalized cross-correlation histogram.",
-    py::arg("bin_edges"), py::arg("left_array"), py::arg("right_array"));
+    py::arg("bin_edges"), py::arg("left_array"), py::arg("right_array"), py::arg("n_threads")=1);
 
     m.def("norm_corr", [](const py::array_t<int64_t,py::array::c_style|py::array::forcecast>& data,
                           const py::array_t<int64_t,py::array::c_style|py::array::forcecast>& bin_edges,
@@ -469,6 +912,951 @@ PYBIND11_MODULE(_libtimetag, m) {
     "ret : list\n"
     "     Re-binned bin edges.",
     py::arg("bin_edges"), py::arg("n"));
+
+    py::class_<sstt2_stream_reader>(m, "SSTTReader", "Reads a single *.sstt.c* (SSTT v2) data file in chunks\n"
+    "\n"
+	"Decodes the data file chunk by chunk, so that files larger than the\n"
+	"available memory can be processed. The overflow state is carried over\n"
+	"between chunks. Most conveniently used through iter_sstt_data().\n"
+	"\n"
+	"The reader can also follow a data file that is still being written:\n"
+	"poll() returns only the photons written since the previous call.\n"
+	"Incomplete events at the end of the file are left for the next call.\n"
+	"\n"
+	"Other event-stream formats (SSTT merged, PTU) are read the same way,\n"
+	"see detect_timetag_format(); all their channels form one stream of\n"
+	"macro timestamps, in file order.\n"
+	"\n"
+    "Parameters\n"
+    "----------\n"
+    "filepath : string\n"
+    "     Path to the *.sstt.c* data file to open.\n"
+    "chunk_size : positive integer (optional)\n"
+    "     Maximum number of photons returned per chunk.\n"
+    "byte_offset : uint64 (optional)\n"
+    "     File offset to start reading at, as given by the 'offset'\n"
+    "     property of a previous reader. Zero: start of the data.\n"
+    "n_overflows : uint64 (optional)\n"
+    "     The number of overflows preceding byte_offset, as given by\n"
+    "     the 'n_overflows' property of a previous reader.")
+        .def(py::init([](const std::string& filepath, uint64_t chunk_size, uint64_t byte_offset, uint64_t n_overflows) {
+            sstt2_stream_reader* reader = new sstt2_stream_reader(filepath, chunk_size, byte_offset, n_overflows);
+
+            if (!reader->is_open()) {
+                int error_code = reader->error_code();
+                delete reader;
+
+                if (error_code == 1) {
+                    throw std::runtime_error("byte_offset is not at an event boundary");
+                } else if (error_code == 2) {
+                    throw std::runtime_error("Failed to open file '" + filepath + "'");
+                } else if (error_code == 3) {
+                    throw std::runtime_error("Did not recognize the file format, or the file is not an event stream!");
+                }
+
+                throw std::runtime_error("Unknown error");
+            }
+
+            return reader;
+        }), py::arg("filepath"), py::arg("chunk_size")=1 << 20, py::arg("byte_offset")=0, py::arg("n_overflows")=0)
+        .def("next_chunk", [](sstt2_stream_reader& self) -> py::array {
+            if (!self.is_open()) {
+                throw std::runtime_error("Reader is closed");
+            }
+
+            int64_t* ret = new int64_t[self.chunk_size()];
+            uint64_t n = 0;
+            int success = 0;
+
+            {
+                py::gil_scoped_release release;
+                success = sstt2_reader_next_chunk(self.handle(), ret, self.chunk_size(), &n);
+            }
+
+            if (success != 0) {
+                delete[] ret;
+                throw std::runtime_error("Failed to read from file");
+            }
+
+            auto capsule = py::capsule(ret, [](void *v) { delete[] (int64_t*)v; });
+
+            return py::array(n, ret, capsule);
+        }, "Returns the next chunk of macro timestamps. An empty array signals the end of the file.")
+        .def("poll", [](sstt2_stream_reader& self) -> py::array {
+            if (!self.is_open()) {
+                throw std::runtime_error("Reader is closed");
+            }
+
+            std::vector<int64_t>* macrotimes = new std::vector<int64_t>();
+            int success = 0;
+
+            {
+                py::gil_scoped_release release;
+                success = self.poll(macrotimes);
+            }
+
+            if (success != 0) {
+                delete macrotimes;
+            }
+
+            if (success == 3) {
+                throw std::runtime_error("Did not recognize file format as SSTT v2!");
+            } else if (success != 0) {
+                throw std::runtime_error("Failed to read from file");
+            }
+
+            auto capsule = py::capsule(macrotimes, [](void *v) { delete reinterpret_cast<std::vector<int64_t>*>(v); });
+
+            return py::array(macrotimes->size(), macrotimes->data(), capsule);
+        }, "Returns all macro timestamps written to the file since the previous call.\n"
+        "\n"
+        "Useful to follow a file that is still being written, e.g. for a live display.\n"
+        "Only the new data is read and decoded.")
+        .def("close", &sstt2_stream_reader::close, "Closes the data file.")
+        .def_property_readonly("n_overflows", &sstt2_stream_reader::n_overflows,
+                               "Number of overflow events encountered so far.")
+        .def("seek_photon", [](sstt2_stream_reader& self, uint64_t photon_index) {
+            int success = 0;
+
+            {
+                py::gil_scoped_release release;
+                success = self.seek_photon(photon_index);
+            }
+
+            if (success == 4) {
+                throw std::runtime_error("Could not index the data file");
+            } else if (success != 0) {
+                throw std::runtime_error("Failed to read from file");
+            }
+        }, "Positions the reader at the given photon.\n"
+        "\n"
+        "Uses (and if needed, creates) the *.idx checkpoint index next to the\n"
+        "data file, so that only a small part of the file needs to be decoded.",
+        py::arg("photon_index"))
+        .def("seek_time", [](sstt2_stream_reader& self, int64_t macrotime) {
+            int success = 0;
+
+            {
+                py::gil_scoped_release release;
+                success = self.seek_time(macrotime);
+            }
+
+            if (success == 4) {
+                throw std::runtime_error("Could not index the data file");
+            } else if (success != 0) {
+                throw std::runtime_error("Failed to read from file");
+            }
+        }, "Positions the reader at the first photon with a macro timestamp of at least\n"
+        "the given value. See seek_photon().",
+        py::arg("macrotime"))
+        .def("set_prefetch", [](sstt2_stream_reader& self, uint32_t n_blocks, uint64_t block_size) {
+            if (self.set_prefetch(n_blocks, block_size) != 0) {
+                throw std::runtime_error("Failed to open file for reading ahead");
+            }
+        }, "Enables (or disables) reading ahead on a background thread\n"
+        "\n"
+	"While a chunk is being processed, the next blocks of the file are\n"
+	"already read, so that reading overlaps with processing. Worthwhile on\n"
+	"slow or high-latency storage, such as network file systems.\n"
+	"\n"
+        "Parameters\n"
+        "----------\n"
+        "n_blocks : integer\n"
+        "     The number of blocks to keep in flight. Zero: read synchronously.\n"
+        "block_size : integer (optional)\n"
+        "     The size of every read, in bytes. Zero: 4 MiB.",
+        py::arg("n_blocks"), py::arg("block_size")=0)
+        .def_property_readonly("n_photons", &sstt2_stream_reader::n_photons,
+                               "Index of the next photon to be read.")
+        .def_property_readonly("offset", &sstt2_stream_reader::offset,
+                               "File offset of the next event to read.")
+        .def_property_readonly("format", [](sstt2_stream_reader& self) -> py::object {
+            const char* name = sstt2_reader_format(self.handle());
+
+            if (name == nullptr) {
+                return py::none();
+            }
+
+            return py::str(name);
+        }, "The format of the file, see detect_timetag_format(). None while its header has not been written.");
+
+    py::class_<sstt2_dataset_writer>(m, "SSTTWriter", "Writes a small simple time-tagged (SSTT v2) dataset\n"
+    "\n"
+	"Creates the header file, and one *.sstt.c* data file per channel.\n"
+	"Overflow events are inserted automatically. Data is written to disk\n"
+	"on a background thread; call close() (or use the writer in a 'with'\n"
+	"statement) to complete the dataset.\n"
+	"\n"
+    "Parameters\n"
+    "----------\n"
+    "filepath : string\n"
+    "     Path to the header file to create, e.g. 'data.sstt'. The data\n"
+    "     files are named <filepath>.c<channel>.\n"
+    "channels : list of integers\n"
+    "     The channel IDs.\n"
+    "time_unit_seconds : float (optional)\n"
+    "     The time unit of the macrotimes, in seconds.\n"
+    "device_type : string (optional)\n"
+    "     The time-to-digital converter used.")
+        .def(py::init([](const std::string& filepath, const std::vector<uint64_t>& channel_ids,
+                         double time_unit_seconds, const std::string& device_type) {
+            exp_info_sstt2 exp_info;
+            exp_info.time_unit_seconds = time_unit_seconds;
+            exp_info.device_type = device_type;
+
+            std::vector<channel_info_sstt2> channels(channel_ids.size());
+
+            for (size_t i = 0; i < channel_ids.size(); i++) {
+                channels[i].ID = channel_ids[i];
+            }
+
+            sstt2_dataset_writer* writer = new sstt2_dataset_writer(filepath, exp_info, channels);
+
+            if (!writer->is_open()) {
+                int error_code = writer->error_code();
+                delete writer;
+
+                if (error_code == 1) {
+                    throw std::runtime_error("Invalid list of channels");
+                } else if (error_code == 2) {
+                    throw std::runtime_error("Failed to create dataset '" + filepath + "'");
+                }
+
+                throw std::runtime_error("Unknown error");
+            }
+
+            return writer;
+        }), py::arg("filepath"), py::arg("channels"), py::arg("time_unit_seconds")=1e-12, py::arg("device_type")="")
+        .def("write", [](sstt2_dataset_writer& self, uint64_t channel,
+                         const py::array_t<int64_t,py::array::c_style|py::array::forcecast>& macrotimes) {
+            int success = 0;
+
+            {
+                py::gil_scoped_release release;
+                success = self.write(channel, macrotimes.data(), macrotimes.size());
+            }
+
+            if (success == 1) {
+                throw std::runtime_error("Unknown channel, or writer is closed");
+            } else if (success == 4) {
+                throw std::runtime_error("Macrotimes must be non-negative and sorted");
+            } else if (success != 0) {
+                throw std::runtime_error("Failed to write to the dataset");
+            }
+        }, "Appends macro timestamps to a channel.", py::arg("channel"), py::arg("macrotimes"))
+        .def("flush", [](sstt2_dataset_writer& self) {
+            py::gil_scoped_release release;
+
+            if (self.flush() != 0) {
+                throw std::runtime_error("Failed to write to the dataset");
+            }
+        }, "Writes all buffered data to disk, and updates the header file.")
+        .def("n_photons", &sstt2_dataset_writer::n_photons, "Number of photons written to a channel.", py::arg("channel"))
+        .def("close", [](sstt2_dataset_writer& self) {
+            py::gil_scoped_release release;
+
+            if (self.close() != 0) {
+                throw std::runtime_error("Failed to write to the dataset");
+            }
+        }, "Writes all remaining data, and closes the dataset.")
+        .def("__enter__", [](sstt2_dataset_writer& self) -> sstt2_dataset_writer& { return self; }, py::return_value_policy::reference)
+        .def("__exit__", [](sstt2_dataset_writer& self, const py::object& exc_type, const py::object&, const py::object&) {
+            int success = 0;
+
+            {
+                py::gil_scoped_release release;
+                success = self.close();
+            }
+
+            // Do not hide an exception raised inside the with block
+            if (success != 0 && exc_type.is_none()) {
+                throw std::runtime_error("Failed to write to the dataset");
+            }
+        });
+
+    m.def("convert_sstt_to_packed", [](const std::string& sstt_filepath, const std::string& packed_filepath) {
+        int success = 0;
+
+        {
+            py::gil_scoped_release release;
+            success = convert_sstt2_to_packed(sstt_filepath, packed_filepath);
+        }
+
+        if (success == 1) {
+            throw std::runtime_error("Failed to open file '" + sstt_filepath + "' or '" + packed_filepath + "'");
+        } else if (success == 3) {
+            throw std::runtime_error("Did not recognize file format as SSTT v2!");
+        } else if (success != 0) {
+            throw std::runtime_error("Failed to write file '" + packed_filepath + "'");
+        }
+    }, "Converts a single *.sstt.c* (SSTT v2) data file to the compressed, packed format\n"
+    "\n"
+	"The conversion is lossless. Packed files store the differences between\n"
+	"consecutive macro timestamps, bit-packed in blocks which can be decoded\n"
+	"independently. Read them using read_packed_data().\n"
+	"\n"
+    "Parameters\n"
+    "----------\n"
+    "sstt_filepath : string\n"
+    "     Path to the *.sstt.c* data file to convert.\n"
+    "packed_filepath : string\n"
+    "     Path to the packed file to create.",
+    py::arg("sstt_filepath"), py::arg("packed_filepath"));
+
+    m.def("read_packed_data", [](const std::string& filepath, uint64_t first_block, int64_t n_blocks) -> py::array {
+        std::vector<int64_t>* macrotimes = new std::vector<int64_t>();
+        int error_code = 0;
+        int success = 0;
+
+        {
+            py::gil_scoped_release release;
+            sstt_packed_reader* r = sstt_packed_open(filepath, &error_code);
+
+            if (r != nullptr) {
+                uint64_t n = (n_blocks < 0) ? sstt_packed_n_blocks(r) : (uint64_t)n_blocks;
+                success = sstt_packed_read_blocks(r, first_block, n, macrotimes);
+                sstt_packed_close(r);
+            }
+        }
+
+        if (error_code != 0 || success != 0) {
+            delete macrotimes;
+        }
+
+        if (error_code == 2) {
+            throw std::runtime_error("Failed to open file '" + filepath + "'");
+        } else if (error_code != 0 || success != 0) {
+            throw std::runtime_error("Not a valid packed file: '" + filepath + "'");
+        }
+
+        auto capsule = py::capsule(macrotimes, [](void *v) { delete reinterpret_cast<std::vector<int64_t>*>(v); });
+        return py::array(macrotimes->size(), macrotimes->data(), capsule);
+    }, "Reads macro timestamps from a packed file\n"
+    "\n"
+	"Blocks hold up to 4096 photons, and are decoded independently: reading\n"
+	"a range of blocks does not decode the blocks before it.\n"
+	"\n"
+    "Parameters\n"
+    "----------\n"
+    "filepath : string\n"
+    "     Path to the packed file.\n"
+    "first_block : uint64 (optional)\n"
+    "     Index of the first block to read.\n"
+    "n_blocks : integer (optional)\n"
+    "     The number of blocks to read. Negative: all blocks.\n"
+    "\n"
+    "Returns\n"
+    "-------\n"
+	"py_macrotimes : list\n"
+	"		List of macro timestamps.",
+    py::arg("filepath"), py::arg("first_block")=0, py::arg("n_blocks")=-1);
+
+    m.def("convert_sstt_v1_to_v2", [](const std::string& filepath, const std::string& new_filepath, bool keep_microtimes, unsigned int n_threads) {
+        int success = 0;
+
+        {
+            py::gil_scoped_release release;
+            success = convert_sstt1_dataset(filepath, new_filepath, keep_microtimes ? 1 : 0, n_threads);
+        }
+
+        if (success == 1) {
+            throw std::runtime_error("Failed to read header file '" + filepath + "'");
+        } else if (success == 2) {
+            throw std::runtime_error("Failed to create dataset '" + new_filepath + "'");
+        } else if (success == 3) {
+            throw std::runtime_error("Failed to open the data files of '" + filepath + "'");
+        } else if (success == 5) {
+            throw std::runtime_error("The macro timestamps of '" + filepath + "' are not sorted");
+        } else if (success != 0) {
+            throw std::runtime_error("Failed to write dataset '" + new_filepath + "'");
+        }
+    }, "Converts a legacy SSTT (v1) dataset to an SSTT v2 dataset\n"
+    "\n"
+	"The channels are converted in parallel, and every data file is\n"
+	"converted chunk by chunk, in constant memory. SSTT v2 files store no\n"
+	"micro timestamps; if keep_microtimes is set, the micro timestamps of\n"
+	"every channel are stored in a side stream '<data file>.micro', which\n"
+	"import_data() reads automatically.\n"
+	"\n"
+    "Parameters\n"
+    "----------\n"
+    "filepath : string\n"
+    "     Path to the header file of the v1 dataset.\n"
+    "new_filepath : string\n"
+    "     Path to the header file of the v2 dataset to create.\n"
+    "keep_microtimes : bool (optional)\n"
+    "     Whether to store the micro timestamps in side streams.\n"
+    "n_threads : positive integer (optional)\n"
+    "     Number of threads to use. Zero: use all available cores.",
+    py::arg("filepath"), py::arg("new_filepath"), py::arg("keep_microtimes")=true, py::arg("n_threads")=0);
+
+    m.def("load_sstt_dataset", [](const std::string& filepath, unsigned int n_threads) -> py::dict {
+        std::vector<sstt_channel_data> data;
+        int success = 0;
+
+        {
+            py::gil_scoped_release release;
+            success = load_sstt_dataset(filepath, nullptr, nullptr, &data, n_threads);
+        }
+
+        if (success == 1) {
+            throw std::runtime_error("Failed to read header file '" + filepath + "'");
+        } else if (success == 3) {
+            throw std::runtime_error("Failed to open the data files of '" + filepath + "'");
+        } else if (success == 4) {
+            throw std::runtime_error("Failed to generate micro timestamps: pulses channel missing or empty");
+        } else if (success != 0) {
+            throw std::runtime_error("Internal error :-(");
+        }
+
+        py::dict ret;
+
+        for (size_t i = 0; i < data.size(); i++) {
+            std::vector<int64_t>* macrotimes = new std::vector<int64_t>(std::move(data[i].macrotimes));
+            std::vector<int64_t>* microtimes = new std::vector<int64_t>(std::move(data[i].microtimes));
+
+            auto capsule_macro = py::capsule(macrotimes, [](void *v) { delete reinterpret_cast<std::vector<int64_t>*>(v); });
+            auto capsule_micro = py::capsule(microtimes, [](void *v) { delete reinterpret_cast<std::vector<int64_t>*>(v); });
+
+            ret[py::int_(data[i].ID)] = py::make_tuple(py::array(macrotimes->size(), macrotimes->data(), capsule_macro),
+                                                       py::array(microtimes->size(), microtimes->data(), capsule_micro),
+                                                       data[i].pulse_period);
+        }
+
+        return ret;
+    }, "Reads the data of all channels of an SSTT dataset, in parallel\n"
+    "\n"
+	"Note: import_data() uses this function, and also returns the header information.\n"
+	"\n"
+	"The data files are decoded concurrently. The micro timestamps of every\n"
+	"channel with a pulses channel are generated (see gen_micro_times()) as\n"
+	"soon as both channels have been read.\n"
+	"\n"
+    "Parameters\n"
+    "----------\n"
+    "filepath : string\n"
+    "     Path to the header file.\n"
+    "n_threads : positive integer (optional)\n"
+    "     Number of threads to use. Zero: use all available cores.\n"
+    "\n"
+    "Returns\n"
+    "-------\n"
+	"data : dict\n"
+	"		Per channel ID, a tuple (macro, micro, pulse_period). micro is empty if the channel has\n"
+	"		no micro timestamps; pulse_period is 0 unless the channel is a pulses channel.",
+    py::arg("filepath"), py::arg("n_threads")=0);
+
+    m.def("read_ptu_data", [](const std::string& filepath) -> py::tuple {
+        ptu_info info;
+        std::vector<ptu_channel_data> channels;
+        std::vector<int64_t>* marker_times = new std::vector<int64_t>();
+        std::vector<uint8_t>* marker_bits = new std::vector<uint8_t>();
+        int success = 0;
+
+        auto capsule_marker_times = py::capsule(marker_times, [](void *v) { delete reinterpret_cast<std::vector<int64_t>*>(v); });
+        auto capsule_marker_bits = py::capsule(marker_bits, [](void *v) { delete reinterpret_cast<std::vector<uint8_t>*>(v); });
+
+        {
+            py::gil_scoped_release release;
+            success = read_ptu_file(filepath, &info, &channels, marker_times, marker_bits);
+        }
+
+        if (success == 1) {
+            throw std::runtime_error("Failed to open file '" + filepath + "'");
+        } else if (success == 3) {
+            throw std::runtime_error("Did not recognize file format as PTU!");
+        } else if (success == 4) {
+            throw std::runtime_error("Unsupported PTU record type " + std::to_string(info.record_type));
+        } else if (success != 0) {
+            throw std::runtime_error("Internal error :-(");
+        }
+
+        py::dict header;
+        header["device_type"] = info.device_type;
+        header["record_type"] = info.record_type;
+        header["T3"] = info.is_t3;
+        header["Time_unit_seconds"] = info.global_resolution;
+        header["Microtime_unit_seconds"] = info.resolution;
+        header["n_records"] = info.n_records;
+
+        py::dict data;
+
+        for (size_t i = 0; i < channels.size(); i++) {
+            std::vector<int64_t>* macrotimes = new std::vector<int64_t>(std::move(channels[i].macrotimes));
+            std::vector<int64_t>* microtimes = new std::vector<int64_t>(std::move(channels[i].microtimes));
+
+            auto capsule_macro = py::capsule(macrotimes, [](void *v) { delete reinterpret_cast<std::vector<int64_t>*>(v); });
+            auto capsule_micro = py::capsule(microtimes, [](void *v) { delete reinterpret_cast<std::vector<int64_t>*>(v); });
+
+            py::dict channel;
+            channel["macro"] = py::array(macrotimes->size(), macrotimes->data(), capsule_macro);
+            channel["micro"] = py::array(microtimes->size(), microtimes->data(), capsule_micro);
+
+            data[py::int_(channels[i].ID)] = channel;
+        }
+
+        py::tuple markers = py::make_tuple(py::array(marker_times->size(), marker_times->data(), capsule_marker_times),
+                                           py::array(marker_bits->size(), marker_bits->data(), capsule_marker_bits));
+
+        return py::make_tuple(header, data, markers);
+    }, "Reads a PicoQuant unified TTTR (.ptu) file, in T2 or T3 mode\n"
+    "\n"
+	"Supported are the PicoHarp, HydraHarp, TimeHarp 260 and MultiHarp\n"
+	"record formats. The file is decoded in native code, per channel.\n"
+	"\n"
+	"In T2 mode, the macro timestamps are in units of Time_unit_seconds (the\n"
+	"global resolution). In T3 mode, the macro timestamps are sync counts\n"
+	"(Time_unit_seconds is then the sync period), and the micro timestamps\n"
+	"are in units of Microtime_unit_seconds. Channel IDs follow the\n"
+	"PicoQuant demo code: for the HydraHarp and later devices, the detector\n"
+	"channels start at 1, and in T2 mode the sync channel is 0.\n"
+	"\n"
+    "Parameters\n"
+    "----------\n"
+    "filepath : string\n"
+    "     Path to the .ptu file.\n"
+    "\n"
+    "Returns\n"
+    "-------\n"
+	"header : dict\n"
+	"		The header information: device_type, record_type, T3, Time_unit_seconds,\n"
+	"		Microtime_unit_seconds and n_records.\n"
+	"data : dict\n"
+	"		Per channel ID, a dict with the macro timestamps ('macro') and, in T3\n"
+	"		mode, the micro timestamps ('micro'; empty in T2 mode).\n"
+	"markers : tuple\n"
+	"		The macro timestamps of the marker records, and their marker bits (uint8).",
+    py::arg("filepath"));
+
+    m.def("merge_sstt_dataset", [](const std::string& filepath, const std::string& merged_filepath) {
+        int success = 0;
+
+        {
+            py::gil_scoped_release release;
+            success = merge_sstt2_dataset(filepath, merged_filepath);
+        }
+
+        if (success == 5) {
+            throw std::runtime_error("Failed to read header file '" + filepath + "'");
+        } else if (success == 1) {
+            throw std::runtime_error("Failed to open the data files of '" + filepath + "', or file '" + merged_filepath + "'");
+        } else if (success == 2) {
+            throw std::runtime_error("Invalid dataset: too many channels, or unsorted macro timestamps");
+        } else if (success == 3) {
+            throw std::runtime_error("Did not recognize file format as SSTT v2!");
+        } else if (success != 0) {
+            throw std::runtime_error("Failed to write file '" + merged_filepath + "'");
+        }
+    }, "Merges all channels of an SSTT (v2) dataset into a single file\n"
+    "\n"
+	"The merged file holds the photons of all channels as one time-ordered\n"
+	"stream, in which every photon carries a channel tag. Read it using\n"
+	"read_merged_data() or demux_merged_data().\n"
+	"\n"
+    "Parameters\n"
+    "----------\n"
+    "filepath : string\n"
+    "     Path to the header file (*.sstt) of the dataset.\n"
+    "merged_filepath : string\n"
+    "     Path to the merged file to create.",
+    py::arg("filepath"), py::arg("merged_filepath"));
+
+    m.def("read_merged_data", [](const std::string& filepath) -> py::tuple {
+        std::vector<int64_t>* macrotimes = new std::vector<int64_t>();
+        std::vector<uint8_t>* tags = new std::vector<uint8_t>();
+        std::vector<uint64_t> channels;
+        int error_code = 0;
+
+        {
+            py::gil_scoped_release release;
+            ssttm_reader* r = ssttm_reader_open(filepath, &error_code);
+
+            if (r != nullptr) {
+                channels = ssttm_reader_channels(r);
+
+                const uint64_t chunk = 1 << 20;
+                uint64_t n = 0;
+
+                do {
+                    uint64_t old_size = macrotimes->size();
+                    macrotimes->resize(old_size + chunk);
+                    tags->resize(old_size + chunk);
+                    ssttm_reader_next_chunk(r, macrotimes->data() + old_size, tags->data() + old_size, chunk, &n);
+                    macrotimes->resize(old_size + n);
+                    tags->resize(old_size + n);
+                } while (n > 0);
+
+                ssttm_reader_close(r);
+            }
+        }
+
+        if (error_code != 0) {
+            delete macrotimes;
+            delete tags;
+        }
+
+        if (error_code == 2) {
+            throw std::runtime_error("Failed to open file '" + filepath + "'");
+        } else if (error_code != 0) {
+            throw std::runtime_error("Not a valid merged file: '" + filepath + "'");
+        }
+
+        auto capsule_macro = py::capsule(macrotimes, [](void *v) { delete reinterpret_cast<std::vector<int64_t>*>(v); });
+        auto capsule_tags = py::capsule(tags, [](void *v) { delete reinterpret_cast<std::vector<uint8_t>*>(v); });
+
+        return py::make_tuple(py::array(macrotimes->size(), macrotimes->data(), capsule_macro),
+                              py::array(tags->size(), tags->data(), capsule_tags),
+                              py::array(channels.size(), channels.data()));
+    }, "Reads the merged, time-ordered stream of all channels from a merged file\n"
+    "\n"
+    "Parameters\n"
+    "----------\n"
+    "filepath : string\n"
+    "     Path to the merged file.\n"
+    "\n"
+    "Returns\n"
+    "-------\n"
+	"py_macrotimes : list\n"
+	"		List of macro timestamps of all channels, in time order.\n"
+	"py_tags : list\n"
+	"		The channel tag of every photon (uint8).\n"
+	"py_channels : list\n"
+	"		The channel ID belonging to every tag: py_channels[py_tags] gives\n"
+	"		the channel ID of every photon.",
+    py::arg("filepath"));
+
+    m.def("demux_merged_data", [](const std::string& filepath, const std::vector<uint64_t>& channels) -> py::dict {
+        std::vector<std::vector<int64_t> > macrotimes;
+        int error_code = 0;
+
+        {
+            py::gil_scoped_release release;
+            ssttm_reader* r = ssttm_reader_open(filepath, &error_code);
+
+            if (r != nullptr) {
+                ssttm_reader_demux(r, channels, &macrotimes);
+                ssttm_reader_close(r);
+            }
+        }
+
+        if (error_code == 2) {
+            throw std::runtime_error("Failed to open file '" + filepath + "'");
+        } else if (error_code != 0) {
+            throw std::runtime_error("Not a valid merged file: '" + filepath + "'");
+        }
+
+        py::dict ret;
+
+        for (size_t i = 0; i < channels.size(); i++) {
+            std::vector<int64_t>* data = new std::vector<int64_t>();
+            data->swap(macrotimes[i]);
+
+            auto capsule = py::capsule(data, [](void *v) { delete reinterpret_cast<std::vector<int64_t>*>(v); });
+            ret[py::int_(channels[i])] = py::array(data->size(), data->data(), capsule);
+        }
+
+        return ret;
+    }, "Extracts the macro timestamps of selected channels from a merged file\n"
+    "\n"
+	"All selected channels are extracted together, in two passes over the\n"
+	"file: one to count the photons of every channel, one to decode them.\n"
+	"\n"
+    "Parameters\n"
+    "----------\n"
+    "filepath : string\n"
+    "     Path to the merged file.\n"
+    "channels : list\n"
+    "     The IDs of the channels to extract.\n"
+    "\n"
+    "Returns\n"
+    "-------\n"
+	"py_data : dict\n"
+	"		The macro timestamps of every channel, keyed by channel ID. Channels\n"
+	"		that are not in the file yield an empty list.",
+    py::arg("filepath"), py::arg("channels"));
+
+    m.def("merge_channels", [](const std::vector<py::array_t<int64_t,py::array::c_style|py::array::forcecast> >& data) -> py::tuple {
+        if (data.size() > KWAY_MERGE_MAX_STREAMS) {
+            throw std::runtime_error("Too many arrays; at most " + std::to_string(KWAY_MERGE_MAX_STREAMS) + " can be merged");
+        }
+
+        std::vector<const int64_t*> arrays(data.size());
+        std::vector<uint64_t> lens(data.size());
+        uint64_t total = 0;
+
+        for (size_t i = 0; i < data.size(); i++) {
+            arrays[i] = data[i].data();
+            lens[i] = data[i].size();
+            total += lens[i];
+        }
+
+        std::vector<int64_t>* macrotimes = new std::vector<int64_t>(total);
+        std::vector<uint8_t>* streams = new std::vector<uint8_t>(total);
+        int success = 0;
+
+        {
+            py::gil_scoped_release release;
+            success = merge_sorted_arrays(arrays.data(), lens.data(), (uint32_t)arrays.size(),
+                                          macrotimes->data(), streams->data(), total);
+        }
+
+        if (success != 0) {
+            delete macrotimes;
+            delete streams;
+            throw std::runtime_error("Unknown error");
+        }
+
+        auto capsule_macro = py::capsule(macrotimes, [](void *v) { delete reinterpret_cast<std::vector<int64_t>*>(v); });
+        auto capsule_streams = py::capsule(streams, [](void *v) { delete reinterpret_cast<std::vector<uint8_t>*>(v); });
+
+        return py::make_tuple(py::array(macrotimes->size(), macrotimes->data(), capsule_macro),
+                              py::array(streams->size(), streams->data(), capsule_streams));
+    }, "Merges sorted arrays of macro timestamps into one time-sorted array\n"
+    "\n"
+	"Replaces concatenating the arrays and sorting the result, for e.g.\n"
+	"coincidence analysis. The merge is stable: equal macro timestamps are\n"
+	"ordered by the index of their array.\n"
+	"\n"
+    "Parameters\n"
+    "----------\n"
+    "data : list of arrays\n"
+    "     The sorted macro timestamps of every channel, e.g. as returned by\n"
+    "     read_sstt_data(). At most 256 arrays.\n"
+    "\n"
+    "Returns\n"
+    "-------\n"
+	"py_macrotimes : list\n"
+	"		The merged macro timestamps.\n"
+	"py_channels : list\n"
+	"		The index into 'data' of every macro timestamp (uint8).",
+    py::arg("data"));
+
+    py::class_<kway_stream_merger>(m, "StreamMerger", "Merges sorted streams of macro timestamps that arrive in chunks\n"
+    "\n"
+	"Push the chunks of every stream (e.g. from SSTTReader) using push(),\n"
+	"and take the merged output using pop(). Output is produced as far as\n"
+	"it is final: when a stream that has not ended runs out of data, pop()\n"
+	"stops until more data of that stream is pushed, or it is ended.\n"
+	"\n"
+    "Parameters\n"
+    "----------\n"
+    "n_streams : positive integer\n"
+    "     The number of streams to merge; at most 256.")
+        .def(py::init([](uint32_t n_streams) {
+            kway_stream_merger* merger = new kway_stream_merger(n_streams);
+
+            if (!merger->is_valid()) {
+                delete merger;
+                throw std::runtime_error("n_streams must be between 1 and " + std::to_string(KWAY_MERGE_MAX_STREAMS));
+            }
+
+            return merger;
+        }), py::arg("n_streams"))
+        .def("push", [](kway_stream_merger& self, uint32_t stream, const py::array_t<int64_t,py::array::c_style|py::array::forcecast>& data) {
+            if (kway_merger_push(self.handle(), stream, data.data(), data.size()) != 0) {
+                throw std::runtime_error("Invalid stream index, or the stream has ended");
+            }
+        }, "Appends a chunk of sorted macro timestamps to a stream",
+        py::arg("stream"), py::arg("data"))
+        .def("end", [](kway_stream_merger& self, uint32_t stream) {
+            if (kway_merger_end(self.handle(), stream) != 0) {
+                throw std::runtime_error("Invalid stream index");
+            }
+        }, "Marks the end of a stream", py::arg("stream"))
+        .def("pop", [](kway_stream_merger& self, uint64_t max_n) -> py::tuple {
+            std::vector<int64_t>* macrotimes = new std::vector<int64_t>(max_n);
+            std::vector<uint8_t>* streams = new std::vector<uint8_t>(max_n);
+            uint64_t n = 0;
+
+            {
+                py::gil_scoped_release release;
+                kway_merger_pop(self.handle(), macrotimes->data(), streams->data(), max_n, &n);
+            }
+
+            macrotimes->resize(n);
+            streams->resize(n);
+
+            auto capsule_macro = py::capsule(macrotimes, [](void *v) { delete reinterpret_cast<std::vector<int64_t>*>(v); });
+            auto capsule_streams = py::capsule(streams, [](void *v) { delete reinterpret_cast<std::vector<uint8_t>*>(v); });
+
+            return py::make_tuple(py::array(macrotimes->size(), macrotimes->data(), capsule_macro),
+                                  py::array(streams->size(), streams->data(), capsule_streams));
+        }, "Takes merged output\n"
+        "\n"
+        "Returns\n"
+        "-------\n"
+	"py_macrotimes : list\n"
+	"		At most max_n merged macro timestamps.\n"
+	"py_streams : list\n"
+	"		The stream index of every macro timestamp (uint8).",
+        py::arg("max_n")=1 << 20)
+        .def_property_readonly("waiting_for", [](kway_stream_merger& self) {
+            return kway_merger_waiting_for(self.handle());
+        }, "The stream that must receive data (or be ended) before pop() can\n"
+        "continue; -1 if none.")
+        .def_property_readonly("done", [](kway_stream_merger& self) {
+            return kway_merger_done(self.handle()) == 1;
+        }, "True when all streams have ended, and all output has been taken.");
+
+    py::class_<multi_tau_stream_correlator>(m, "MultiTauCorrelator", "Multi-tau correlator for photon streams that arrive in chunks\n"
+    "\n"
+	"Add the chunks of both streams as they are read using add(); the\n"
+	"histogram can be taken at any time using histogram(), e.g. to display\n"
+	"the correlation during a measurement. Photons are correlated once both\n"
+	"streams have reached them; call flush() when both streams have ended.\n"
+	"See correlate_multi_tau().\n"
+	"\n"
+    "Parameters\n"
+    "----------\n"
+    "n_channels : positive integer (optional)\n"
+    "     Number of lags per cascade level; even. Typically 8 or 16.\n"
+    "n_levels : positive integer (optional)\n"
+    "     Number of cascade levels.")
+        .def(py::init([](uint32_t n_channels, uint32_t n_levels) {
+            multi_tau_stream_correlator* correlator = new multi_tau_stream_correlator(n_channels, n_levels);
+
+            if (!correlator->is_valid()) {
+                delete correlator;
+                throw std::runtime_error("n_channels must be even and at most " + std::to_string(MULTI_TAU_MAX_CHANNELS) +
+                                         ", and n_levels between 1 and " + std::to_string(MULTI_TAU_MAX_LEVELS));
+            }
+
+            return correlator;
+        }), py::arg("n_channels")=16, py::arg("n_levels")=32)
+        .def("add", [](multi_tau_stream_correlator& self,
+                       const py::array_t<int64_t,py::array::c_style|py::array::forcecast>& left_list,
+                       const py::array_t<int64_t,py::array::c_style|py::array::forcecast>& right_list) {
+            py::gil_scoped_release release;
+            multi_tau_add(self.handle(), left_list.data(), left_list.size(), right_list.data(), right_list.size());
+        }, "Adds the next chunks of sorted timestamps of both streams; either may\n"
+        "be empty.",
+        py::arg("left_array"), py::arg("right_array"))
+        .def("flush", [](multi_tau_stream_correlator& self) {
+            py::gil_scoped_release release;
+            multi_tau_flush(self.handle());
+        }, "Correlates all photons still waiting for the other stream")
+        .def("histogram", [](multi_tau_stream_correlator& self) -> py::tuple {
+            std::vector<int64_t>* hist = new std::vector<int64_t>(self.n_bins());
+            auto capsule = py::capsule(hist, [](void *v) { delete reinterpret_cast<std::vector<int64_t>*>(v); });
+            uint64_t n_left = 0;
+            uint64_t n_right = 0;
+
+            multi_tau_get(self.handle(), hist->data(), hist->size(), &n_left, &n_right);
+
+            return py::make_tuple(py::array(hist->size(), hist->data(), capsule), n_left, n_right);
+        }, "Gets the correlation so far\n"
+        "\n"
+        "Returns\n"
+        "-------\n"
+	"data : list\n"
+	"		The non-normalized cross-correlation histogram.\n"
+	"n_left : integer\n"
+	"		The number of 'left' photons correlated; for norm_corr().\n"
+	"n_right : integer\n"
+	"		The number of 'right' photons correlated.")
+        .def_property_readonly("bin_edges", [](multi_tau_stream_correlator& self) -> py::array {
+            std::vector<int64_t>* bin_edges = new std::vector<int64_t>(self.n_bins() + 1);
+            auto capsule = py::capsule(bin_edges, [](void *v) { delete reinterpret_cast<std::vector<int64_t>*>(v); });
+
+            multi_tau_bin_edges(self.n_channels(), self.n_levels(), bin_edges->data(), bin_edges->size());
+
+            return py::array(bin_edges->size(), bin_edges->data(), capsule);
+        }, "The edges of the correlation histogram.");
+
+    m.def("build_sstt_index", [](const std::string& filepath, uint64_t interval) {
+        sstt2_index index;
+        index.interval = interval;
+        int success = 0;
+
+        {
+            py::gil_scoped_release release;
+            success = build_sstt2_index(filepath, &index);
+
+            if (success == 0) {
+                success = (write_sstt2_index(sstt2_index_filepath(filepath), index) == 0) ? 0 : 4;
+            }
+        }
+
+        if (success == 1) {
+            throw std::runtime_error("Failed to open file '" + filepath + "'");
+        } else if (success == 3) {
+            throw std::runtime_error("Did not recognize the file format, or the file is not an event stream!");
+        } else if (success == 4) {
+            throw std::runtime_error("Failed to write index file '" + sstt2_index_filepath(filepath) + "'");
+        } else if (success != 0) {
+            throw std::runtime_error("Unknown error");
+        }
+
+        return index.checkpoints.size();
+    }, "Builds the checkpoint index of a single *.sstt.c* (SSTT v2) data file\n"
+    "\n"
+	"The index is stored next to the data file (*.sstt.c*.idx), and allows\n"
+	"SSTTReader to seek to any photon or time without decoding the data\n"
+	"before it. It is also created automatically on the first seek. Other\n"
+	"event-stream formats (SSTT merged, PTU) can be indexed as well.\n"
+	"\n"
+    "Parameters\n"
+    "----------\n"
+    "filepath : string\n"
+    "     Path to the *.sstt.c* data file.\n"
+    "interval : positive integer (optional)\n"
+    "     Number of events between checkpoints.\n"
+    "\n"
+    "Returns\n"
+    "-------\n"
+    "n_checkpoints : integer\n"
+    "     The number of checkpoints in the index.",
+    py::arg("filepath"), py::arg("interval")=SSTT2_INDEX_DEFAULT_INTERVAL);
+
+    m.def("get_sstt_summary", [](const std::string& filepath, bool save) -> py::dict {
+        sstt2_summary summary;
+        int success = 0;
+
+        {
+            py::gil_scoped_release release;
+            success = get_sstt2_summary(filepath, &summary, save ? 1 : 0);
+        }
+
+        if (success == 1) {
+            throw std::runtime_error("Failed to open file '" + filepath + "'");
+        } else if (success == 3) {
+            throw std::runtime_error("Did not recognize file format as SSTT v2!");
+        } else if (success != 0) {
+            throw std::runtime_error("Unknown error");
+        }
+
+        py::dict ret;
+        ret["n_photons"] = summary.n_photons;
+        ret["n_overflows"] = summary.n_overflows;
+        ret["t_first"] = summary.t_first;
+        ret["t_last"] = summary.t_last;
+        ret["profile_bin_width"] = summary.profile_bin_width;
+        ret["rate_profile"] = py::array_t<uint64_t>(summary.profile.size(), summary.profile.data());
+
+        return ret;
+    }, "Returns a summary of a single *.sstt.c* (SSTT v2) data file\n"
+    "\n"
+	"The summary is stored next to the data file (*.sstt.c*.sum), and is\n"
+	"returned without decoding the data file for as long as the size and\n"
+	"modification time of the data file do not change. read_sstt_data()\n"
+	"also creates it, when reading a file in full.\n"
+	"\n"
+    "Parameters\n"
+    "----------\n"
+    "filepath : string\n"
+    "     Path to the *.sstt.c* data file.\n"
+    "save : bool (optional)\n"
+    "     Whether to store a newly computed summary.\n"
+    "\n"
+    "Returns\n"
+    "-------\n"
+    "summary : dict\n"
+    "     n_photons, n_overflows: number of photon and overflow events.\n"
+    "     t_first, t_last: first and last macro timestamp (0 if there are\n"
+    "     no photons).\n"
+    "     rate_profile: number of photons per bin of profile_bin_width\n"
+    "     macrotime units, the first bin starting at t_first.",
+    py::arg("filepath"), py::arg("save")=true);
 }
 
-#endif
+#endif
\ No newline at end of file
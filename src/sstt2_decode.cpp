@@ -0,0 +1,659 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    sstt2_decode.cpp
+ * \brief   Block decoders for SSTT2 (version 2) event records
+ * \author  Stijn Hinterding
+*/
+
+#include "sstt2_decode.h"
+
+#include <thread>
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define SSTT2_DECODE_X86
+#include <immintrin.h>
+#endif
+
+uint64_t sstt2_decode_block_scalar(const unsigned char* data,
+                                   uint64_t n_events,
+                                   uint64_t* n_overflows,
+                                   int64_t* macrotimes,
+                                   uint64_t macrotimes_len,
+                                   uint64_t* n_events_decoded)
+{
+    uint64_t overflows = *n_overflows;
+    uint64_t n_photons = 0;
+    uint64_t i = 0;
+
+    for (; i < n_events; i++) {
+        uint64_t e = (uint64_t)sstt2_load_event(data + i * SSTT2_N_BYTES_TOT);
+        uint64_t signal = e & SSTT2_MASK_SIGNAL;
+        uint64_t value = (e >> SSTT2_N_BITS_SIGNAL) & SSTT2_MASK_MACRO;
+
+        if (signal == 1) {
+            // Overflow event
+            overflows += value;
+        } else if (signal == 0) {
+            if (n_photons == macrotimes_len) {
+                // No room left for this photon
+                break;
+            }
+
+            // Photon event, also account for the overflows
+            macrotimes[n_photons] = (int64_t)(value + overflows * SSTT2_OVERFLOW_VAL);
+            n_photons++;
+        }
+    }
+
+    *n_overflows = overflows;
+
+    if (n_events_decoded != nullptr) {
+        *n_events_decoded = i;
+    }
+
+    return n_photons;
+}
+
+void sstt2_count_block_scalar(const unsigned char* data,
+                              uint64_t n_events,
+                              uint64_t* n_photons,
+                              uint64_t* n_overflows)
+{
+    uint64_t photons = 0;
+    uint64_t overflows = 0;
+
+    for (uint64_t i = 0; i < n_events; i++) {
+        uint64_t e = (uint64_t)sstt2_load_event(data + i * SSTT2_N_BYTES_TOT);
+        uint64_t signal = e & SSTT2_MASK_SIGNAL;
+
+        if (signal == 1) {
+            overflows += (e >> SSTT2_N_BITS_SIGNAL) & SSTT2_MASK_OVERFLOW;
+        } else if (signal == 0) {
+            photons++;
+        }
+    }
+
+    *n_photons += photons;
+    *n_overflows += overflows;
+}
+
+uint64_t sstt2_count_photons_scalar(const unsigned char* data, uint64_t n_events)
+{
+    uint64_t photons = 0;
+
+    // The signal bits are the lowest bits of the first byte of an event
+    for (uint64_t i = 0; i < n_events; i++) {
+        photons += (data[i * SSTT2_N_BYTES_TOT] & SSTT2_MASK_SIGNAL) == 0;
+    }
+
+    return photons;
+}
+
+// Number of events counted at once when skipping
+#define SSTT2_SKIP_CHUNK_EVENTS     256
+
+uint64_t sstt2_skip_to_time(const unsigned char* data,
+                            uint64_t n_events,
+                            uint64_t* n_overflows,
+                            int64_t macrotime,
+                            uint64_t* n_photons_skipped)
+{
+    uint64_t overflows = *n_overflows;
+    uint64_t photons = 0;
+    uint64_t i = 0;
+
+    // Skip whole chunks with the (vectorized) counter, as long as they end before the macrotime
+    while (n_events - i >= SSTT2_SKIP_CHUNK_EVENTS) {
+        const unsigned char* chunk = data + i * SSTT2_N_BYTES_TOT;
+        uint64_t chunk_photons = 0;
+        uint64_t overflows_end = overflows;
+        int64_t last_macrotime = 0;
+
+        sstt2_count_block(chunk, SSTT2_SKIP_CHUNK_EVENTS, &chunk_photons, &overflows_end);
+
+        if (chunk_photons != 0 &&
+                sstt2_last_photon(chunk, SSTT2_SKIP_CHUNK_EVENTS, overflows_end, &last_macrotime) &&
+                last_macrotime >= macrotime) {
+            break;
+        }
+
+        photons += chunk_photons;
+        overflows = overflows_end;
+        i += SSTT2_SKIP_CHUNK_EVENTS;
+    }
+
+    for (; i < n_events; i++) {
+        uint64_t e = (uint64_t)sstt2_load_event(data + i * SSTT2_N_BYTES_TOT);
+        uint64_t signal = e & SSTT2_MASK_SIGNAL;
+        uint64_t value = (e >> SSTT2_N_BITS_SIGNAL) & SSTT2_MASK_MACRO;
+
+        if (signal == 1) {
+            overflows += value;
+        } else if (signal == 0) {
+            if ((int64_t)(value + overflows * SSTT2_OVERFLOW_VAL) >= macrotime) {
+                break;
+            }
+
+            photons++;
+        }
+    }
+
+    *n_overflows = overflows;
+    *n_photons_skipped += photons;
+
+    return i;
+}
+
+uint64_t sstt2_skip_photons(const unsigned char* data,
+                            uint64_t n_events,
+                            uint64_t* n_overflows,
+                            uint64_t n_photons,
+                            uint64_t* n_photons_skipped)
+{
+    uint64_t overflows = *n_overflows;
+    uint64_t photons = 0;
+    uint64_t i = 0;
+
+    // Skip whole chunks with the (vectorized) counter, as long as the photon is not in them
+    while (n_events - i >= SSTT2_SKIP_CHUNK_EVENTS) {
+        uint64_t chunk_photons = 0;
+        uint64_t chunk_overflows = 0;
+
+        sstt2_count_block(data + i * SSTT2_N_BYTES_TOT, SSTT2_SKIP_CHUNK_EVENTS, &chunk_photons, &chunk_overflows);
+
+        if (photons + chunk_photons > n_photons) {
+            break;
+        }
+
+        photons += chunk_photons;
+        overflows += chunk_overflows;
+        i += SSTT2_SKIP_CHUNK_EVENTS;
+    }
+
+    for (; i < n_events; i++) {
+        uint64_t e = (uint64_t)sstt2_load_event(data + i * SSTT2_N_BYTES_TOT);
+        uint64_t signal = e & SSTT2_MASK_SIGNAL;
+
+        if (signal == 1) {
+            overflows += (e >> SSTT2_N_BITS_SIGNAL) & SSTT2_MASK_OVERFLOW;
+        } else if (signal == 0) {
+            if (photons == n_photons) {
+                break;
+            }
+
+            photons++;
+        }
+    }
+
+    *n_overflows = overflows;
+    *n_photons_skipped += photons;
+
+    return i;
+}
+
+bool sstt2_last_photon(const unsigned char* data,
+                       uint64_t n_events,
+                       uint64_t n_overflows_end,
+                       int64_t* macrotime)
+{
+    uint64_t overflows = n_overflows_end;
+
+    for (uint64_t i = n_events; i > 0; i--) {
+        uint64_t e = (uint64_t)sstt2_load_event(data + (i - 1) * SSTT2_N_BYTES_TOT);
+        uint64_t signal = e & SSTT2_MASK_SIGNAL;
+        uint64_t value = (e >> SSTT2_N_BITS_SIGNAL) & SSTT2_MASK_MACRO;
+
+        if (signal == 1) {
+            // This overflow came after the photon we are looking for
+            overflows -= value;
+        } else if (signal == 0) {
+            *macrotime = (int64_t)(value + overflows * SSTT2_OVERFLOW_VAL);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#ifdef SSTT2_DECODE_X86
+
+// Permutation indices (in 32-bit units) that move the photon lanes
+// selected by a 4-bit mask to the front of a 256-bit register
+static const int32_t avx2_compact_lut[16][8] = {
+    {0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 1, 0, 0, 0, 0, 0, 0},
+    {2, 3, 0, 0, 0, 0, 0, 0},
+    {0, 1, 2, 3, 0, 0, 0, 0},
+    {4, 5, 0, 0, 0, 0, 0, 0},
+    {0, 1, 4, 5, 0, 0, 0, 0},
+    {2, 3, 4, 5, 0, 0, 0, 0},
+    {0, 1, 2, 3, 4, 5, 0, 0},
+    {6, 7, 0, 0, 0, 0, 0, 0},
+    {0, 1, 6, 7, 0, 0, 0, 0},
+    {2, 3, 6, 7, 0, 0, 0, 0},
+    {0, 1, 2, 3, 6, 7, 0, 0},
+    {4, 5, 6, 7, 0, 0, 0, 0},
+    {0, 1, 4, 5, 6, 7, 0, 0},
+    {2, 3, 4, 5, 6, 7, 0, 0},
+    {0, 1, 2, 3, 4, 5, 6, 7}
+};
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_load_4_events(const unsigned char* p)
+{
+    // Events 0,1 live in bytes 0-11, events 2,3 in bytes 12-23. Load each
+    // pair into its own 128-bit lane, then widen every 6-byte event to 64 bit.
+    const __m256i shuffle = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, -1, -1, 6, 7, 8, 9, 10, 11, -1, -1,
+                                             0, 1, 2, 3, 4, 5, -1, -1, 6, 7, 8, 9, 10, 11, -1, -1);
+    __m128i lo = _mm_loadu_si128((const __m128i*)p);
+    __m128i hi = _mm_loadu_si128((const __m128i*)(p + 2 * SSTT2_N_BYTES_TOT));
+    __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+    return _mm256_shuffle_epi8(v, shuffle);
+}
+
+__attribute__((target("avx2")))
+static uint64_t sstt2_decode_block_avx2(const unsigned char* data,
+                                        uint64_t n_events,
+                                        uint64_t* n_overflows,
+                                        int64_t* macrotimes,
+                                        uint64_t macrotimes_len,
+                                        uint64_t* n_events_decoded)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i mask_signal = _mm256_set1_epi64x(SSTT2_MASK_SIGNAL);
+
+    uint64_t overflows = *n_overflows;
+    uint64_t n_photons = 0;
+    uint64_t i = 0;
+
+    // Each iteration reads 28 bytes (the last 16-byte load starts at byte 12),
+    // so keep at least one spare event behind the block. It also stores four
+    // lanes, of which only the photon lanes are kept.
+    while (i + 5 <= n_events && n_photons + 4 <= macrotimes_len) {
+        __m256i e = avx2_load_4_events(data + i * SSTT2_N_BYTES_TOT);
+        __m256i signal = _mm256_and_si256(e, mask_signal);
+        __m256i value = _mm256_srli_epi64(e, SSTT2_N_BITS_SIGNAL);
+
+        __m256i is_overflow = _mm256_cmpeq_epi64(signal, one);
+        __m256i is_photon = _mm256_cmpeq_epi64(signal, zero);
+
+        // Inclusive prefix sum of the overflows over the four lanes
+        __m256i ovf = _mm256_and_si256(value, is_overflow);
+        __m256i shifted = _mm256_blend_epi32(_mm256_permute4x64_epi64(ovf, _MM_SHUFFLE(2, 1, 0, 0)), zero, 0x03);
+        ovf = _mm256_add_epi64(ovf, shifted);
+        shifted = _mm256_blend_epi32(_mm256_permute4x64_epi64(ovf, _MM_SHUFFLE(1, 0, 0, 0)), zero, 0x0F);
+        ovf = _mm256_add_epi64(ovf, shifted);
+
+        __m256i total_ovf = _mm256_add_epi64(ovf, _mm256_set1_epi64x((int64_t)overflows));
+        __m256i macro = _mm256_add_epi64(value, _mm256_slli_epi64(total_ovf, SSTT2_N_BITS_MACRO));
+
+        // Compact the photon lanes to the front and store them
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(is_photon));
+        __m256i perm = _mm256_loadu_si256((const __m256i*)avx2_compact_lut[mask]);
+        _mm256_storeu_si256((__m256i*)(macrotimes + n_photons), _mm256_permutevar8x32_epi32(macro, perm));
+
+        n_photons += __builtin_popcount(mask);
+        overflows += (uint64_t)_mm256_extract_epi64(ovf, 3);
+        i += 4;
+    }
+
+    *n_overflows = overflows;
+
+    uint64_t n_events_tail = 0;
+
+    n_photons += sstt2_decode_block_scalar(data + i * SSTT2_N_BYTES_TOT, n_events - i, n_overflows,
+                                           macrotimes + n_photons, macrotimes_len - n_photons, &n_events_tail);
+
+    if (n_events_decoded != nullptr) {
+        *n_events_decoded = i + n_events_tail;
+    }
+
+    return n_photons;
+}
+
+__attribute__((target("avx2")))
+static void sstt2_count_block_avx2(const unsigned char* data,
+                                   uint64_t n_events,
+                                   uint64_t* n_photons,
+                                   uint64_t* n_overflows)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i mask_signal = _mm256_set1_epi64x(SSTT2_MASK_SIGNAL);
+
+    __m256i photons = zero;
+    __m256i overflows = zero;
+    uint64_t i = 0;
+
+    while (i + 5 <= n_events) {
+        __m256i e = avx2_load_4_events(data + i * SSTT2_N_BYTES_TOT);
+        __m256i signal = _mm256_and_si256(e, mask_signal);
+        __m256i value = _mm256_srli_epi64(e, SSTT2_N_BITS_SIGNAL);
+
+        // Comparisons yield -1 for matching lanes
+        photons = _mm256_sub_epi64(photons, _mm256_cmpeq_epi64(signal, zero));
+        overflows = _mm256_add_epi64(overflows, _mm256_and_si256(value, _mm256_cmpeq_epi64(signal, one)));
+        i += 4;
+    }
+
+    uint64_t lanes[4];
+
+    _mm256_storeu_si256((__m256i*)lanes, photons);
+    *n_photons += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+    _mm256_storeu_si256((__m256i*)lanes, overflows);
+    *n_overflows += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+    sstt2_count_block_scalar(data + i * SSTT2_N_BYTES_TOT, n_events - i, n_photons, n_overflows);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i sse41_load_2_events(const unsigned char* p)
+{
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 3, 4, 5, -1, -1, 6, 7, 8, 9, 10, 11, -1, -1);
+
+    return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)p), shuffle);
+}
+
+__attribute__((target("sse4.1")))
+static uint64_t sstt2_decode_block_sse41(const unsigned char* data,
+                                         uint64_t n_events,
+                                         uint64_t* n_overflows,
+                                         int64_t* macrotimes,
+                                         uint64_t macrotimes_len,
+                                         uint64_t* n_events_decoded)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi64x(1);
+    const __m128i mask_signal = _mm_set1_epi64x(SSTT2_MASK_SIGNAL);
+
+    uint64_t overflows = *n_overflows;
+    uint64_t n_photons = 0;
+    uint64_t i = 0;
+
+    // Each iteration reads 16 bytes, i.e. a bit more than two events,
+    // and stores two lanes
+    while (i + 3 <= n_events && n_photons + 2 <= macrotimes_len) {
+        __m128i e = sse41_load_2_events(data + i * SSTT2_N_BYTES_TOT);
+        __m128i signal = _mm_and_si128(e, mask_signal);
+        __m128i value = _mm_srli_epi64(e, SSTT2_N_BITS_SIGNAL);
+
+        __m128i is_overflow = _mm_cmpeq_epi64(signal, one);
+        __m128i is_photon = _mm_cmpeq_epi64(signal, zero);
+
+        // Inclusive prefix sum of the overflows over the two lanes
+        __m128i ovf = _mm_and_si128(value, is_overflow);
+        ovf = _mm_add_epi64(ovf, _mm_slli_si128(ovf, 8));
+
+        __m128i total_ovf = _mm_add_epi64(ovf, _mm_set1_epi64x((int64_t)overflows));
+        __m128i macro = _mm_add_epi64(value, _mm_slli_epi64(total_ovf, SSTT2_N_BITS_MACRO));
+
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(is_photon));
+
+        if (mask == 2) {
+            // Only the second lane holds a photon; move it to the front
+            macro = _mm_unpackhi_epi64(macro, macro);
+        }
+
+        _mm_storeu_si128((__m128i*)(macrotimes + n_photons), macro);
+
+        n_photons += __builtin_popcount(mask);
+        overflows += (uint64_t)_mm_extract_epi64(ovf, 1);
+        i += 2;
+    }
+
+    *n_overflows = overflows;
+
+    uint64_t n_events_tail = 0;
+
+    n_photons += sstt2_decode_block_scalar(data + i * SSTT2_N_BYTES_TOT, n_events - i, n_overflows,
+                                           macrotimes + n_photons, macrotimes_len - n_photons, &n_events_tail);
+
+    if (n_events_decoded != nullptr) {
+        *n_events_decoded = i + n_events_tail;
+    }
+
+    return n_photons;
+}
+
+__attribute__((target("sse4.1")))
+static void sstt2_count_block_sse41(const unsigned char* data,
+                                    uint64_t n_events,
+                                    uint64_t* n_photons,
+                                    uint64_t* n_overflows)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi64x(1);
+    const __m128i mask_signal = _mm_set1_epi64x(SSTT2_MASK_SIGNAL);
+
+    __m128i photons = zero;
+    __m128i overflows = zero;
+    uint64_t i = 0;
+
+    while (i + 3 <= n_events) {
+        __m128i e = sse41_load_2_events(data + i * SSTT2_N_BYTES_TOT);
+        __m128i signal = _mm_and_si128(e, mask_signal);
+        __m128i value = _mm_srli_epi64(e, SSTT2_N_BITS_SIGNAL);
+
+        photons = _mm_sub_epi64(photons, _mm_cmpeq_epi64(signal, zero));
+        overflows = _mm_add_epi64(overflows, _mm_and_si128(value, _mm_cmpeq_epi64(signal, one)));
+        i += 2;
+    }
+
+    *n_photons += (uint64_t)_mm_cvtsi128_si64(photons) + (uint64_t)_mm_extract_epi64(photons, 1);
+    *n_overflows += (uint64_t)_mm_cvtsi128_si64(overflows) + (uint64_t)_mm_extract_epi64(overflows, 1);
+
+    sstt2_count_block_scalar(data + i * SSTT2_N_BYTES_TOT, n_events - i, n_photons, n_overflows);
+}
+
+__attribute__((target("sse4.1")))
+static uint64_t sstt2_count_photons_sse41(const unsigned char* data, uint64_t n_events)
+{
+    // Gathers the first byte of each event from 48 bytes (eight events) of
+    // data, which are spread over three 16-byte loads
+    const __m128i shuffle_0 = _mm_setr_epi8(0, 6, 12, -1, -1, -1, -1, -1, 0, 6, 12, -1, -1, -1, -1, -1);
+    const __m128i shuffle_1 = _mm_setr_epi8(-1, -1, -1, 2, 8, 14, -1, -1, -1, -1, -1, 2, 8, 14, -1, -1);
+    const __m128i shuffle_2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 4, 10, -1, -1, -1, -1, -1, -1, 4, 10);
+    const __m128i mask_signal = _mm_set1_epi8(SSTT2_MASK_SIGNAL);
+    const __m128i zero = _mm_setzero_si128();
+
+    uint64_t photons = 0;
+    uint64_t i = 0;
+
+    // Sixteen events (96 bytes) per iteration; the two halves of the
+    // shuffle masks select from the first and the second 48 bytes
+    while (i + 16 <= n_events) {
+        const __m128i* p = (const __m128i*)(data + i * SSTT2_N_BYTES_TOT);
+
+        __m128i lo = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128(p), shuffle_0),
+                                               _mm_shuffle_epi8(_mm_loadu_si128(p + 1), shuffle_1)),
+                                  _mm_shuffle_epi8(_mm_loadu_si128(p + 2), shuffle_2));
+        __m128i hi = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128(p + 3), shuffle_0),
+                                               _mm_shuffle_epi8(_mm_loadu_si128(p + 4), shuffle_1)),
+                                  _mm_shuffle_epi8(_mm_loadu_si128(p + 5), shuffle_2));
+
+        __m128i flags = _mm_blend_epi16(lo, hi, 0xF0);
+        __m128i is_photon = _mm_cmpeq_epi8(_mm_and_si128(flags, mask_signal), zero);
+
+        photons += __builtin_popcount(_mm_movemask_epi8(is_photon));
+        i += 16;
+    }
+
+    return photons + sstt2_count_photons_scalar(data + i * SSTT2_N_BYTES_TOT, n_events - i);
+}
+
+enum simd_level
+{
+    SIMD_NONE = 0,
+    SIMD_SSE41 = 1,
+    SIMD_AVX2 = 2
+};
+
+static int detect_simd_level()
+{
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        return SIMD_AVX2;
+    }
+
+    if (__builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3")) {
+        return SIMD_SSE41;
+    }
+
+    return SIMD_NONE;
+}
+
+static int simd_level()
+{
+    static const int level = detect_simd_level();
+
+    return level;
+}
+
+#endif // SSTT2_DECODE_X86
+
+uint64_t sstt2_decode_block_bounded(const unsigned char* data,
+                                    uint64_t n_events,
+                                    uint64_t* n_overflows,
+                                    int64_t* macrotimes,
+                                    uint64_t macrotimes_len,
+                                    uint64_t* n_events_decoded)
+{
+#ifdef SSTT2_DECODE_X86
+    switch (simd_level()) {
+    case SIMD_AVX2:
+        return sstt2_decode_block_avx2(data, n_events, n_overflows, macrotimes, macrotimes_len, n_events_decoded);
+    case SIMD_SSE41:
+        return sstt2_decode_block_sse41(data, n_events, n_overflows, macrotimes, macrotimes_len, n_events_decoded);
+    default:
+        break;
+    }
+#endif
+
+    return sstt2_decode_block_scalar(data, n_events, n_overflows, macrotimes, macrotimes_len, n_events_decoded);
+}
+
+uint64_t sstt2_decode_block(const unsigned char* data,
+                            uint64_t n_events,
+                            uint64_t* n_overflows,
+                            int64_t* macrotimes)
+{
+    return sstt2_decode_block_bounded(data, n_events, n_overflows, macrotimes, n_events, nullptr);
+}
+
+void sstt2_count_block(const unsigned char* data,
+                       uint64_t n_events,
+                       uint64_t* n_photons,
+                       uint64_t* n_overflows)
+{
+#ifdef SSTT2_DECODE_X86
+    switch (simd_level()) {
+    case SIMD_AVX2:
+        sstt2_count_block_avx2(data, n_events, n_photons, n_overflows);
+        return;
+    case SIMD_SSE41:
+        sstt2_count_block_sse41(data, n_events, n_photons, n_overflows);
+        return;
+    default:
+        break;
+    }
+#endif
+
+    sstt2_count_block_scalar(data, n_events, n_photons, n_overflows);
+}
+
+uint64_t sstt2_count_photons(const unsigned char* data, uint64_t n_events)
+{
+#ifdef SSTT2_DECODE_X86
+    if (simd_level() >= SIMD_SSE41) {
+        return sstt2_count_photons_sse41(data, n_events);
+    }
+#endif
+
+    return sstt2_count_photons_scalar(data, n_events);
+}
+
+unsigned int sstt2_resolve_n_threads(unsigned int n_threads)
+{
+    if (n_threads == 0) {
+        n_threads = std::thread::hardware_concurrency();
+    }
+
+    return n_threads == 0 ? 1 : n_threads;
+}
+
+std::vector<sstt2_segment> sstt2_count_segments(const unsigned char* data,
+                                                uint64_t n_events,
+                                                uint64_t n_overflows_before,
+                                                unsigned int n_threads)
+{
+    std::vector<sstt2_segment> segments;
+
+    if (n_events == 0) {
+        return segments;
+    }
+
+    n_threads = sstt2_resolve_n_threads(n_threads);
+
+    uint64_t n_segments = n_events / SSTT2_MIN_SEGMENT_EVENTS;
+
+    if (n_segments > n_threads) {
+        n_segments = n_threads;
+    } else if (n_segments == 0) {
+        n_segments = 1;
+    }
+
+    uint64_t events_per_segment = n_events / n_segments;
+
+    segments.resize(n_segments);
+
+    for (uint64_t i = 0; i < n_segments; i++) {
+        segments[i].first_event = i * events_per_segment;
+        segments[i].n_events = (i == n_segments - 1) ? n_events - segments[i].first_event : events_per_segment;
+        segments[i].n_photons = 0;
+        segments[i].n_overflows = 0;
+    }
+
+    // Pass one: count
+    sstt2_run_in_parallel(n_segments, n_threads, [&](uint64_t i) {
+        sstt2_count_block(data + segments[i].first_event * SSTT2_N_BYTES_TOT, segments[i].n_events,
+                          &segments[i].n_photons, &segments[i].n_overflows);
+    });
+
+    // Exclusive scan over the segments
+    uint64_t n_photons = 0;
+    uint64_t n_overflows = n_overflows_before;
+
+    for (uint64_t i = 0; i < n_segments; i++) {
+        segments[i].first_photon = n_photons;
+        segments[i].overflows_before = n_overflows;
+
+        n_photons += segments[i].n_photons;
+        n_overflows += segments[i].n_overflows;
+    }
+
+    return segments;
+}
+
+void sstt2_decode_segments(const unsigned char* data,
+                           const std::vector<sstt2_segment>& segments,
+                           int64_t* macrotimes,
+                           unsigned int n_threads)
+{
+    n_threads = sstt2_resolve_n_threads(n_threads);
+
+    // Pass two: decode every segment into its own slot. The bounded decoder
+    // guarantees that no segment writes into the slot of its neighbour.
+    sstt2_run_in_parallel(segments.size(), n_threads, [&](uint64_t i) {
+        uint64_t n_overflows = segments[i].overflows_before;
+
+        sstt2_decode_block_bounded(data + segments[i].first_event * SSTT2_N_BYTES_TOT, segments[i].n_events,
+                                   &n_overflows, macrotimes + segments[i].first_photon, segments[i].n_photons, nullptr);
+    });
+}
@@ -0,0 +1,263 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    sstt2_decode.h
+ * \brief   Block decoders for SSTT2 (version 2) event records
+ * \author  Stijn Hinterding
+*/
+
+/*
+	All SSTT2 reading paths funnel through the block decoders below.
+	An event is classified by its two signal bits:
+		0b00:	photon event, the 46 data bits hold the macrotime
+		0b01:	overflow event, the 46 data bits hold the number of overflows
+		other:	reserved, skipped
+
+	The vectorized decoders (AVX2, SSE4.1) are selected at run time,
+	based on the capabilities of the CPU, and produce exactly the same
+	output as the scalar decoder.
+*/
+
+#ifndef SSTT2_DECODE_H
+#define SSTT2_DECODE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <thread>
+#include <vector>
+
+#include "sstt_file2.h"
+
+static inline int64_t sstt2_load_event(const unsigned char* p)
+{
+    // Events are stored little-endian; the upper two bytes remain zero
+    int64_t event = 0;
+    memcpy(&event, p, SSTT2_N_BYTES_TOT);
+
+    return event;
+}
+
+static inline bool sstt2_is_header(const unsigned char* data, uint64_t size)
+{
+    return size >= sizeof(SSTT2_MAGIC) - 1 && memcmp(data, SSTT2_MAGIC, sizeof(SSTT2_MAGIC) - 1) == 0;
+}
+
+/**
+ * \brief   Decodes a block of SSTT2 events into macrotimes
+ *
+ * \param   data            Pointer to the first event of the block
+ * \param   n_events        The number of (complete) events in the block
+ * \param   n_overflows     Running number of overflows. Used as the starting offset, and updated with the overflows in this block.
+ * \param   macrotimes      Array to store the photon macrotimes in. Must have room for \p n_events elements.
+ * \returns The number of photons stored in \p macrotimes
+*/
+uint64_t sstt2_decode_block(const unsigned char* data,
+                            uint64_t n_events,
+                            uint64_t* n_overflows,
+                            int64_t* macrotimes);
+
+/**
+ * \brief   Decodes a block of SSTT2 events into a buffer of limited size
+ *
+ * Decoding stops at the first photon that does not fit in \p macrotimes anymore; nothing is ever
+ * written beyond \p macrotimes_len elements.
+ *
+ * \param   data                Pointer to the first event of the block
+ * \param   n_events            The number of (complete) events in the block
+ * \param   n_overflows         Running number of overflows. Used as the starting offset, and updated with the decoded overflows.
+ * \param   macrotimes          Array to store the photon macrotimes in
+ * \param   macrotimes_len      The number of elements in (capacity of) \p macrotimes
+ * \param   n_events_decoded    Is set to the number of events consumed (may be NULL). Decoding can be resumed from there.
+ * \returns The number of photons stored in \p macrotimes
+*/
+uint64_t sstt2_decode_block_bounded(const unsigned char* data,
+                                    uint64_t n_events,
+                                    uint64_t* n_overflows,
+                                    int64_t* macrotimes,
+                                    uint64_t macrotimes_len,
+                                    uint64_t* n_events_decoded);
+
+/**
+ * \brief   Counts the photons and overflows in a block of SSTT2 events, without storing any macrotimes
+ *
+ * \param   data            Pointer to the first event of the block
+ * \param   n_events        The number of (complete) events in the block
+ * \param   n_photons       The number of photon events is added to this value
+ * \param   n_overflows     The number of overflows is added to this value
+*/
+void sstt2_count_block(const unsigned char* data,
+                       uint64_t n_events,
+                       uint64_t* n_photons,
+                       uint64_t* n_overflows);
+
+/**
+ * \brief   Counts the photons in a block of SSTT2 events, looking only at the signal bits
+ *
+ * Faster than sstt2_count_block() when the number of overflows is not needed.
+ *
+ * \param   data            Pointer to the first event of the block
+ * \param   n_events        The number of (complete) events in the block
+ * \returns The number of photon events
+*/
+uint64_t sstt2_count_photons(const unsigned char* data, uint64_t n_events);
+
+/**
+ * \brief   Scalar reference implementation of sstt2_decode_block_bounded()
+*/
+uint64_t sstt2_decode_block_scalar(const unsigned char* data,
+                                   uint64_t n_events,
+                                   uint64_t* n_overflows,
+                                   int64_t* macrotimes,
+                                   uint64_t macrotimes_len,
+                                   uint64_t* n_events_decoded);
+
+/**
+ * \brief   Scalar reference implementation of sstt2_count_block()
+*/
+void sstt2_count_block_scalar(const unsigned char* data,
+                              uint64_t n_events,
+                              uint64_t* n_photons,
+                              uint64_t* n_overflows);
+
+/**
+ * \brief   Scalar reference implementation of sstt2_count_photons()
+*/
+uint64_t sstt2_count_photons_scalar(const unsigned char* data, uint64_t n_events);
+
+/**
+ * \brief   Skips events up to the first photon with a macrotime of at least \p macrotime
+ *
+ * \param   data                Pointer to the first event of the block
+ * \param   n_events            The number of (complete) events in the block
+ * \param   n_overflows         Running number of overflows, updated with the skipped overflows
+ * \param   macrotime           The macrotime to search for
+ * \param   n_photons_skipped   The number of skipped photons is added to this value
+ * \returns The number of events skipped. Equal to \p n_events if the photon was not found in this block.
+*/
+uint64_t sstt2_skip_to_time(const unsigned char* data,
+                            uint64_t n_events,
+                            uint64_t* n_overflows,
+                            int64_t macrotime,
+                            uint64_t* n_photons_skipped);
+
+/**
+ * \brief   Skips the given number of photons, stopping at the photon after them
+ *
+ * \param   data                Pointer to the first event of the block
+ * \param   n_events            The number of (complete) events in the block
+ * \param   n_overflows         Running number of overflows, updated with the skipped overflows
+ * \param   n_photons           The number of photons to skip
+ * \param   n_photons_skipped   The number of skipped photons is added to this value
+ * \returns The number of events skipped. Equal to \p n_events if the block holds no more than \p n_photons photons.
+*/
+uint64_t sstt2_skip_photons(const unsigned char* data,
+                            uint64_t n_events,
+                            uint64_t* n_overflows,
+                            uint64_t n_photons,
+                            uint64_t* n_photons_skipped);
+
+/**
+ * \brief   Finds the macrotime of the last photon in a block of events, scanning backwards from the end
+ *
+ * \param   data                Pointer to the first event of the block
+ * \param   n_events            The number of (complete) events in the block
+ * \param   n_overflows_end     The number of overflows at the end of the block
+ * \param   macrotime           Is set to the macrotime of the last photon
+ * \returns true if the block contains a photon
+*/
+bool sstt2_last_photon(const unsigned char* data,
+                       uint64_t n_events,
+                       uint64_t n_overflows_end,
+                       int64_t* macrotime);
+
+/*
+	Parallel decoding of one file: the events are split into segments.
+	The first pass counts the photons and overflows of each segment in
+	parallel. A prefix sum over the segments then gives every segment its
+	starting overflow count and its output position, so that the second
+	pass can decode all segments independently.
+*/
+
+struct sstt2_segment
+{
+public:
+    uint64_t first_event;
+    uint64_t n_events;
+    uint64_t n_photons;
+    uint64_t n_overflows;
+
+    // Filled in by the prefix sum
+    uint64_t first_photon;
+    uint64_t overflows_before;
+};
+
+/**
+ * \brief   Splits a block of events into segments, and counts the photons and overflows in each of them in parallel
+ *
+ * \param   data                Pointer to the first event
+ * \param   n_events            The number of (complete) events
+ * \param   n_overflows_before  The number of overflows preceding the first event
+ * \param   n_threads           The number of threads to use. Zero: use all hardware threads.
+ * \returns The segments, including the prefix sums. The total number of photons is given by the
+ *          first_photon + n_photons of the last segment.
+*/
+std::vector<sstt2_segment> sstt2_count_segments(const unsigned char* data,
+                                                uint64_t n_events,
+                                                uint64_t n_overflows_before,
+                                                unsigned int n_threads);
+
+/**
+ * \brief   Decodes all segments in parallel, each into its precomputed slot of \p macrotimes
+ *
+ * \param   data        Pointer to the first event, as passed to sstt2_count_segments()
+ * \param   segments    The segments returned by sstt2_count_segments()
+ * \param   macrotimes  Array to store the photon macrotimes in. Must have room for all photons.
+ * \param   n_threads   The number of threads to use. Zero: use all hardware threads.
+*/
+void sstt2_decode_segments(const unsigned char* data,
+                           const std::vector<sstt2_segment>& segments,
+                           int64_t* macrotimes,
+                           unsigned int n_threads);
+
+unsigned int sstt2_resolve_n_threads(unsigned int n_threads);
+
+// Segments smaller than this are not worth a thread of their own
+#define SSTT2_MIN_SEGMENT_EVENTS    (1 << 18)
+
+/**
+ * \brief   Calls \p func(i) for every segment i in [0, \p n_segments), on up to \p n_threads threads
+*/
+template <typename F>
+static void sstt2_run_in_parallel(uint64_t n_segments, unsigned int n_threads, F func)
+{
+    if (n_threads <= 1 || n_segments <= 1) {
+        for (uint64_t i = 0; i < n_segments; i++) {
+            func(i);
+        }
+
+        return;
+    }
+
+    std::vector<std::thread> threads;
+
+    for (unsigned int t = 1; t < n_threads && t < n_segments; t++) {
+        threads.push_back(std::thread([=]() {
+            for (uint64_t i = t; i < n_segments; i += n_threads) {
+                func(i);
+            }
+        }));
+    }
+
+    for (uint64_t i = 0; i < n_segments; i += n_threads) {
+        func(i);
+    }
+
+    for (size_t t = 0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+}
+
+#endif // SSTT2_DECODE_H
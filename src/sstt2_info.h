@@ -0,0 +1,36 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    sstt2_info.h
+ * \brief   Section markers and column names of the SSTT2 info (header) file
+ * \author  Stijn Hinterding
+*/
+
+#ifndef SSTT2_INFO_H
+#define SSTT2_INFO_H
+
+#define SSTT2_CHAN_HEADER_TEXT "CHANNEL_HEADER\n"
+
+#define SSTT2_HEADER_DELIMITER       "\t\n"
+#define SSTT2_HEADER_CHANID          "ChannelID"
+#define SSTT2_HEADER_FILENAME        "Filename"
+#define SSTT2_HEADER_NUMPHOTONS      "NumPhotons"
+#define SSTT2_HEADER_NUMOVERFLOWS    "NumOverflows"
+#define SSTT2_HEADER_FILESIZE        "Filesize"
+#define SSTT2_HEADER_SYNCDIV         "HardwareSyncDivider"
+#define SSTT2_HEADER_ADDI_SYNCDIV    "AdditionalSyncDivider"
+#define SSTT2_HEADER_TOTAL_SYNCDIV   "TotalSyncDivider"
+#define SSTT2_HEADER_IS_PULSES       "IsPulsesChannel"
+#define SSTT2_HEADER_HAS_PULSES      "HasPulsesChannel"
+#define SSTT2_HEADER_CORR_PULSECHAN  "CorrespondingPulsesChannel"
+#define SSTT2_HEADER_HAS_MICRO       "HasMicrotimes"
+
+#define SSTT2_EXP_HEADER_TEXT "EXPERIMENT_HEADER\n"
+
+#define SSTT2_HEADER_TIMEUNIT       "Time_unit_seconds"
+#define SSTT2_HEADER_DEV_TYPE       "device_type"
+#define SSTT2_HEADER_START_TIME     "experiment_start_timestamp_UTC"
+
+#endif // SSTT2_INFO_H
@@ -0,0 +1,288 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    sstt_dataset.cpp
+ * \brief   Loads all channels of an SSTT dataset concurrently, including the microtimes of pulse-linked channels
+ * \author  Stijn Hinterding
+*/
+
+#include "sstt_dataset.h"
+#include "sstt_file.h"
+#include "sstt_packed.h"
+#include "algos.h"
+#include "sstt2_decode.h"
+#include "timetag_reader.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+enum dataset_task_kind
+{
+    TASK_DECODE,
+    TASK_MICROTIMES
+};
+
+struct dataset_task
+{
+    dataset_task_kind kind;
+    size_t channel;
+};
+
+struct dataset_loader
+{
+    const std::string* info_filepath;
+    std::vector<channel_info_sstt2>* channels;
+    std::vector<sstt_channel_data>* data;
+    unsigned int n_threads_per_file;
+
+    std::vector<int64_t> pulses_index;  // Index of the pulses channel of every channel that needs microtimes; -1: none, -2: missing
+    std::vector<bool> decoded;
+    std::vector<int> results;
+
+    std::mutex mutex;
+    std::condition_variable task_ready;
+    std::deque<dataset_task> tasks;
+    size_t n_unfinished;                // Tasks queued, running, or still to be queued
+};
+
+static bool file_exists(const std::string& filepath)
+{
+    FILE* f = fopen(filepath.c_str(), "rb");
+
+    if (f == nullptr) {
+        return false;
+    }
+
+    fclose(f);
+    return true;
+}
+
+static int decode_channel(dataset_loader* l, size_t i)
+{
+    const channel_info_sstt2& ci = (*l->channels)[i];
+    sstt_channel_data& d = (*l->data)[i];
+    std::string filepath = *l->info_filepath + ".c" + std::to_string(ci.ID);
+
+    d.ID = ci.ID;
+
+    // Any single-channel format; version 1 files (no magic) always hold microtimes
+    timetag_read_options options;
+    options.n_threads = l->n_threads_per_file;
+    options.fallback = timetag_get_reader(TIMETAG_READER_SSTT1);
+
+    timetag_data file_data;
+
+    if (read_timetag_file(filepath, options, &file_data) != 0 || (file_data.reader->flags & TIMETAG_HAS_CHANNELS)) {
+        return 3;
+    }
+
+    d.macrotimes.swap(file_data.macrotimes);
+    d.microtimes.swap(file_data.microtimes);
+
+    // Microtimes kept by convert_sstt1_dataset()
+    std::string micro_filepath = filepath + SSTT1_MICRO_EXTENSION;
+
+    if (ci.channel_has_microtime && d.microtimes.empty() && file_exists(micro_filepath)) {
+        // A side stream that does not belong to these macrotimes is corrupt
+        if (read_packed_file(micro_filepath, &d.microtimes) != 0 || d.microtimes.size() != d.macrotimes.size()) {
+            d.microtimes.clear();
+            return 3;
+        }
+    }
+
+    if (ci.is_pulses_channel && d.macrotimes.size() > 1) {
+        double avg_period = (double)(d.macrotimes.back() - d.macrotimes.front()) / (double)(d.macrotimes.size() - 1);
+        d.pulse_period = (int64_t)round(avg_period / (double)(ci.sync_divider * ci.additional_sync_divider));
+    }
+
+    return 0;
+}
+
+static int gen_channel_microtimes(dataset_loader* l, size_t i)
+{
+    sstt_channel_data& d = (*l->data)[i];
+
+    if (l->pulses_index[i] < 0) {
+        return 4;
+    }
+
+    const channel_info_sstt2& pulses_ci = (*l->channels)[l->pulses_index[i]];
+    const std::vector<int64_t>& pulses = (*l->data)[l->pulses_index[i]].macrotimes;
+
+    d.microtimes.resize(d.macrotimes.size());
+
+    int success = gen_microtimes(pulses.data(), pulses.size(),
+                                 d.macrotimes.data(), d.macrotimes.size(),
+                                 d.microtimes.data(), d.microtimes.size(),
+                                 pulses_ci.sync_divider * pulses_ci.additional_sync_divider);
+
+    if (success != 0) {
+        d.microtimes.clear();
+        return 4;
+    }
+
+    return 0;
+}
+
+// Called with the mutex held, after channel i has been decoded: queues the microtimes that can now be generated
+static void queue_microtimes(dataset_loader* l, size_t i)
+{
+    l->decoded[i] = true;
+
+    for (size_t j = 0; j < l->pulses_index.size(); j++) {
+        int64_t p = l->pulses_index[j];
+
+        if (p == -1 || (j != i && p != (int64_t)i)) {
+            continue;
+        }
+
+        if (!l->decoded[j] || (p >= 0 && !l->decoded[p])) {
+            continue;
+        }
+
+        if (l->results[j] != 0 || (p >= 0 && l->results[p] != 0) || (*l->data)[j].macrotimes.empty()) {
+            // Nothing to generate
+            l->n_unfinished--;
+            continue;
+        }
+
+        dataset_task t;
+        t.kind = TASK_MICROTIMES;
+        t.channel = j;
+        l->tasks.push_back(t);
+        l->task_ready.notify_one();
+    }
+}
+
+static void dataset_worker(dataset_loader* l)
+{
+    std::unique_lock<std::mutex> lock(l->mutex);
+
+    while (true) {
+        l->task_ready.wait(lock, [l] { return !l->tasks.empty() || l->n_unfinished == 0; });
+
+        if (l->tasks.empty()) {
+            break;
+        }
+
+        dataset_task t = l->tasks.front();
+        l->tasks.pop_front();
+
+        lock.unlock();
+
+        int success = t.kind == TASK_DECODE ? decode_channel(l, t.channel) : gen_channel_microtimes(l, t.channel);
+
+        lock.lock();
+
+        if (success != 0) {
+            l->results[t.channel] = success;
+        }
+
+        if (t.kind == TASK_DECODE) {
+            queue_microtimes(l, t.channel);
+        }
+
+        if (--l->n_unfinished == 0) {
+            l->task_ready.notify_all();
+        }
+    }
+}
+
+int LIBTIMETAG_DLL load_sstt_dataset(const std::string& info_filepath,
+                                     exp_info_sstt2* exp_info,
+                                     std::vector<channel_info_sstt2>* channels,
+                                     std::vector<sstt_channel_data>* data,
+                                     unsigned int n_threads)
+{
+    if (data == nullptr) {
+        return 2;
+    }
+
+    int error_code = 0;
+    exp_info_sstt2 exp;
+    std::vector<channel_info_sstt2> info = get_sstt2_info(info_filepath.c_str(), &error_code, &exp);
+
+    if (error_code != 0) {
+        return 1;
+    }
+
+    data->clear();
+    data->resize(info.size());
+
+    dataset_loader l;
+    l.info_filepath = &info_filepath;
+    l.channels = &info;
+    l.data = data;
+    l.pulses_index.assign(info.size(), -1);
+    l.decoded.assign(info.size(), false);
+    l.results.assign(info.size(), 0);
+    l.n_unfinished = info.size();
+
+    for (size_t i = 0; i < info.size(); i++) {
+        dataset_task t;
+        t.kind = TASK_DECODE;
+        t.channel = i;
+        l.tasks.push_back(t);
+
+        if (!info[i].has_pulses_channel || info[i].channel_has_microtime) {
+            continue;
+        }
+
+        l.pulses_index[i] = -2;
+
+        for (size_t j = 0; j < info.size(); j++) {
+            if (info[j].ID == info[i].corresponding_pulses_channel) {
+                l.pulses_index[i] = (int64_t)j;
+                break;
+            }
+        }
+
+        l.n_unfinished++;
+    }
+
+    n_threads = sstt2_resolve_n_threads(n_threads);
+
+    // Channels are decoded in parallel first; left-over threads split the files
+    unsigned int n_workers = std::max(1u, std::min(n_threads, (unsigned int)info.size()));
+    l.n_threads_per_file = std::max(1u, n_threads / n_workers);
+
+    std::vector<std::thread> threads;
+
+    for (unsigned int t = 1; t < n_workers; t++) {
+        threads.push_back(std::thread(dataset_worker, &l));
+    }
+
+    dataset_worker(&l);
+
+    for (size_t t = 0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+
+    for (size_t i = 0; i < info.size(); i++) {
+        if (l.results[i] != 0) {
+            return l.results[i];
+        }
+
+        if (info[i].n_photons == 0) {
+            info[i].n_photons = (*data)[i].macrotimes.size();
+        }
+    }
+
+    if (exp_info != nullptr) {
+        *exp_info = exp;
+    }
+
+    if (channels != nullptr) {
+        *channels = info;
+    }
+
+    return 0;
+}
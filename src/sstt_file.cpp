@@ -9,13 +9,22 @@
 */
 
 #include "sstt_file.h"
+#include "sstt_file2.h"
+#include "sstt_writer2.h"
+#include "sstt_packed.h"
+#include "sstt2_decode.h"
+#include "mapped_file.h"
 #include "getline.h"
+#include "timetag_formats.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <thread>
 
 #define SSTT_CHAN_HEADER_TEXT "CHANNEL_HEADER\n"
 
@@ -24,34 +33,85 @@
 #define SSTT_HEADER_FILENAME        "Filename"
 #define SSTT_HEADER_NUMPHOTONS      "NumPhotons"
 
-struct processed_event
+// Number of events decoded at a time by the converter
+#define SSTT1_CONVERT_EVENTS        65536
+
+static inline uint64_t sstt1_load_event(const unsigned char* p)
 {
-    int64_t macrotime;
-    int64_t microtime;
-    uint64_t n_overflows;
-};
+    uint64_t event = 0;
+    memcpy(&event, p, SSTT_N_BYTES_EVENT);
 
-struct processed_event handle_event(int64_t e, uint64_t num_overflows)
+    return event;
+}
+
+/*
+	An event is classified by its two signal bits:
+		0b00:	photon event: 34 bits microtime, then 28 bits macrotime
+		0b01:	overflow event, the 62 data bits hold the number of overflows
+		other:	reserved, skipped
+*/
+template <bool store_macro, bool store_micro>
+static uint64_t sstt1_decode_block_tmpl(const unsigned char* data,
+                                        uint64_t n_events,
+                                        uint64_t* n_overflows,
+                                        int64_t* macrotimes,
+                                        int64_t* microtimes)
 {
-    // Prepare the return value
-    struct processed_event ret;
-    ret.macrotime = 0;
-    ret.microtime = 0;
-    ret.n_overflows = 0;
-
-    if ( (e & 1) && !( (e >> 1) & 1 ) ) {
-        // Overflow event
-        ret.n_overflows = (e >> SSTT_N_BITS_SIGNAL) & SSTT_MASK_OVERFLOW;
-    } else if ( !(e & 1) && !( (e >> 1) & 1)) {
-        // Photon event
-        ret.microtime = (e >> SSTT_N_BITS_SIGNAL) & SSTT_MASK_MICRO;
-        ret.macrotime = (e >> (SSTT_N_BITS_SIGNAL + SSTT_N_BITS_MICRO)) & SSTT_MASK_MACRO;
-
-        // Also account for the overflows
-        ret.macrotime += num_overflows * SSTT_OVERFLOW_VAL;
+    uint64_t overflows = *n_overflows;
+    uint64_t n = 0;
+
+    for (uint64_t i = 0; i < n_events; i++) {
+        uint64_t e = sstt1_load_event(data + i * SSTT_N_BYTES_EVENT);
+        uint64_t signal = e & SSTT_MASK_SIGNAL;
+
+        if (signal == 1) {
+            overflows += (e >> SSTT_N_BITS_SIGNAL) & SSTT_MASK_OVERFLOW;
+        } else if (signal == 0) {
+            if (store_macro) {
+                macrotimes[n] = (int64_t)(((e >> (SSTT_N_BITS_SIGNAL + SSTT_N_BITS_MICRO)) & SSTT_MASK_MACRO) +
+                                          overflows * SSTT_OVERFLOW_VAL);
+            }
+
+            if (store_micro) {
+                microtimes[n] = (int64_t)((e >> SSTT_N_BITS_SIGNAL) & SSTT_MASK_MICRO);
+            }
+
+            n++;
+        }
     }
 
-    return ret;
+    *n_overflows = overflows;
+
+    return n;
+}
+
+// Decodes a block of events; either output may be NULL. Returns the number of photons.
+static uint64_t sstt1_decode_block(const unsigned char* data,
+                                   uint64_t n_events,
+                                   uint64_t* n_overflows,
+                                   int64_t* macrotimes,
+                                   int64_t* microtimes)
+{
+    if (macrotimes != nullptr && microtimes != nullptr) {
+        return sstt1_decode_block_tmpl<true, true>(data, n_events, n_overflows, macrotimes, microtimes);
+    } else if (macrotimes != nullptr) {
+        return sstt1_decode_block_tmpl<true, false>(data, n_events, n_overflows, macrotimes, microtimes);
+    } else if (microtimes != nullptr) {
+        return sstt1_decode_block_tmpl<false, true>(data, n_events, n_overflows, macrotimes, microtimes);
+    }
+
+    return sstt1_decode_block_tmpl<false, false>(data, n_events, n_overflows, macrotimes, microtimes);
+}
+
+static uint64_t sstt1_count_photons(const unsigned char* data, uint64_t n_events)
+{
+    uint64_t n = 0;
+
+    for (uint64_t i = 0; i < n_events; i++) {
+        n += (sstt1_load_event(data + i * SSTT_N_BYTES_EVENT) & SSTT_MASK_SIGNAL) == 0;
+    }
+
+    return n;
 }
 
 int LIBTIMETAG_DLL n_photons_in_datafile(const char* directory,
@@ -62,27 +122,16 @@ int LIBTIMETAG_DLL n_photons_in_datafile(const char* directory,
         return 1;
     }
 
-    FILE* f = fopen((std::string(directory) + std::string(filename)).c_str(), "rb");
+    mapped_file mf;
 
-    if (f == NULL) {
+    if (map_file((std::string(directory) + std::string(filename)).c_str(), &mf) != 0) {
         // Error opening the file
         return 2;
     }
 
-    uint64_t n_overflows = 0;
-    uint64_t event = 0;
-    uint64_t n_read = fread(&event, 8, 1, f);
-
-    while (n_read == 1) {
-        struct processed_event pe = handle_event(event, n_overflows);
+    *ret += sstt1_count_photons(mf.data, mf.size / SSTT_N_BYTES_EVENT);
 
-        if (pe.n_overflows == 0)
-            (*ret)++;
-
-        n_read = fread(&event, 8, 1, f);
-    }
-
-    fclose(f);
+    unmap_file(&mf);
 
     return 0;
 }
@@ -91,52 +140,173 @@ int LIBTIMETAG_DLL read_data_file(const std::string& filepath,
                    std::vector<int64_t>* macrotimes,
                    std::vector<int64_t>* microtimes)
 {
-    bool save_macro = false;
-    bool save_micro = false;
+    if (macrotimes == NULL && microtimes == NULL) {
+        return 0;
+    }
+
+    mapped_file mf;
+
+    if (map_file(filepath.c_str(), &mf) != 0) {
+        // Error opening the file
+        return 1;
+    }
+
+    uint64_t n_events = mf.size / SSTT_N_BYTES_EVENT;
+    uint64_t n_photons = sstt1_count_photons(mf.data, n_events);
+    uint64_t n_overflows = 0;
+    int64_t* macro_ret = nullptr;
+    int64_t* micro_ret = nullptr;
 
-    // Check if input is valid
     if (macrotimes != NULL) {
-        save_macro = true;
+        macrotimes->resize(macrotimes->size() + n_photons);
+        macro_ret = macrotimes->data() + macrotimes->size() - n_photons;
     }
 
     if (microtimes != NULL) {
-        save_micro = true;
+        microtimes->resize(microtimes->size() + n_photons);
+        micro_ret = microtimes->data() + microtimes->size() - n_photons;
     }
 
-    if (!save_macro && !save_micro) {
-        return 0;
+    if (n_photons > 0) {
+        sstt1_decode_block(mf.data, n_events, &n_overflows, macro_ret, micro_ret);
     }
 
-    FILE* f = fopen(filepath.c_str(), "rb");
+    unmap_file(&mf);
 
-    if (f == NULL) {
-        // Error opening the file
-        return 1;
+    return 0;
+}
+
+// Converts a single data file; the macrotimes go to a channel of the SSTT2 writer
+static int convert_sstt1_data_file(const std::string& v1_filepath,
+                                   sstt2_writer* writer,
+                                   uint64_t channel_id,
+                                   const std::string& micro_filepath)
+{
+    mapped_file mf;
+
+    if (map_file(v1_filepath.c_str(), &mf) != 0) {
+        return 3;
     }
 
-    int64_t event = 0;
+    sstt_packed_writer* micro_writer = nullptr;
+
+    if (!micro_filepath.empty()) {
+        int error_code = 0;
+        micro_writer = sstt_packed_writer_open(micro_filepath, &error_code);
 
-    size_t n_read = fread(&event, 8, 1, f);
+        if (micro_writer == nullptr) {
+            unmap_file(&mf);
+            return 4;
+        }
+    }
+
+    std::vector<int64_t> macrotimes(SSTT1_CONVERT_EVENTS);
+    std::vector<int64_t> microtimes(micro_writer != nullptr ? SSTT1_CONVERT_EVENTS : 0);
+    const unsigned char* p = mf.data;
+    uint64_t n_events = mf.size / SSTT_N_BYTES_EVENT;
     uint64_t n_overflows = 0;
+    int success = 0;
+
+    while (n_events > 0 && success == 0) {
+        uint64_t n_block = std::min(n_events, (uint64_t)SSTT1_CONVERT_EVENTS);
+        uint64_t n = sstt1_decode_block(p, n_block, &n_overflows, macrotimes.data(),
+                                        micro_writer != nullptr ? microtimes.data() : nullptr);
 
-    while (n_read == 1) {
-        struct processed_event pe = handle_event(event, n_overflows);
+        success = sstt2_writer_write(writer, channel_id, macrotimes.data(), n);
 
-        if (pe.n_overflows != 0) {
-            // Update the number of overflows
-            n_overflows += pe.n_overflows;
-        } else {
-            // Store the photon
-            macrotimes->push_back(pe.macrotime);
-            microtimes->push_back(pe.microtime);
+        if (success == 4) {
+            success = 5;
+        } else if (success != 0) {
+            success = 4;
+        } else if (micro_writer != nullptr && sstt_packed_writer_write(micro_writer, microtimes.data(), n) != 0) {
+            success = 4;
         }
 
-        n_read = fread(&event, 8, 1, f);
+        p += n_block * SSTT_N_BYTES_EVENT;
+        n_events -= n_block;
     }
 
-    fclose(f);
+    if (sstt_packed_writer_close(micro_writer) != 0 && success == 0) {
+        success = 4;
+    }
 
-    return 0;
+    unmap_file(&mf);
+
+    return success;
+}
+
+int LIBTIMETAG_DLL convert_sstt1_dataset(const std::string& v1_info_filepath,
+                                         const std::string& v2_info_filepath,
+                                         int keep_microtimes,
+                                         unsigned int n_threads)
+{
+    // The version 1 header has the same layout as the SSTT2 one, minus some columns
+    int error_code = 0;
+    exp_info_sstt2 exp_info;
+    std::vector<channel_info_sstt2> channels = get_sstt2_info(v1_info_filepath.c_str(), &error_code, &exp_info);
+
+    if (error_code != 0) {
+        return 1;
+    }
+
+    if (exp_info.time_unit_seconds <= 0.0) {
+        exp_info.time_unit_seconds = SSTT1_DEFAULT_TIME_UNIT;
+    }
+
+    if (exp_info.device_type.empty()) {
+        exp_info.device_type = SSTT1_DEFAULT_DEVICE_TYPE;
+    }
+
+    for (size_t i = 0; i < channels.size(); i++) {
+        channels[i].channel_has_microtime = keep_microtimes != 0;
+    }
+
+    sstt2_writer* writer = sstt2_writer_open(v2_info_filepath, exp_info, channels, &error_code);
+
+    if (writer == nullptr) {
+        return 2;
+    }
+
+    std::vector<int> results(channels.size(), 0);
+    std::atomic<size_t> next_channel(0);
+
+    // Every thread converts whole channels; the writer's I/O thread does the writing
+    auto worker = [&]() {
+        size_t i = 0;
+
+        while ((i = next_channel++) < channels.size()) {
+            std::string v1_filepath = v1_info_filepath + ".c" + std::to_string(channels[i].ID);
+            std::string v2_filepath = v2_info_filepath + ".c" + std::to_string(channels[i].ID);
+
+            results[i] = convert_sstt1_data_file(v1_filepath, writer, channels[i].ID,
+                                                 keep_microtimes ? v2_filepath + SSTT1_MICRO_EXTENSION : std::string());
+        }
+    };
+
+    n_threads = std::min(sstt2_resolve_n_threads(n_threads), (unsigned int)channels.size());
+
+    std::vector<std::thread> threads;
+
+    for (unsigned int t = 1; t < n_threads; t++) {
+        threads.push_back(std::thread(worker));
+    }
+
+    worker();
+
+    for (size_t t = 0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+
+    int success = sstt2_writer_close(writer) == 0 ? 0 : 4;
+
+    for (size_t i = 0; i < results.size(); i++) {
+        if (results[i] != 0) {
+            success = results[i];
+            break;
+        }
+    }
+
+    return success;
 }
 
 std::vector<channel_info> LIBTIMETAG_DLL get_sstt_info(const char* filename, int* error_code)
@@ -270,3 +440,60 @@ std::vector<channel_info> LIBTIMETAG_DLL get_sstt_info(const char* filename, int
     *error_code = 0;
     return ret;
 }
+
+/*
+	Reader for the time-tag reader registry. Version 1 files have no
+	magic: this reader has no probe, and is only used where a caller
+	names it as the fallback for files that no reader recognizes.
+*/
+
+static int sstt1_open(const unsigned char*, uint64_t, timetag_layout* layout)
+{
+    layout->data_offset = 0;
+    layout->n_bytes_event = SSTT_N_BYTES_EVENT;
+
+    return 0;
+}
+
+static void sstt1_count(const timetag_layout*,
+                        const unsigned char* data,
+                        uint64_t n_events,
+                        uint64_t* n_photons,
+                        uint64_t* n_overflows)
+{
+    uint64_t photons = 0;
+    uint64_t overflows = 0;
+
+    for (uint64_t i = 0; i < n_events; i++) {
+        uint64_t e = sstt1_load_event(data + i * SSTT_N_BYTES_EVENT);
+        uint64_t signal = e & SSTT_MASK_SIGNAL;
+
+        photons += signal == 0;
+        overflows += (signal == 1) ? (e >> SSTT_N_BITS_SIGNAL) & SSTT_MASK_OVERFLOW : 0;
+    }
+
+    *n_photons += photons;
+    *n_overflows += overflows;
+}
+
+static uint64_t sstt1_decode(const timetag_layout*,
+                             const unsigned char* data,
+                             uint64_t n_events,
+                             uint64_t,
+                             uint64_t* n_overflows,
+                             int64_t* macrotimes,
+                             int64_t* microtimes,
+                             uint64_t*)
+{
+    return sstt1_decode_block(data, n_events, n_overflows, macrotimes, microtimes);
+}
+
+const timetag_reader sstt1_timetag_reader = {
+    TIMETAG_READER_SSTT1,
+    TIMETAG_HAS_MICROTIMES,
+    nullptr,
+    sstt1_open,
+    sstt1_count,
+    sstt1_decode,
+    nullptr
+};
@@ -9,92 +9,66 @@
 */
 
 #include "sstt_file2.h"
+#include "sstt_index2.h"
 #include "getline.h"
+#include "mapped_file.h"
+#include "sstt2_decode.h"
+#include "sstt2_info.h"
+#include "timetag_formats.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
 #include <cmath>
 
-#define SSTT2_CHAN_HEADER_TEXT "CHANNEL_HEADER\n"
+#define SSTT2_RANGE_BLOCK_EVENTS    65536
 
-#define SSTT2_HEADER_DELIMITER       "\t\n"
-#define SSTT2_HEADER_CHANID          "ChannelID"
-#define SSTT2_HEADER_FILENAME        "Filename"
-#define SSTT2_HEADER_NUMPHOTONS      "NumPhotons"
-#define SSTT2_HEADER_SYNCDIV         "HardwareSyncDivider"
-#define SSTT2_HEADER_ADDI_SYNCDIV    "AdditionalSyncDivider"
-#define SSTT2_HEADER_IS_PULSES       "IsPulsesChannel"
-#define SSTT2_HEADER_HAS_PULSES      "HasPulsesChannel"
-#define SSTT2_HEADER_CORR_PULSECHAN  "CorrespondingPulsesChannel"
-
-#define SSTT2_EXP_HEADER_TEXT "EXPERIMENT_HEADER\n"
-
-#define SSTT2_HEADER_TIMEUNIT       "Time_unit_seconds"
-#define SSTT2_HEADER_DEV_TYPE       "device_type"
-
-struct processed_event_sstt2
+static std::string join_path(const char* directory, const char* filename)
 {
-    int64_t macrotime;
-    uint64_t n_overflows;
-};
+    std::string path(directory == NULL ? "" : directory);
 
-struct processed_event_sstt2 handle_event_sstt2(int64_t e, uint64_t num_overflows)
-{
-    // Prepare the return value
-    struct processed_event_sstt2 ret;
-    ret.macrotime = 0;
-    ret.n_overflows = 0;
-
-    if ( (e & 1) && !( (e >> 1) & 1 ) ) {
-        // Overflow event
-        ret.n_overflows = (e >> SSTT2_N_BITS_SIGNAL) & SSTT2_MASK_OVERFLOW;
-    } else if ( !(e & 1) && !( (e >> 1) & 1)) {
-        // Photon event
-        ret.macrotime = (e >> SSTT2_N_BITS_SIGNAL) & SSTT2_MASK_MACRO;
-
-        // Also account for the overflows
-        ret.macrotime += num_overflows * SSTT2_OVERFLOW_VAL;
+    if (!path.empty() && path.back() != '/' && path.back() != '\\') {
+        path += '/';
     }
 
-    return ret;
+    return path + filename;
 }
 
 int LIBTIMETAG_DLL n_photons_in_datafile_sstt2(const char* directory,
                           const char* filename,
                           uint64_t* ret)
 {
-    if (ret == NULL) {
+    if (ret == NULL || filename == NULL) {
         return 1;
     }
 
-    FILE* f = fopen((std::string(directory) + std::string(filename)).c_str(), "rb");
+    *ret = 0;
 
-    if (f == NULL) {
+    std::string filepath = join_path(directory, filename);
+    mapped_file mf;
+
+    if (map_file(filepath.c_str(), &mf) != 0) {
         // Error opening the file
         return 2;
     }
 
-    // Read in the header
-    std::vector<char> header(18,'\0');
+    if (mf.size > SSTT2_N_BYTES_HEADER) {
+        uint64_t n_events = (mf.size - SSTT2_N_BYTES_HEADER) / SSTT2_N_BYTES_TOT;
+        sstt2_index index;
 
-    size_t n_read = fread(header.data(), SSTT2_N_BYTES_HEADER, 1, f);
-
-    uint64_t n_overflows = 0;
-    uint64_t event = 0;
-   n_read = fread(&event, SSTT2_N_BYTES_TOT, 1, f);
-
-    while (n_read == 1) {
-        struct processed_event_sstt2 pe = handle_event_sstt2(event, n_overflows);
-
-        if (pe.n_overflows == 0)
-            (*ret)++;
-
-        n_read = fread(&event, SSTT2_N_BYTES_TOT, 1, f);
+        // An index that covers the whole file already holds the count
+        if (read_sstt2_index(sstt2_index_filepath(filepath), &index) == 0 &&
+                index.indexed_size == SSTT2_N_BYTES_HEADER + n_events * SSTT2_N_BYTES_TOT &&
+                sstt2_index_matches(index, mf.data, mf.size)) {
+            *ret = index.n_photons;
+        } else {
+            *ret = sstt2_count_photons(mf.data + SSTT2_N_BYTES_HEADER, n_events);
+        }
     }
 
-    fclose(f);
+    unmap_file(&mf);
 
     return 0;
 }
@@ -127,63 +101,316 @@ int LIBTIMETAG_DLL read_data_file_sstt2(const std::string& filepath,
                          uint64_t n_events_to_skip,
                          uint64_t n_overflows_had,
                          uint64_t* n_overflows_in_file)
+{
+    return read_data_file_sstt2_parallel(filepath, macrotimes, n_events_to_skip, n_overflows_had, n_overflows_in_file, 1);
+}
+
+int LIBTIMETAG_DLL read_data_file_sstt2_parallel(const std::string& filepath,
+                                                 std::vector<int64_t>* macrotimes,
+                                                 uint64_t n_events_to_skip,
+                                                 uint64_t n_overflows_had,
+                                                 uint64_t* n_overflows_in_file,
+                                                 unsigned int n_threads)
 {
     if (macrotimes == nullptr) {
         return 2;
     }
 
-    if (!test_is_sstt2_file(filepath)) {
+    // Map the entire file, and decode straight from the mapped bytes
+    mapped_file mf;
+
+    if (map_file(filepath.c_str(), &mf) != 0) {
+        // Error opening the file
+        return 1;
+    }
+
+    if (!sstt2_is_header(mf.data, mf.size)) {
+        unmap_file(&mf);
         return 3;
     }
 
-    FILE* f = fopen(filepath.c_str(), "rb");
+    uint64_t offset = SSTT2_N_BYTES_HEADER;
+    uint64_t n_overflows = 0;
 
-    if (f == NULL) {
-        // Error opening the file
+    if (n_events_to_skip != 0) {
+        offset += SSTT2_N_BYTES_TOT * (n_events_to_skip + n_overflows_had);
+        n_overflows = n_overflows_had;
+    }
+
+    if (offset < mf.size) {
+        uint64_t n_events = (mf.size - offset) / SSTT2_N_BYTES_TOT;
+        uint64_t n_had = macrotimes->size();
+
+        if (sstt2_resolve_n_threads(n_threads) == 1) {
+            // Every event is at most one photon; trim the excess after decoding
+            macrotimes->resize(n_had + n_events);
+
+            uint64_t n_photons = sstt2_decode_block(mf.data + offset, n_events, &n_overflows, macrotimes->data() + n_had);
+
+            macrotimes->resize(n_had + n_photons);
+        } else {
+            // Count first, so that each segment knows where its photons go
+            std::vector<sstt2_segment> segments = sstt2_count_segments(mf.data + offset, n_events, n_overflows, n_threads);
+            const sstt2_segment& last = segments.back();
+
+            macrotimes->resize(n_had + last.first_photon + last.n_photons);
+
+            sstt2_decode_segments(mf.data + offset, segments, macrotimes->data() + n_had, n_threads);
+
+            n_overflows = last.overflows_before + last.n_overflows;
+        }
+    }
+
+    unmap_file(&mf);
+
+    if (n_overflows_in_file != nullptr) {
+        *n_overflows_in_file = n_overflows;
+    }
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL read_data_file_sstt2_range(const std::string& filepath,
+                                              std::vector<int64_t>* macrotimes,
+                                              int64_t t_start,
+                                              int64_t t_stop)
+{
+    if (macrotimes == nullptr) {
+        return 2;
+    }
+
+    mapped_file mf;
+
+    if (map_file(filepath.c_str(), &mf) != 0) {
         return 1;
     }
 
-    // Read in the header
-    std::vector<char> header(18,'\0');
+    if (!sstt2_is_header(mf.data, mf.size)) {
+        unmap_file(&mf);
+        return 3;
+    }
 
-    size_t n_read = fread(header.data(), SSTT2_N_BYTES_HEADER, 1, f);
+    uint64_t offset = SSTT2_N_BYTES_HEADER;
     uint64_t n_overflows = 0;
 
-    if (n_events_to_skip != 0) {
-        int success = fseek(f, SSTT2_N_BYTES_TOT * (n_events_to_skip + n_overflows_had), SEEK_CUR);
+    // If there is an index, start at the checkpoint closest to t_start.
+    // Do not build one here; the block skipping below is cheap enough.
+    sstt2_index index;
+
+    if (read_sstt2_index(sstt2_index_filepath(filepath), &index) == 0 &&
+            sstt2_index_matches(index, mf.data, mf.size) &&
+            !index.checkpoints.empty()) {
+        const sstt2_checkpoint& cp = index.checkpoints[sstt2_index_find_time(index, t_start)];
+
+        offset = cp.byte_offset;
+        n_overflows = cp.n_overflows;
+    }
+
+    const unsigned char* p = mf.data + offset;
+    uint64_t n_events = (mf.size > offset) ? (mf.size - offset) / SSTT2_N_BYTES_TOT : 0;
 
-        if (success != 0) {
-            printf("ERROR: cound not skip required number (%lld photons, %lld overflows) of events! \n", n_events_to_skip, n_overflows_had);
-            return 4;
+    // Skip whole blocks that end before t_start. This only needs the
+    // signal bits and the overflow records, not the photon macrotimes.
+    while (n_events > 0) {
+        uint64_t n_block = std::min(n_events, (uint64_t)SSTT2_RANGE_BLOCK_EVENTS);
+        uint64_t n_photons_block = 0;
+        uint64_t n_overflows_end = n_overflows;
+        int64_t last_macrotime = 0;
+
+        sstt2_count_block(p, n_block, &n_photons_block, &n_overflows_end);
+
+        if (n_photons_block != 0 &&
+                sstt2_last_photon(p, n_block, n_overflows_end, &last_macrotime) &&
+                last_macrotime >= t_start) {
+            break;
         }
 
-        n_overflows = n_overflows_had;
+        n_overflows = n_overflows_end;
+        p += n_block * SSTT2_N_BYTES_TOT;
+        n_events -= n_block;
     }
 
-    int64_t event = 0;
+    // The first photon of the window lies in the current block
+    uint64_t n_photons_skipped = 0;
+    uint64_t n_skipped = sstt2_skip_to_time(p, n_events, &n_overflows, t_start, &n_photons_skipped);
 
-    n_read = fread(&event, SSTT2_N_BYTES_TOT, 1, f);
+    p += n_skipped * SSTT2_N_BYTES_TOT;
+    n_events -= n_skipped;
 
-    while (n_read == 1) {
-        struct processed_event_sstt2 pe = handle_event_sstt2(event, n_overflows);
+    // Decode block by block, until we are past t_stop
+    while (n_events > 0) {
+        uint64_t n_block = std::min(n_events, (uint64_t)SSTT2_RANGE_BLOCK_EVENTS);
+        uint64_t n_had = macrotimes->size();
 
-        if (pe.n_overflows != 0) {
-            // Update the number of overflows
-            n_overflows += pe.n_overflows;
-        } else {
-            // Store the photon
-            macrotimes->push_back(pe.macrotime);
+        macrotimes->resize(n_had + n_block);
+
+        uint64_t n_photons = sstt2_decode_block(p, n_block, &n_overflows, macrotimes->data() + n_had);
+        std::vector<int64_t>::iterator block_end = macrotimes->begin() + n_had + n_photons;
+        std::vector<int64_t>::iterator stop = std::lower_bound(macrotimes->begin() + n_had, block_end, t_stop);
+
+        macrotimes->resize(stop - macrotimes->begin());
+
+        if (stop != block_end) {
+            break;
         }
 
-        n_read = fread(&event, SSTT2_N_BYTES_TOT, 1, f);
+        p += n_block * SSTT2_N_BYTES_TOT;
+        n_events -= n_block;
     }
 
-    fclose(f);
+    unmap_file(&mf);
 
-    if (n_overflows_in_file != nullptr) {
-        *n_overflows_in_file = n_overflows;
+    return 0;
+}
+
+// Macrotime of the photon event at p
+static inline int64_t photon_macrotime(const unsigned char* p, uint64_t n_overflows)
+{
+    uint64_t value = ((uint64_t)sstt2_load_event(p) >> SSTT2_N_BITS_SIGNAL) & SSTT2_MASK_MACRO;
+
+    return (int64_t)(value + n_overflows * SSTT2_OVERFLOW_VAL);
+}
+
+int LIBTIMETAG_DLL read_data_file_sstt2_decimated(const std::string& filepath,
+                                                  std::vector<int64_t>* macrotimes,
+                                                  uint64_t photon_step,
+                                                  int64_t time_quantum)
+{
+    if (macrotimes == nullptr) {
+        return 2;
+    }
+
+    if ((photon_step == 0) == (time_quantum <= 0)) {
+        return 4;
+    }
+
+    mapped_file mf;
+
+    if (map_file(filepath.c_str(), &mf) != 0) {
+        return 1;
+    }
+
+    if (!sstt2_is_header(mf.data, mf.size)) {
+        unmap_file(&mf);
+        return 3;
     }
 
+    // Only use an existing index, as read_data_file_sstt2_range() does
+    sstt2_index index;
+    bool has_index = read_sstt2_index(sstt2_index_filepath(filepath), &index) == 0 &&
+            sstt2_index_matches(index, mf.data, mf.size) &&
+            !index.checkpoints.empty();
+
+    uint64_t offset = SSTT2_N_BYTES_HEADER;
+    uint64_t n_overflows = 0;
+    uint64_t photon_index = 0;      // Photons before offset
+
+    uint64_t next_photon = 0;       // Next photon to take (photon_step)
+    int64_t next_time = INT64_MIN;  // Start of the next time quantum (time_quantum)
+    bool done = false;
+
+    while (!done && offset + SSTT2_N_BYTES_TOT <= mf.size) {
+        uint64_t n_events = (mf.size - offset) / SSTT2_N_BYTES_TOT;
+
+        if (has_index) {
+            uint64_t c = photon_step > 0 ? sstt2_index_find_photon(index, next_photon) : sstt2_index_find_time(index, next_time);
+
+            if (photon_step == 0) {
+                // The first photon after a checkpoint is known without reading the
+                // file; take it if it lies within the next quantum
+                uint64_t c_next = index.checkpoints[c].macrotime >= next_time ? c : c + 1;
+
+                if (c_next < index.checkpoints.size()) {
+                    int64_t t = index.checkpoints[c_next].macrotime;
+
+                    if (t != INT64_MAX && t / time_quantum == std::max(next_time, (int64_t)0) / time_quantum) {
+                        macrotimes->push_back(t);
+                        done = t / time_quantum >= INT64_MAX / time_quantum;
+                        next_time = (t / time_quantum + 1) * time_quantum;
+                        continue;
+                    }
+                }
+            }
+
+            // Jump to the checkpoint just before the next photon to take; that
+            // photon then lies within one interval, which is scanned directly.
+            const sstt2_checkpoint& cp = index.checkpoints[c];
+
+            if (cp.byte_offset > offset) {
+                offset = cp.byte_offset;
+                n_overflows = cp.n_overflows;
+                photon_index = cp.photon_index;
+                continue;
+            }
+        } else {
+            // Skip whole blocks without a photon to take. Counting a block
+            // only needs the signal bits and the overflow records.
+            uint64_t n_block = std::min(n_events, (uint64_t)SSTT2_RANGE_BLOCK_EVENTS);
+            const unsigned char* p = mf.data + offset;
+            uint64_t n_photons_block = 0;
+            uint64_t n_overflows_end = n_overflows;
+            int64_t last_macrotime = 0;
+
+            sstt2_count_block(p, n_block, &n_photons_block, &n_overflows_end);
+
+            bool has_sample = photon_step > 0 ?
+                        photon_index + n_photons_block > next_photon :
+                        n_photons_block != 0 &&
+                        sstt2_last_photon(p, n_block, n_overflows_end, &last_macrotime) &&
+                        last_macrotime >= next_time;
+
+            if (!has_sample) {
+                offset += n_block * SSTT2_N_BYTES_TOT;
+                n_overflows = n_overflows_end;
+                photon_index += n_photons_block;
+                continue;
+            }
+
+            n_events = n_block;
+        }
+
+        // Take the photons within these events, or only the next one if the index can jump further
+        const unsigned char* p = mf.data + offset;
+        uint64_t n_left = n_events;
+
+        while (n_left > 0) {
+            uint64_t n_skipped = photon_step > 0 ?
+                        sstt2_skip_photons(p, n_left, &n_overflows, next_photon - photon_index, &photon_index) :
+                        sstt2_skip_to_time(p, n_left, &n_overflows, next_time, &photon_index);
+
+            p += n_skipped * SSTT2_N_BYTES_TOT;
+            n_left -= n_skipped;
+
+            if (n_left == 0) {
+                break;
+            }
+
+            // p now points at the photon to take
+            int64_t t = photon_macrotime(p, n_overflows);
+            macrotimes->push_back(t);
+
+            p += SSTT2_N_BYTES_TOT;
+            n_left--;
+            photon_index++;
+
+            if (photon_step > 0) {
+                done = next_photon > UINT64_MAX - photon_step;
+                next_photon += photon_step;
+            } else {
+                done = t / time_quantum >= INT64_MAX / time_quantum;
+                next_time = (t / time_quantum + 1) * time_quantum;
+            }
+
+            if (done || has_index) {
+                break;
+            }
+        }
+
+        offset = p - mf.data;
+    }
+
+    unmap_file(&mf);
+
     return 0;
 }
 
@@ -248,6 +475,7 @@ std::vector<channel_info_sstt2> LIBTIMETAG_DLL get_sstt2_info(const char* filena
     int index_is_pulsechan = -1;
     int index_has_pulsechan = -1;
     int index_corr_pulsechan = -1;
+    int index_has_micro = -1;
 
     long start_chan_data_seek_pos = 0;
     int64_t n_channels = 0;
@@ -318,6 +546,9 @@ std::vector<channel_info_sstt2> LIBTIMETAG_DLL get_sstt2_info(const char* filena
 
         if (start_chan_header) {
             start_chan_header = 0;
+
+            // The last column title would otherwise include the line ending
+            line[strcspn(line, "\r\n")] = '\0';
             char* substring = strtok(line, SSTT2_HEADER_DELIMITER);
 
             unsigned int index = 0;
@@ -341,6 +572,8 @@ std::vector<channel_info_sstt2> LIBTIMETAG_DLL get_sstt2_info(const char* filena
                     index_has_pulsechan= index;
                 } else if (strcmp(substring, SSTT2_HEADER_CORR_PULSECHAN) == 0) {
                     index_corr_pulsechan = index;
+                } else if (strcmp(substring, SSTT2_HEADER_HAS_MICRO) == 0) {
+                    index_has_micro = index;
                 }
 
                 index++;
@@ -418,6 +651,8 @@ std::vector<channel_info_sstt2> LIBTIMETAG_DLL get_sstt2_info(const char* filena
                 ci.has_pulses_channel= (bool)atoi(substring);
             } else if (index == index_corr_pulsechan) {
                 ci.corresponding_pulses_channel = atoi(substring);
+            } else if (index == index_has_micro) {
+                ci.channel_has_microtime = (bool)atoi(substring);
             }
 
             index++;
@@ -440,3 +675,51 @@ std::vector<channel_info_sstt2> LIBTIMETAG_DLL get_sstt2_info(const char* filena
 
     return ret;
 }
+
+/*
+	Reader for the time-tag reader registry
+*/
+
+static int sstt2_probe(const unsigned char* data, uint64_t size)
+{
+    return sstt2_is_header(data, size) ? 1 : 0;
+}
+
+static int sstt2_open(const unsigned char*, uint64_t, timetag_layout* layout)
+{
+    layout->data_offset = SSTT2_N_BYTES_HEADER;
+    layout->n_bytes_event = SSTT2_N_BYTES_TOT;
+
+    return 0;
+}
+
+static void sstt2_count(const timetag_layout*,
+                        const unsigned char* data,
+                        uint64_t n_events,
+                        uint64_t* n_photons,
+                        uint64_t* n_overflows)
+{
+    sstt2_count_block(data, n_events, n_photons, n_overflows);
+}
+
+static uint64_t sstt2_decode(const timetag_layout*,
+                             const unsigned char* data,
+                             uint64_t n_events,
+                             uint64_t n_photons,
+                             uint64_t* n_overflows,
+                             int64_t* macrotimes,
+                             int64_t*,
+                             uint64_t*)
+{
+    return sstt2_decode_block_bounded(data, n_events, n_overflows, macrotimes, n_photons, nullptr);
+}
+
+const timetag_reader sstt2_timetag_reader = {
+    TIMETAG_READER_SSTT2,
+    TIMETAG_SIMPLE_EVENTS,
+    sstt2_probe,
+    sstt2_open,
+    sstt2_count,
+    sstt2_decode,
+    nullptr
+};
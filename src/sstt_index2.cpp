@@ -0,0 +1,363 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    sstt_index2.cpp
+ * \brief   Checkpoint index for "small simple time-tagged" (SSTT) data files, version 2.
+ * \author  Stijn Hinterding
+*/
+
+#include "sstt_index2.h"
+#include "timetag_reader.h"
+#include "mapped_file.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#define SSTT2_INDEX_N_HEADER_FIELDS 7
+
+std::string LIBTIMETAG_DLL sstt2_index_filepath(const std::string& filepath)
+{
+    return filepath + SSTT2_INDEX_EXTENSION;
+}
+
+// Finds the reader of an event stream, and parses its header; returns false if the file is not one
+static bool open_event_stream(const unsigned char* data, uint64_t size, const timetag_reader** reader, timetag_layout* layout)
+{
+    *reader = timetag_find_reader(data, size);
+
+    if (*reader == nullptr || (*reader)->open == nullptr) {
+        return false;
+    }
+
+    layout->flags = (*reader)->flags;
+
+    return (*reader)->open(data, size, layout) == 0 && layout->n_bytes_event != 0 && layout->data_offset <= size;
+}
+
+// The raw bytes (at most eight) of the last event before \p end; zero if there is none
+static uint64_t last_event_bytes(const timetag_layout& layout, const unsigned char* data, uint64_t end)
+{
+    uint64_t bytes = 0;
+
+    if (end >= layout.data_offset + layout.n_bytes_event) {
+        memcpy(&bytes, data + end - layout.n_bytes_event, std::min(layout.n_bytes_event, (uint64_t)sizeof(bytes)));
+    }
+
+    return bytes;
+}
+
+// Decodes the first photon in the events at \p data; returns false if there is none
+static bool first_photon(const timetag_reader* reader,
+                         const timetag_layout& layout,
+                         const unsigned char* data,
+                         uint64_t n_events,
+                         uint64_t n_overflows,
+                         int64_t* macrotime)
+{
+    // Every event holds at most one photon
+    for (uint64_t i = 0; i < n_events; i++) {
+        const unsigned char* p = data + i * layout.n_bytes_event;
+        uint64_t n_photons = 0;
+        uint64_t n_overflows_event = 0;
+
+        reader->count_block(&layout, p, 1, &n_photons, &n_overflows_event);
+
+        if (n_photons != 0) {
+            reader->decode_block(&layout, p, 1, 1, &n_overflows, macrotime, nullptr, nullptr);
+            return true;
+        }
+
+        n_overflows += n_overflows_event;
+    }
+
+    return false;
+}
+
+// Decodes the first photon of the interval at a checkpoint again, and compares it
+static bool checkpoint_matches(const sstt2_index& index,
+                               const timetag_reader* reader,
+                               const timetag_layout& layout,
+                               const sstt2_checkpoint& cp,
+                               const unsigned char* data)
+{
+    if (cp.byte_offset < layout.data_offset || cp.byte_offset > index.indexed_size ||
+            (cp.byte_offset - layout.data_offset) % layout.n_bytes_event != 0) {
+        return false;
+    }
+
+    uint64_t n_events = std::min(index.interval, (index.indexed_size - cp.byte_offset) / layout.n_bytes_event);
+    int64_t macrotime = 0;
+
+    // An interval without photons took the macrotime of a later one; there is nothing to compare
+    if (!first_photon(reader, layout, data + cp.byte_offset, n_events, cp.n_overflows, &macrotime)) {
+        return true;
+    }
+
+    return macrotime == cp.macrotime;
+}
+
+int LIBTIMETAG_DLL sstt2_index_matches(const sstt2_index& index, const unsigned char* data, uint64_t size)
+{
+    const timetag_reader* reader = nullptr;
+    timetag_layout layout;
+
+    if (data == nullptr || !open_event_stream(data, size, &reader, &layout) ||
+            index.indexed_size > size || index.indexed_size < layout.data_offset) {
+        return 0;
+    }
+
+    if (last_event_bytes(layout, data, index.indexed_size) != index.last_event) {
+        return 0;
+    }
+
+    if (!index.checkpoints.empty() &&
+            (!checkpoint_matches(index, reader, layout, index.checkpoints.front(), data) ||
+             !checkpoint_matches(index, reader, layout, index.checkpoints.back(), data))) {
+        return 0;
+    }
+
+    return 1;
+}
+
+int LIBTIMETAG_DLL build_sstt2_index(const std::string& filepath, sstt2_index* index)
+{
+    if (index == nullptr) {
+        return 2;
+    }
+
+    mapped_file mf;
+
+    if (map_file(filepath.c_str(), &mf) != 0) {
+        return 1;
+    }
+
+    const timetag_reader* reader = nullptr;
+    timetag_layout layout;
+
+    if (!open_event_stream(mf.data, mf.size, &reader, &layout)) {
+        unmap_file(&mf);
+        return 3;
+    }
+
+    if (index->interval == 0) {
+        index->interval = SSTT2_INDEX_DEFAULT_INTERVAL;
+    }
+
+    // Start at the header, or continue from the last checkpoint. The last
+    // interval may have been incomplete, so it is scanned again.
+    sstt2_checkpoint state;
+    state.byte_offset = layout.data_offset;
+    state.photon_index = 0;
+    state.n_overflows = 0;
+
+    if (index->checkpoints.empty() || !sstt2_index_matches(*index, mf.data, mf.size)) {
+        index->checkpoints.clear();
+    } else {
+        state = index->checkpoints.back();
+        index->checkpoints.pop_back();
+    }
+
+    uint64_t offset = state.byte_offset;
+    uint64_t n_photons = state.photon_index;
+    uint64_t n_overflows = state.n_overflows;
+    uint64_t n_events_left = (mf.size > offset) ? (mf.size - offset) / layout.n_bytes_event : 0;
+
+    while (n_events_left > 0) {
+        uint64_t n_events = std::min(n_events_left, index->interval);
+        const unsigned char* p = mf.data + offset;
+
+        sstt2_checkpoint cp;
+        cp.byte_offset = offset;
+        cp.photon_index = n_photons;
+        cp.n_overflows = n_overflows;
+        cp.macrotime = INT64_MAX;
+
+        // Find the first photon of this interval
+        int64_t first_macrotime = 0;
+
+        if (first_photon(reader, layout, p, n_events, n_overflows, &first_macrotime)) {
+            cp.macrotime = first_macrotime;
+        }
+
+        index->checkpoints.push_back(cp);
+
+        reader->count_block(&layout, p, n_events, &n_photons, &n_overflows);
+
+        offset += n_events * layout.n_bytes_event;
+        n_events_left -= n_events;
+    }
+
+    // Intervals without any photons take the macrotime of the next photon in the file
+    int64_t next_macrotime = INT64_MAX;
+
+    for (size_t i = index->checkpoints.size(); i > 0; i--) {
+        if (index->checkpoints[i - 1].macrotime == INT64_MAX) {
+            index->checkpoints[i - 1].macrotime = next_macrotime;
+        }
+
+        next_macrotime = index->checkpoints[i - 1].macrotime;
+    }
+
+    index->indexed_size = offset;
+    index->n_photons = n_photons;
+    index->n_overflows = n_overflows;
+    index->last_event = last_event_bytes(layout, mf.data, offset);
+
+    unmap_file(&mf);
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL read_sstt2_index(const std::string& index_filepath, sstt2_index* index)
+{
+    if (index == nullptr) {
+        return 2;
+    }
+
+    FILE* f = fopen(index_filepath.c_str(), "rb");
+
+    if (f == nullptr) {
+        return 1;
+    }
+
+    char magic[sizeof(SSTT2_INDEX_MAGIC) - 1];
+    uint64_t header[SSTT2_INDEX_N_HEADER_FIELDS];
+
+    if (fread(magic, sizeof(magic), 1, f) != 1 ||
+            memcmp(magic, SSTT2_INDEX_MAGIC, sizeof(magic)) != 0 ||
+            fread(header, sizeof(header), 1, f) != 1 ||
+            header[0] != SSTT2_INDEX_VERSION) {
+        fclose(f);
+        return 3;
+    }
+
+    // The checkpoint count is only trusted as far as the file holds checkpoints
+    long header_end = ftell(f);
+    long file_end = (header_end >= 0 && fseek(f, 0, SEEK_END) == 0) ? ftell(f) : -1;
+
+    if (file_end < header_end ||
+            fseek(f, header_end, SEEK_SET) != 0 ||
+            header[1] == 0 ||
+            header[6] > (uint64_t)(file_end - header_end) / sizeof(sstt2_checkpoint)) {
+        fclose(f);
+        return 3;
+    }
+
+    index->interval = header[1];
+    index->indexed_size = header[2];
+    index->n_photons = header[3];
+    index->n_overflows = header[4];
+    index->last_event = header[5];
+    index->checkpoints.resize(header[6]);
+
+    size_t n_read = index->checkpoints.empty() ? 0 :
+            fread(index->checkpoints.data(), sizeof(sstt2_checkpoint), index->checkpoints.size(), f);
+
+    fclose(f);
+
+    if (n_read != index->checkpoints.size()) {
+        index->checkpoints.clear();
+        return 3;
+    }
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL write_sstt2_index(const std::string& index_filepath, const sstt2_index& index)
+{
+    FILE* f = fopen(index_filepath.c_str(), "wb");
+
+    if (f == nullptr) {
+        return 1;
+    }
+
+    uint64_t header[SSTT2_INDEX_N_HEADER_FIELDS] = {
+        SSTT2_INDEX_VERSION,
+        index.interval,
+        index.indexed_size,
+        index.n_photons,
+        index.n_overflows,
+        index.last_event,
+        index.checkpoints.size()
+    };
+
+    bool ok = fwrite(SSTT2_INDEX_MAGIC, sizeof(SSTT2_INDEX_MAGIC) - 1, 1, f) == 1 &&
+            fwrite(header, sizeof(header), 1, f) == 1;
+
+    if (ok && !index.checkpoints.empty()) {
+        ok = fwrite(index.checkpoints.data(), sizeof(sstt2_checkpoint), index.checkpoints.size(), f) == index.checkpoints.size();
+    }
+
+    ok = (fclose(f) == 0) && ok;
+
+    if (!ok) {
+        // Do not leave a truncated index behind
+        remove(index_filepath.c_str());
+        return 2;
+    }
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL get_sstt2_index(const std::string& filepath, sstt2_index* index, int save)
+{
+    if (index == nullptr) {
+        return 2;
+    }
+
+    std::string index_filepath = sstt2_index_filepath(filepath);
+
+    if (read_sstt2_index(index_filepath, index) != 0) {
+        *index = sstt2_index();
+    }
+
+    uint64_t indexed_size = index->indexed_size;
+    uint64_t n_checkpoints = index->checkpoints.size();
+    uint64_t last_event = index->last_event;
+
+    int success = build_sstt2_index(filepath, index);
+
+    if (success != 0) {
+        return success;
+    }
+
+    bool changed = index->indexed_size != indexed_size || index->checkpoints.size() != n_checkpoints ||
+            index->last_event != last_event;
+
+    if (save && changed) {
+        write_sstt2_index(index_filepath, *index);
+    }
+
+    return 0;
+}
+
+uint64_t LIBTIMETAG_DLL sstt2_index_find_photon(const sstt2_index& index, uint64_t photon_index)
+{
+    // First checkpoint beyond the photon, then step back
+    std::vector<sstt2_checkpoint>::const_iterator it = std::upper_bound(index.checkpoints.begin(), index.checkpoints.end(), photon_index,
+            [](uint64_t value, const sstt2_checkpoint& cp) { return value < cp.photon_index; });
+
+    if (it == index.checkpoints.begin()) {
+        return 0;
+    }
+
+    return (uint64_t)(it - index.checkpoints.begin()) - 1;
+}
+
+uint64_t LIBTIMETAG_DLL sstt2_index_find_time(const sstt2_index& index, int64_t macrotime)
+{
+    // All photons before a checkpoint with a first macrotime smaller than the
+    // one searched for are smaller as well; start at the last such checkpoint.
+    std::vector<sstt2_checkpoint>::const_iterator it = std::lower_bound(index.checkpoints.begin(), index.checkpoints.end(), macrotime,
+            [](const sstt2_checkpoint& cp, int64_t value) { return cp.macrotime < value; });
+
+    if (it == index.checkpoints.begin()) {
+        return 0;
+    }
+
+    return (uint64_t)(it - index.checkpoints.begin()) - 1;
+}
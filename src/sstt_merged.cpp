@@ -0,0 +1,538 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    sstt_merged.cpp
+ * \brief   Single-file container holding all channels of a dataset as one time-ordered stream ("SSTT merged").
+ * \author  Stijn Hinterding
+*/
+
+#include "sstt_merged.h"
+#include "sstt_file2.h"
+#include "mapped_file.h"
+#include "sstt2_decode.h"
+#include "loser_tree.h"
+#include "timetag_formats.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#define SSTTM_N_BYTES_HEADER        16
+#define SSTTM_CURSOR_EVENTS         65536
+#define SSTTM_WRITE_EVENTS          65536
+
+struct ssttm_reader
+{
+    mapped_file mf;
+    std::vector<uint64_t> channels;
+    uint64_t offset;
+    uint64_t n_overflows;
+};
+
+/*
+	Reading SSTT2 data files photon by photon, decoding a chunk at a time
+*/
+
+struct sstt2_cursor
+{
+    mapped_file mf;
+    const unsigned char* p;
+    uint64_t n_events_left;
+    uint64_t n_overflows;
+    std::vector<int64_t> buffer;
+    size_t pos;
+    size_t len;
+};
+
+static int cursor_open(sstt2_cursor* c, const std::string& filepath)
+{
+    c->pos = 0;
+    c->len = 0;
+    c->n_overflows = 0;
+    c->n_events_left = 0;
+
+    if (map_file(filepath.c_str(), &c->mf) != 0) {
+        return 1;
+    }
+
+    if (!sstt2_is_header(c->mf.data, c->mf.size)) {
+        unmap_file(&c->mf);
+        return 3;
+    }
+
+    c->p = c->mf.data + SSTT2_N_BYTES_HEADER;
+    c->n_events_left = (c->mf.size > SSTT2_N_BYTES_HEADER) ? (c->mf.size - SSTT2_N_BYTES_HEADER) / SSTT2_N_BYTES_TOT : 0;
+    c->buffer.resize(SSTTM_CURSOR_EVENTS);
+
+    return 0;
+}
+
+// Makes sure that there is a photon at c->pos; returns false at the end of the file
+static bool cursor_fill(sstt2_cursor* c)
+{
+    while (c->pos == c->len && c->n_events_left > 0) {
+        uint64_t n_block = std::min(c->n_events_left, (uint64_t)SSTTM_CURSOR_EVENTS);
+
+        c->len = sstt2_decode_block(c->p, n_block, &c->n_overflows, c->buffer.data());
+        c->pos = 0;
+        c->p += n_block * SSTT2_N_BYTES_TOT;
+        c->n_events_left -= n_block;
+    }
+
+    return c->pos < c->len;
+}
+
+/*
+	Writing
+*/
+
+struct ssttm_encoder
+{
+    FILE* f;
+    bool ok;
+    uint64_t period;
+    int64_t last_macrotime;
+    std::vector<uint64_t> events;
+};
+
+static void encoder_flush(ssttm_encoder* enc)
+{
+    if (enc->ok && !enc->events.empty() &&
+            fwrite(enc->events.data(), SSTTM_N_BYTES_EVENT, enc->events.size(), enc->f) != enc->events.size()) {
+        enc->ok = false;
+    }
+
+    enc->events.clear();
+}
+
+static inline void encoder_put(ssttm_encoder* enc, uint64_t event)
+{
+    enc->events.push_back(event);
+
+    if (enc->events.size() == SSTTM_WRITE_EVENTS) {
+        encoder_flush(enc);
+    }
+}
+
+// Returns false if the macrotime is negative, or smaller than the previous one
+static inline bool encoder_put_photon(ssttm_encoder* enc, int64_t macrotime, uint64_t tag)
+{
+    if (macrotime < enc->last_macrotime) {
+        return false;
+    }
+
+    uint64_t period = (uint64_t)macrotime >> SSTTM_N_BITS_MACRO;
+    enc->last_macrotime = macrotime;
+
+    if (period != enc->period) {
+        encoder_put(enc, ((period - enc->period) << (SSTTM_N_BITS_SIGNAL + SSTTM_N_BITS_TAG)) | 1);
+        enc->period = period;
+    }
+
+    encoder_put(enc, (((uint64_t)macrotime & SSTTM_MASK_MACRO) << (SSTTM_N_BITS_SIGNAL + SSTTM_N_BITS_TAG)) |
+                (tag << SSTTM_N_BITS_SIGNAL));
+
+    return true;
+}
+
+int LIBTIMETAG_DLL merge_sstt2_files(const std::vector<std::string>& filepaths,
+                                     const std::vector<uint64_t>& channel_ids,
+                                     const std::string& merged_filepath)
+{
+    if (filepaths.empty() || filepaths.size() != channel_ids.size() || filepaths.size() > SSTTM_MAX_CHANNELS) {
+        return 2;
+    }
+
+    std::vector<sstt2_cursor> cursors(filepaths.size());
+    size_t n_open = 0;
+    int success = 0;
+
+    for (; n_open < cursors.size() && success == 0; n_open++) {
+        success = cursor_open(&cursors[n_open], filepaths[n_open]);
+    }
+
+    if (success != 0) {
+        // The last cursor failed to open, and holds no mapping
+        for (size_t i = 0; i + 1 < n_open; i++) {
+            unmap_file(&cursors[i].mf);
+        }
+
+        return success;
+    }
+
+    ssttm_encoder enc;
+    enc.f = fopen(merged_filepath.c_str(), "wb");
+    enc.ok = true;
+    enc.period = 0;
+    enc.last_macrotime = 0;
+
+    if (enc.f == nullptr) {
+        success = 1;
+    } else {
+        uint32_t header[2] = { SSTTM_VERSION, (uint32_t)channel_ids.size() };
+
+        enc.ok = fwrite(SSTTM_MAGIC, sizeof(SSTTM_MAGIC) - 1, 1, enc.f) == 1 &&
+                fwrite(header, sizeof(header), 1, enc.f) == 1 &&
+                fwrite(channel_ids.data(), sizeof(uint64_t), channel_ids.size(), enc.f) == channel_ids.size();
+
+        // Equal macrotimes are ordered by tag
+        loser_tree tree((uint32_t)cursors.size());
+
+        for (size_t i = 0; i < cursors.size(); i++) {
+            if (cursor_fill(&cursors[i])) {
+                tree.set((uint32_t)i, cursors[i].buffer[cursors[i].pos]);
+            }
+        }
+
+        tree.build();
+
+        while (!tree.empty()) {
+            uint32_t w = tree.winner();
+
+            if (!encoder_put_photon(&enc, tree.winner_head(), w)) {
+                // The data files are not sorted
+                success = 2;
+                break;
+            }
+
+            sstt2_cursor& c = cursors[w];
+            c.pos++;
+
+            if (cursor_fill(&c)) {
+                tree.replace_winner(c.buffer[c.pos]);
+            } else {
+                tree.exhaust_winner();
+            }
+        }
+
+        encoder_flush(&enc);
+
+        if ((fclose(enc.f) != 0 || !enc.ok) && success == 0) {
+            success = 4;
+        }
+
+        if (success != 0) {
+            remove(merged_filepath.c_str());
+        }
+    }
+
+    for (size_t i = 0; i < cursors.size(); i++) {
+        unmap_file(&cursors[i].mf);
+    }
+
+    return success;
+}
+
+int LIBTIMETAG_DLL merge_sstt2_dataset(const std::string& info_filepath, const std::string& merged_filepath)
+{
+    int error_code = 0;
+    exp_info_sstt2 exp_info;
+    std::vector<channel_info_sstt2> info = get_sstt2_info(info_filepath.c_str(), &error_code, &exp_info);
+
+    if (error_code != 0) {
+        return 5;
+    }
+
+    std::vector<std::string> filepaths;
+    std::vector<uint64_t> channel_ids;
+
+    for (size_t i = 0; i < info.size(); i++) {
+        filepaths.push_back(info_filepath + ".c" + std::to_string(info[i].ID));
+        channel_ids.push_back(info[i].ID);
+    }
+
+    return merge_sstt2_files(filepaths, channel_ids, merged_filepath);
+}
+
+/*
+	Reading
+*/
+
+// Validates the file header, and reads the channel table
+static bool parse_header(const unsigned char* data, uint64_t size, std::vector<uint64_t>* channels)
+{
+    uint32_t header[2] = { 0, 0 };
+    bool ok = size >= SSTTM_N_BYTES_HEADER && memcmp(data, SSTTM_MAGIC, sizeof(SSTTM_MAGIC) - 1) == 0;
+
+    if (ok) {
+        memcpy(header, data + 8, sizeof(header));
+        ok = header[0] == SSTTM_VERSION && header[1] <= SSTTM_MAX_CHANNELS &&
+                size >= SSTTM_N_BYTES_HEADER + (uint64_t)header[1] * sizeof(uint64_t);
+    }
+
+    if (!ok) {
+        return false;
+    }
+
+    channels->resize(header[1]);
+
+    if (!channels->empty()) {
+        memcpy(channels->data(), data + SSTTM_N_BYTES_HEADER, channels->size() * sizeof(uint64_t));
+    }
+
+    return true;
+}
+
+ssttm_reader* LIBTIMETAG_DLL ssttm_reader_open(const std::string& filepath, int* error_code)
+{
+    if (error_code == nullptr) {
+        return nullptr;
+    }
+
+    ssttm_reader* r = new ssttm_reader();
+    r->n_overflows = 0;
+
+    if (map_file(filepath.c_str(), &r->mf) != 0) {
+        delete r;
+        *error_code = 2;
+        return nullptr;
+    }
+
+    if (!parse_header(r->mf.data, r->mf.size, &r->channels)) {
+        ssttm_reader_close(r);
+        *error_code = 3;
+        return nullptr;
+    }
+
+    r->offset = SSTTM_N_BYTES_HEADER + r->channels.size() * sizeof(uint64_t);
+    *error_code = 0;
+
+    return r;
+}
+
+std::vector<uint64_t> LIBTIMETAG_DLL ssttm_reader_channels(const ssttm_reader* reader)
+{
+    return reader == nullptr ? std::vector<uint64_t>() : reader->channels;
+}
+
+int LIBTIMETAG_DLL ssttm_reader_next_chunk(ssttm_reader* reader,
+                                           int64_t* macrotimes,
+                                           uint8_t* tags,
+                                           uint64_t len,
+                                           uint64_t* n_photons)
+{
+    if (reader == nullptr || macrotimes == nullptr || tags == nullptr || n_photons == nullptr) {
+        return 1;
+    }
+
+    const unsigned char* data = reader->mf.data;
+    uint64_t offset = reader->offset;
+    uint64_t end = reader->mf.size - (reader->mf.size - offset) % SSTTM_N_BYTES_EVENT;
+    uint64_t overflows = reader->n_overflows;
+    uint64_t n = 0;
+
+    for (; offset < end && n < len; offset += SSTTM_N_BYTES_EVENT) {
+        uint64_t e;
+        memcpy(&e, data + offset, sizeof(e));
+
+        uint64_t signal = e & SSTTM_MASK_SIGNAL;
+        uint64_t value = e >> (SSTTM_N_BITS_SIGNAL + SSTTM_N_BITS_TAG);
+
+        if (signal == 1) {
+            overflows += value;
+        } else if (signal == 0) {
+            macrotimes[n] = (int64_t)(value + (overflows << SSTTM_N_BITS_MACRO));
+            tags[n] = (uint8_t)((e >> SSTTM_N_BITS_SIGNAL) & SSTTM_MASK_TAG);
+            n++;
+        }
+    }
+
+    reader->offset = offset;
+    reader->n_overflows = overflows;
+    *n_photons = n;
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL ssttm_reader_demux(ssttm_reader* reader,
+                                      const std::vector<uint64_t>& channel_ids,
+                                      std::vector<std::vector<int64_t> >* macrotimes)
+{
+    if (reader == nullptr || macrotimes == nullptr) {
+        return 1;
+    }
+
+    macrotimes->resize(channel_ids.size());
+
+    // Output slot of every tag; -1: not selected
+    int64_t slot[SSTTM_MAX_CHANNELS];
+
+    for (size_t t = 0; t < SSTTM_MAX_CHANNELS; t++) {
+        slot[t] = -1;
+    }
+
+    for (size_t t = 0; t < reader->channels.size(); t++) {
+        for (size_t i = 0; i < channel_ids.size(); i++) {
+            if (channel_ids[i] == reader->channels[t]) {
+                slot[t] = (int64_t)i;
+                break;
+            }
+        }
+    }
+
+    const unsigned char* data = reader->mf.data;
+    uint64_t end = reader->mf.size - (reader->mf.size - reader->offset) % SSTTM_N_BYTES_EVENT;
+
+    // Count first, so that every output is allocated only once
+    uint64_t counts[SSTTM_MAX_CHANNELS] = { 0 };
+
+    for (uint64_t offset = reader->offset; offset < end; offset += SSTTM_N_BYTES_EVENT) {
+        uint64_t e;
+        memcpy(&e, data + offset, sizeof(e));
+
+        counts[(e >> SSTTM_N_BITS_SIGNAL) & SSTTM_MASK_TAG] += (e & SSTTM_MASK_SIGNAL) == 0;
+    }
+
+    for (size_t t = 0; t < SSTTM_MAX_CHANNELS; t++) {
+        if (slot[t] >= 0) {
+            std::vector<int64_t>& out = (*macrotimes)[slot[t]];
+            out.reserve(out.size() + counts[t]);
+        }
+    }
+
+    uint64_t overflows = reader->n_overflows;
+
+    for (uint64_t offset = reader->offset; offset < end; offset += SSTTM_N_BYTES_EVENT) {
+        uint64_t e;
+        memcpy(&e, data + offset, sizeof(e));
+
+        uint64_t signal = e & SSTTM_MASK_SIGNAL;
+        uint64_t value = e >> (SSTTM_N_BITS_SIGNAL + SSTTM_N_BITS_TAG);
+
+        if (signal == 1) {
+            overflows += value;
+        } else if (signal == 0) {
+            int64_t s = slot[(e >> SSTTM_N_BITS_SIGNAL) & SSTTM_MASK_TAG];
+
+            if (s >= 0) {
+                (*macrotimes)[s].push_back((int64_t)(value + (overflows << SSTTM_N_BITS_MACRO)));
+            }
+        }
+    }
+
+    reader->offset = end;
+    reader->n_overflows = overflows;
+
+    return 0;
+}
+
+void LIBTIMETAG_DLL ssttm_reader_close(ssttm_reader* reader)
+{
+    if (reader == nullptr) {
+        return;
+    }
+
+    unmap_file(&reader->mf);
+    delete reader;
+}
+
+int LIBTIMETAG_DLL test_is_merged_file(const std::string& filepath)
+{
+    FILE* f = fopen(filepath.c_str(), "rb");
+
+    if (f == nullptr) {
+        return 0;
+    }
+
+    char magic[sizeof(SSTTM_MAGIC) - 1];
+    bool ok = fread(magic, sizeof(magic), 1, f) == 1 && memcmp(magic, SSTTM_MAGIC, sizeof(magic)) == 0;
+
+    fclose(f);
+
+    return ok ? 1 : 0;
+}
+
+/*
+	Reader for the time-tag reader registry
+*/
+
+static int merged_probe(const unsigned char* data, uint64_t size)
+{
+    return size >= sizeof(SSTTM_MAGIC) - 1 && memcmp(data, SSTTM_MAGIC, sizeof(SSTTM_MAGIC) - 1) == 0;
+}
+
+static int merged_open(const unsigned char* data, uint64_t size, timetag_layout* layout)
+{
+    if (!parse_header(data, size, &layout->channel_ids)) {
+        return 1;
+    }
+
+    layout->data_offset = SSTTM_N_BYTES_HEADER + layout->channel_ids.size() * sizeof(uint64_t);
+    layout->n_bytes_event = SSTTM_N_BYTES_EVENT;
+
+    return 0;
+}
+
+static void merged_count(const timetag_layout*,
+                         const unsigned char* data,
+                         uint64_t n_events,
+                         uint64_t* n_photons,
+                         uint64_t* n_overflows)
+{
+    uint64_t photons = 0;
+    uint64_t overflows = 0;
+
+    for (uint64_t i = 0; i < n_events; i++) {
+        uint64_t e;
+        memcpy(&e, data + i * SSTTM_N_BYTES_EVENT, sizeof(e));
+
+        uint64_t signal = e & SSTTM_MASK_SIGNAL;
+
+        photons += signal == 0;
+        overflows += (signal == 1) ? e >> (SSTTM_N_BITS_SIGNAL + SSTTM_N_BITS_TAG) : 0;
+    }
+
+    *n_photons += photons;
+    *n_overflows += overflows;
+}
+
+static uint64_t merged_decode(const timetag_layout* layout,
+                              const unsigned char* data,
+                              uint64_t n_events,
+                              uint64_t,
+                              uint64_t* n_overflows,
+                              int64_t* macrotimes,
+                              int64_t*,
+                              uint64_t* channels)
+{
+    uint64_t overflows = *n_overflows;
+    uint64_t n = 0;
+
+    for (uint64_t i = 0; i < n_events; i++) {
+        uint64_t e;
+        memcpy(&e, data + i * SSTTM_N_BYTES_EVENT, sizeof(e));
+
+        uint64_t signal = e & SSTTM_MASK_SIGNAL;
+        uint64_t value = e >> (SSTTM_N_BITS_SIGNAL + SSTTM_N_BITS_TAG);
+
+        if (signal == 1) {
+            overflows += value;
+        } else if (signal == 0) {
+            macrotimes[n] = (int64_t)(value + (overflows << SSTTM_N_BITS_MACRO));
+
+            if (channels != nullptr) {
+                uint64_t tag = (e >> SSTTM_N_BITS_SIGNAL) & SSTTM_MASK_TAG;
+                channels[n] = tag < layout->channel_ids.size() ? layout->channel_ids[tag] : tag;
+            }
+
+            n++;
+        }
+    }
+
+    *n_overflows = overflows;
+
+    return n;
+}
+
+const timetag_reader merged_timetag_reader = {
+    TIMETAG_READER_SSTT_MERGED,
+    TIMETAG_HAS_CHANNELS,
+    merged_probe,
+    merged_open,
+    merged_count,
+    merged_decode,
+    nullptr
+};
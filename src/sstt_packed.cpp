@@ -0,0 +1,658 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    sstt_packed.cpp
+ * \brief   Compressed, block-based container for photon macrotimes ("SSTT packed").
+ * \author  Stijn Hinterding
+*/
+
+#include "sstt_packed.h"
+#include "sstt_file2.h"
+#include "mapped_file.h"
+#include "timetag_formats.h"
+#include "sstt2_decode.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define SSTT_PACKED_X86
+#include <immintrin.h>
+#endif
+
+#define SSTT_PACKED_CONVERT_EVENTS  65536
+
+struct sstt_packed_block_header
+{
+    int64_t first_macrotime;
+    int64_t min_delta;
+    uint32_t n_photons;
+    uint32_t bit_width;
+    uint64_t n_bytes;
+};
+
+struct sstt_packed_reader
+{
+    mapped_file mf;
+    uint64_t n_photons;
+    std::vector<sstt_packed_block_info> blocks;
+};
+
+static inline uint64_t load_u64(const unsigned char* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+
+    return v;
+}
+
+static unsigned int bit_width_of(uint64_t v)
+{
+    unsigned int n = 0;
+
+    while (v != 0) {
+        v >>= 1;
+        n++;
+    }
+
+    return n;
+}
+
+// The number of bytes of packed data of a block, including the padding word
+static uint64_t packed_n_bytes(uint64_t n_photons, uint64_t bit_width)
+{
+    uint64_t n_bits = (n_photons - 1) * bit_width;
+
+    return 8 * ((n_bits + 63) / 64 + 1);
+}
+
+/*
+	Encoding
+*/
+
+struct sstt_packed_encoder
+{
+    FILE* f;
+    uint64_t offset;
+    uint64_t n_photons;
+    bool ok;
+    std::vector<int64_t> pending;
+    std::vector<uint64_t> words;
+    std::vector<sstt_packed_block_info> blocks;
+};
+
+static void encoder_write(sstt_packed_encoder* enc, const void* data, size_t len)
+{
+    if (enc->ok && len > 0 && fwrite(data, len, 1, enc->f) != 1) {
+        enc->ok = false;
+    }
+
+    enc->offset += len;
+}
+
+static void encoder_put_block(sstt_packed_encoder* enc, const int64_t* macrotimes, uint64_t n)
+{
+    // Deltas are computed modulo 2^64, which makes any sequence lossless
+    int64_t min_delta = 0;
+    int64_t max_delta = 0;
+
+    for (uint64_t j = 0; j + 1 < n; j++) {
+        int64_t d = (int64_t)((uint64_t)macrotimes[j + 1] - (uint64_t)macrotimes[j]);
+
+        min_delta = (j == 0) ? d : std::min(min_delta, d);
+        max_delta = (j == 0) ? d : std::max(max_delta, d);
+    }
+
+    unsigned int width = bit_width_of((uint64_t)max_delta - (uint64_t)min_delta);
+
+    sstt_packed_block_header h;
+    h.first_macrotime = macrotimes[0];
+    h.min_delta = min_delta;
+    h.n_photons = (uint32_t)n;
+    h.bit_width = width;
+    h.n_bytes = packed_n_bytes(n, width);
+
+    std::vector<uint64_t>& words = enc->words;
+    words.assign(h.n_bytes / 8, 0);
+
+    for (uint64_t j = 0; j + 1 < n && width > 0; j++) {
+        uint64_t v = ((uint64_t)macrotimes[j + 1] - (uint64_t)macrotimes[j]) - (uint64_t)min_delta;
+        uint64_t bitpos = j * width;
+        uint64_t w = bitpos >> 6;
+        unsigned int s = bitpos & 63;
+
+        words[w] |= v << s;
+
+        if (s + width > 64) {
+            words[w + 1] |= v >> (64 - s);
+        }
+    }
+
+    sstt_packed_block_info info;
+    info.byte_offset = enc->offset;
+    info.first_photon = enc->n_photons;
+    info.first_macrotime = macrotimes[0];
+    enc->blocks.push_back(info);
+
+    encoder_write(enc, &h.first_macrotime, sizeof(h.first_macrotime));
+    encoder_write(enc, &h.min_delta, sizeof(h.min_delta));
+    encoder_write(enc, &h.n_photons, sizeof(h.n_photons));
+    encoder_write(enc, &h.bit_width, sizeof(h.bit_width));
+    encoder_write(enc, &h.n_bytes, sizeof(h.n_bytes));
+    encoder_write(enc, words.data(), h.n_bytes);
+
+    enc->n_photons += n;
+}
+
+static int encoder_open(sstt_packed_encoder* enc, const std::string& filepath)
+{
+    enc->f = fopen(filepath.c_str(), "wb");
+    enc->offset = 0;
+    enc->n_photons = 0;
+    enc->ok = true;
+
+    if (enc->f == nullptr) {
+        return 1;
+    }
+
+    uint32_t header[2] = { SSTT_PACKED_VERSION, SSTT_PACKED_BLOCK_PHOTONS };
+
+    encoder_write(enc, SSTT_PACKED_MAGIC, sizeof(SSTT_PACKED_MAGIC) - 1);
+    encoder_write(enc, header, sizeof(header));
+
+    return 0;
+}
+
+// Encodes all complete blocks of pending photons (and the rest, if final)
+static void encoder_add(sstt_packed_encoder* enc, const int64_t* macrotimes, uint64_t n, bool final)
+{
+    std::vector<int64_t>& pending = enc->pending;
+    pending.insert(pending.end(), macrotimes, macrotimes + n);
+
+    uint64_t i = 0;
+
+    while (pending.size() - i >= SSTT_PACKED_BLOCK_PHOTONS || (final && i < pending.size())) {
+        uint64_t n_block = std::min((uint64_t)(pending.size() - i), (uint64_t)SSTT_PACKED_BLOCK_PHOTONS);
+
+        encoder_put_block(enc, pending.data() + i, n_block);
+        i += n_block;
+    }
+
+    pending.erase(pending.begin(), pending.begin() + i);
+}
+
+static int encoder_close(sstt_packed_encoder* enc, const std::string& filepath)
+{
+    uint64_t table_offset = enc->offset;
+
+    for (size_t i = 0; i < enc->blocks.size(); i++) {
+        const sstt_packed_block_info& b = enc->blocks[i];
+
+        encoder_write(enc, &b.byte_offset, sizeof(b.byte_offset));
+        encoder_write(enc, &b.first_photon, sizeof(b.first_photon));
+        encoder_write(enc, &b.first_macrotime, sizeof(b.first_macrotime));
+    }
+
+    uint64_t trailer[3] = { enc->blocks.size(), enc->n_photons, table_offset };
+
+    encoder_write(enc, trailer, sizeof(trailer));
+    encoder_write(enc, SSTT_PACKED_END_MAGIC, sizeof(SSTT_PACKED_END_MAGIC) - 1);
+
+    bool ok = (fclose(enc->f) == 0) && enc->ok;
+
+    if (!ok) {
+        // Do not leave a truncated file behind
+        remove(filepath.c_str());
+        return 4;
+    }
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL write_packed_file(const std::string& filepath, const int64_t* macrotimes, uint64_t n_photons)
+{
+    if (macrotimes == nullptr && n_photons != 0) {
+        return 2;
+    }
+
+    sstt_packed_encoder enc;
+
+    if (encoder_open(&enc, filepath) != 0) {
+        return 1;
+    }
+
+    for (uint64_t i = 0; i < n_photons; i += SSTT_PACKED_BLOCK_PHOTONS) {
+        encoder_put_block(&enc, macrotimes + i, std::min(n_photons - i, (uint64_t)SSTT_PACKED_BLOCK_PHOTONS));
+    }
+
+    return encoder_close(&enc, filepath);
+}
+
+struct sstt_packed_writer
+{
+    std::string filepath;
+    sstt_packed_encoder enc;
+};
+
+sstt_packed_writer* LIBTIMETAG_DLL sstt_packed_writer_open(const std::string& filepath, int* error_code)
+{
+    if (error_code == nullptr) {
+        return nullptr;
+    }
+
+    sstt_packed_writer* w = new sstt_packed_writer();
+    w->filepath = filepath;
+
+    if (encoder_open(&w->enc, filepath) != 0) {
+        delete w;
+        *error_code = 2;
+        return nullptr;
+    }
+
+    *error_code = 0;
+
+    return w;
+}
+
+int LIBTIMETAG_DLL sstt_packed_writer_write(sstt_packed_writer* writer, const int64_t* values, uint64_t n)
+{
+    if (writer == nullptr || (values == nullptr && n != 0)) {
+        return 2;
+    }
+
+    encoder_add(&writer->enc, values, n, false);
+
+    // Complete blocks are written straight away
+    return writer->enc.ok ? 0 : 1;
+}
+
+int LIBTIMETAG_DLL sstt_packed_writer_close(sstt_packed_writer* writer)
+{
+    if (writer == nullptr) {
+        return 0;
+    }
+
+    encoder_add(&writer->enc, nullptr, 0, true);
+
+    int success = encoder_close(&writer->enc, writer->filepath);
+    delete writer;
+
+    return success;
+}
+
+int LIBTIMETAG_DLL convert_sstt2_to_packed(const std::string& sstt2_filepath, const std::string& packed_filepath)
+{
+    mapped_file mf;
+
+    if (map_file(sstt2_filepath.c_str(), &mf) != 0) {
+        return 1;
+    }
+
+    if (!sstt2_is_header(mf.data, mf.size)) {
+        unmap_file(&mf);
+        return 3;
+    }
+
+    sstt_packed_encoder enc;
+
+    if (encoder_open(&enc, packed_filepath) != 0) {
+        unmap_file(&mf);
+        return 1;
+    }
+
+    // Decode in chunks, so that the conversion runs in constant memory
+    std::vector<int64_t> macrotimes(SSTT_PACKED_CONVERT_EVENTS);
+    const unsigned char* p = mf.data + SSTT2_N_BYTES_HEADER;
+    uint64_t n_events = (mf.size > SSTT2_N_BYTES_HEADER) ? (mf.size - SSTT2_N_BYTES_HEADER) / SSTT2_N_BYTES_TOT : 0;
+    uint64_t n_overflows = 0;
+
+    while (n_events > 0) {
+        uint64_t n_block = std::min(n_events, (uint64_t)SSTT_PACKED_CONVERT_EVENTS);
+        uint64_t n_photons = sstt2_decode_block(p, n_block, &n_overflows, macrotimes.data());
+
+        encoder_add(&enc, macrotimes.data(), n_photons, false);
+
+        p += n_block * SSTT2_N_BYTES_TOT;
+        n_events -= n_block;
+    }
+
+    encoder_add(&enc, nullptr, 0, true);
+
+    unmap_file(&mf);
+
+    return encoder_close(&enc, packed_filepath);
+}
+
+/*
+	Decoding
+*/
+
+static void decode_block_scalar(const unsigned char* data,
+                                const sstt_packed_block_header& h,
+                                uint64_t first,
+                                int64_t* macrotimes)
+{
+    const uint64_t mask = (h.bit_width == 64) ? ~(uint64_t)0 : (((uint64_t)1 << h.bit_width) - 1);
+    uint64_t t = (uint64_t)macrotimes[first];
+
+    for (uint64_t j = first; j + 1 < h.n_photons; j++) {
+        uint64_t bitpos = j * h.bit_width;
+        uint64_t w = bitpos >> 6;
+        unsigned int s = bitpos & 63;
+        uint64_t v = load_u64(data + 8 * w) >> s;
+
+        if (s + h.bit_width > 64) {
+            v |= load_u64(data + 8 * (w + 1)) << (64 - s);
+        }
+
+        t += (v & mask) + (uint64_t)h.min_delta;
+        macrotimes[j + 1] = (int64_t)t;
+    }
+}
+
+#ifdef SSTT_PACKED_X86
+
+// Unpacks four values per iteration with a gather at byte granularity,
+// which covers bit widths up to 56, and accumulates them with a prefix sum
+__attribute__((target("avx2")))
+static uint64_t decode_block_avx2(const unsigned char* data,
+                                  const sstt_packed_block_header& h,
+                                  int64_t* macrotimes)
+{
+    const int64_t w = h.bit_width;
+    const __m256i mask = _mm256_set1_epi64x((int64_t)(((uint64_t)1 << w) - 1));
+    const __m256i min_delta = _mm256_set1_epi64x(h.min_delta);
+    const __m256i seven = _mm256_set1_epi64x(7);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i step = _mm256_set1_epi64x(4 * w);
+
+    __m256i bitpos = _mm256_setr_epi64x(0, w, 2 * w, 3 * w);
+    __m256i carry = _mm256_set1_epi64x(macrotimes[0]);
+    uint64_t n_deltas = h.n_photons - 1;
+    uint64_t j = 0;
+
+    for (; j + 4 <= n_deltas; j += 4) {
+        __m256i bytes = _mm256_srli_epi64(bitpos, 3);
+        __m256i shift = _mm256_and_si256(bitpos, seven);
+        __m256i v = _mm256_i64gather_epi64((const long long*)data, bytes, 1);
+
+        v = _mm256_and_si256(_mm256_srlv_epi64(v, shift), mask);
+        v = _mm256_add_epi64(v, min_delta);
+
+        // Inclusive prefix sum over the four lanes
+        v = _mm256_add_epi64(v, _mm256_blend_epi32(_mm256_permute4x64_epi64(v, _MM_SHUFFLE(2, 1, 0, 0)), zero, 0x03));
+        v = _mm256_add_epi64(v, _mm256_blend_epi32(_mm256_permute4x64_epi64(v, _MM_SHUFFLE(1, 0, 0, 0)), zero, 0x0F));
+        v = _mm256_add_epi64(v, carry);
+
+        _mm256_storeu_si256((__m256i*)(macrotimes + j + 1), v);
+
+        carry = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 3, 3, 3));
+        bitpos = _mm256_add_epi64(bitpos, step);
+    }
+
+    return j;
+}
+
+static bool has_avx2()
+{
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+
+    return avx2;
+}
+
+#endif // SSTT_PACKED_X86
+
+// Parses and validates the block at \p offset
+static bool read_block_header(const mapped_file& mf, uint64_t offset, sstt_packed_block_header* h)
+{
+    if (offset > mf.size || mf.size - offset < SSTT_PACKED_N_BYTES_BLOCK_HEADER) {
+        return false;
+    }
+
+    const unsigned char* p = mf.data + offset;
+
+    memcpy(&h->first_macrotime, p, 8);
+    memcpy(&h->min_delta, p + 8, 8);
+    memcpy(&h->n_photons, p + 16, 4);
+    memcpy(&h->bit_width, p + 20, 4);
+    memcpy(&h->n_bytes, p + 24, 8);
+
+    return h->n_photons >= 1 &&
+            h->n_photons <= SSTT_PACKED_BLOCK_PHOTONS &&
+            h->bit_width <= 64 &&
+            h->n_bytes == packed_n_bytes(h->n_photons, h->bit_width) &&
+            mf.size - offset - SSTT_PACKED_N_BYTES_BLOCK_HEADER >= h->n_bytes;
+}
+
+// Validates the magics, and loads the trailer and the block table
+static bool read_block_table(sstt_packed_reader* r)
+{
+    const mapped_file& mf = r->mf;
+    uint64_t trailer[3] = { 0, 0, 0 };
+    bool ok = mf.size >= SSTT_PACKED_N_BYTES_HEADER + SSTT_PACKED_N_BYTES_TRAILER &&
+            memcmp(mf.data, SSTT_PACKED_MAGIC, sizeof(SSTT_PACKED_MAGIC) - 1) == 0 &&
+            memcmp(mf.data + mf.size - 8, SSTT_PACKED_END_MAGIC, 8) == 0;
+
+    if (ok) {
+        memcpy(trailer, mf.data + mf.size - SSTT_PACKED_N_BYTES_TRAILER, sizeof(trailer));
+
+        uint64_t table_end = mf.size - SSTT_PACKED_N_BYTES_TRAILER;
+        ok = trailer[2] <= table_end && (table_end - trailer[2]) / 24 == trailer[0] && (table_end - trailer[2]) % 24 == 0;
+    }
+
+    if (ok) {
+        r->n_photons = trailer[1];
+        r->blocks.resize(trailer[0]);
+
+        const unsigned char* p = mf.data + trailer[2];
+
+        for (size_t i = 0; i < r->blocks.size(); i++) {
+            memcpy(&r->blocks[i].byte_offset, p, 8);
+            memcpy(&r->blocks[i].first_photon, p + 8, 8);
+            memcpy(&r->blocks[i].first_macrotime, p + 16, 8);
+            p += 24;
+        }
+    }
+
+    return ok;
+}
+
+sstt_packed_reader* LIBTIMETAG_DLL sstt_packed_open(const std::string& filepath, int* error_code)
+{
+    if (error_code == nullptr) {
+        return nullptr;
+    }
+
+    sstt_packed_reader* r = new sstt_packed_reader();
+
+    if (map_file(filepath.c_str(), &r->mf) != 0) {
+        delete r;
+        *error_code = 2;
+        return nullptr;
+    }
+
+    if (!read_block_table(r)) {
+        sstt_packed_close(r);
+        *error_code = 3;
+        return nullptr;
+    }
+
+    *error_code = 0;
+
+    return r;
+}
+
+uint64_t LIBTIMETAG_DLL sstt_packed_n_photons(const sstt_packed_reader* reader)
+{
+    return reader == nullptr ? 0 : reader->n_photons;
+}
+
+uint64_t LIBTIMETAG_DLL sstt_packed_n_blocks(const sstt_packed_reader* reader)
+{
+    return reader == nullptr ? 0 : reader->blocks.size();
+}
+
+sstt_packed_block_info LIBTIMETAG_DLL sstt_packed_block(const sstt_packed_reader* reader, uint64_t block_index)
+{
+    return reader->blocks[block_index];
+}
+
+uint64_t LIBTIMETAG_DLL sstt_packed_find_photon(const sstt_packed_reader* reader, uint64_t photon_index)
+{
+    std::vector<sstt_packed_block_info>::const_iterator it = std::upper_bound(reader->blocks.begin(), reader->blocks.end(), photon_index,
+            [](uint64_t value, const sstt_packed_block_info& b) { return value < b.first_photon; });
+
+    return it == reader->blocks.begin() ? 0 : (uint64_t)(it - reader->blocks.begin()) - 1;
+}
+
+uint64_t LIBTIMETAG_DLL sstt_packed_find_time(const sstt_packed_reader* reader, int64_t macrotime)
+{
+    std::vector<sstt_packed_block_info>::const_iterator it = std::lower_bound(reader->blocks.begin(), reader->blocks.end(), macrotime,
+            [](const sstt_packed_block_info& b, int64_t value) { return b.first_macrotime < value; });
+
+    return it == reader->blocks.begin() ? 0 : (uint64_t)(it - reader->blocks.begin()) - 1;
+}
+
+int LIBTIMETAG_DLL sstt_packed_read_blocks(const sstt_packed_reader* reader,
+                                           uint64_t first_block,
+                                           uint64_t n_blocks,
+                                           std::vector<int64_t>* macrotimes)
+{
+    if (reader == nullptr || macrotimes == nullptr) {
+        return 1;
+    }
+
+    uint64_t n_total = reader->blocks.size();
+    uint64_t last_block = (first_block < n_total) ? first_block + std::min(n_blocks, n_total - first_block) : first_block;
+
+    for (uint64_t b = first_block; b < last_block; b++) {
+        sstt_packed_block_header h;
+
+        if (!read_block_header(reader->mf, reader->blocks[b].byte_offset, &h)) {
+            return 3;
+        }
+
+        const unsigned char* data = reader->mf.data + reader->blocks[b].byte_offset + SSTT_PACKED_N_BYTES_BLOCK_HEADER;
+        uint64_t n_had = macrotimes->size();
+
+        macrotimes->resize(n_had + h.n_photons);
+
+        int64_t* out = macrotimes->data() + n_had;
+        uint64_t j = 0;
+
+        out[0] = h.first_macrotime;
+
+#ifdef SSTT_PACKED_X86
+        if (h.bit_width <= 56 && has_avx2()) {
+            j = decode_block_avx2(data, h, out);
+        }
+#endif
+
+        decode_block_scalar(data, h, j, out);
+    }
+
+    return 0;
+}
+
+void LIBTIMETAG_DLL sstt_packed_close(sstt_packed_reader* reader)
+{
+    if (reader == nullptr) {
+        return;
+    }
+
+    unmap_file(&reader->mf);
+    delete reader;
+}
+
+int LIBTIMETAG_DLL read_packed_file(const std::string& filepath, std::vector<int64_t>* macrotimes)
+{
+    if (macrotimes == nullptr) {
+        return 2;
+    }
+
+    int error_code = 0;
+    sstt_packed_reader* r = sstt_packed_open(filepath, &error_code);
+
+    if (r == nullptr) {
+        return error_code == 2 ? 1 : 3;
+    }
+
+    macrotimes->reserve(macrotimes->size() + r->n_photons);
+
+    int success = sstt_packed_read_blocks(r, 0, r->blocks.size(), macrotimes);
+
+    sstt_packed_close(r);
+
+    return success == 0 ? 0 : 3;
+}
+
+int LIBTIMETAG_DLL test_is_packed_file(const std::string& filepath)
+{
+    FILE* f = fopen(filepath.c_str(), "rb");
+
+    if (f == nullptr) {
+        return 0;
+    }
+
+    char magic[sizeof(SSTT_PACKED_MAGIC) - 1];
+    bool ok = fread(magic, sizeof(magic), 1, f) == 1 && memcmp(magic, SSTT_PACKED_MAGIC, sizeof(magic)) == 0;
+
+    fclose(f);
+
+    return ok ? 1 : 0;
+}
+
+/*
+	Reader for the time-tag reader registry
+*/
+
+static int packed_probe(const unsigned char* data, uint64_t size)
+{
+    return size >= sizeof(SSTT_PACKED_MAGIC) - 1 && memcmp(data, SSTT_PACKED_MAGIC, sizeof(SSTT_PACKED_MAGIC) - 1) == 0;
+}
+
+static int packed_read_file(const unsigned char* data,
+                            uint64_t size,
+                            const timetag_read_options* options,
+                            timetag_data* result)
+{
+    // The mapping belongs to the caller: the reader is never closed
+    sstt_packed_reader r;
+    r.mf.data = data;
+    r.mf.size = size;
+
+    if (!read_block_table(&r)) {
+        return 3;
+    }
+
+    uint64_t n_skip = std::min(options->n_photons_to_skip, r.n_photons);
+    uint64_t first_block = sstt_packed_find_photon(&r, n_skip);
+    uint64_t first_photon = first_block < r.blocks.size() ? r.blocks[first_block].first_photon : 0;
+
+    // Whole blocks are skipped using the block table
+    result->macrotimes.reserve(r.n_photons - first_photon);
+    n_skip -= std::min(n_skip, first_photon);
+
+    if (sstt_packed_read_blocks(&r, first_block, r.blocks.size(), &result->macrotimes) != 0) {
+        return 3;
+    }
+
+    // Photons before the first one requested, in its block
+    result->macrotimes.erase(result->macrotimes.begin(), result->macrotimes.begin() + std::min((size_t)n_skip, result->macrotimes.size()));
+
+    return 0;
+}
+
+const timetag_reader packed_timetag_reader = {
+    TIMETAG_READER_SSTT_PACKED,
+    0,
+    packed_probe,
+    nullptr,
+    nullptr,
+    nullptr,
+    packed_read_file
+};
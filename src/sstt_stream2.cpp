@@ -0,0 +1,724 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    sstt_stream2.cpp
+ * \brief   Streaming (chunked) reader for "small simple time-tagged" (SSTT) data files, version 2.
+ * \author  Stijn Hinterding
+*/
+
+#include "sstt_stream2.h"
+#include "sstt_file2.h"
+#include "sstt_index2.h"
+#include "sstt2_decode.h"
+#include "timetag_reader.h"
+#include "file_prefetcher.h"
+#include "mapped_file.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct sstt2_reader
+{
+    FILE* f;
+    std::string filepath;
+
+    // The format of the file, from the time-tag reader registry; NULL while the header is pending
+    const timetag_reader* format;
+    timetag_layout layout;
+
+    // Loaded on the first seek
+    std::unique_ptr<sstt2_index> index;
+
+    // Raw event bytes. Bytes [buffer_pos, buffer_len) have not been decoded yet;
+    // a trailing incomplete event is kept until the rest of it has been read.
+    std::vector<unsigned char> buffer;
+    uint64_t buffer_pos;
+    uint64_t buffer_len;
+
+    // File offset of buffer[0]. While the header is pending: the offset asked for.
+    uint64_t buffer_file_offset;
+
+    // Set when the file was opened before its header was written
+    bool header_pending;
+
+    // Asynchronous read-ahead; NULL: read synchronously from f
+    file_prefetcher* prefetch;
+    uint32_t prefetch_blocks;
+    uint64_t prefetch_block_bytes;
+
+    uint64_t n_overflows;
+    uint64_t n_photons;
+};
+
+static int seek64(FILE* f, uint64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(f, (__int64)offset, SEEK_SET);
+#else
+    return fseeko(f, (off_t)offset, SEEK_SET);
+#endif
+}
+
+static void sstt2_reader_compact(sstt2_reader* r)
+{
+    uint64_t n_left = r->buffer_len - r->buffer_pos;
+
+    if (n_left != 0 && r->buffer_pos != 0) {
+        memmove(r->buffer.data(), r->buffer.data() + r->buffer_pos, n_left);
+    }
+
+    r->buffer_file_offset += r->buffer_pos;
+    r->buffer_pos = 0;
+    r->buffer_len = n_left;
+}
+
+// Returns the number of bytes read, or -1 on a read error
+static int64_t sstt2_reader_refill(sstt2_reader* r)
+{
+    sstt2_reader_compact(r);
+
+    if (r->prefetch != nullptr) {
+        int64_t n_read = file_prefetcher_read(r->prefetch, r->buffer.data() + r->buffer_len, r->buffer.size() - r->buffer_len);
+
+        if (n_read > 0) {
+            r->buffer_len += n_read;
+        }
+
+        return n_read;
+    }
+
+    size_t n_read = fread(r->buffer.data() + r->buffer_len, 1, r->buffer.size() - r->buffer_len, r->f);
+
+    if (n_read == 0) {
+        if (ferror(r->f)) {
+            return -1;
+        }
+
+        // Allow subsequent calls to pick up data appended in the meantime
+        clearerr(r->f);
+    }
+
+    r->buffer_len += n_read;
+
+    return (int64_t)n_read;
+}
+
+/*
+	Detects the format of the file, and parses its header. Returns 0 if
+	the header is valid, 1 if it has not been (completely) written yet,
+	3 if it is invalid, or the file is not an event stream.
+*/
+static int sstt2_reader_check_header(sstt2_reader* r)
+{
+    mapped_file mf;
+
+    if (map_file(r->filepath.c_str(), &mf) != 0) {
+        return 1;
+    }
+
+    const timetag_reader* format = timetag_find_reader(mf.data, mf.size);
+    timetag_layout layout;
+    layout.flags = format != nullptr ? format->flags : 0;
+
+    int success = 0;
+
+    if (format == nullptr) {
+        // Too short to tell: the magic may still be written
+        success = mf.size < TIMETAG_N_BYTES_PROBE ? 1 : 3;
+    } else if (format->open == nullptr) {
+        success = 3;
+    } else if (format->open(mf.data, mf.size, &layout) != 0 || layout.n_bytes_event == 0) {
+        success = 1;
+    }
+
+    unmap_file(&mf);
+
+    if (success == 0) {
+        r->format = format;
+        r->layout = layout;
+    }
+
+    return success;
+}
+
+// Moves the requested offset to the first event, once the header is known; returns 1 if it is not at an event boundary
+static int sstt2_reader_start(sstt2_reader* r)
+{
+    uint64_t data_offset = r->layout.data_offset;
+    uint64_t n_bytes_event = r->layout.n_bytes_event;
+
+    if (r->buffer_file_offset < data_offset) {
+        r->buffer_file_offset = data_offset;
+    }
+
+    if ((r->buffer_file_offset - data_offset) % n_bytes_event != 0) {
+        return 1;
+    }
+
+    r->buffer.resize(std::max((uint64_t)r->buffer.size(), SSTT2_READER_DEFAULT_BLOCK_EVENTS * n_bytes_event));
+    r->header_pending = false;
+
+    return 0;
+}
+
+// Returns 0 once the header is known, 1 while it is still pending, 2 on a read error, 3 if it is invalid
+static int sstt2_reader_poll_header(sstt2_reader* r)
+{
+    if (!r->header_pending) {
+        return 0;
+    }
+
+    int header_ok = sstt2_reader_check_header(r);
+
+    if (header_ok != 0) {
+        return header_ok;
+    }
+
+    if (sstt2_reader_start(r) != 0) {
+        return 3;
+    }
+
+    if (seek64(r->f, r->buffer_file_offset) != 0) {
+        return 2;
+    }
+
+    if (r->prefetch != nullptr) {
+        // Reading ahead started before the position was known
+        file_prefetcher_stop(r->prefetch);
+        r->prefetch = file_prefetcher_start(r->filepath.c_str(), r->buffer_file_offset, r->prefetch_blocks, r->prefetch_block_bytes);
+
+        if (r->prefetch == nullptr) {
+            return 2;
+        }
+    }
+
+    return 0;
+}
+
+static sstt2_reader* sstt2_reader_open_internal(const char* filepath,
+                                                uint64_t byte_offset,
+                                                uint64_t n_overflows,
+                                                bool allow_pending_header,
+                                                int* error_code)
+{
+    if (error_code == nullptr) {
+        return nullptr;
+    }
+
+    if (filepath == nullptr) {
+        *error_code = 1;
+        return nullptr;
+    }
+
+    FILE* f = fopen(filepath, "rb");
+
+    if (f == nullptr) {
+        *error_code = 2;
+        return nullptr;
+    }
+
+    // We do our own buffering
+    setvbuf(f, nullptr, _IONBF, 0);
+
+    sstt2_reader* r = new sstt2_reader;
+    r->f = f;
+    r->filepath = filepath;
+    r->format = nullptr;
+    r->buffer_pos = 0;
+    r->buffer_len = 0;
+    r->buffer_file_offset = byte_offset;
+    r->header_pending = true;
+    r->prefetch = nullptr;
+    r->prefetch_blocks = 0;
+    r->prefetch_block_bytes = 0;
+    r->n_overflows = n_overflows;
+    r->n_photons = 0;
+
+    int header_ok = sstt2_reader_check_header(r);
+
+    if (header_ok == 1 && allow_pending_header) {
+        // The file is still being created; check again on the next read
+        *error_code = 0;
+        return r;
+    }
+
+    if (header_ok != 0) {
+        sstt2_reader_close(r);
+        *error_code = 3;
+        return nullptr;
+    }
+
+    if (sstt2_reader_start(r) != 0) {
+        // Not at an event boundary
+        sstt2_reader_close(r);
+        *error_code = 1;
+        return nullptr;
+    }
+
+    // Seeking past the end is fine; the data may still be written
+    if (seek64(f, r->buffer_file_offset) != 0) {
+        sstt2_reader_close(r);
+        *error_code = 2;
+        return nullptr;
+    }
+
+    *error_code = 0;
+    return r;
+}
+
+sstt2_reader* LIBTIMETAG_DLL sstt2_reader_open(const char* filepath, int* error_code)
+{
+    return sstt2_reader_open_internal(filepath, 0, 0, false, error_code);
+}
+
+sstt2_reader* LIBTIMETAG_DLL sstt2_reader_open_at(const char* filepath,
+                                                  uint64_t byte_offset,
+                                                  uint64_t n_overflows,
+                                                  int* error_code)
+{
+    return sstt2_reader_open_internal(filepath, byte_offset, n_overflows, true, error_code);
+}
+
+int LIBTIMETAG_DLL sstt2_reader_next_photons(sstt2_reader* reader,
+                                             int64_t* macrotimes,
+                                             int64_t* microtimes,
+                                             uint64_t* channels,
+                                             uint64_t len,
+                                             uint64_t* n_photons)
+{
+    if (reader == nullptr || macrotimes == nullptr || n_photons == nullptr) {
+        return 1;
+    }
+
+    uint64_t n = 0;
+    int header_ok = sstt2_reader_poll_header(reader);
+
+    if (header_ok == 1) {
+        *n_photons = 0;
+        return 0;
+    }
+
+    if (header_ok != 0) {
+        return header_ok;
+    }
+
+    const uint64_t n_bytes_event = reader->layout.n_bytes_event;
+
+    while (n < len) {
+        uint64_t n_events = (reader->buffer_len - reader->buffer_pos) / n_bytes_event;
+
+        if (n_events == 0) {
+            int64_t n_read = sstt2_reader_refill(reader);
+
+            if (n_read < 0) {
+                *n_photons = n;
+                reader->n_photons += n;
+                return 2;
+            }
+
+            if (n_read == 0) {
+                // End of file (for now)
+                break;
+            }
+
+            continue;
+        }
+
+        // Each event holds at most one photon, so never decode more
+        // events than there is room left in the output
+        n_events = std::min(n_events, len - n);
+
+        n += reader->format->decode_block(&reader->layout, reader->buffer.data() + reader->buffer_pos, n_events, n_events,
+                                          &reader->n_overflows, macrotimes + n,
+                                          microtimes != nullptr ? microtimes + n : nullptr,
+                                          channels != nullptr ? channels + n : nullptr);
+
+        reader->buffer_pos += n_events * n_bytes_event;
+    }
+
+    reader->n_photons += n;
+    *n_photons = n;
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL sstt2_reader_next_chunk(sstt2_reader* reader,
+                                           int64_t* macrotimes,
+                                           uint64_t macrotimes_len,
+                                           uint64_t* n_photons)
+{
+    return sstt2_reader_next_photons(reader, macrotimes, nullptr, nullptr, macrotimes_len, n_photons);
+}
+
+// Repositions the reader at a checkpoint of the index
+static int sstt2_reader_goto_checkpoint(sstt2_reader* reader, int64_t macrotime, uint64_t photon_index, bool by_time)
+{
+    int header_ok = sstt2_reader_poll_header(reader);
+
+    if (header_ok == 2) {
+        return 2;
+    }
+
+    if (header_ok != 0) {
+        return 4;
+    }
+
+    if (!reader->index) {
+        reader->index.reset(new sstt2_index());
+    }
+
+    // Make sure the index also covers data appended since the last seek
+    if (get_sstt2_index(reader->filepath, reader->index.get(), 1) != 0) {
+        return 4;
+    }
+
+    reader->buffer_pos = 0;
+    reader->buffer_len = 0;
+
+    if (reader->index->checkpoints.empty()) {
+        // No events at all (yet)
+        reader->buffer_file_offset = reader->layout.data_offset;
+        reader->n_overflows = 0;
+        reader->n_photons = 0;
+    } else {
+        uint64_t i = by_time ? sstt2_index_find_time(*reader->index, macrotime) :
+                               sstt2_index_find_photon(*reader->index, photon_index);
+        const sstt2_checkpoint& cp = reader->index->checkpoints[i];
+
+        reader->buffer_file_offset = cp.byte_offset;
+        reader->n_overflows = cp.n_overflows;
+        reader->n_photons = cp.photon_index;
+    }
+
+    if (seek64(reader->f, reader->buffer_file_offset) != 0) {
+        return 2;
+    }
+
+    if (reader->prefetch != nullptr) {
+        // The blocks read ahead are of the old position
+        file_prefetcher_stop(reader->prefetch);
+        reader->prefetch = file_prefetcher_start(reader->filepath.c_str(), reader->buffer_file_offset,
+                                                 reader->prefetch_blocks, reader->prefetch_block_bytes);
+
+        if (reader->prefetch == nullptr) {
+            return 2;
+        }
+    }
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL sstt2_reader_seek_photon(sstt2_reader* reader, uint64_t photon_index)
+{
+    if (reader == nullptr) {
+        return 1;
+    }
+
+    int success = sstt2_reader_goto_checkpoint(reader, 0, photon_index, false);
+
+    if (success != 0) {
+        return success;
+    }
+
+    const uint64_t n_bytes_event = reader->layout.n_bytes_event;
+
+    // Skip the remaining photons (at most one index interval)
+    std::vector<int64_t> scratch;
+
+    while (reader->n_photons < photon_index) {
+        uint64_t n_events = (reader->buffer_len - reader->buffer_pos) / n_bytes_event;
+
+        if (n_events == 0) {
+            int64_t n_read = sstt2_reader_refill(reader);
+
+            if (n_read < 0) {
+                return 2;
+            }
+
+            if (n_read == 0) {
+                // Beyond the end of the file
+                break;
+            }
+
+            continue;
+        }
+
+        // At most one photon per event: these events never pass the photon
+        n_events = std::min(photon_index - reader->n_photons, n_events);
+        scratch.resize(n_events);
+
+        reader->n_photons += reader->format->decode_block(&reader->layout, reader->buffer.data() + reader->buffer_pos,
+                                                          n_events, n_events, &reader->n_overflows, scratch.data(),
+                                                          nullptr, nullptr);
+        reader->buffer_pos += n_events * n_bytes_event;
+    }
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL sstt2_reader_seek_time(sstt2_reader* reader, int64_t macrotime)
+{
+    if (reader == nullptr) {
+        return 1;
+    }
+
+    int success = sstt2_reader_goto_checkpoint(reader, macrotime, 0, true);
+
+    if (success != 0) {
+        return success;
+    }
+
+    const uint64_t n_bytes_event = reader->layout.n_bytes_event;
+    std::vector<int64_t> scratch;
+
+    for (;;) {
+        uint64_t n_events = (reader->buffer_len - reader->buffer_pos) / n_bytes_event;
+
+        if (n_events == 0) {
+            int64_t n_read = sstt2_reader_refill(reader);
+
+            if (n_read < 0) {
+                return 2;
+            }
+
+            if (n_read == 0) {
+                // Beyond the end of the file
+                break;
+            }
+
+            continue;
+        }
+
+        const unsigned char* p = reader->buffer.data() + reader->buffer_pos;
+        uint64_t n_overflows = reader->n_overflows;
+
+        scratch.resize(n_events);
+
+        uint64_t n = reader->format->decode_block(&reader->layout, p, n_events, n_events, &n_overflows,
+                                                  scratch.data(), nullptr, nullptr);
+
+        if (n == 0 || scratch[n - 1] < macrotime) {
+            reader->n_overflows = n_overflows;
+            reader->n_photons += n;
+            reader->buffer_pos += n_events * n_bytes_event;
+            continue;
+        }
+
+        // Found it: step over the events of the photons before it
+        uint64_t n_before = std::lower_bound(scratch.begin(), scratch.begin() + n, macrotime) - scratch.begin();
+        uint64_t n_photons = 0;
+        uint64_t i = 0;
+
+        while (n_photons < n_before) {
+            reader->format->count_block(&reader->layout, p + i * n_bytes_event, 1, &n_photons, &reader->n_overflows);
+            i++;
+        }
+
+        reader->n_photons += n_photons;
+        reader->buffer_pos += i * n_bytes_event;
+        break;
+    }
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL sstt2_reader_set_prefetch(sstt2_reader* reader, uint32_t n_blocks, uint64_t block_bytes)
+{
+    if (reader == nullptr) {
+        return 1;
+    }
+
+    // Position of the first byte that is not in the buffer yet
+    uint64_t offset = reader->buffer_file_offset + reader->buffer_len;
+
+    file_prefetcher_stop(reader->prefetch);
+    reader->prefetch = nullptr;
+
+    if (n_blocks == 0) {
+        return seek64(reader->f, offset) == 0 ? 0 : 2;
+    }
+
+    if (block_bytes == 0) {
+        block_bytes = SSTT2_READER_PREFETCH_BLOCK_BYTES;
+    }
+
+    reader->prefetch_blocks = n_blocks;
+    reader->prefetch_block_bytes = block_bytes;
+
+    // Room for a whole block, next to an incomplete event
+    sstt2_reader_compact(reader);
+    reader->buffer.resize(std::max((uint64_t)reader->buffer.size(), block_bytes + reader->layout.n_bytes_event));
+
+    reader->prefetch = file_prefetcher_start(reader->filepath.c_str(), offset, n_blocks, block_bytes);
+
+    return reader->prefetch == nullptr ? 2 : 0;
+}
+
+uint64_t LIBTIMETAG_DLL sstt2_reader_offset(const sstt2_reader* reader)
+{
+    return reader == nullptr ? 0 : reader->buffer_file_offset + reader->buffer_pos;
+}
+
+uint64_t LIBTIMETAG_DLL sstt2_reader_n_overflows(const sstt2_reader* reader)
+{
+    return reader == nullptr ? 0 : reader->n_overflows;
+}
+
+uint64_t LIBTIMETAG_DLL sstt2_reader_n_photons(const sstt2_reader* reader)
+{
+    return reader == nullptr ? 0 : reader->n_photons;
+}
+
+const char* LIBTIMETAG_DLL sstt2_reader_format(const sstt2_reader* reader)
+{
+    return (reader == nullptr || reader->format == nullptr) ? nullptr : reader->format->name;
+}
+
+int LIBTIMETAG_DLL sstt2_reader_flags(const sstt2_reader* reader)
+{
+    return (reader == nullptr || reader->format == nullptr) ? 0 : reader->layout.flags & (TIMETAG_HAS_MICROTIMES | TIMETAG_HAS_CHANNELS);
+}
+
+void LIBTIMETAG_DLL sstt2_reader_close(sstt2_reader* reader)
+{
+    if (reader == nullptr) {
+        return;
+    }
+
+    file_prefetcher_stop(reader->prefetch);
+    fclose(reader->f);
+    delete reader;
+}
+
+/*
+	Decoding into a buffer of the caller
+*/
+
+// Maps the file, and resolves byte_offset; returns 0 or an error code of sstt2_decode_file_into()
+static int map_at(const char* filepath, uint64_t* byte_offset, mapped_file* mf)
+{
+    if (*byte_offset == 0) {
+        *byte_offset = SSTT2_N_BYTES_HEADER;
+    }
+
+    if (*byte_offset < SSTT2_N_BYTES_HEADER || (*byte_offset - SSTT2_N_BYTES_HEADER) % SSTT2_N_BYTES_TOT != 0) {
+        return 1;
+    }
+
+    if (map_file(filepath, mf) != 0) {
+        return 2;
+    }
+
+    if (!sstt2_is_header(mf->data, mf->size)) {
+        unmap_file(mf);
+        return 3;
+    }
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL sstt2_count_file_photons(const char* filepath, uint64_t byte_offset, uint64_t* n_photons)
+{
+    if (filepath == nullptr || n_photons == nullptr) {
+        return 1;
+    }
+
+    *n_photons = 0;
+
+    mapped_file mf;
+    int success = map_at(filepath, &byte_offset, &mf);
+
+    if (success != 0) {
+        return success;
+    }
+
+    if (byte_offset < mf.size) {
+        uint64_t n_events = (mf.size - byte_offset) / SSTT2_N_BYTES_TOT;
+        sstt2_index index;
+
+        // An index that covers the whole file already holds the count
+        if (byte_offset == SSTT2_N_BYTES_HEADER &&
+                read_sstt2_index(sstt2_index_filepath(filepath), &index) == 0 &&
+                index.indexed_size == byte_offset + n_events * SSTT2_N_BYTES_TOT &&
+                sstt2_index_matches(index, mf.data, mf.size)) {
+            *n_photons = index.n_photons;
+        } else {
+            *n_photons = sstt2_count_photons(mf.data + byte_offset, n_events);
+        }
+    }
+
+    unmap_file(&mf);
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL sstt2_decode_file_into(const char* filepath,
+                                          sstt2_decode_position* position,
+                                          int64_t* macrotimes,
+                                          uint64_t capacity,
+                                          uint64_t* n_written,
+                                          unsigned int n_threads)
+{
+    if (filepath == nullptr || position == nullptr || n_written == nullptr || (macrotimes == nullptr && capacity > 0)) {
+        return 1;
+    }
+
+    *n_written = 0;
+
+    uint64_t offset = position->byte_offset;
+    mapped_file mf;
+    int success = map_at(filepath, &offset, &mf);
+
+    if (success != 0) {
+        return success;
+    }
+
+    const unsigned char* p = mf.data + offset;
+    uint64_t n_events = (mf.size > offset) ? (mf.size - offset) / SSTT2_N_BYTES_TOT : 0;
+    uint64_t n_overflows = position->n_overflows;
+
+    // Every event is at most one photon, so the first `capacity` events always fit
+    uint64_t n_first = std::min(n_events, capacity);
+    uint64_t n = 0;
+
+    if (n_first > 0) {
+        if (sstt2_resolve_n_threads(n_threads) == 1) {
+            n = sstt2_decode_block(p, n_first, &n_overflows, macrotimes);
+        } else {
+            std::vector<sstt2_segment> segments = sstt2_count_segments(p, n_first, n_overflows, n_threads);
+            const sstt2_segment& last = segments.back();
+
+            sstt2_decode_segments(p, segments, macrotimes, n_threads);
+
+            n = last.first_photon + last.n_photons;
+            n_overflows = last.overflows_before + last.n_overflows;
+        }
+    }
+
+    uint64_t n_decoded = n_first;
+
+    // Overflow (or reserved) events left room for more photons
+    if (n_decoded < n_events && n < capacity) {
+        uint64_t n_more = 0;
+
+        n += sstt2_decode_block_bounded(p + n_decoded * SSTT2_N_BYTES_TOT, n_events - n_decoded, &n_overflows,
+                                        macrotimes + n, capacity - n, &n_more);
+        n_decoded += n_more;
+    }
+
+    unmap_file(&mf);
+
+    position->byte_offset = offset + n_decoded * SSTT2_N_BYTES_TOT;
+    position->n_overflows = n_overflows;
+    position->at_end = n_decoded == n_events;
+    *n_written = n;
+
+    return 0;
+}
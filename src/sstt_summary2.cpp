@@ -0,0 +1,297 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    sstt_summary2.cpp
+ * \brief   Cached per-file summaries of "small simple time-tagged" (SSTT) data files, version 2.
+ * \author  Stijn Hinterding
+*/
+
+#include "sstt_summary2.h"
+#include "sstt_file2.h"
+#include "mapped_file.h"
+#include "sstt2_decode.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+#define SSTT2_SUMMARY_N_HEADER_FIELDS   9
+#define SSTT2_SUMMARY_BLOCK_EVENTS      65536
+
+static int stat_file(const std::string& filepath, uint64_t* size, int64_t* mtime)
+{
+#ifdef _WIN32
+    struct __stat64 st;
+
+    if (_stat64(filepath.c_str(), &st) != 0) {
+        return 1;
+    }
+#else
+    struct stat st;
+
+    if (stat(filepath.c_str(), &st) != 0) {
+        return 1;
+    }
+#endif
+
+    *size = (uint64_t)st.st_size;
+    *mtime = (int64_t)st.st_mtime;
+
+    return 0;
+}
+
+std::string LIBTIMETAG_DLL sstt2_summary_filepath(const std::string& filepath)
+{
+    return filepath + SSTT2_SUMMARY_EXTENSION;
+}
+
+int LIBTIMETAG_DLL init_sstt2_summary(const std::string& filepath, sstt2_summary* summary)
+{
+    if (summary == nullptr) {
+        return 2;
+    }
+
+    *summary = sstt2_summary();
+
+    return stat_file(filepath, &summary->file_size, &summary->file_mtime);
+}
+
+void LIBTIMETAG_DLL sstt2_summary_add(sstt2_summary* summary, const int64_t* macrotimes, uint64_t n_photons)
+{
+    if (n_photons == 0) {
+        return;
+    }
+
+    if (summary->n_photons == 0) {
+        summary->t_first = macrotimes[0];
+        summary->profile_bin_width = 1;
+        summary->profile.clear();
+    }
+
+    std::vector<uint64_t>& profile = summary->profile;
+    int64_t t_first = summary->t_first;
+    int shift = 0;
+
+    while (((uint64_t)1 << shift) < summary->profile_bin_width) {
+        shift++;
+    }
+
+    for (uint64_t i = 0; i < n_photons; i++) {
+        uint64_t bin = macrotimes[i] > t_first ? (uint64_t)(macrotimes[i] - t_first) >> shift : 0;
+
+        // Widen the bins until the photon fits
+        while (bin >= SSTT2_SUMMARY_PROFILE_BINS) {
+            for (size_t j = 0; j < profile.size(); j++) {
+                profile[j / 2] = (j % 2 == 0) ? profile[j] : profile[j / 2] + profile[j];
+            }
+
+            profile.resize((profile.size() + 1) / 2);
+            shift++;
+            bin >>= 1;
+        }
+
+        if (bin >= profile.size()) {
+            profile.resize(bin + 1, 0);
+        }
+
+        profile[bin]++;
+    }
+
+    summary->profile_bin_width = (uint64_t)1 << shift;
+    summary->n_photons += n_photons;
+    summary->t_last = macrotimes[n_photons - 1];
+}
+
+int LIBTIMETAG_DLL compute_sstt2_summary(const std::string& filepath, sstt2_summary* summary)
+{
+    if (summary == nullptr) {
+        return 2;
+    }
+
+    if (init_sstt2_summary(filepath, summary) != 0) {
+        return 1;
+    }
+
+    mapped_file mf;
+
+    if (map_file(filepath.c_str(), &mf) != 0) {
+        return 1;
+    }
+
+    if (!sstt2_is_header(mf.data, mf.size)) {
+        unmap_file(&mf);
+        return 3;
+    }
+
+    // Decode in blocks, so that the photons never need to be held in memory all at once
+    std::vector<int64_t> macrotimes(SSTT2_SUMMARY_BLOCK_EVENTS);
+    const unsigned char* p = mf.data + SSTT2_N_BYTES_HEADER;
+    uint64_t n_events = (mf.size > SSTT2_N_BYTES_HEADER) ? (mf.size - SSTT2_N_BYTES_HEADER) / SSTT2_N_BYTES_TOT : 0;
+    uint64_t n_overflows = 0;
+
+    while (n_events > 0) {
+        uint64_t n_block = std::min(n_events, (uint64_t)SSTT2_SUMMARY_BLOCK_EVENTS);
+        uint64_t n_photons = sstt2_decode_block(p, n_block, &n_overflows, macrotimes.data());
+
+        sstt2_summary_add(summary, macrotimes.data(), n_photons);
+
+        p += n_block * SSTT2_N_BYTES_TOT;
+        n_events -= n_block;
+    }
+
+    summary->n_overflows = n_overflows;
+
+    // The file may have been appended to after it was stamped. The summary
+    // then does not match the stamp; clear it, so that it is never stored.
+    if (mf.size != summary->file_size) {
+        summary->file_size = 0;
+    }
+
+    unmap_file(&mf);
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL read_sstt2_summary(const std::string& summary_filepath, sstt2_summary* summary)
+{
+    if (summary == nullptr) {
+        return 2;
+    }
+
+    FILE* f = fopen(summary_filepath.c_str(), "rb");
+
+    if (f == nullptr) {
+        return 1;
+    }
+
+    char magic[sizeof(SSTT2_SUMMARY_MAGIC) - 1];
+    uint64_t header[SSTT2_SUMMARY_N_HEADER_FIELDS];
+
+    if (fread(magic, sizeof(magic), 1, f) != 1 ||
+            memcmp(magic, SSTT2_SUMMARY_MAGIC, sizeof(magic)) != 0 ||
+            fread(header, sizeof(header), 1, f) != 1 ||
+            header[0] != SSTT2_SUMMARY_VERSION ||
+            header[8] > SSTT2_SUMMARY_PROFILE_BINS) {
+        fclose(f);
+        return 3;
+    }
+
+    summary->file_size = header[1];
+    summary->file_mtime = (int64_t)header[2];
+    summary->n_photons = header[3];
+    summary->n_overflows = header[4];
+    summary->t_first = (int64_t)header[5];
+    summary->t_last = (int64_t)header[6];
+    summary->profile_bin_width = header[7];
+    summary->profile.resize(header[8]);
+
+    size_t n_read = summary->profile.empty() ? 0 :
+            fread(summary->profile.data(), sizeof(uint64_t), summary->profile.size(), f);
+
+    fclose(f);
+
+    if (n_read != summary->profile.size()) {
+        *summary = sstt2_summary();
+        return 3;
+    }
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL write_sstt2_summary(const std::string& summary_filepath, const sstt2_summary& summary)
+{
+    FILE* f = fopen(summary_filepath.c_str(), "wb");
+
+    if (f == nullptr) {
+        return 1;
+    }
+
+    uint64_t header[SSTT2_SUMMARY_N_HEADER_FIELDS] = {
+        SSTT2_SUMMARY_VERSION,
+        summary.file_size,
+        (uint64_t)summary.file_mtime,
+        summary.n_photons,
+        summary.n_overflows,
+        (uint64_t)summary.t_first,
+        (uint64_t)summary.t_last,
+        summary.profile_bin_width,
+        summary.profile.size()
+    };
+
+    bool ok = fwrite(SSTT2_SUMMARY_MAGIC, sizeof(SSTT2_SUMMARY_MAGIC) - 1, 1, f) == 1 &&
+            fwrite(header, sizeof(header), 1, f) == 1;
+
+    if (ok && !summary.profile.empty()) {
+        ok = fwrite(summary.profile.data(), sizeof(uint64_t), summary.profile.size(), f) == summary.profile.size();
+    }
+
+    ok = (fclose(f) == 0) && ok;
+
+    if (!ok) {
+        // Do not leave a truncated summary behind
+        remove(summary_filepath.c_str());
+        return 2;
+    }
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL load_sstt2_summary(const std::string& filepath, sstt2_summary* summary)
+{
+    if (summary == nullptr) {
+        return 2;
+    }
+
+    if (read_sstt2_summary(sstt2_summary_filepath(filepath), summary) != 0) {
+        return 1;
+    }
+
+    uint64_t size = 0;
+    int64_t mtime = 0;
+
+    if (stat_file(filepath, &size, &mtime) != 0 || size != summary->file_size || mtime != summary->file_mtime) {
+        return 4;
+    }
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL store_sstt2_summary(const std::string& filepath, const sstt2_summary& summary)
+{
+    uint64_t size = 0;
+    int64_t mtime = 0;
+
+    if (stat_file(filepath, &size, &mtime) != 0 || size != summary.file_size || mtime != summary.file_mtime) {
+        return 4;
+    }
+
+    return write_sstt2_summary(sstt2_summary_filepath(filepath), summary);
+}
+
+int LIBTIMETAG_DLL get_sstt2_summary(const std::string& filepath, sstt2_summary* summary, int save)
+{
+    if (summary == nullptr) {
+        return 2;
+    }
+
+    if (load_sstt2_summary(filepath, summary) == 0) {
+        return 0;
+    }
+
+    int success = compute_sstt2_summary(filepath, summary);
+
+    if (success != 0) {
+        return success;
+    }
+
+    if (save) {
+        store_sstt2_summary(filepath, *summary);
+    }
+
+    return 0;
+}
@@ -0,0 +1,477 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    sstt_writer2.cpp
+ * \brief   Buffered writer for "small simple time-tagged" (SSTT) datasets, version 2.
+ * \author  Stijn Hinterding
+*/
+
+#include "sstt_writer2.h"
+#include "sstt2_info.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// Room for an 8-byte store of the last event in a block
+#define SSTT2_WRITER_BLOCK_SLACK    8
+
+struct sstt2_write_block
+{
+    unsigned char* data;
+    uint64_t len;
+    size_t channel;
+};
+
+struct sstt2_writer_channel
+{
+    channel_info_sstt2 info;
+    std::string filepath;
+    FILE* f;
+
+    unsigned char* block;
+    uint64_t block_len;
+
+    uint64_t n_overflows;
+    uint64_t file_size;     // Including the events that are still buffered
+
+    sstt2_writer_channel() :
+        info(),
+        filepath(),
+        f(nullptr),
+        block(nullptr),
+        block_len(0),
+        n_overflows(0),
+        file_size(0)
+    {
+    }
+};
+
+struct sstt2_writer
+{
+    std::string filepath;
+    exp_info_sstt2 exp_info;
+    std::string start_time;
+    std::vector<sstt2_writer_channel> channels;
+
+    // Shared with the I/O thread
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable work_done;
+    std::deque<sstt2_write_block> queue;
+    std::vector<unsigned char*> free_blocks;
+    bool writing;
+    bool stop;
+    bool io_error;
+
+    std::thread io_thread;
+};
+
+static unsigned char* alloc_block()
+{
+    void* p = nullptr;
+
+#ifdef _WIN32
+    p = _aligned_malloc(SSTT2_WRITER_BLOCK_BYTES + SSTT2_WRITER_BLOCK_SLACK, SSTT2_WRITER_BLOCK_ALIGNMENT);
+#else
+    if (posix_memalign(&p, SSTT2_WRITER_BLOCK_ALIGNMENT, SSTT2_WRITER_BLOCK_BYTES + SSTT2_WRITER_BLOCK_SLACK) != 0) {
+        p = nullptr;
+    }
+#endif
+
+    return (unsigned char*)p;
+}
+
+static void free_block(unsigned char* p)
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+static void sstt2_writer_io_loop(sstt2_writer* w)
+{
+    std::unique_lock<std::mutex> lock(w->mutex);
+
+    while (true) {
+        w->work_available.wait(lock, [w] { return w->stop || !w->queue.empty(); });
+
+        if (w->queue.empty()) {
+            // Stopping, and nothing left to write
+            break;
+        }
+
+        sstt2_write_block b = w->queue.front();
+        w->queue.pop_front();
+        w->writing = true;
+
+        lock.unlock();
+
+        bool ok = fwrite(b.data, 1, b.len, w->channels[b.channel].f) == b.len;
+
+        lock.lock();
+
+        w->io_error = w->io_error || !ok;
+        w->writing = false;
+        w->free_blocks.push_back(b.data);
+        w->work_done.notify_all();
+    }
+}
+
+// Hands the current block of a channel to the I/O thread, and gets an empty one
+static int sstt2_writer_submit(sstt2_writer* w, size_t channel)
+{
+    sstt2_writer_channel& ch = w->channels[channel];
+    std::unique_lock<std::mutex> lock(w->mutex);
+
+    if (ch.block_len > 0) {
+        sstt2_write_block b;
+        b.data = ch.block;
+        b.len = ch.block_len;
+        b.channel = channel;
+
+        w->queue.push_back(b);
+        w->work_available.notify_one();
+
+        ch.block = nullptr;
+        ch.block_len = 0;
+    }
+
+    if (ch.block == nullptr) {
+        // Only stall when the disk cannot keep up
+        w->work_done.wait(lock, [w] { return w->queue.size() < SSTT2_WRITER_MAX_PENDING_BLOCKS; });
+
+        if (!w->free_blocks.empty()) {
+            ch.block = w->free_blocks.back();
+            w->free_blocks.pop_back();
+        } else {
+            lock.unlock();
+            ch.block = alloc_block();
+        }
+    }
+
+    return ch.block == nullptr ? 2 : 0;
+}
+
+static inline int sstt2_writer_put_event(sstt2_writer* w, size_t channel, uint64_t event)
+{
+    sstt2_writer_channel& ch = w->channels[channel];
+
+    if (ch.block_len + SSTT2_N_BYTES_TOT > SSTT2_WRITER_BLOCK_BYTES) {
+        if (sstt2_writer_submit(w, channel) != 0) {
+            return 2;
+        }
+    }
+
+    // Little endian; the two bytes beyond the event are overwritten by the next one
+    memcpy(ch.block + ch.block_len, &event, sizeof(event));
+    ch.block_len += SSTT2_N_BYTES_TOT;
+    ch.file_size += SSTT2_N_BYTES_TOT;
+
+    return 0;
+}
+
+static std::string basename_of(const std::string& filepath)
+{
+    size_t pos = filepath.find_last_of("/\\");
+
+    return pos == std::string::npos ? filepath : filepath.substr(pos + 1);
+}
+
+static int sstt2_writer_write_info(const sstt2_writer* w)
+{
+    FILE* f = fopen(w->filepath.c_str(), "w");
+
+    if (f == nullptr) {
+        return 2;
+    }
+
+    fprintf(f, "%s", SSTT2_MAGIC_INFO);
+    fprintf(f, "%s", SSTT2_EXP_HEADER_TEXT);
+    fprintf(f, "%s\t%s\t%s\n", SSTT2_HEADER_TIMEUNIT, SSTT2_HEADER_DEV_TYPE, SSTT2_HEADER_START_TIME);
+    fprintf(f, "%.10g\t%s\t%s\n\n", w->exp_info.time_unit_seconds,
+            w->exp_info.device_type.empty() ? "unknown" : w->exp_info.device_type.c_str(), w->start_time.c_str());
+
+    fprintf(f, "%s", SSTT2_CHAN_HEADER_TEXT);
+    fprintf(f, "%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n",
+            SSTT2_HEADER_CHANID, SSTT2_HEADER_FILENAME, SSTT2_HEADER_NUMPHOTONS, SSTT2_HEADER_NUMOVERFLOWS,
+            SSTT2_HEADER_FILESIZE, SSTT2_HEADER_SYNCDIV, SSTT2_HEADER_ADDI_SYNCDIV, SSTT2_HEADER_TOTAL_SYNCDIV,
+            SSTT2_HEADER_IS_PULSES, SSTT2_HEADER_HAS_PULSES, SSTT2_HEADER_CORR_PULSECHAN, SSTT2_HEADER_HAS_MICRO);
+
+    for (size_t i = 0; i < w->channels.size(); i++) {
+        const sstt2_writer_channel& ch = w->channels[i];
+        const channel_info_sstt2& ci = ch.info;
+
+        fprintf(f, "%llu\t\"%s\"\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%d\t%d\t%llu\t%d\n",
+                (unsigned long long)ci.ID,
+                ci.filename.c_str(),
+                (unsigned long long)ci.n_photons,
+                (unsigned long long)ch.n_overflows,
+                (unsigned long long)ch.file_size,
+                (unsigned long long)ci.sync_divider,
+                (unsigned long long)ci.additional_sync_divider,
+                (unsigned long long)(ci.sync_divider * ci.additional_sync_divider),
+                ci.is_pulses_channel ? 1 : 0,
+                ci.has_pulses_channel ? 1 : 0,
+                (unsigned long long)ci.corresponding_pulses_channel,
+                ci.channel_has_microtime ? 1 : 0);
+    }
+
+    fprintf(f, "\n");
+
+    return fclose(f) == 0 ? 0 : 2;
+}
+
+static void sstt2_writer_release(sstt2_writer* w)
+{
+    if (w->io_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(w->mutex);
+            w->stop = true;
+        }
+
+        w->work_available.notify_one();
+        w->io_thread.join();
+    }
+
+    for (size_t i = 0; i < w->channels.size(); i++) {
+        if (w->channels[i].f != nullptr) {
+            fclose(w->channels[i].f);
+        }
+
+        free_block(w->channels[i].block);
+    }
+
+    for (size_t i = 0; i < w->free_blocks.size(); i++) {
+        free_block(w->free_blocks[i]);
+    }
+
+    delete w;
+}
+
+sstt2_writer* LIBTIMETAG_DLL sstt2_writer_open(const std::string& filepath,
+                                               const exp_info_sstt2& exp_info,
+                                               const std::vector<channel_info_sstt2>& channels,
+                                               int* error_code)
+{
+    if (error_code == nullptr) {
+        return nullptr;
+    }
+
+    *error_code = 1;
+
+    if (filepath.empty() || channels.empty()) {
+        return nullptr;
+    }
+
+    for (size_t i = 0; i < channels.size(); i++) {
+        for (size_t j = 0; j < i; j++) {
+            if (channels[i].ID == channels[j].ID) {
+                return nullptr;
+            }
+        }
+    }
+
+    sstt2_writer* w = new sstt2_writer();
+    w->filepath = filepath;
+    w->exp_info = exp_info;
+    w->writing = false;
+    w->stop = false;
+    w->io_error = false;
+
+    char start_time[32];
+    time_t now = time(nullptr);
+    strftime(start_time, sizeof(start_time), "%Y-%m-%d %H:%M:%S", gmtime(&now));
+    w->start_time = start_time;
+
+    w->channels.resize(channels.size());
+
+    for (size_t i = 0; i < channels.size(); i++) {
+        sstt2_writer_channel& ch = w->channels[i];
+
+        ch.info = channels[i];
+        ch.info.n_photons = 0;
+        ch.filepath = filepath + ".c" + std::to_string(ch.info.ID);
+        ch.info.filename = basename_of(ch.filepath);
+        ch.block = alloc_block();
+        ch.f = fopen(ch.filepath.c_str(), "wb");
+
+        if (ch.f == nullptr || ch.block == nullptr) {
+            *error_code = 2;
+            sstt2_writer_release(w);
+            return nullptr;
+        }
+
+        // The blocks are large already; bypass the stdio buffer
+        setvbuf(ch.f, nullptr, _IONBF, 0);
+
+        // The header is part of the first block, which keeps all following blocks aligned
+        memset(ch.block, 0, SSTT2_N_BYTES_HEADER);
+        memcpy(ch.block, SSTT2_MAGIC, sizeof(SSTT2_MAGIC) - 1);
+        ch.block_len = SSTT2_N_BYTES_HEADER;
+        ch.file_size = SSTT2_N_BYTES_HEADER;
+    }
+
+    if (sstt2_writer_write_info(w) != 0) {
+        *error_code = 2;
+        sstt2_writer_release(w);
+        return nullptr;
+    }
+
+    w->io_thread = std::thread(sstt2_writer_io_loop, w);
+
+    *error_code = 0;
+
+    return w;
+}
+
+int LIBTIMETAG_DLL sstt2_writer_write(sstt2_writer* writer,
+                                      uint64_t channel_id,
+                                      const int64_t* macrotimes,
+                                      uint64_t n_photons)
+{
+    if (writer == nullptr || (macrotimes == nullptr && n_photons != 0)) {
+        return 1;
+    }
+
+    size_t channel = 0;
+
+    while (channel < writer->channels.size() && writer->channels[channel].info.ID != channel_id) {
+        channel++;
+    }
+
+    if (channel == writer->channels.size()) {
+        return 1;
+    }
+
+    sstt2_writer_channel& ch = writer->channels[channel];
+    uint64_t overflows = ch.n_overflows;
+    int success = 0;
+    uint64_t i = 0;
+
+    for (; i < n_photons; i++) {
+        if (macrotimes[i] < 0) {
+            success = 4;
+            break;
+        }
+
+        uint64_t t = (uint64_t)macrotimes[i];
+        uint64_t period = t >> SSTT2_N_BITS_MACRO;
+
+        if (period != overflows) {
+            if (period < overflows) {
+                success = 4;
+                break;
+            }
+
+            // Insert overflow events; each holds at most a 46-bit count
+            while (period != overflows && success == 0) {
+                uint64_t n = std::min(period - overflows, (uint64_t)SSTT2_MASK_OVERFLOW);
+
+                success = sstt2_writer_put_event(writer, channel, (n << SSTT2_N_BITS_SIGNAL) | 1);
+                overflows += n;
+            }
+
+            if (success != 0) {
+                break;
+            }
+        }
+
+        success = sstt2_writer_put_event(writer, channel, (t & SSTT2_MASK_MACRO) << SSTT2_N_BITS_SIGNAL);
+
+        if (success != 0) {
+            break;
+        }
+    }
+
+    ch.n_overflows = overflows;
+    ch.info.n_photons += i;
+
+    if (success == 0) {
+        std::lock_guard<std::mutex> lock(writer->mutex);
+        success = writer->io_error ? 2 : 0;
+    }
+
+    return success;
+}
+
+int LIBTIMETAG_DLL sstt2_writer_flush(sstt2_writer* writer)
+{
+    if (writer == nullptr) {
+        return 1;
+    }
+
+    int success = 0;
+
+    for (size_t i = 0; i < writer->channels.size(); i++) {
+        success = sstt2_writer_submit(writer, i) != 0 ? 2 : success;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(writer->mutex);
+        writer->work_done.wait(lock, [writer] { return writer->queue.empty() && !writer->writing; });
+
+        success = writer->io_error ? 2 : success;
+    }
+
+    for (size_t i = 0; i < writer->channels.size(); i++) {
+        success = fflush(writer->channels[i].f) != 0 ? 2 : success;
+    }
+
+    if (sstt2_writer_write_info(writer) != 0) {
+        success = 2;
+    }
+
+    return success;
+}
+
+uint64_t LIBTIMETAG_DLL sstt2_writer_n_photons(const sstt2_writer* writer, uint64_t channel_id)
+{
+    if (writer == nullptr) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < writer->channels.size(); i++) {
+        if (writer->channels[i].info.ID == channel_id) {
+            return writer->channels[i].info.n_photons;
+        }
+    }
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL sstt2_writer_close(sstt2_writer* writer)
+{
+    if (writer == nullptr) {
+        return 0;
+    }
+
+    int success = sstt2_writer_flush(writer);
+
+    for (size_t i = 0; i < writer->channels.size(); i++) {
+        if (fclose(writer->channels[i].f) != 0) {
+            success = 2;
+        }
+
+        writer->channels[i].f = nullptr;
+    }
+
+    sstt2_writer_release(writer);
+
+    return success;
+}
@@ -0,0 +1,22 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    timetag_formats.h
+ * \brief   The built-in readers of the time-tag reader registry; each is defined next to its format
+ * \author  Stijn Hinterding
+*/
+
+#ifndef TIMETAG_FORMATS_H
+#define TIMETAG_FORMATS_H
+
+#include "timetag_reader.h"
+
+extern const timetag_reader sstt2_timetag_reader;       // sstt_file2.cpp
+extern const timetag_reader packed_timetag_reader;      // sstt_packed.cpp
+extern const timetag_reader merged_timetag_reader;      // sstt_merged.cpp
+extern const timetag_reader ptu_timetag_reader;         // ptu_file.cpp
+extern const timetag_reader sstt1_timetag_reader;       // sstt_file.cpp
+
+#endif // TIMETAG_FORMATS_H
@@ -0,0 +1,284 @@
+/* Copyright (c) 2020 Stijn Hinterding, Utrecht University
+ * This sofware is licensed under the MIT license (see the LICENSE file)
+*/
+
+/**
+ * \file    timetag_reader.cpp
+ * \brief   Registry of time-tag file readers, with detection of the file format
+ * \author  Stijn Hinterding
+*/
+
+#include "timetag_reader.h"
+#include "timetag_formats.h"
+#include "mapped_file.h"
+#include "sstt2_decode.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <mutex>
+
+#define TIMETAG_SKIP_BLOCK_EVENTS   65536
+
+static std::mutex registry_mutex;
+
+// Called with registry_mutex held
+static std::vector<const timetag_reader*>& registry()
+{
+    static std::vector<const timetag_reader*> readers = {
+        &sstt2_timetag_reader,
+        &packed_timetag_reader,
+        &merged_timetag_reader,
+        &ptu_timetag_reader,
+        &sstt1_timetag_reader
+    };
+
+    return readers;
+}
+
+int LIBTIMETAG_DLL timetag_register_reader(const timetag_reader* reader)
+{
+    if (reader == nullptr || reader->name == nullptr) {
+        return 1;
+    }
+
+    bool is_stream = reader->open != nullptr && reader->count_block != nullptr && reader->decode_block != nullptr;
+
+    if (!is_stream && reader->read_file == nullptr) {
+        return 1;
+    }
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    registry().push_back(reader);
+
+    return 0;
+}
+
+const timetag_reader* LIBTIMETAG_DLL timetag_find_reader(const unsigned char* data, uint64_t size)
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    const std::vector<const timetag_reader*>& readers = registry();
+
+    // Readers without a magic are never detected
+    for (size_t i = 0; i < readers.size(); i++) {
+        if (readers[i]->probe != nullptr && readers[i]->probe(data, size)) {
+            return readers[i];
+        }
+    }
+
+    return nullptr;
+}
+
+const timetag_reader* LIBTIMETAG_DLL timetag_get_reader(const char* name)
+{
+    if (name == nullptr) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    const std::vector<const timetag_reader*>& readers = registry();
+
+    for (size_t i = 0; i < readers.size(); i++) {
+        if (strcmp(readers[i]->name, name) == 0) {
+            return readers[i];
+        }
+    }
+
+    return nullptr;
+}
+
+const timetag_reader* LIBTIMETAG_DLL timetag_detect_format(const std::string& filepath)
+{
+    mapped_file mf;
+
+    if (map_file(filepath.c_str(), &mf) != 0) {
+        return nullptr;
+    }
+
+    const timetag_reader* reader = timetag_find_reader(mf.data, mf.size);
+
+    unmap_file(&mf);
+
+    return reader;
+}
+
+// Counts the events up to and including the photon \p n_photons_to_skip - 1; returns the number of events to skip
+static uint64_t count_skipped_events(const timetag_reader* reader,
+                                     const timetag_layout* layout,
+                                     const unsigned char* events,
+                                     uint64_t n_events,
+                                     uint64_t n_photons_to_skip,
+                                     uint64_t* n_overflows)
+{
+    uint64_t i = 0;
+    uint64_t n_photons = 0;
+
+    // Whole blocks first, then event by event within the block of the photon
+    while (i < n_events && n_photons < n_photons_to_skip) {
+        uint64_t n_block = std::min(n_events - i, (uint64_t)TIMETAG_SKIP_BLOCK_EVENTS);
+        uint64_t n_photons_block = 0;
+        uint64_t n_overflows_block = 0;
+
+        reader->count_block(layout, events + i * layout->n_bytes_event, n_block, &n_photons_block, &n_overflows_block);
+
+        if (n_photons + n_photons_block <= n_photons_to_skip) {
+            n_photons += n_photons_block;
+            *n_overflows += n_overflows_block;
+            i += n_block;
+            continue;
+        }
+
+        while (n_photons < n_photons_to_skip) {
+            reader->count_block(layout, events + i * layout->n_bytes_event, 1, &n_photons, n_overflows);
+            i++;
+        }
+    }
+
+    return i;
+}
+
+/*
+	Decoding of event streams, shared by all formats that have one: the
+	same two passes over segments as sstt2_count_segments() and
+	sstt2_decode_segments(), using the block functions of the reader.
+*/
+static int read_event_stream(const timetag_reader* reader,
+                             const unsigned char* data,
+                             uint64_t size,
+                             const timetag_read_options& options,
+                             const timetag_allocator& allocate,
+                             timetag_data* result)
+{
+    timetag_layout layout;
+    layout.flags = reader->flags;
+
+    if (reader->open(data, size, &layout) != 0 || layout.n_bytes_event == 0 || layout.data_offset > size) {
+        return 3;
+    }
+
+    uint64_t offset = layout.data_offset;
+    uint64_t n_overflows = 0;
+
+    if (options.n_photons_to_skip != 0 && (reader->flags & TIMETAG_SIMPLE_EVENTS)) {
+        offset += layout.n_bytes_event * (options.n_photons_to_skip + options.n_overflow_events);
+        n_overflows = options.n_overflow_events;
+    } else if (options.n_photons_to_skip != 0) {
+        offset += layout.n_bytes_event * count_skipped_events(reader, &layout, data + offset,
+                                                              (size - offset) / layout.n_bytes_event,
+                                                              options.n_photons_to_skip, &n_overflows);
+    }
+
+    result->n_overflows = n_overflows;
+
+    uint64_t n_events = (offset < size) ? (size - offset) / layout.n_bytes_event : 0;
+    const unsigned char* events = data + std::min(offset, size);
+
+    timetag_buffers buffers;
+    int flags = layout.flags & ((options.read_microtimes ? TIMETAG_HAS_MICROTIMES : 0) |
+                                (options.read_channels ? TIMETAG_HAS_CHANNELS : 0));
+
+    if (n_events == 0) {
+        allocate(0, flags, &buffers);
+        return 0;
+    }
+
+    unsigned int n_threads = sstt2_resolve_n_threads(options.n_threads);
+    uint64_t n_segments = std::max((uint64_t)1, std::min((uint64_t)n_threads, n_events / SSTT2_MIN_SEGMENT_EVENTS));
+    uint64_t events_per_segment = n_events / n_segments;
+    std::vector<sstt2_segment> segments(n_segments);
+
+    for (uint64_t i = 0; i < n_segments; i++) {
+        segments[i].first_event = i * events_per_segment;
+        segments[i].n_events = (i == n_segments - 1) ? n_events - segments[i].first_event : events_per_segment;
+        segments[i].n_photons = 0;
+        segments[i].n_overflows = 0;
+    }
+
+    // Pass one: count
+    sstt2_run_in_parallel(n_segments, n_threads, [&](uint64_t i) {
+        reader->count_block(&layout, events + segments[i].first_event * layout.n_bytes_event, segments[i].n_events,
+                            &segments[i].n_photons, &segments[i].n_overflows);
+    });
+
+    uint64_t n_photons = 0;
+
+    for (uint64_t i = 0; i < n_segments; i++) {
+        segments[i].first_photon = n_photons;
+        segments[i].overflows_before = n_overflows;
+
+        n_photons += segments[i].n_photons;
+        n_overflows += segments[i].n_overflows;
+    }
+
+    allocate(n_photons, flags, &buffers);
+    result->n_overflows = n_overflows;
+
+    // Pass two: decode every segment into its own slot
+    sstt2_run_in_parallel(n_segments, n_threads, [&](uint64_t i) {
+        const sstt2_segment& s = segments[i];
+        uint64_t overflows = s.overflows_before;
+
+        reader->decode_block(&layout, events + s.first_event * layout.n_bytes_event, s.n_events, s.n_photons, &overflows,
+                             buffers.macrotimes + s.first_photon,
+                             buffers.microtimes != nullptr ? buffers.microtimes + s.first_photon : nullptr,
+                             buffers.channels != nullptr ? buffers.channels + s.first_photon : nullptr);
+    });
+
+    return 0;
+}
+
+int LIBTIMETAG_DLL read_timetag_file_into(const std::string& filepath,
+                                          const timetag_read_options& options,
+                                          const timetag_allocator& allocate,
+                                          timetag_data* result)
+{
+    if (result == nullptr) {
+        return 2;
+    }
+
+    mapped_file mf;
+
+    if (map_file(filepath.c_str(), &mf) != 0) {
+        return 1;
+    }
+
+    // The format is detected on the mapping that is decoded: the file is opened once
+    const timetag_reader* reader = timetag_find_reader(mf.data, mf.size);
+    int success = 3;
+
+    if (reader == nullptr) {
+        reader = options.fallback;
+    }
+
+    *result = timetag_data();
+
+    if (reader != nullptr) {
+        result->reader = reader;
+
+        if (reader->read_file != nullptr) {
+            success = reader->read_file(mf.data, mf.size, &options, result) == 0 ? 0 : 3;
+        } else {
+            success = read_event_stream(reader, mf.data, mf.size, options, allocate, result);
+        }
+    }
+
+    unmap_file(&mf);
+
+    return success;
+}
+
+int LIBTIMETAG_DLL read_timetag_file(const std::string& filepath,
+                                     const timetag_read_options& options,
+                                     timetag_data* result)
+{
+    // Event streams are decoded into the vectors of the result, sized once
+    return read_timetag_file_into(filepath, options, [result](uint64_t n_photons, int flags, timetag_buffers* buffers) {
+        result->macrotimes.resize(n_photons);
+        result->microtimes.resize((flags & TIMETAG_HAS_MICROTIMES) ? n_photons : 0);
+        result->channels.resize((flags & TIMETAG_HAS_CHANNELS) ? n_photons : 0);
+
+        buffers->macrotimes = result->macrotimes.data();
+        buffers->microtimes = (flags & TIMETAG_HAS_MICROTIMES) ? result->microtimes.data() : nullptr;
+        buffers->channels = (flags & TIMETAG_HAS_CHANNELS) ? result->channels.data() : nullptr;
+    }, result);
+}